@@ -0,0 +1,380 @@
+/** @file FilterBank.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *  This is open source software licensed under the Apache 2.0 license.
+ *  See http://www.apache.org/licenses/LICENSE-2.0 for details.
+ */
+
+#include "FilterBank.h"
+#include <mutex>
+#include <map>
+
+namespace fizz {
+
+namespace {
+
+const unsigned MAXPLANS = 64;	///< max number of cached integerizers
+
+/** Cached kernels. */
+struct Caches {
+	mutex	mtx;				///< protects the caches
+	map<string, shared_ptr<const FilterBank::Gaussian>> gauss;
+	map<string, shared_ptr<const FilterBank::SavGol>> savgol;
+	vector<shared_ptr<const FilterBank::Integerizer>> plans;
+};
+
+/** Get the caches; they are built on first use, so the constructors of
+ *  static objects can use them. */
+Caches& caches() {
+	static Caches c;
+	return c;
+}
+
+/** Make a cache key from a kernel type and its parameters. */
+string makeKey(char type, double a, double b, double c, double d) {
+	char buf[100];
+	snprintf(buf, sizeof(buf), "%c %.17g %.17g %.17g %.17g", type, a, b, c, d);
+	return buf;
+}
+
+/** Add terms f*in[j..j+m) to out[0..m); the inner loop of each filter. */
+inline void axpy(double f, const double* __restrict__ in,
+				 double* __restrict__ out, int m) {
+	for (int i = 0; i < m; i++) out[i] += f * in[i];
+}
+
+}
+
+/** Get a gaussian smoothing kernel.
+ *  @param width specifies the width of the kernel; it has 2*width+1 taps
+ *  @param sigma specifies the spread of the gaussian
+ *  @return a pointer to the kernel
+ */
+shared_ptr<const FilterBank::Gaussian> FilterBank::gaussian(int width,
+															double sigma) {
+	string key = makeKey('g', width, sigma, 0, 0);
+	Caches& cache = caches();
+	unique_lock<mutex> lck(cache.mtx);
+	auto p = cache.gauss.find(key);
+	if (p != cache.gauss.end()) return p->second;
+
+	shared_ptr<Gaussian> g = make_shared<Gaussian>();
+	g->width = width = max(width, 0); g->sigma = sigma;
+	g->taps.resize(2*width+1);
+	double fsum = 0.0;
+	for (int i = 0; i < 2*width+1; i++) {
+		double x = 0.0 + i - width;
+		g->taps[i] = exp(-(x*x)/(2.*sigma*sigma));
+		fsum += g->taps[i];
+	}
+	for (int i = 0; i < 2*width+1; i++) g->taps[i] /= fsum;
+	g->endWeight.assign(max(width, 1), 0.0);
+	for (int i = 1; i < width; i++) {
+		for (int j = 0; j < 2*i+1; j++) g->endWeight[i] += g->taps[j+width-i];
+	}
+	cache.gauss[key] = g;
+	return g;
+}
+
+/** Get a Savitzky-Golay kernel.
+ *  The taps are computed as in Library.deriv, by fitting the monomials
+ *  of the given degree to a window of 2*width+1 points.
+ *  @param degree is the degree of the polynomial fit to each window
+ *  @param width specifies the width of the window
+ *  @param k is the index of the derivative (0 for smoothing)
+ *  @param delta is the interval between x values
+ *  @return a pointer to the kernel, or null if k is larger than degree
+ *  or the fit is singular
+ */
+shared_ptr<const FilterBank::SavGol> FilterBank::savgol(int degree, int width,
+													   int k, double delta) {
+	if (k < 0 || k > degree || width < 0) return 0;
+	string key = makeKey('s', degree, width, k, delta);
+	Caches& cache = caches();
+	unique_lock<mutex> lck(cache.mtx);
+	auto p = cache.savgol.find(key);
+	if (p != cache.savgol.end()) return p->second;
+
+	// M[i][j] is the i-th power of the j-th x value in the window
+	int m = 2*width+1;
+	vector<vector<double>> M(degree+1, vector<double>(m));
+	for (int i = 0; i <= degree; i++) {
+		for (int j = 0; j < m; j++)
+			M[i][j] = (i == 0 ? 1 : (j-width)*delta*M[i-1][j]);
+	}
+	vector<vector<double>> A(degree+1, vector<double>(degree+1));
+	for (int i = 0; i <= degree; i++) {
+		for (int j = 0; j <= degree; j++) {
+			if (i > j) { A[i][j] = A[j][i]; continue; }
+			double s = 0;
+			for (int h = 0; h < m; h++) s += M[i][h] * M[j][h];
+			A[i][j] = s;
+		}
+	}
+	if (!matrixInvert(A)) return 0;
+
+	// the coefficients for a window V are (A^{-1} x M) x V; keep row k
+	shared_ptr<SavGol> sg = make_shared<SavGol>();
+	sg->degree = degree; sg->width = width; sg->k = k; sg->delta = delta;
+	sg->scale = 1;
+	for (int i = 2; i <= k; i++) sg->scale *= i;
+	sg->taps.resize(m);
+	for (int j = 0; j < m; j++) {
+		double s = 0;
+		for (int h = 0; h <= degree; h++) s += A[k][h] * M[h][j];
+		sg->taps[j] = s;
+	}
+	cache.savgol[key] = sg;
+	return sg;
+}
+
+/** Get an integerization plan for a set of raw wavelengths.
+ *  @param wl is the vector of raw wavelengths
+ *  @param classic is true for polynomial interpolation, as in the
+ *  classic cook recipe, false for a gaussian weighted average, as in
+ *  the nuvo recipe
+ *  @param p0 is the degree of the polynomial (classic) or the half-width
+ *  of the window (nuvo)
+ *  @param p1 is the half-width of the window (classic) or the sigma of
+ *  the gaussian (nuvo)
+ *  @param lo is the first output wavelength
+ *  @param hi is one more than the last output wavelength
+ *  @return a pointer to the plan
+ */
+shared_ptr<const FilterBank::Integerizer> FilterBank::integerizer(
+		const vector<double>& wl, bool classic, double p0, double p1,
+		int lo, int hi) {
+	Caches& cache = caches();
+	unique_lock<mutex> lck(cache.mtx);
+	for (auto& plan : cache.plans) {
+		if (plan->classic == classic && plan->params[0] == p0 &&
+			plan->params[1] == p1 && plan->lo == lo && plan->hi == hi &&
+			plan->wavelengths == wl)
+			return plan;
+	}
+
+	shared_ptr<Integerizer> ip = make_shared<Integerizer>();
+	Integerizer& plan = *ip;
+	plan.wavelengths = wl; plan.classic = classic;
+	plan.params[0] = p0; plan.params[1] = p1;
+	plan.lo = lo; plan.hi = hi = max(lo, hi);
+	int width = (int) (classic ? p1 : p0);
+	plan.stride = max(2*width, 1);
+	plan.start.assign(hi - lo, 0); plan.len.assign(hi - lo, 0);
+	plan.wt.assign((hi - lo) * plan.stride, 0.0);
+
+	const vector<double>& x = wl;
+	int n = x.size(); int i = 0;
+	for (int w = lo; w < hi && n > 0; w++) {
+		int k = w - lo; double* wt = &plan.wt[k*plan.stride];
+		while (i < n && x[i] <= w) i++;
+		int first = max(0, i - width); int last = min(n, i + width);
+		if (classic) {
+			if (i == 0 || i >= n) break; // shouldn't happen
+			if (x[i-1] == w) {
+				// as in the javascript, use the value that follows
+				plan.start[k] = i; plan.len[k] = 1; wt[0] = 1;
+				continue;
+			}
+			// fit a polynomial to the nearby points, shifted so w is at
+			// zero; its constant term is the value at w, which is a
+			// linear combination of the raw values
+			int degree = (int) p0;
+			vector<double> xs(2*degree+1, 0.0);
+			for (int j = first; j < last; j++) {
+				double p = 1;
+				for (int d = 0; d <= 2*degree; d++) {
+					xs[d] += p; p *= x[j] - w;
+				}
+			}
+			vector<vector<double>> A(degree+1, vector<double>(degree+1));
+			for (int r = 0; r <= degree; r++) {
+				for (int c = 0; c <= degree; c++) A[r][c] = xs[r+c];
+			}
+			if (!matrixInvert(A)) continue;
+			for (int j = first; j < last; j++) {
+				double p = 1; double s = 0;
+				for (int d = 0; d <= degree; d++) {
+					s += A[0][d] * p; p *= x[j] - w;
+				}
+				wt[j-first] = s;
+			}
+		} else {
+			// gaussian weighted average of nearby points
+			double twt = 0;
+			for (int j = first; j < last; j++) {
+				double z = (w - x[j]) / p1;
+				wt[j-first] = exp(-.5*z*z); twt += wt[j-first];
+			}
+			if (twt == 0) continue;
+			for (int j = first; j < last; j++) wt[j-first] /= twt;
+		}
+		plan.start[k] = first; plan.len[k] = last - first;
+	}
+
+	if (cache.plans.size() >= MAXPLANS)
+		cache.plans.erase(cache.plans.begin());
+	cache.plans.push_back(ip);
+	return ip;
+}
+
+/** Apply a gaussian smoothing kernel to a vector.
+ *  @param g is the kernel
+ *  @param in is the vector to be smoothed; it is assumed to be longer
+ *  than the kernel, and is copied to out if it is not
+ *  @param out is used to return the smoothed vector
+ *  @param edges specifies which version of the javascript to follow
+ */
+void FilterBank::smooth(const Gaussian& g, const vector<double>& in,
+						vector<double>& out, Edges edges) {
+	int n = in.size(); int w = g.width;
+	if (w < 1 || n < 2*w+1) { out = in; return; }
+	out.assign(n, 0.0);
+
+	// middle of the vector
+	for (int j = 0; j < 2*w+1; j++)
+		axpy(g.taps[j], in.data() + j, out.data() + w, n - 2*w);
+
+	// ends of the vector, using renormalized partial windows
+	for (int i = 1; i < w; i++) {
+		double s = 0.0, t = 0.0;
+		for (int j = 0; j < 2*i+1; j++) {
+			s += g.taps[j+w-i] * in[j];
+			t += g.taps[j+w-i] * in[(n-1)-j];
+		}
+		out[i] = s / g.endWeight[i];
+		if (edges == LIBRARY) out[(n-1)-i] = t / g.endWeight[i];
+		else out[(n-w-1)+i] = t / g.endWeight[i];
+	}
+	if (edges == ANALYSISLIB) out[0] = in[0];
+	out[n-1] = in[n-1];
+}
+
+/** Apply a gaussian smoothing kernel to a batch of vectors. */
+void FilterBank::smooth(const Gaussian& g, const vector<vector<double>>& in,
+						vector<vector<double>>& out, Edges edges) {
+	out.resize(in.size());
+	for (unsigned i = 0; i < in.size(); i++) smooth(g, in[i], out[i], edges);
+}
+
+/** Apply a Savitzky-Golay kernel to a vector.
+ *  @param sg is the kernel
+ *  @param in is the vector to be filtered
+ *  @param out is used to return the filtered vector; values within
+ *  sg.width of either end are zero
+ */
+void FilterBank::apply(const SavGol& sg, const vector<double>& in,
+					   vector<double>& out) {
+	int n = in.size(); int w = sg.width; int m = n - 2*w;
+	out.assign(n, 0.0);
+	if (m <= 0) return;
+	for (int j = 0; j < 2*w+1; j++)
+		axpy(sg.taps[j], in.data() + j, out.data() + w, m);
+	if (sg.scale != 1) {
+		double* op = out.data() + w;
+		for (int i = 0; i < m; i++) op[i] *= sg.scale;
+	}
+}
+
+/** Apply a Savitzky-Golay kernel to a batch of vectors. */
+void FilterBank::apply(const SavGol& sg, const vector<vector<double>>& in,
+					   vector<vector<double>>& out) {
+	out.resize(in.size());
+	for (unsigned i = 0; i < in.size(); i++) apply(sg, in[i], out[i]);
+}
+
+/** Integerize a raw spectrum.
+ *  @param plan is the integerization plan for the spectrum's wavelengths
+ *  @param in is the raw spectrum
+ *  @param out is used to return the values at wavelengths in
+ *  [plan.lo,plan.hi); they are zero if in is too short
+ */
+void FilterBank::integerize(const Integerizer& plan, const vector<double>& in,
+							vector<double>& out) {
+	int n = plan.hi - plan.lo;
+	out.assign(n, 0.0);
+	if (in.size() < plan.wavelengths.size()) return;
+	for (int k = 0; k < n; k++) {
+		const double* wt = &plan.wt[k*plan.stride];
+		const double* ip = in.data() + plan.start[k];
+		double s = 0;
+		for (int j = 0; j < plan.len[k]; j++) s += wt[j] * ip[j];
+		out[k] = s;
+	}
+}
+
+/** Compute the derivative of a function, as Library.deriv does.
+ *  @param f is a vector of function values at equally spaced points
+ *  @param k is the index of the derivative (1 for the first derivative)
+ *  @param degree is the degree of the polynomial fit to each window
+ *  @param width specifies the width of the window
+ *  @param out is used to return the derivative
+ *  @param delta is the interval between x values
+ *  @return true on success, false if k is not less than degree
+ */
+bool FilterBank::deriv(const vector<double>& f, int k, int degree, int width,
+					   vector<double>& out, double delta) {
+	if (k > degree-1) return false;
+	shared_ptr<const SavGol> sg = savgol(degree, width, k, delta);
+	if (!sg) return false;
+	apply(*sg, f, out);
+	return true;
+}
+
+/** Smooth a function by fitting a polynomial to a window around each
+ *  point, as lib.polySmooth does.
+ *  @param f is a vector of function values at equally spaced points
+ *  @param degree is the degree of the polynomial
+ *  @param width specifies the width of the window
+ *  @param dvx is the index of a derivative to return instead of the
+ *  smoothed function
+ *  @param out is used to return the result
+ */
+void FilterBank::polySmooth(const vector<double>& f, int degree, int width,
+							int dvx, vector<double>& out) {
+	shared_ptr<const SavGol> sg = savgol(degree, width, min(dvx, degree));
+	if (sg) apply(*sg, f, out);
+	else out.assign(f.size(), 0.0);
+}
+
+/** Invert a matrix using gauss-jordan elimination with partial pivoting.
+ *  @param AA is a square matrix; it is replaced by its inverse
+ *  @return true on success, false if the matrix is singular
+ */
+bool FilterBank::matrixInvert(vector<vector<double>>& AA) {
+	int n = AA.size();
+	if (n < 1 || n != (int) AA[0].size()) return false;
+	vector<vector<double>> A(AA), B(n, vector<double>(n, 0.0));
+	for (int i = 0; i < n; i++) B[i][i] = 1;
+
+	for (int h = 0; h < n; h++) {
+		int iMax = h; double maxVal = fabs(A[h][h]);
+		for (int i = h+1; i < n; i++) {
+			if (fabs(A[i][h]) > maxVal) { maxVal = fabs(A[i][h]); iMax = i; }
+		}
+		if (maxVal < 1e-100) return false;
+		swap(A[h], A[iMax]); swap(B[h], B[iMax]);
+		double f = A[h][h];
+		for (int j = 0; j < n; j++) { A[h][j] /= f; B[h][j] /= f; }
+		for (int i = 0; i < n; i++) {
+			if (i == h) continue;
+			f = -A[i][h];
+			for (int j = 0; j < n; j++) {
+				if (j >= h) A[i][j] += A[h][j] * f;
+				B[i][j] += B[h][j] * f;
+			}
+		}
+	}
+	AA = B;
+	return true;
+}
+
+/** Discard all cached kernels. Kernels in use remain valid. */
+void FilterBank::clearCache() {
+	Caches& cache = caches();
+	unique_lock<mutex> lck(cache.mtx);
+	cache.gauss.clear(); cache.savgol.clear(); cache.plans.clear();
+}
+
+} // ends namespace
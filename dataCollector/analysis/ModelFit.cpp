@@ -0,0 +1,457 @@
+/** @file ModelFit.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *  This is open source software licensed under the Apache 2.0 license.
+ *  See http://www.apache.org/licenses/LICENSE-2.0 for details.
+ */
+
+#include "ModelFit.h"
+#include "FilterBank.h"
+#include <algorithm>
+#include <queue>
+#include <atomic>
+#include <mutex>
+#include <limits>
+
+namespace fizz {
+
+namespace {
+
+const int EXTRA = 8;	///< results kept beyond those asked for, so near
+						///< ties are settled by the exact computation
+
+/** Candidate result. */
+struct Candidate {
+	double	sqErr;
+	uint64_t rank;			///< position in SubsetLister order
+	vector<int> ss;			///< the models used
+};
+
+/** Order candidates as saveBest does: by error, then by listing order. */
+bool operator<(const Candidate& a, const Candidate& b) {
+	return a.sqErr < b.sqErr || (a.sqErr == b.sqErr && a.rank < b.rank);
+}
+
+}
+
+/** Constructor for ModelFit object.
+ *  @param models is a vector of model spectra, all of the same length
+ *  @param lo is the first index of the range used in fits
+ *  @param hi is one more than the last index of the range; if negative,
+ *  the range extends to the end of the spectra
+ */
+ModelFit::ModelFit(const vector<vector<double>>& models, int lo, int hi)
+		: models(models), lo(lo), hi(hi) {
+	int n = models.size();
+	if (this->hi < 0) this->hi = (n == 0 ? 0 : models[0].size());
+	gram.resize(n, vector<double>(n));
+	for (int i = 0; i < n; i++) {
+		for (int j = i; j < n; j++)
+			gram[i][j] = gram[j][i] = dotProduct(models[i], models[j],
+												 this->lo, this->hi);
+	}
+
+	// factor the Gram matrix of the models in reverse order; stop at the
+	// first suffix of the model list that is (nearly) linearly dependent
+	revFactor.resize(n);
+	for (revRank = 0; revRank < n; revRank++) {
+		int r = revRank; int mr = n-1-r;
+		vector<double>& row = revFactor[r];
+		row.resize(r+1);
+		double d = gram[mr][mr];
+		for (int c = 0; c < r; c++) {
+			double s = gram[mr][n-1-c];
+			for (int k = 0; k < c; k++) s -= row[k] * revFactor[c][k];
+			row[c] = s / revFactor[c][c];
+			d -= row[c] * row[c];
+		}
+		if (!(d > 1e-12 * gram[mr][mr])) break;
+		row[r] = sqrt(d);
+	}
+}
+
+/** Compute a dot product as Library.dotProduct does.
+ *  @param a is a vector
+ *  @param b is a vector of the same length
+ *  @param lo is the first index in the range of the dot product
+ *  @param hi is one more than the last index
+ */
+double ModelFit::dotProduct(const vector<double>& a, const vector<double>& b,
+							int lo, int hi) {
+	double sum = 0;
+	for (int i = lo; i < hi; i++) sum += a[i] * b[i];
+	return sum;
+}
+
+/** State of one thread's search of the model subsets. */
+struct ModelFit::Search {
+	const ModelFit& mf;
+	const vector<double>& q;		///< dot products of target and models
+	double	vdotv;					///< dot product of target with itself
+	const vector<double>& revZ;		///< q, in reverse, solved by revFactor
+	const vector<double>& revZsq;	///< prefix sums of squares of revZ
+	const vector<uint64_t>& offset;	///< rank of first subset of each size
+	const vector<vector<uint64_t>>& binom;	///< binomial coefficients
+	int		maxModels;
+	bool	posOnly;
+	unsigned cap;					///< number of candidates to keep
+	double	margin;					///< allowance for rounding errors
+	atomic<double>& shared;			///< error no thread needs to beat
+
+	vector<int> ss;					///< current subset
+	vector<vector<double>> rows;	///< Cholesky factor for ss, by row
+	vector<double> z;				///< q for ss, solved by the factor
+	vector<double> zsq;				///< prefix sums of squares of z
+	vector<double> w;				///< weights for ss
+
+	/** For the models after the last in ss: cols[i] is the next row
+	 *  of the factor for model i, and diag[k][i] and resid[k][i] are
+	 *  what is left of its diagonal element in the Gram matrix and of
+	 *  q[i], after the first k models in ss are accounted for */
+	vector<vector<double>> cols, diag, resid;
+	priority_queue<Candidate> best;	///< best candidates found, worst on top
+
+	Search(const ModelFit& mf, const vector<double>& q, double vdotv,
+		   const vector<double>& revZ, const vector<double>& revZsq,
+		   const vector<uint64_t>& offset,
+		   const vector<vector<uint64_t>>& binom, int maxModels,
+		   bool posOnly, unsigned cap, atomic<double>& shared)
+		: mf(mf), q(q), vdotv(vdotv), revZ(revZ), revZsq(revZsq),
+		  offset(offset), binom(binom), maxModels(maxModels),
+		  posOnly(posOnly), cap(cap), shared(shared) {
+		margin = 1e-9 * fabs(vdotv);
+		rows.resize(maxModels);
+		for (int i = 0; i < maxModels; i++) rows[i].resize(i+1);
+		z.resize(maxModels); zsq.resize(maxModels+1); zsq[0] = 0;
+		w.resize(maxModels);
+		int n = mf.models.size();
+		cols.resize(n, vector<double>(maxModels));
+		diag.resize(maxModels, vector<double>(n));
+		resid.resize(maxModels, vector<double>(n));
+		for (int i = 0; i < n; i++) {
+			diag[0][i] = mf.gram[i][i]; resid[0][i] = q[i];
+		}
+	}
+
+	/** Error that a candidate must not exceed to be kept. */
+	double threshold() const {
+		double t = shared.load();
+		if (best.size() >= cap) t = min(t, best.top().sqErr);
+		return t;
+	}
+
+	/** Add a model to the current subset, extending the factor.
+	 *  The factor's next row for every later model, and what it leaves of
+	 *  that model's diagonal element and dot product with the target, are
+	 *  updated here, once, for all the subsets that extend the new one.
+	 *  @return false if the new subset is linearly dependent (as are
+	 *  all its supersets), in which case the subset is unchanged
+	 */
+	bool extend(int j) {
+		int m = ss.size(); int n = mf.models.size();
+		const vector<vector<double>>& g = mf.gram;
+		double d = diag[m][j];
+		if (!(d > 1e-12 * g[j][j])) return false;
+		vector<double>& row = rows[m];
+		for (int k = 0; k < m; k++) row[k] = cols[j][k];
+		row[m] = sqrt(d);
+		z[m] = resid[m][j] / row[m];
+		zsq[m+1] = zsq[m] + z[m] * z[m];
+		ss.push_back(j);
+		if (m+1 >= maxModels) return true;
+		for (int i = j+1; i < n; i++) {
+			double x = g[j][i];
+			for (int k = 0; k < m; k++) x -= row[k] * cols[i][k];
+			x /= row[m];
+			cols[i][m] = x;
+			diag[m+1][i] = diag[m][i] - x * x;
+			resid[m+1][i] = resid[m][i] - x * z[m];
+		}
+		return true;
+	}
+
+	void retract() { ss.pop_back(); }
+
+	/** Get a lower bound on the error of all subsets that extend the
+	 *  current one with models after its last.
+	 *  This is the error of the fit that uses the current subset and all
+	 *  those models; the factor for the models comes from revFactor.
+	 *  @return the bound, or minus infinity if there is none
+	 */
+	double bound() const {
+		int n = mf.models.size();
+		int r0 = n - (ss.back() + 1);	// number of models after ss
+		if (r0 > mf.revRank) return -numeric_limits<double>::infinity();
+		const vector<vector<double>>& g = mf.gram;
+		int m = ss.size();
+		vector<vector<double>> ext(m, vector<double>(r0+m));
+		vector<double> zext(m);
+		double sum = revZsq[r0];
+		for (int a = 0; a < m; a++) {
+			int s = ss[a];
+			vector<double>& row = ext[a];
+			double d = g[s][s];
+			for (int c = 0; c < r0 + a; c++) {
+				double x = (c < r0 ? g[s][n-1-c] : g[s][ss[c-r0]]);
+				const double* rc = (c < r0 ? &mf.revFactor[c][0]
+										   : &ext[c-r0][0]);
+				for (int k = 0; k < c; k++) x -= rc[k] * row[k];
+				row[c] = x / rc[c];
+				d -= row[c] * row[c];
+			}
+			if (!(d > 1e-12 * g[s][s]))
+				return -numeric_limits<double>::infinity();
+			row[r0+a] = sqrt(d);
+			double x = q[s];
+			for (int c = 0; c < r0 + a; c++)
+				x -= row[c] * (c < r0 ? revZ[c] : zext[c-r0]);
+			zext[a] = x / row[r0+a];
+			sum += zext[a] * zext[a];
+		}
+		return vdotv - sum;
+	}
+
+	/** Consider the current subset as a candidate. */
+	void consider() {
+		int m = ss.size();
+		double err = vdotv - zsq[m];
+		if (err > threshold() + margin) return;
+		if (posOnly) {
+			// solve for the weights; allow for rounding near zero, as
+			// the final check is made by the exact computation
+			double wmax = 0;
+			for (int i = m-1; i >= 0; i--) {
+				double x = z[i];
+				for (int k = i+1; k < m; k++) x -= rows[k][i] * w[k];
+				w[i] = x / rows[i][i];
+				wmax = max(wmax, fabs(w[i]));
+			}
+			for (int i = 0; i < m; i++)
+				if (w[i] < -1e-9 * wmax) return;
+		}
+		Candidate c;
+		c.sqErr = err; c.ss = ss;
+		c.rank = offset[m];
+		for (int i = 0; i < m; i++) c.rank += binom[ss[i]][i+1];
+		best.push(c);
+		if (best.size() > cap) best.pop();
+		if (best.size() >= cap) {
+			double t = best.top().sqErr, s = shared.load();
+			while (t < s && !shared.compare_exchange_weak(s, t)) {}
+		}
+	}
+
+	/** Consider the current subset and all subsets extending it with
+	 *  models after its last. */
+	void explore() {
+		consider();
+		int m = ss.size(); int n = mf.models.size();
+		if (m >= maxModels || ss.back() == n-1) return;
+		if (m <= maxModels - 2 && bound() > threshold() + margin) return;
+		for (int j = ss.back() + 1; j < n; j++) {
+			if (m+1 == maxModels) {
+				// leaf, so check its error before extending the factor
+				double d = diag[m][j];
+				if (!(d > 1e-12 * mf.gram[j][j]) ||
+					vdotv - zsq[m] - resid[m][j] * resid[m][j] / d >
+					threshold() + margin)
+					continue;
+			}
+			if (extend(j)) { explore(); retract(); }
+		}
+	}
+};
+
+/** Fit the models to a spectrum, as lib.fitModels does.
+ *  @param spect is the target spectrum
+ *  @param maxModels is the largest number of models in a fit
+ *  @param count is the number of results to return
+ *  @param posOnly is true if only fits with non-negative weights are
+ *  to be returned
+ *  @param results is used to return the best fits, best first
+ *  @param threads is the number of threads to use
+ */
+void ModelFit::fit(const vector<double>& spect, int maxModels, int count,
+				   bool posOnly, vector<Match>& results, int threads) const {
+	results.clear();
+	int n = models.size();
+	maxModels = min(maxModels, n);
+	if (n == 0 || maxModels < 1 || count < 1) return;
+
+	vector<double> q(n);
+	for (int i = 0; i < n; i++) q[i] = dotProduct(spect, models[i], lo, hi);
+	double vdotv = dotProduct(spect, spect, lo, hi);
+
+	vector<double> revZ(revRank), revZsq(revRank+1);
+	revZsq[0] = 0;
+	for (int r = 0; r < revRank; r++) {
+		double x = q[n-1-r];
+		for (int k = 0; k < r; k++) x -= revFactor[r][k] * revZ[k];
+		revZ[r] = x / revFactor[r][r];
+		revZsq[r+1] = revZsq[r] + revZ[r] * revZ[r];
+	}
+
+	// ranks of subsets in SubsetLister order: by size, then colex order
+	vector<vector<uint64_t>> binom(n+1, vector<uint64_t>(maxModels+2, 0));
+	for (int i = 0; i <= n; i++) {
+		binom[i][0] = 1;
+		for (int k = 1; k <= min(i, maxModels+1); k++)
+			binom[i][k] = binom[i-1][k-1] + (k < i ? binom[i-1][k] : 0);
+	}
+	vector<uint64_t> offset(maxModels+1, 0);
+	for (int k = 2; k <= maxModels; k++)
+		offset[k] = offset[k-1] + binom[n][k-1];
+
+	// tasks are single models, then pairs, each searched separately
+	vector<pair<int,int>> tasks;
+	for (int i = 0; i < n; i++) tasks.push_back(make_pair(i, -1));
+	if (maxModels > 1) {
+		for (int i = 0; i < n; i++)
+			for (int j = i+1; j < n; j++) tasks.push_back(make_pair(i, j));
+	}
+	unsigned cap = count + EXTRA;
+	atomic<double> shared(numeric_limits<double>::infinity());
+	threads = max(1, min(threads, (int) tasks.size()));
+	vector<Search*> searches;
+	for (int t = 0; t < threads; t++)
+		searches.push_back(new Search(*this, q, vdotv, revZ, revZsq, offset,
+									  binom, maxModels, posOnly, cap, shared));
+	atomic<unsigned> next(0);
+	auto worker = [&](Search* s) {
+		unsigned t;
+		while ((t = next++) < tasks.size()) {
+			int i = tasks[t].first; int j = tasks[t].second;
+			if (!s->extend(i)) continue;
+			if (j < 0) s->consider();
+			else if (s->extend(j)) { s->explore(); s->retract(); }
+			s->retract();
+		}
+	};
+	vector<thread> pool;
+	for (int t = 1; t < threads; t++)
+		pool.push_back(thread(worker, searches[t]));
+	worker(searches[0]);
+	for (thread& t : pool) t.join();
+
+	vector<Candidate> cands;
+	for (Search* s : searches) {
+		while (!s->best.empty()) {
+			cands.push_back(s->best.top()); s->best.pop();
+		}
+		delete s;
+	}
+	sort(cands.begin(), cands.end());
+	if (cands.size() > cap) cands.resize(cap);
+
+	// redo the best fits as vectorFit does, for the final selection
+	vector<Candidate> exact;
+	vector<vector<double>> weights;
+	for (Candidate& c : cands) {
+		vector<double> w; double err;
+		if (!jsSolve(c.ss, q, vdotv, w, err)) continue;
+		if (posOnly && *min_element(w.begin(), w.end()) < 0) continue;
+		c.sqErr = err;
+		vector<double> full(n, 0.0);
+		for (unsigned i = 0; i < c.ss.size(); i++) full[c.ss[i]] = w[i];
+		c.ss.assign(1, weights.size()); weights.push_back(full);
+		exact.push_back(c);
+	}
+	sort(exact.begin(), exact.end());
+	for (Candidate& c : exact) {
+		if ((int) results.size() >= count) break;
+		Match m; m.weights = weights[c.ss[0]]; m.sqErr = c.sqErr;
+		results.push_back(m);
+	}
+}
+
+/** Solve for the weights of a subset of models as vectorFit does.
+ *  @param ss is the subset
+ *  @param q is the vector of dot products of the target with the models
+ *  @param vdotv is the dot product of the target with itself
+ *  @param w is used to return the weights
+ *  @param err is used to return the squared error
+ *  @return false if the subset's Gram matrix is singular
+ */
+bool ModelFit::jsSolve(const vector<int>& ss, const vector<double>& q,
+					   double vdotv, vector<double>& w, double& err) const {
+	int m = ss.size();
+	vector<vector<double>> p(m, vector<double>(m));
+	vector<double> qs(m);
+	for (int i = 0; i < m; i++) {
+		for (int j = 0; j < m; j++) p[i][j] = gram[ss[i]][ss[j]];
+		qs[i] = q[ss[i]];
+	}
+	vector<vector<double>> pi(p);
+	if (!FilterBank::matrixInvert(pi)) return false;
+	w.resize(m);
+	for (int i = 0; i < m; i++) w[i] = dotProduct(pi[i], qs, 0, m);
+	err = vdotv;
+	for (int i = 0; i < m; i++) {
+		err -= 2 * w[i] * qs[i];
+		for (int j = 0; j < m; j++) err += w[i] * w[j] * p[i][j];
+	}
+	return true;
+}
+
+/** Find the best matches of phytoplankton models to an absorbance
+ *  spectrum, as lib.findBestMatches does.
+ *  The fourth derivatives of the models are fit to that of the
+ *  spectrum; then for each fit, the background models are fit to what
+ *  the fit's absorbance spectra leave of the spectrum.
+ *  @param absorb is the absorbance spectrum
+ *  @param fourth is its fourth derivative
+ *  @param absorbModels is the vector of model absorbance spectra
+ *  @param fourthFit is a ModelFit for the models' fourth derivatives
+ *  @param backFit is a ModelFit for the background models; it must use
+ *  the same range as fourthFit
+ *  @param maxModels is the largest number of models in a fit
+ *  @param count is the number of results to return
+ *  @param results is used to return the best fits, best first
+ *  @param threads is the number of threads to use
+ */
+void ModelFit::bestMatches(const vector<double>& absorb,
+						   const vector<double>& fourth,
+						   const vector<vector<double>>& absorbModels,
+						   const ModelFit& fourthFit, const ModelFit& backFit,
+						   int maxModels, int count, vector<Match>& results,
+						   int threads) {
+	int lo = fourthFit.lo; int hi = fourthFit.hi;
+	fourthFit.fit(fourth, maxModels, count, true, results, threads);
+	double mag = sqrt(dotProduct(absorb, absorb, lo, hi));
+
+	atomic<unsigned> next(0);
+	auto worker = [&]() {
+		unsigned r;
+		while ((r = next++) < results.size()) {
+			Match& m = results[r];
+			int len = absorb.size();
+			vector<double> fg(len), diff(len);
+			for (int j = 0; j < len; j++) {
+				double sum = 0;
+				for (unsigned i = 0; i < m.weights.size(); i++)
+					sum += m.weights[i] * absorbModels[i][j];
+				fg[j] = sum; diff[j] = absorb[j] - sum;
+			}
+			vector<Match> dMatch;
+			backFit.fit(diff, backFit.size(), 1, true, dMatch);
+			double avg = 0;
+			for (int j = lo; j < hi; j++) avg += diff[j];
+			avg /= (hi - lo);
+			if (avg > 0 && dMatch.size() > 0) {
+				m.backWeights = dMatch[0].weights;
+			} else {
+				double f = mag / sqrt(dotProduct(fg, fg, lo, hi));
+				for (double& w : m.weights) w = f * w;
+				m.backWeights.assign(backFit.size(), 0.0);
+			}
+		}
+	};
+	threads = max(1, min(threads, (int) results.size()));
+	vector<thread> pool;
+	for (int t = 1; t < threads; t++) pool.push_back(thread(worker));
+	worker();
+	for (thread& t : pool) t.join();
+}
+
+} // ends namespace
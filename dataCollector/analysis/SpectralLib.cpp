@@ -0,0 +1,470 @@
+/** @file SpectralLib.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *  This is open source software licensed under the Apache 2.0 license.
+ *  See http://www.apache.org/licenses/LICENSE-2.0 for details.
+ */
+
+#include "SpectralLib.h"
+
+namespace fizz {
+
+SpectralLib::SpectralLib() : rawLo(-1), rawHi(-1), waveguideLength(0.28),
+							 recipe(CLASSIC), derivDegree(7), derivWidth(28) {
+	settings = classicSettings();
+	setupFilters();
+}
+
+/** Default settings for the classic recipe. */
+SpectralLib::Settings SpectralLib::classicSettings() {
+	Settings s; s.smoothWidth = 23; s.smoothSigma = 12;
+	s.integerize[0] = 1; s.integerize[1] = 1;
+	return s;
+}
+
+/** Default settings for the nuvo recipe. */
+SpectralLib::Settings SpectralLib::nuvoSettings() {
+	Settings s; s.smoothWidth = 8; s.smoothSigma = 4;
+	s.integerize[0] = 3; s.integerize[1] = .5;
+	return s;
+}
+
+/** Set the raw wavelengths; must be done before spectra are cooked.
+ *  @param wl is the vector of wavelengths from the deployment record
+ */
+void SpectralLib::setWavelengths(const vector<double>& wl) {
+	wavelengths = wl;
+	int n = wl.size();
+	for (rawLo = 0; rawLo < n && wl[rawLo] < MINWAVE; rawLo++) {}
+	rawLo = (rawLo < n ? rawLo - 1 : -2);	// as findIndex(...) - 1 does
+	for (rawHi = 0; rawHi < n && wl[rawHi] <= MAXWAVE; rawHi++) {}
+	if (rawHi == n) rawHi = -1;
+	setupFilters();
+}
+
+/** Set the waveguide length used to compute absorption. */
+void SpectralLib::setWaveguideLength(double length) {
+	waveguideLength = length;
+}
+
+/** Set the cook recipe and its settings. */
+void SpectralLib::setRecipe(Recipe r, const Settings& s) {
+	recipe = r; settings = s;
+	setupFilters();
+}
+
+/** Set the cook recipe, using its default settings. */
+void SpectralLib::setRecipe(Recipe r) {
+	setRecipe(r, r == CLASSIC ? classicSettings() : nuvoSettings());
+}
+
+/** Set the parameters used to compute derivatives.
+ *  @param degree is the degree of the polynomial fit to each window
+ *  @param width is the half-width of the window
+ */
+void SpectralLib::setDerivSettings(int degree, int width) {
+	derivDegree = degree; derivWidth = width;
+}
+
+/** Get the smoothing and integerization filters for the current
+ *  recipe and wavelengths. */
+void SpectralLib::setupFilters() {
+	gauss = FilterBank::gaussian(settings.smoothWidth, settings.smoothSigma);
+	plan = FilterBank::integerizer(wavelengths, recipe == CLASSIC,
+								   settings.integerize[0],
+								   settings.integerize[1], MINWAVE, MAXWAVE);
+}
+
+/** Apply the gaussian filter to a vector.
+ *  As in summarize/analysisLibrary, the first value is copied and the
+ *  smoothed values near the right end are stored in reverse order.
+ *  @param in is the vector to be smoothed; it is assumed to be longer
+ *  than the filter
+ *  @param out is used to return the smoothed vector
+ */
+void SpectralLib::smooth(const vector<double>& in, vector<double>& out) const {
+	FilterBank::smooth(*gauss, in, out, FilterBank::ANALYSISLIB);
+}
+
+/** Compute a derivative of a function, as lib.deriv does with the
+ *  default settings.
+ *  @param f is a vector of function values at equally spaced points
+ *  @param k is the index of the derivative
+ *  @param out is used to return the derivative
+ *  @return true on success, false if k is too large
+ */
+bool SpectralLib::deriv(const vector<double>& f, int k,
+						vector<double>& out) const {
+	return FilterBank::deriv(f, k, derivDegree, derivWidth, out);
+}
+
+/** Compute a cooked spectrum.
+ *  The classic recipe smooths the raw spectrum and dark spectrum and
+ *  integerizes them by polynomial interpolation. The nuvo recipe
+ *  integerizes using a gaussian weighted average. Both steps are linear,
+ *  so the dark spectrum is subtracted first and only the difference is
+ *  filtered.
+ *  @param sample is a raw spectrum
+ *  @param dark is its dark spectrum
+ *  @param out is used to return the cooked spectrum; it has one value
+ *  for each wavelength in [MINWAVE,MAXWAVE)
+ */
+void SpectralLib::cook(const vector<double>& sample, const vector<double>& dark,
+					   vector<double>& out) const {
+	int n = min(sample.size(), dark.size());
+	vector<double> diff(n);
+	for (int i = 0; i < n; i++) diff[i] = sample[i] - dark[i];
+	if (recipe == CLASSIC) {
+		vector<double> smoothed;
+		smooth(diff, smoothed);
+		FilterBank::integerize(*plan, smoothed, out);
+	} else {
+		FilterBank::integerize(*plan, diff, out);
+	}
+}
+
+/** Calculate the cdom absorption spectrum.
+ *  @param spect is a raw filtered spectrum
+ *  @param dark is the dark spectrum for spect
+ *  @param ref is the reference spectrum
+ *  @param refDark is the dark spectrum for ref
+ *  @param out is used to return the absorption spectrum; as in the
+ *  javascript, it is not smoothed for the nuvo recipe
+ */
+void SpectralLib::absorption(const vector<double>& spect,
+							 const vector<double>& dark,
+							 const vector<double>& ref,
+							 const vector<double>& refDark,
+							 vector<double>& out) const {
+	vector<double> cookedSpect, cookedRef;
+	cook(spect, dark, cookedSpect);
+	cook(ref, refDark, cookedRef);
+	rawAbsorption(cookedSpect, cookedRef, out);
+}
+
+/** Calculate the cdom absorption from cooked spectra.
+ *  @param sample is a cooked sample spectrum
+ *  @param ref is the corresponding cooked reference spectrum
+ *  @param out is used to return the absorption
+ */
+void SpectralLib::rawAbsorption(const vector<double>& sample,
+								const vector<double>& ref,
+								vector<double>& out) const {
+	int n = sample.size(); out.resize(n);
+	for (int i = 0; i < n; i++) {
+		out[i] = (ref[i] > .0000001 && sample[i] > .0000001 ?
+				  log(max(1., ref[i]) / max(1., sample[i])) / waveguideLength
+				  : 0);
+	}
+}
+
+/** Calculate the cdom absorption parameters.
+ *  An exponential curve is fit to the shifted absorption spectrum
+ *  over [CDOM_MINWAVE,CDOM_MAXWAVE).
+ *  @param absorp is an absorption spectrum
+ *  @param a440 is used to return the absorption at 440 nm
+ *  @param slope is used to return the slope parameter
+ *  @return true on success, false if there are too few positive values
+ *  to fit a curve; in this case a440 and slope are zero
+ */
+bool SpectralLib::absorptionParameters(const vector<double>& absorp,
+									   double& a440, double& slope) const {
+	a440 = slope = 0;
+	vector<double> shifted; vectorShift(absorp, shifted);
+	vector<double> x, y;
+	int hi = min((int) shifted.size(), CDOM_MAXWAVE - MINWAVE);
+	for (int i = CDOM_MINWAVE - MINWAVE; i < hi; i++) {
+		if (shifted[i] > 0) {
+			x.push_back(i - (440 - MINWAVE));
+			y.push_back(log(shifted[i]));
+		}
+	}
+	if (x.size() < 20) return false;
+	double y0, m; fitline(x, y, y0, m);
+	a440 = exp(y0); slope = -m;
+	return true;
+}
+
+/** Compute the exponential absorption curve for given parameters.
+ *  @param out is used to return the curve at the cooked wavelengths
+ */
+void SpectralLib::absorpExpCurve(double a440, double slope,
+								 vector<double>& out) const {
+	out.resize(NCOOKED);
+	for (int i = 0; i < NCOOKED; i++)
+		out[i] = a440 * exp(-slope * (i + (MINWAVE - 440)));
+}
+
+/** Calculate the absorbance spectrum for an unfiltered sample.
+ *  @param spect is a raw unfiltered spectrum
+ *  @param dark is the dark spectrum for spect
+ *  @param ref is the reference spectrum
+ *  @param refDark is the dark spectrum for ref
+ *  @param out is used to return the absorbance spectrum; it is smoothed
+ *  for the nuvo recipe
+ */
+void SpectralLib::absorbance(const vector<double>& spect,
+							 const vector<double>& dark,
+							 const vector<double>& ref,
+							 const vector<double>& refDark,
+							 vector<double>& out) const {
+	vector<double> cookedSpect, cookedRef;
+	cook(spect, dark, cookedSpect);
+	cook(ref, refDark, cookedRef);
+	rawAbsorbance(cookedSpect, cookedRef, out);
+	if (recipe == NUVO) {
+		vector<double> raw(out); smooth(raw, out);
+	}
+}
+
+/** Calculate absorbance from cooked spectra.
+ *  @param sample is a cooked sample spectrum
+ *  @param ref is the corresponding cooked reference spectrum
+ *  @param out is used to return the absorbance
+ */
+void SpectralLib::rawAbsorbance(const vector<double>& sample,
+								const vector<double>& ref,
+								vector<double>& out) const {
+	int n = sample.size(); out.resize(n);
+	for (int i = 0; i < n; i++)
+		out[i] = log10(max(1., ref[i]) / max(1., sample[i]));
+}
+
+/** Compute the similarity index of a pair of vectors; this is their
+ *  angular similarity over [SIM_MINWAVE,SIM_MAXWAVE).
+ */
+double SpectralLib::simIndex(const vector<double>& x,
+							 const vector<double>& y) const {
+	return angularSim(x, y, SIM_MINWAVE - MINWAVE, SIM_MAXWAVE - MINWAVE);
+}
+
+/** Get the index range of a raw spectrum that covers the cooked
+ *  wavelengths. As in the javascript, this is the slice [rawLo,rawHi),
+ *  where negative values count from the end.
+ *  @param n is the length of the raw spectrum
+ *  @param lo is used to return the first index of the range
+ *  @param hi is used to return one more than the last index
+ */
+void SpectralLib::rawRange(int n, int& lo, int& hi) const {
+	lo = (rawLo < 0 ? max(0, n + rawLo) : min(rawLo, n));
+	hi = (rawHi < 0 ? max(0, n + rawHi) : min(rawHi, n));
+}
+
+/** Average of a raw spectrum over the range that covers the cooked
+ *  wavelengths. */
+double SpectralLib::rawAvg(const vector<double>& v) const {
+	int lo, hi; rawRange(v.size(), lo, hi);
+	double s = 0;
+	for (int i = lo; i < hi; i++) s += v[i];
+	return s / (hi - lo);
+}
+
+/** Check the quality of a dark spectrum.
+ *  @return -1 if invalid, 0 if marginal, 1 if ok
+ */
+int SpectralLib::qaDark(const vector<double>& dark) const {
+	if (dark.size() == 0) return -1;
+	int lo, hi; rawRange(dark.size(), lo, hi);
+	if (lo >= hi) return 1;
+	double avg = rawAvg(dark);
+	double dmin = dark[lo];
+	for (int i = lo; i < hi; i++) dmin = min(dmin, dark[i]);
+	// the javascript also tests the average and maximum, but its
+	// result is determined by the minimum alone
+	return (dmin < .8 * avg ? -1 : (dmin < .9 * avg ? 0 : 1));
+}
+
+/** Check the quality of a filtered spectrum.
+ *  @param filtered is a raw filtered spectrum
+ *  @param dark is its dark spectrum
+ *  @return -1 if invalid, 0 if marginal, 1 if ok
+ */
+int SpectralLib::qaFiltered(const vector<double>& filtered,
+							const vector<double>& dark) const {
+	int qa = qaDark(dark);
+	double r = rawAvg(filtered) / rawAvg(dark);
+	return min(qa, (r < 3 ? -1 : (r < 5 ? 0 : 1)));
+}
+
+/** Check the quality of an unfiltered spectrum.
+ *  @param unfiltered is a raw unfiltered spectrum
+ *  @param dark is its dark spectrum
+ *  @return -1 if invalid, 0 if marginal, 1 if ok
+ */
+int SpectralLib::qaUnfiltered(const vector<double>& unfiltered,
+							  const vector<double>& dark) const {
+	return qaFiltered(unfiltered, dark);
+}
+
+/** Check the quality of a reference spectrum.
+ *  @param ref is a raw reference spectrum
+ *  @param dark is its dark spectrum
+ *  @return -1 if invalid, 0 if marginal, 1 if ok
+ */
+int SpectralLib::qaReference(const vector<double>& ref,
+							 const vector<double>& dark) const {
+	if (ref.size() == 0 || dark.size() == 0) return -1;
+	int qa = qaDark(dark);
+	double rmax = ref[0];
+	for (double x : ref) rmax = max(rmax, x);
+	return min(qa, (rmax > 60000 || rmax < 30000 ? -1 :
+					(rmax < 50000 ? 0 : 1)));
+}
+
+/** Check the quality of a cdom absorption measurement.
+ *  @param filtered is the raw filtered spectrum
+ *  @param dark is its dark spectrum
+ *  @param ref is the reference spectrum
+ *  @param refDark is the dark spectrum for ref
+ *  @param absorp is the absorption spectrum computed from these
+ *  @return -1 if invalid, 0 if marginal, 1 if ok
+ */
+int SpectralLib::qaAbsorption(const vector<double>& filtered,
+							  const vector<double>& dark,
+							  const vector<double>& ref,
+							  const vector<double>& refDark,
+							  const vector<double>& absorp) const {
+	int qa = qaReference(ref, refDark);
+	qa = min(qa, qaFiltered(filtered, dark));
+
+	// check absorption level at 440 nm
+	double a440, slope;
+	absorptionParameters(absorp, a440, slope);
+	qa = min(qa, (a440 < log(1/.95)/waveguideLength ? -1 :
+				  (a440 < log(1/.9)/waveguideLength ? 0 : 1)));
+
+	// check similarity to exponential curve, below 600 nm
+	vector<double> curve, shifted, dcurve, dshifted;
+	absorpExpCurve(a440, slope, curve);
+	vectorShift(absorp, shifted);
+	int n = min(600 - MINWAVE, (int) shifted.size());
+	curve.resize(n); shifted.resize(n);
+	deriv(curve, 1, dcurve); deriv(shifted, 1, dshifted);
+	double simx = angularSim(dcurve, dshifted);
+	return min(qa, (simx < .8 ? -1 : (simx < .9 ? 0 : 1)));
+}
+
+/** Check the quality of an absorbance measurement.
+ *  @param unfiltered is the raw unfiltered spectrum
+ *  @param dark is its dark spectrum
+ *  @param ref is the reference spectrum
+ *  @param refDark is the dark spectrum for ref
+ *  @param absorb is the absorbance spectrum computed from these
+ *  @return -1 if invalid, 0 if marginal, 1 if ok
+ */
+int SpectralLib::qaAbsorbance(const vector<double>& unfiltered,
+							  const vector<double>& dark,
+							  const vector<double>& ref,
+							  const vector<double>& refDark,
+							  const vector<double>& absorb) const {
+	int qa = qaUnfiltered(unfiltered, dark);
+	qa = min(qa, qaFiltered(ref, refDark));
+	double avg = 0;
+	for (double x : absorb) avg += x;
+	avg /= absorb.size();
+	return min(qa, (avg < log10(1/.98) ? -1 : (avg < log10(1/.95) ? 0 : 1)));
+}
+
+/** Get the string used for a qa value in summary records. */
+string SpectralLib::qaString(int qa) {
+	return (qa < 0 ? "invalid" : (qa == 0 ? "marginal" : "ok"));
+}
+
+/** Shift a vector vertically.
+ *  The average of each window of the given width is computed and the
+ *  smallest is subtracted from each value; negative results become zero.
+ *  @param vec is the vector to be shifted
+ *  @param out is used to return the shifted vector
+ *  @param width is the window width
+ */
+void SpectralLib::vectorShift(const vector<double>& vec, vector<double>& out,
+							  int width) {
+	int n = vec.size(); width = min(width, n);
+	out.resize(n);
+	if (n == 0) return;
+	double windowSum = 0;
+	for (int i = 0; i < width; i++) windowSum += vec[i];
+	double minSum = windowSum;
+	for (int i = width; i < n; i++) {
+		windowSum = windowSum + vec[i] - vec[i-width];
+		if (windowSum < minSum) minSum = windowSum;
+	}
+	double shift = minSum/width;
+	for (int i = 0; i < n; i++) out[i] = max(0., vec[i] - shift);
+}
+
+/** Fit a line to a set of points, using least-squares.
+ *  @param x is a vector of x values
+ *  @param y is a vector of y values with the same length as x
+ *  @param y0 is used to return the y-intercept
+ *  @param slope is used to return the slope
+ */
+void SpectralLib::fitline(const vector<double>& x, const vector<double>& y,
+						  double& y0, double& slope) {
+	int n = x.size();
+	double xbar = 0, ybar = 0;
+	for (int i = 0; i < n; i++) xbar += x[i];
+	for (int i = 0; i < n; i++) ybar += y[i];
+	xbar /= n; ybar /= n;
+	double dx = 0., dy = 0.;
+	for (int i = 0; i < n; i++) {
+		dx += (x[i]-xbar)*(x[i]-xbar); dy += (x[i]-xbar)*(y[i]-ybar);
+	}
+	slope = dy/dx;
+	y0 = ybar - slope*xbar;
+}
+
+/** Find a polynomial that fits a set of points, using least-squares.
+ *  @param x is a vector of x values
+ *  @param y is a matching vector of y values
+ *  @param k is the degree of the polynomial
+ *  @param coef is used to return the k+1 coefficients, lowest order first
+ *  @return true on success, false if there is no unique solution
+ */
+bool SpectralLib::polyfit(const vector<double>& x, const vector<double>& y,
+						  int k, vector<double>& coef) {
+	vector<double> xs(2*k+1, 0.0), ys(k+1, 0.0);
+	for (unsigned i = 0; i < x.size(); i++) {
+		double p = 1;
+		for (int j = 0; j < 2*k+1; j++) {
+			xs[j] += p;
+			if (j <= k) ys[j] += y[i] * p;
+			p *= x[i];
+		}
+	}
+	vector<vector<double>> A(k+1, vector<double>(k+1));
+	for (int i = 0; i <= k; i++) {
+		for (int j = 0; j <= k; j++) A[i][j] = xs[i+j];
+	}
+	if (!FilterBank::matrixInvert(A)) return false;
+	coef.assign(k+1, 0.0);
+	for (int i = 0; i <= k; i++) {
+		for (int j = 0; j <= k; j++) coef[i] += A[i][j] * ys[j];
+	}
+	return true;
+}
+
+/** Compute the angular similarity of two vectors.
+ *  @param a is a vector
+ *  @param b is a vector of the same length
+ *  @param lo is the first index of the range over which the similarity
+ *  is computed
+ *  @param hi is one more than the last index of the range; if negative,
+ *  the range extends to the end of the vectors
+ *  @return 1 - (2/pi) times the angle between a and b, which is 1 for
+ *  vectors pointing the same way and 0 for orthogonal vectors
+ */
+double SpectralLib::angularSim(const vector<double>& a, const vector<double>& b,
+							   int lo, int hi) {
+	if (hi < 0) hi = a.size();
+	double ab = 0, aa = 0, bb = 0;
+	for (int i = lo; i < hi; i++) ab += a[i] * b[i];
+	for (int i = lo; i < hi; i++) aa += a[i] * a[i];
+	for (int i = lo; i < hi; i++) bb += b[i] * b[i];
+	double x = sqrt(aa) * sqrt(bb);
+	double cosine = min(1., (x == 0 ? 0 : ab / x));
+	return 1 - (2 / M_PI) * acos(cosine);
+}
+
+} // ends namespace
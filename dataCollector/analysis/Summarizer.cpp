@@ -0,0 +1,210 @@
+/** @file Summarizer.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *  This is open source software licensed under the Apache 2.0 license.
+ *  See http://www.apache.org/licenses/LICENSE-2.0 for details.
+ */
+
+#include "Summarizer.h"
+#include "JsonScan.h"
+#include <map>
+#include <algorithm>
+#include <dirent.h>
+
+namespace fizz {
+
+namespace {
+
+/** Longer versions of phytoplankton model names, from summarize.js. */
+const map<string,string> longNames = {
+	{ "Phaeo_tri", "Bacillar_Phaeodac" },
+	{ "Pseudo_del", "Bacillar_P-nitz_del" },
+	{ "Pseudo_frau", "Bacillar_P-nitz_fraud" },
+	{ "Shel_cos (should be Skel_cos)", "Bacillar_Skeleto" },
+	{ "Thal_pseudonana", "Bacillar_Thal_pseudo" },
+	{ "Thal_weissflogii_n", "Bacillar_Thal_weiss" },
+	{ "Dunal", "Chloro_Dunali" },
+	{ "Hemisel_1", "Crypto_Hemisel" },
+	{ "Tricho", "Cyano_Tricho_eryt" },
+	{ "Amphid_cart", "Dino_per_Amphidi" },
+	{ "KB_GI", "Dino_Kar_brevis_GI" },
+	{ "KB_TL", "Dino_Kar_brevis_TL" },
+	{ "KB_mrh04n", "Dino_Kar_brevis_mrh04n" },
+	{ "Kar_miki", "Dino_Kar_miki" },
+	{ "Proro_min", "Dino_per_Prorocent" },
+	{ "Tetrasel", "Prasino_Tetrasel" },
+	{ "EmillIan_hux (should be Emilian_hux)", "Prymnes_Emilli" },
+	{ "Pleurochrysis", "Prymnes_Pleurochry" },
+	{ "Iso_galb", "Pyrmnes_Isochry" },
+	{ "Heterosig_akash", "Raphido_Heterosig" }
+};
+
+}
+
+Summarizer::Summarizer() {}
+
+/** Load the phytoplankton models.
+ *  Each model is a .unia file holding a JSON object with the fields
+ *  wavelengths, dark, cdom and disc. The model's absorbance and its
+ *  fourth derivative are computed here, once, since they do not depend
+ *  on the sample.
+ *  @param dir is the directory containing the model files
+ *  @return the number of models loaded, or -1 if dir cannot be read
+ */
+int Summarizer::loadModels(const string& dir) {
+	models.clear();
+	DIR* dp = opendir(dir.c_str());
+	if (dp == 0) return -1;
+	vector<string> files;
+	struct dirent* ep;
+	while ((ep = readdir(dp)) != 0) {
+		string name = ep->d_name;
+		if (name.length() > 5 && name.substr(name.length()-5) == ".unia")
+			files.push_back(name);
+	}
+	closedir(dp);
+	sort(files.begin(), files.end());
+
+	SpectralLib mlib;
+	for (string& fname : files) {
+		ifstream in(dir + "/" + fname);
+		stringstream ss; ss << in.rdbuf();
+		string s = ss.str();
+		for (char& c : s) if (c == '\n' || c == '\r') c = ' ';
+		vector<double> wl, dark, cdom, disc;
+		if (!JsonScan::getVector(s, "wavelengths", wl) ||
+			!JsonScan::getVector(s, "dark", dark) ||
+			!JsonScan::getVector(s, "cdom", cdom) ||
+			!JsonScan::getVector(s, "disc", disc) ||
+			dark.size() != wl.size() || cdom.size() != wl.size() ||
+			disc.size() != wl.size())
+			continue;
+		Model m;
+		string stem = fname.substr(0, fname.length()-5);
+		auto lp = longNames.find(stem);
+		m.name = (lp != longNames.end() ? lp->second : stem);
+
+		vector<double> absorb;
+		mlib.setWavelengths(wl);
+		mlib.absorbance(disc, dark, cdom, dark, absorb);
+		mlib.deriv(absorb, 4, m.deriv);
+
+		// a later file with the same long name replaces an earlier one,
+		// but keeps its position, as object properties do
+		auto mp = find_if(models.begin(), models.end(),
+						  [&m](const Model& x) { return x.name == m.name; });
+		if (mp != models.end()) *mp = m;
+		else models.push_back(m);
+	}
+	return models.size();
+}
+
+/** Set the deployment parameters.
+ *  @param wavelengths is the vector of raw wavelengths, as given in the
+ *  deployment record
+ *  @param waveguideLength is the waveguide length, in meters
+ */
+void Summarizer::setDeployment(const vector<double>& wavelengths,
+							   double waveguideLength) {
+	if (wavelengths != lib.getWavelengths()) lib.setWavelengths(wavelengths);
+	lib.setWaveguideLength(waveguideLength);
+}
+
+/** Compute the summary fields for a sample cycle.
+ *  @param filtered specifies the spectra for the cycle's filtered
+ *  measurement, or is null if there is none
+ *  @param concentrate specifies the spectra for the cycle's concentrate
+ *  measurement, or is null if there is none
+ *  @param fields is used to return the names and values of the summary
+ *  fields, in the order summarize.js produces them
+ */
+void Summarizer::summarize(const Measurement* filtered,
+						   const Measurement* concentrate,
+						   FieldList& fields) const {
+	fields.clear();
+	if (filtered != 0) {
+		const Measurement& m = *filtered;
+		vector<double> absorp;
+		lib.absorption(*m.spect, *m.dark, *m.ref, *m.refDark, absorp);
+		double a440, slope;
+		lib.absorptionParameters(absorp, a440, slope);
+		int qa = lib.qaAbsorption(*m.spect, *m.dark, *m.ref, *m.refDark,
+								  absorp);
+		fields.push_back(make_pair("cdomAbsorp440", jsNumber(a440, 4)));
+		fields.push_back(make_pair("cdomSlope", jsNumber(slope, 5)));
+		fields.push_back(make_pair("cdom_QA",
+								   "\"" + SpectralLib::qaString(qa) + "\""));
+	}
+	if (concentrate != 0) {
+		const Measurement& m = *concentrate;
+		vector<double> absorb, deriv;
+		lib.absorbance(*m.spect, *m.dark, *m.ref, *m.refDark, absorb);
+		lib.deriv(absorb, 4, deriv);
+		for (const Model& model : models) {
+			double simx = lib.simIndex(deriv, model.deriv);
+			fields.push_back(make_pair("simIndex/" + model.name,
+									   jsNumber(simx, 4)));
+		}
+		int qa = lib.qaAbsorbance(*m.spect, *m.dark, *m.ref, *m.refDark,
+								  absorb);
+		fields.push_back(make_pair("simIndex_QA",
+								   "\"" + SpectralLib::qaString(qa) + "\""));
+	}
+}
+
+/** Format a number as JSON.stringify(Number(x.toFixed(d))) does.
+ *  @param x is the number
+ *  @param d is the number of decimal places to round to, or -1 to
+ *  format x without rounding
+ *  @return the shortest string that reads back as the (rounded) value,
+ *  or "null" if x is not finite
+ */
+string Summarizer::jsNumber(double x, int d) {
+	if (!isfinite(x)) return "null";
+	char buf[400];
+	if (d >= 0 && fabs(x) < 1e21) {
+		// toFixed rounds ties away from zero, printf to even
+		double scaled = fabs(x) * pow(10., d);
+		if (scaled - floor(scaled) == .5) {
+			double n = floor(scaled) + 1;
+			snprintf(buf, sizeof(buf), "%.0f", n);
+			string digits = buf;
+			while ((int) digits.length() <= d) digits = "0" + digits;
+			string s = digits.substr(0, digits.length() - d);
+			if (d > 0) s += "." + digits.substr(digits.length() - d);
+			x = strtod(s.c_str(), 0) * (x < 0 ? -1 : 1);
+		} else {
+			snprintf(buf, sizeof(buf), "%.*f", d, x);
+			x = strtod(buf, 0);
+		}
+	}
+	if (x == 0) return "0";
+
+	// find the shortest digit string that reads back as x
+	int p;
+	for (p = 1; p < 17; p++) {
+		snprintf(buf, sizeof(buf), "%.*e", p-1, x);
+		if (strtod(buf, 0) == x) break;
+	}
+	snprintf(buf, sizeof(buf), "%.*e", p-1, x);
+	string s = buf;
+	string sign = (s[0] == '-' ? "-" : "");
+	if (sign.length() > 0) s = s.substr(1);
+	string::size_type epos = s.find('e');
+	int e = atoi(s.c_str() + epos + 1);
+	string digits = s.substr(0, 1) + (p > 1 ? s.substr(2, epos - 2) : "");
+
+	// use exponential notation only where javascript does
+	if (e >= 21 || e < -6) {
+		string m = digits.substr(0, 1);
+		if (digits.length() > 1) m += "." + digits.substr(1);
+		return sign + m + "e" + (e > 0 ? "+" : "-") + to_string(abs(e));
+	}
+	if (e < 0) return sign + "0." + string(-e-1, '0') + digits;
+	if ((int) digits.length() <= e + 1)
+		return sign + digits + string(e + 1 - digits.length(), '0');
+	return sign + digits.substr(0, e+1) + "." + digits.substr(e+1);
+}
+
+} // ends namespace
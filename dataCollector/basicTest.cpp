@@ -40,8 +40,12 @@ bool getWavelengths(double*);
 
 /** Perform basic tests on the arduino version of the physs.
  * 
- * usage: aBasicTest
+ * usage: aBasicTest [device]
  * 
+ * The optional device is the serial device for the arduino (for example,
+ * the pty of an arduinoEmulator); by default, the first /dev/ttyUSB
+ * device that can be opened is used.
+ *
  * This program does some initialization, then reads commands from stdin
  * and responds as requested. Commands take one of the following forms.
  * 
@@ -66,6 +70,10 @@ bool getWavelengths(double*);
  * log		print arduino log messages
  * echo s	echos the string s (enclosed in double quotes) back to the
  * 		console
+ * stressTest n p [pipe]	send n echo queries, one every p ms, and
+ * 		report missed replies and reply latencies; with pipe, send
+ * 		queries in groups of 8 without waiting for each reply
+ * linkStats	show arduino reply latency statistics
  * pause t	pauses for t seconds (t may include a decimal point)
  * quit		exits the program
  */
@@ -93,14 +101,18 @@ string helpString = "Commands\n\n"
 "log       	 print arduino log messages\n"
 "echo s      echos the string s (enclosed in double quotes) back to the\n"
 "            console\n"
+"stressTest n p [pipe] send n echo queries, one every p ms, and\n"
+"            report missed replies and reply latencies; with pipe,\n"
+"            send queries in groups of 8 without waiting for each reply\n"
+"linkStats   show arduino reply latency statistics\n"
 "pause t     pauses for t seconds (t may include a decimal point)\n"
 "quit        exits the program\n";
 
 Arduino arduino;
 
-int main() {
+int main(int argc, char* argv[]) {
 	logger.addTarget(log2stderr);
-	arduino.start();
+	arduino.start(argc > 1 ? argv[1] : "");
 	startSpect();
 	// add code to set pump speeds to 0
 	while (true) {
@@ -251,11 +263,15 @@ bool processCommand(string line) {
 		string s = arduino.query("e" + line.substr(i+1, j-(i+1)));
 		cout << s << endl;
 	} else if (cmd == "stressTest") {
-		checkit(n == 3);
+		checkit(n == 3 || (n == 4 && words[3] == "pipe"));
+		bool pipe = (n == 4);
 		int n = atoi(words[1].c_str());
 		double period = atof(words[2].c_str()) / 1000;
-		int miss = arduino.stressTest(n, period);
+		int miss = arduino.stressTest(n, period, pipe);
 		cout << "missed " << miss << " out of " << n << endl;
+		cout << arduino.linkStats() << endl;
+	} else if (cmd == "linkStats") {
+		cout << arduino.linkStats() << endl;
 	} else if (cmd == "dpin") {
 		checkit(n == 3 && words[1].length() <= 2 && words[2].length() == 1);
 		if (words[1].length() == 1) words[1] = "0" + words[1];
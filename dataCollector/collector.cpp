@@ -35,11 +35,15 @@ Usage: collector
 #include "ConsoleInterp.h"
 #include "Operations.h"
 #include "CollectorState.h"
+#include "PressureController.h"
 #include "Interrupt.h"
+#include "Reactor.h"
+#include "Telemetry.h"
 
 namespace fizz {
 
 DataStore dataStore;	// put first so Log2debug can refer to it
+extern Config config;
 
 // define LogTargets
 class Log2debug : public LogTarget {
@@ -47,11 +51,18 @@ public:		Log2debug(int level);
 	void	logMessage(const string& s, int level) {
 		if (level >= logLevel && fs.is_open()) {
 			fs << s << std::flush;
+			if (config.getEventRecords()) return;
 			size_t n = s.find("\n");
 			if (n == string::npos || n == s.length()-1)
 				dataStore.saveDebugRecord(s);
 		}
 	}
+	bool	acceptsEvents() { return true; }
+	void	logEvent(const LogEvent& ev) {
+		if (ev.level >= logLevel && fs.is_open() &&
+			config.getEventRecords())
+			dataStore.saveEvent(ev);
+	}
 	void	close() { fs.close(); }
 private:
 	ofstream fs;
@@ -71,6 +82,8 @@ public:		Log2stderr(int level) : LogTarget(level) {}
 	}
 } log2stderr(Logger::ERROR);
 
+Reactor reactor;		// event loop for console, arduino and timers
+Telemetry telemetry;	// snapshot of state, refreshed by reactor
 Console console;
 Logger logger;
 
@@ -98,6 +111,7 @@ MaintLog maintLog("maintLog");
 CollectorState cstate("state");
 ConsoleInterp consoleInterp;
 ScriptInterp scriptInterp;
+PressureController pressureController;
 Interrupt interrupt;
 
 string serialNumber = "0";
@@ -149,6 +163,61 @@ bool criticalFailure() {
 	return false;
 }
 
+/** Reasons for the collector to exit. */
+enum { NO_EXIT, CRITICAL_FAILURE, CONSOLE_QUIT, SCRIPT_DONE };
+
+/** Check for conditions that end the collector.
+ *  @return the reason for exiting, or NO_EXIT
+ */
+int checkForExit() {
+	if (criticalFailure()) {
+		// criticalFailure is false when no arduino or no control board
+		return CRITICAL_FAILURE;
+	} else if (consoleInterp.zombie()) {
+		logger.debug("main: detected consoleInterp termination");
+		return CONSOLE_QUIT;
+	} else if (scriptInterp.zombie()) {
+		logger.debug("main: detected scriptInterp termination");
+		return SCRIPT_DONE;
+	}
+	return NO_EXIT;
+}
+
+// Work handed from the status tick to the main thread
+mutex mainMtx;
+condition_variable mainCond;
+bool statusDue = false;		///< main thread is to poll status and check
+bool mainBusy = false;		///< main thread is polling status
+int exitReason = NO_EXIT;	///< set when tick detects a reason to exit
+
+int statusTimer = -1;		///< reactor timer that runs statusTick
+double statusPeriod = 0;	///< current period of statusTimer
+
+/** Periodic status tick, run by the reactor.
+ *  When the arduino streams status reports, the checks are done here,
+ *  since they do not block; otherwise, status must be polled, so the
+ *  main thread is asked to do the work. Either way, exiting is left to
+ *  the main thread. Streamed reports need no polling, so the tick runs
+ *  every 250 ms while they arrive, and every 50 ms otherwise.
+ */
+void statusTick() {
+	bool streaming = arduino.isStreaming();
+	double period = (streaming ? .25 : .05);
+	if (period != statusPeriod &&
+		reactor.setTimerPeriod(statusTimer, period))
+		statusPeriod = period;
+	unique_lock<mutex> lck(mainMtx);
+	if (statusDue || mainBusy || exitReason != NO_EXIT) return;
+	if (!streaming) {
+		statusDue = true; mainCond.notify_one(); return;
+	}
+	lck.unlock();
+	int reason = checkForExit();
+	if (reason == NO_EXIT) return;
+	lck.lock();
+	exitReason = reason; mainCond.notify_one();
+}
+
 /** Final processing before exit.
  *  @param critFail is true if we're exiting due to a critical failure
  *  @param exitOnly is a boolean which controls how the program exits;
@@ -163,7 +232,9 @@ void wrapup(bool critFail, bool exitOnly) {
 		        Clock::dateTimeString().c_str(),
 			    (critFail ? "critical failure" : "normal completion")); 
 	arduino.log();
+	logger.flush();		  // deliver pending log messages
 	dataStore.close();    // close the raw data file
+	cstate.flush();		  // write any pending state changes
 	log2debug.close();    // final log message
 	sleep_for(milliseconds(100));
 	arduino.send("S0");   // essential steps are done
@@ -205,14 +276,17 @@ int main(int argc, char* argv[]) {
 	log2debug.setLevel(Logger::DEBUG);
 	logger.addTarget(log2stderr);
 
-	// open console
-	if (!console.open("127.0.0.1", 6256)) {
+	// start event loop and open console
+	if (!reactor.start()) {
+		logger.fatal("cannot start event loop, quitting");
+		exit(1);
+	}
+	if (!console.open("127.0.0.1", 6256, reactor)) {
 		logger.fatal("cannot open console socket, quitting");
 		exit(1);
 	}
 
-	sleep_for(seconds(1));
-	console.accept();
+	sleep_for(seconds(1));	// give console a chance to connect
 	logger.addTarget(console);
 	logger.info("opened console");
 
@@ -244,12 +318,16 @@ int main(int argc, char* argv[]) {
 	}
 
 	logger.info("read state file");
+	// state changes are written to the state file at most once a second
+	reactor.addTimer(1.0, []() { cstate.flush(); });
 	// initialize objects that keep data in state file
 	samplePump.initState(); referencePump.initState();
 	reagent1Pump.initState(); reagent2Pump.initState();
 	bool spectrometerStatus = spectrometer.initDevice();
 	spectrometer.initState();
 	scriptInterp.initState();
+	pressureController.initState();
+	hwStatus.init();
 	dataStore.initState();
 	logger.info("initialized stateful objects");
 
@@ -259,7 +337,7 @@ int main(int argc, char* argv[]) {
 	// Attempt to connect to arduino and set flags
 	int i;
 	for (i = 0; i < 10; i++) {
-		if (arduino.start()) break;
+		if (arduino.start(config.getArduinoDevice(), &reactor)) break;
 		arduino.finish();
 		sleep_for(seconds(1));
 	}
@@ -283,32 +361,40 @@ int main(int argc, char* argv[]) {
 	}
 
 	arduino.log();
+	hwStatus.startStreaming();
 
 	powerControl.set(0b00);
 	Operations::idleMode(); // idleMode before power on, ensures that pumps
 			// come up stopped rather than with random pump speed 
 			// from digital pot;
 
+	telemetry.refresh();
+	reactor.addTimer(.25, []() {
+		telemetry.refresh();
+		console.publishSnapshot(*telemetry.snapshot());
+	});
 	consoleInterp.begin(); scriptInterp.begin(); // start other threads
 
 	hwStatus.update();		// get status values from arduino
 	hwStatus.recordDepth();
 
+	statusPeriod = .05;
+	statusTimer = reactor.addTimer(statusPeriod, statusTick);
 	while (true) {
-		double t0 = Util::elapsedTime();
-		hwStatus.update();
-		if (criticalFailure()) {
-			// criticalFailure is false when no arduino or no control board
-			wrapup(true, false);
-		} else if (consoleInterp.zombie()) {
-			logger.debug("main: detected consoleInterp termination");
-			wrapup(false, true);
-		} else if (scriptInterp.zombie()) {
-			logger.debug("main: detected scriptInterp termination");
-			wrapup(false, !arduino.isReady());
+		unique_lock<mutex> lck(mainMtx);
+		mainCond.wait(lck, []{ return statusDue || exitReason != NO_EXIT; });
+		int reason = exitReason;
+		if (reason == NO_EXIT) {
+			statusDue = false; mainBusy = true;
+			lck.unlock();
+			hwStatus.update();		// waits for reply from arduino
+			reason = checkForExit();
+			lck.lock();
+			mainBusy = false;
 		}
-		int interval = (int) (1000 * (Util::elapsedTime() - t0));
-		if (interval < 40)
-			sleep_for(milliseconds(50 - interval));
+		lck.unlock();
+		if (reason == CRITICAL_FAILURE) wrapup(true, false);
+		else if (reason == CONSOLE_QUIT) wrapup(false, true);
+		else if (reason == SCRIPT_DONE) wrapup(false, !arduino.isReady());
 	}
 }
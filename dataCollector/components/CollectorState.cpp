@@ -30,7 +30,7 @@ extern DataStore dataStore;
  *  @param stateFile name of the state file
  */
 CollectorState::CollectorState(const string& stateFile) : stateFile(stateFile) {
-	doneReading = false;
+	doneReading = false; dirty = false;
 
 	cycleNumber = 0;
 
@@ -50,6 +50,13 @@ CollectorState::CollectorState(const string& stateFile) : stateFile(stateFile) {
 
 	integrationTime = -1;
 
+	baselineCount = 0;
+	baseline440 = 0;
+	baseline676 = 0;
+
+	filterResistance = 0;
+	filterResistanceTrend = 0;
+
 	currentIndex = 0;
 	deploymentIndex = 0;
 	spectrumCount = 0;
@@ -119,6 +126,43 @@ bool CollectorState::read() {
 		} else if (words[0] == "integrationTime") {
 			integrationTime = atof(words[2].c_str());
 
+		} else if (words[0] == "baselineCount") {
+			baselineCount = atoi(words[2].c_str());
+		} else if (words[0] == "baseline440") {
+			baseline440 = atof(words[2].c_str());
+		} else if (words[0] == "baseline676") {
+			baseline676 = atof(words[2].c_str());
+		} else if (words[0] == "filterResistance") {
+			filterResistance = atof(words[2].c_str());
+		} else if (words[0] == "filterResistanceTrend") {
+			filterResistanceTrend = atof(words[2].c_str());
+		} else if (words[0] == "flushSignature") {
+			vector<string> values;
+			Util::split(words[2], 1000, values);
+			flushSignature.clear();
+			for (string& v : values)
+				flushSignature.push_back(atof(v.c_str()));
+		} else if (words[0] == "missionState") {
+			// each entry has form name:lastRun:cycles:day:runs:fluid:delay
+			vector<string> entries;
+			Util::split(words[2], 1000, entries);
+			for (string& e : entries) {
+				vector<string> f;
+				size_t i = 0, j;
+				while ((j = e.find(':', i)) != string::npos) {
+					f.push_back(e.substr(i, j-i)); i = j+1;
+				}
+				f.push_back(e.substr(i));
+				if (f.size() != 7) continue;
+				MissionState& ms = missionState[f[0]];
+				ms.lastRun = atol(f[1].c_str());
+				ms.cycleCount = atol(f[2].c_str());
+				ms.day = atol(f[3].c_str());
+				ms.runs = atoi(f[4].c_str());
+				ms.fluid = atof(f[5].c_str());
+				ms.delay = atol(f[6].c_str());
+			}
+
 		} else if (words[0] == "currentIndex") {
 			currentIndex = atoi(words[2].c_str());
 		} else if (words[0] == "deploymentIndex") {
@@ -161,8 +205,19 @@ bool CollectorState::read() {
 // Macro used to format floats in output streams
 #define FLOAT(x,y) fixed << setprecision(y) << x
 
+/** Write the state file, if any variable has changed since the last write.
+ *  @return true on success, false if the file could not be written
+ */
+bool CollectorState::flush() {
+	unique_lock<mutex> lck(cstateMtx);
+	if (!dirty) return true;
+	if (!update()) return false;
+	dirty = false;
+	return true;
+}
+
 /** Save values of internal variables in external state file.
- *  This is only called from setters, so lock is alread engaged.
+ *  This is only called from flush, so lock is alread engaged.
  */
 bool CollectorState::update() {
 	if (not doneReading) return false;
@@ -210,6 +265,35 @@ bool CollectorState::update() {
 
 	ofs << "\n# spectrometer parameters\n";
 	ofs << "integrationTime = " << integrationTime << endl;
+
+	ofs << "\n# adaptive sampling baseline\n";
+	ofs << "baselineCount = " << baselineCount << endl;
+	ofs << "baseline440 = " << FLOAT(baseline440,5) << endl;
+	ofs << "baseline676 = " << FLOAT(baseline676,5) << endl;
+
+	ofs << "\n# filter state\n";
+	ofs << "filterResistance = " << FLOAT(filterResistance,4) << endl;
+	ofs << "filterResistanceTrend = "
+		<< FLOAT(filterResistanceTrend,5) << endl;
+
+	if (flushSignature.size() > 0) {
+		ofs << "\n# normalized waveguide spectrum following flush\n";
+		ofs << "flushSignature =";
+		for (double v : flushSignature) ofs << " " << FLOAT(v,4);
+		ofs << endl;
+	}
+
+	if (missionState.size() > 0) {
+		ofs << "\n# mission scheduling state\n";
+		ofs << "missionState =";
+		for (auto p = missionState.begin(); p != missionState.end(); p++) {
+			MissionState& ms = p->second;
+			ofs << " " << p->first << ":" << ms.lastRun << ":"
+				<< ms.cycleCount << ":" << ms.day << ":" << ms.runs << ":"
+				<< FLOAT(ms.fluid,2) << ":" << ms.delay;
+		}
+		ofs << endl;
+	}
 		
 	ofs << "\n# data store state\n";
 	ofs << "currentIndex = " << currentIndex << endl;
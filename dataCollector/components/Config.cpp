@@ -14,10 +14,9 @@ namespace fizz {
 
 extern Logger logger;
 
-/** Constructor for Config objects.
- *  @param configFile name of the config file
- */
-Config::Config(const string& configFile) : configFile(configFile) {
+/** Constructor for ConfigData objects; sets default values. */
+ConfigData::ConfigData() {
+	hardwareConfig = Config::BASIC;
 	waveguideLength = 0.28; // length in meters
 	location = { 0.0, 0.0 };
 	deploymentLabel = "no label";
@@ -30,22 +29,56 @@ Config::Config(const string& configFile) : configFile(configFile) {
 	logLevelConsole = Logger::DETAILS;
 	logLevelStderr = Logger::INFO;
 	logLevelDebug = Logger::DEBUG;
+	adaptMinPeriod = 0;		// 0 means adaptive sampling is disabled
+	adaptMaxPeriod = 0;
+	adaptThreshold = 0.02;
+	adaptLabel = "unfiltered";
+	flushTolerance = 0.01;
+	pcTarget = 0.5; pcGainP = 0.5; pcGainI = 0.2;
+	statusPeriod = 20;
+	arduinoDevice = "";
+	eventRecords = false;
+}
 
-	doneReading = false;
+/** Constructor for Config objects.
+ *  @param configFile name of the config file
+ */
+Config::Config(const string& configFile) : configFile(configFile) {
+	snapshots.push_back(unique_ptr<const ConfigData>(new ConfigData()));
+	data.store(snapshots.back().get());
+	memset(&fileStat, 0, sizeof(fileStat));
+}
+
+/** Determine if the config file has changed since it was last read.
+ *  @return true if the file's modification time, size or inode differ
+ *  from when it was last read, else false
+ */
+bool Config::changed() {
+	struct stat st;
+	if (stat(configFile.c_str(), &st) < 0) return false;
+	unique_lock<mutex> lck(readMtx);
+	return st.st_mtim.tv_sec != fileStat.st_mtim.tv_sec ||
+		   st.st_mtim.tv_nsec != fileStat.st_mtim.tv_nsec ||
+		   st.st_size != fileStat.st_size || st.st_ino != fileStat.st_ino;
 }
 
 /** Read config file and set internal variables accordingly.
+ *  Values not given in the file keep their current values. The new
+ *  values replace the current ones all at once, when the whole file
+ *  has been read.
  */
 bool Config::read() {
 	logger.debug("Config: reading config file");
-	unique_lock<mutex> lck(cfgMtx);
+	unique_lock<mutex> lck(readMtx);
+	struct stat st;
 	ifstream ifs;
 	ifs.open(configFile, ifstream::in);
-	if (ifs.fail()) {
+	if (ifs.fail() || stat(configFile.c_str(), &st) < 0) {
 		lck.unlock();
 		logger.error("cannot open config file\n");
 		return false;
 	}
+	unique_ptr<ConfigData> d(new ConfigData(*current()));
 	string cfgStr;
 	queue<string> errors;
 	while (!ifs.eof()) {
@@ -67,48 +100,93 @@ bool Config::read() {
 		}
 		
 		if (words[0] == "autoRun") {
-			autoRun = atoi(words[2].c_str());
+			d->autoRun = atoi(words[2].c_str());
 		} else if (words[0] == "hardwareConfig") {
 			if (words[2] == "BASIC") {
-				hardwareConfig = BASIC;
+				d->hardwareConfig = BASIC;
 			} else if (words[2] == "TWO_REAGENTS") {
-				hardwareConfig = TWO_REAGENTS;
+				d->hardwareConfig = TWO_REAGENTS;
 			} else {
 				errors.push("invalid hardwareConfig: " + words[2]);
 			}
 		} else if (words[0] == "waveguideLength") {
-			waveguideLength = atof(words[2].c_str());
+			d->waveguideLength = atof(words[2].c_str());
 		} else if (words[0] == "maxFilterPressure") {
-			maxPressure = atof(words[2].c_str());
+			d->maxPressure = atof(words[2].c_str());
 		} else if (words[0] == "maxDepth") {
-			maxDepth = atof(words[2].c_str());
+			d->maxDepth = atof(words[2].c_str());
 		} else if (words[0] == "gpsCoordinates" || words[0] == "location") {
-			location.fromString(words[2]);
+			d->location.fromString(words[2]);
 		} else if (words[0] == "deploymentLabel") {
-			deploymentLabel.assign(words[2]);
+			d->deploymentLabel.assign(words[2]);
 		} else if (words[0] == "powerSave") {
-			powerSave = (words[2] == "1");
+			d->powerSave = (words[2] == "1");
 		} else if (words[0] == "portSwitching") {
-			portSwitching = (words[2] == "1");
+			d->portSwitching = (words[2] == "1");
 		} else if (words[0] == "ignoreFailures") {
-			ignoreFailures = (words[2] == "1");
+			d->ignoreFailures = (words[2] == "1");
 		} else if (words[0] == "logLevel") {
 			vector<string> subwords(3);
 			Util::split(words[2], 3, subwords);
 			if (subwords.size() >= 1)
-				logLevelConsole = logger.string2logLevel(subwords[0]);
+				d->logLevelConsole = logger.string2logLevel(subwords[0]);
 			if (subwords.size() >= 2)
-				logLevelStderr = logger.string2logLevel(subwords[1]);
+				d->logLevelStderr = logger.string2logLevel(subwords[1]);
 			if (subwords.size() >= 3)
-				logLevelDebug = logger.string2logLevel(subwords[2]);
+				d->logLevelDebug = logger.string2logLevel(subwords[2]);
+		} else if (words[0] == "pressureControl") {
+			vector<string> subwords(3);
+			Util::split(words[2], 3, subwords);
+			if (subwords.size() >= 1)
+				d->pcTarget = atof(subwords[0].c_str());
+			if (subwords.size() >= 2) d->pcGainP = atof(subwords[1].c_str());
+			if (subwords.size() >= 3) d->pcGainI = atof(subwords[2].c_str());
+			if (d->pcTarget <= 0 || d->pcTarget >= 1 ||
+				d->pcGainP < 0 || d->pcGainI <= 0) {
+				errors.push("invalid pressureControl: " + words[2]);
+				d->pcTarget = 0.5; d->pcGainP = 0.5; d->pcGainI = 0.2;
+			}
+		} else if (words[0] == "arduinoDevice") {
+			d->arduinoDevice.assign(words[2]);
+		} else if (words[0] == "debugRecords") {
+			if (words[2] == "text") d->eventRecords = false;
+			else if (words[2] == "events") d->eventRecords = true;
+			else errors.push("invalid debugRecords: " + words[2]);
+		} else if (words[0] == "statusPeriod") {
+			d->statusPeriod = atoi(words[2].c_str());
+			if (d->statusPeriod < 0) {
+				errors.push("invalid statusPeriod: " + words[2]);
+				d->statusPeriod = 20;
+			}
+		} else if (words[0] == "flushTolerance") {
+			d->flushTolerance = atof(words[2].c_str());
+		} else if (words[0] == "adaptiveSampling") {
+			vector<string> subwords(4);
+			Util::split(words[2], 4, subwords);
+			if (subwords.size() < 3) {
+				errors.push("invalid adaptiveSampling: " + words[2]);
+				continue;
+			}
+			d->adaptMinPeriod = atol(subwords[0].c_str());
+			d->adaptMaxPeriod = atol(subwords[1].c_str());
+			d->adaptThreshold = atof(subwords[2].c_str());
+			if (subwords.size() >= 4) d->adaptLabel = subwords[3];
+			if (d->adaptMinPeriod < 0 ||
+				d->adaptMaxPeriod < d->adaptMinPeriod ||
+				d->adaptThreshold <= 0) {
+				errors.push("invalid adaptiveSampling: " + words[2]);
+				d->adaptMinPeriod = d->adaptMaxPeriod = 0;
+			}
 		} else {
 			errors.push("invalid line in config file: " + line);
 			continue;
 		}
 	}
 	ifs.close();
-	doneReading = true;
-	configString.assign(cfgStr);
+	d->configString.assign(cfgStr);
+	snapshots.push_back(move(d));
+	data.store(snapshots.back().get(), memory_order_release);
+	fileStat = st;
 	lck.unlock();
 	// delay error messages until lock is released
 	while (!errors.empty()) {
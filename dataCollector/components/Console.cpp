@@ -10,20 +10,60 @@ using namespace std;
 
 namespace fizz {
 
+extern Logger logger;
+
+namespace {
+
+/** Split a flat JSON object into its fields.
+ *  @param json is a JSON object whose values are strings or numbers
+ *  @param fields is used to return (name, value) pairs, in order;
+ *  string values are returned with their quotes
+ */
+void splitFields(const string& json, vector<pair<string,string>>& fields) {
+	fields.clear();
+	string::size_type i = json.find('{');
+	while (i != string::npos) {
+		string::size_type k0 = json.find('"', i);
+		if (k0 == string::npos) return;
+		string::size_type k1 = json.find('"', k0 + 1);
+		string::size_type c = json.find(':', k1);
+		if (k1 == string::npos || c == string::npos) return;
+		string::size_type v0 = json.find_first_not_of(" ", c + 1);
+		if (v0 == string::npos) return;
+		string::size_type v1 = v0;
+		if (json[v0] == '"') {
+			for (v1 = v0 + 1; v1 < json.length() && json[v1] != '"'; v1++)
+				if (json[v1] == '\\') v1++;
+			v1++;
+		} else {
+			v1 = json.find_first_of(",}", v0);
+			if (v1 == string::npos) v1 = json.length();
+		}
+		string value = json.substr(v0, v1 - v0);
+		value.erase(value.find_last_not_of(" ") + 1);
+		fields.push_back(make_pair(json.substr(k0 + 1, k1 - k0 - 1), value));
+		i = json.find(',', v1);
+	}
+}
+
+}
+
 /** Constructor for Console object.
  *  @param logLevel is the logging level used for reporting log messages.
  */
 Console::Console() {
 	this->serverAddr = serverAddr;
-	connected = false;
+	reactor = 0; nextId = 1; current = 0; wakeFlag = false;
+	wakeups.store(0);
 }
 
 /** Open server socket.
  *  @param ipAddress is the address to be used for the listening socket.
  *  @param portNum is the port number to be used.
+ *  @param r is a running Reactor used to watch the console sockets
  *  @return true on success, false on failure.
  */
-bool Console::open(const string& ipAddress, int portNum) {
+bool Console::open(const string& ipAddress, int portNum, Reactor& r) {
 	unique_lock<mutex> consoleLock(consoleMtx);
 
 	serverAddr = SocketAddress(ipAddress, portNum);
@@ -33,75 +73,345 @@ bool Console::open(const string& ipAddress, int portNum) {
 		     << ")\n";
 		return false;
 	}
+	reactor = &r;
+	if (!reactor->addFd(serverSock.getSocketNumber(), EPOLLIN,
+						[this](uint32_t) { acceptReady(); })) {
+		cerr << "Console::open: cannot watch listening socket\n";
+		return false;
+	}
 	return true;
 }
 
-/** Close the console socket. */
+/** Close all console connections. */
 void Console::close() {
+	if (reactor == 0) return;
+	reactor->call([this]() {
+		vector<int> ids;
+		{
+			unique_lock<mutex> consoleLock(consoleMtx);
+			for (auto& p : clients) ids.push_back(p.second->id);
+		}
+		for (int id : ids) disconnect(id, "console closed");
+	});
+}
+
+/** Close the connection to the client that sent the last line. */
+void Console::closeCurrent() {
+	if (reactor == 0) return;
+	int id;
+	{
+		unique_lock<mutex> consoleLock(consoleMtx);
+		id = current;
+	}
+	reactor->call([this, id]() { disconnect(id, "closed on request"); });
+}
+
+/** Determine if any client is connected. */
+bool Console::isConnected() {
+	unique_lock<mutex> consoleLock(consoleMtx);
+	return !clients.empty();
+}
+
+/** Find a client.
+ *  @param id is the identifier of a client
+ *  @return a pointer to the client, or null if it is no longer connected;
+ *  the caller must hold consoleMtx
+ */
+Console::Client* Console::findClient(int id) {
+	for (auto& p : clients)
+		if (p.second->id == id) return p.second.get();
+	return 0;
+}
+
+/** Close a client connection. Runs in the reactor's loop thread.
+ *  @param id is the identifier of the client; if it has already been
+ *  disconnected, nothing is done
+ *  @param reason is the reason for closing, which is logged
+ */
+void Console::disconnect(int id, const string& reason) {
+	unique_lock<mutex> consoleLock(consoleMtx);
+	auto p = clients.begin();
+	while (p != clients.end() && p->second->id != id) p++;
+	if (p == clients.end()) return;
+	string peer = p->second->addr.toString();
+	reactor->removeFd(p->first);
+	clients.erase(p);		// closes the socket
+	consoleLock.unlock();
+	logger.info("Console: closed connection from %s: %s",
+				peer.c_str(), reason.c_str());
+}
+
+/** Accept an incoming connection request from a remote console.
+ *  Runs in the reactor's loop thread.
+ */
+void Console::acceptReady() {
+	unique_ptr<Client> c(new Client());
+	int status = serverSock.accept(c->sock, c->addr);
+	if (status == -1) return;
+	if (status < 0) {
+		LOG_TRACE("Console: socket error while accepting connection");
+		return;
+	}
+	if (!c->sock.nonblock()) return;
+	int fd = c->sock.getSocketNumber();
+	string peer = c->addr.toString();
+
+	unique_lock<mutex> consoleLock(consoleMtx);
+	if ((int) clients.size() >= MAXCLIENTS) {
+		consoleLock.unlock();
+		logger.warning("Console: refused connection from %s, too many "
+					   "clients", peer.c_str());
+		return;
+	}
+	c->id = nextId++; c->closing = false; c->snapDue = 0;
+	Subscription log = { 0, 1, Util::elapsedTime(), 0 };
+	c->subs["log"] = log;
+	clients[fd] = move(c);
+	if (!reactor->addFd(fd, EPOLLIN, [this, fd](uint32_t events) {
+							clientReady(fd, events); })) {
+		clients.erase(fd);
+		cerr << "Console::acceptReady: cannot watch connection\n";
+		return;
+	}
+	cerr << "Console: accepted connection from " << peer << endl;
+}
+
+/** Handle input and output for a client. Runs in the reactor's loop thread.
+ *  Complete input lines are queued for nextLine and queued output
+ *  is sent when the socket can accept it.
+ *  @param fd is the socket number of the connection
+ *  @param events is the set of epoll events that occurred
+ */
+void Console::clientReady(int fd, uint32_t events) {
+	unique_lock<mutex> consoleLock(consoleMtx);
+	auto p = clients.find(fd);
+	if (p == clients.end()) return;
+	Client& c = *p->second;
+	int id = c.id;
+	if (events & EPOLLOUT) output(c, "");
+	string reason;
+	while (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		string line;
+		int status = c.sock.readline(line, 1024);
+			// long lines are discarded to block buffer-overflow attack
+		if (status == -1) break;	// no complete line available yet
+		if (status <= 0) { reason = "lost connection to peer"; break; }
+		lines.push_back(make_pair(c.id, line));
+		lineCond.notify_one();
+	}
+	consoleLock.unlock();
+	if (reason.length() > 0) disconnect(id, reason);
+}
+
+/** Queue output for a client and send as much as the socket will take.
+ *  The caller must hold consoleMtx. If more than MAXQUEUE bytes would
+ *  be left waiting, the client is disconnected rather than blocking
+ *  the caller.
+ *  @param c is the client
+ *  @param s is the string to be sent
+ */
+void Console::output(Client& c, const string& s) {
+	if (c.closing) return;
+	int fd = c.sock.getSocketNumber(); int id = c.id;
+	if (c.outq.length() + s.length() > MAXQUEUE) {
+		c.closing = true;
+		reactor->post([this, id]() { disconnect(id, "client too slow"); });
+		return;
+	}
+	bool waiting = !c.outq.empty();
+	c.outq += s;
+	while (!c.outq.empty()) {
+		ssize_t n = ::send(fd, c.outq.data(), c.outq.length(),
+						   MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n > 0) { c.outq.erase(0, n); continue; }
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		c.closing = true;
+		reactor->post([this, id]() { disconnect(id, "write error"); });
+		return;
+	}
+	// watch for the socket becoming writable only while output waits
+	if (waiting != !c.outq.empty())
+		reactor->modifyFd(fd, c.outq.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT);
+}
+
+/** Get the next line of console input.
+ *  Returns when a line is available, wakeup is called or the timeout
+ *  expires. Subsequent replies go to the client that sent the line.
+ *  @param line is used to return the line
+ *  @param timeout is the maximum time to wait in ms
+ *  @return true if a line was returned, else false
+ */
+bool Console::nextLine(string& line, int timeout) {
+	unique_lock<mutex> consoleLock(consoleMtx);
+	lineCond.wait_for(consoleLock, milliseconds(timeout),
+					  [this]{ return !lines.empty() || wakeFlag; });
+	wakeups++; wakeFlag = false;
+	if (lines.empty()) return false;
+	current = lines.front().first; line = lines.front().second;
+	lines.pop_front();
+	return true;
+}
+
+/** Wake a thread waiting in nextLine(). */
+void Console::wakeup() {
+	unique_lock<mutex> consoleLock(consoleMtx);
+	wakeFlag = true;
+	lineCond.notify_all();
+}
+
+/** Subscribe the client that sent the last line to a topic.
+ *  @param topic is one of "log", "snapshot", "cycle", "spectrum" or
+ *  "summary"
+ *  @param rate is the maximum number of messages per second; messages
+ *  beyond this are dropped, and the number dropped is reported in a
+ *  "!dropped topic count" line; zero means no limit, and a negative
+ *  value selects the default (2 for snapshot, else no limit); the
+ *  snapshot is refreshed four times a second, which limits its rate
+ *  @return true on success, false if the topic is not valid or the
+ *  client has disconnected
+ */
+bool Console::subscribe(const string& topic, double rate) {
+	if (topic != "log" && topic != "snapshot" && topic != "cycle" &&
+		topic != "spectrum" && topic != "summary")
+		return false;
+	if (rate < 0) rate = (topic == "snapshot" ? 2 : 0);
+	if (topic == "snapshot" && rate == 0) rate = 10;
+	unique_lock<mutex> consoleLock(consoleMtx);
+	Client* c = findClient(current);
+	if (c == 0) return false;
+	double now = Util::elapsedTime();
+	Subscription sub = { rate, max(1., rate), now, 0 };
+	c->subs[topic] = sub;
+	if (topic == "snapshot") {
+		c->snapDue = now; c->snap.clear();	// next one is complete
+	}
+	return true;
+}
+
+/** Cancel a subscription for the client that sent the last line.
+ *  @param topic is the topic
+ *  @return true if the client was subscribed to topic, else false
+ */
+bool Console::unsubscribe(const string& topic) {
 	unique_lock<mutex> consoleLock(consoleMtx);
-	connSock.close();
-	connected = false;
+	Client* c = findClient(current);
+	return c != 0 && c->subs.erase(topic) > 0;
 }
 
-/** Check for connection from remote console and if incoming request
- *  has come in, accept it.
- *  @return -1 if no incoming connection request is available, -2 if there
- *  is an error on the socket; otherwise, return 1.
+/** Send snapshot changes to clients that are due for them.
+ *  Each client is sent the fields that have changed since the last
+ *  snapshot it was sent, in a "!snapshot {...}" line. Called from the
+ *  reactor each time the snapshot is refreshed, so pushes continue
+ *  while the console interpreter is busy with a long command.
+ *  @param json is the current snapshot, as a flat JSON object
  */
-int Console::accept() {
+void Console::publishSnapshot(const string& json) {
+	vector<pair<string,string>> fields;
+	splitFields(json, fields);
 	unique_lock<mutex> consoleLock(consoleMtx);
-	if (connected) {
-		cerr << "Console:accept: accept invalid when connection "
-			"already active\n";
-		return -2;
+	double now = Util::elapsedTime();
+	for (auto& p : clients) {
+		Client& c = *p.second;
+		auto sp = c.subs.find("snapshot");
+		if (sp == c.subs.end() || c.snapDue > now) continue;
+		c.snapDue = now + 1/sp->second.rate;
+		string delta;
+		for (auto& f : fields) {
+			string& last = c.snap[f.first];
+			if (last == f.second) continue;
+			last = f.second;
+			delta += (delta.length() == 0 ? "" : ", ");
+			delta += "\"" + f.first + "\": " + f.second;
+		}
+		if (delta.length() > 0) output(c, "!snapshot {" + delta + "}\n");
 	}
-	int status = serverSock.accept(connSock, clientAddr);
-	if (status < 0) return status;
-	if (!connSock.nonblock()) return -2;
-	connected = true;
-	cerr << "Console: accepted connection from "
-	     << clientAddr.toString() << endl;
-	return 1;
-}
-
-/** Read a line from the socket (if connected).
- *  @param line is a string in which line of input is returned.
- *  @return 0 if connection has been closed by peer, -1 connection remains
- *  open but no complete line is available yet, -2 if an error has occurred
- *  on the socket; otherwise return the length of the line returned.
- */
-int Console::readline(string& line) {
+}
+
+/** Send a message to the clients subscribed to a topic.
+ *  @param topic is the topic (e.g. "cycle")
+ *  @param s is the message, which is sent as "!topic s"
+ *  @param data is binary data sent after the message line
+ *  @return the number of clients subscribed to topic
+ */
+int Console::publish(const string& topic, const string& s,
+					 const string& data) {
 	unique_lock<mutex> consoleLock(consoleMtx);
-	if (!connected) return -2;
-	int status = connSock.readline(line, 1024);
-		// long lines are discarded to block buffer-overflow attack
-	if (status == 0 || status == -2) connected = false;
-	return status;
+	double now = Util::elapsedTime(); int count = 0;
+	for (auto& p : clients) {
+		Client& c = *p.second;
+		auto sp = c.subs.find(topic);
+		if (sp == c.subs.end()) continue;
+		count++;
+		if (!admit(sp->second, now)) continue;
+		reportDrops(c, topic, sp->second);
+		output(c, "!" + topic + " " + s + "\n" + data);
+	}
+	return count;
 }
 
-/** Write a log message to the console.;
+/** Send a message with binary data to the client that sent the last line.
+ *  @param topic is the topic
+ *  @param s is the message, which is sent as "!topic s"
+ *  @param data is binary data sent after the message line
+ */
+void Console::sendFrame(const string& topic, const string& s,
+						const string& data) {
+	unique_lock<mutex> consoleLock(consoleMtx);
+	Client* c = findClient(current);
+	if (c != 0) output(*c, "!" + topic + " " + s + "\n" + data);
+}
+
+/** Apply the rate limit of a subscription to one message.
+ *  @param sub is the subscription
+ *  @param now is the current time
+ *  @return true if the message may be sent, false if it is to be dropped
+ */
+bool Console::admit(Subscription& sub, double now) {
+	if (sub.rate <= 0) return true;
+	sub.tokens = min(max(1., sub.rate),
+					 sub.tokens + (now - sub.last) * sub.rate);
+	sub.last = now;
+	if (sub.tokens >= 1) { sub.tokens -= 1; return true; }
+	sub.dropped++;
+	return false;
+}
+
+/** Tell a client how many messages were dropped for a subscription. */
+void Console::reportDrops(Client& c, const string& topic, Subscription& sub) {
+	if (sub.dropped == 0) return;
+	output(c, "!dropped " + topic + " " + to_string(sub.dropped) + "\n");
+	sub.dropped = 0;
+}
+
+/** Write a log message to the clients subscribed to log messages.
  *  @param s is message to be written
  *  @param level is the log level for this method; the message should
  *  be written if level exceeds the threshold for this LogTarget.
  */
 void Console::logMessage(const string& s, int level) {
+	if (level < this->logLevel) return;
 	unique_lock<mutex> consoleLock(consoleMtx);
-	if (!connected || level < this->logLevel) return;
-	if (connSock.write(s) < 0) {
-		connected = false;
+	double now = Util::elapsedTime();
+	for (auto& p : clients) {
+		Client& c = *p.second;
+		auto sp = c.subs.find("log");
+		if (sp == c.subs.end() || !admit(sp->second, now)) continue;
+		reportDrops(c, "log", sp->second);
+		output(c, s);
 	}
 }
 
-/** Send a reply to the console.;
+/** Send a reply to the client that sent the last line.
  *  @param s is string to be written
  */
 void Console::reply(const string& s) {
+	logger.flush();		// so reply follows messages logged by command
 	unique_lock<mutex> consoleLock(consoleMtx);
-	if (connected) {
-		if (connSock.write("|" + s + "\n") < 0) {
-			connected = false;
-		}
-	} else {
+	Client* c = findClient(current);
+	if (c != 0) {
+		output(*c, "|" + s + "\n");
+	} else if (clients.empty()) {
 		cout << s << endl;
 			// this is mostly useful when first starting up,;
 			// allows messages to reach user before console has;
@@ -31,6 +31,7 @@
 #include "ScriptInterp.h"
 #include "Operations.h"
 #include "Interrupt.h"
+#include "Telemetry.h"
 
 namespace fizz {
 
@@ -58,6 +59,8 @@ extern Console console;
 extern ScriptInterp scriptInterp;
 extern DataStore dataStore;
 extern Interrupt interrupt;
+extern Reactor reactor;
+extern Telemetry telemetry;
 
 extern string serialNumber;
 extern string versionNumber;
@@ -70,6 +73,7 @@ using this_thread::sleep_for;
  */
 ConsoleInterp::ConsoleInterp() {
 	scriptPath = "script";
+	previewOn.store(false); frameSeq.store(0);
 }
 
 void consoleIntHandler() {}
@@ -89,10 +93,13 @@ void ConsoleInterp::end() {
 	unique_lock<mutex> lck(mtx);
 	logger.details("ConsoleInterp: terminating thread");
 	quitFlag = true; interrupt.request(thread_id, true);
+	quitCond.notify_one(); console.wakeup();
+	previewOn.store(false); previewCond.notify_all();
 }
 
 void ConsoleInterp::join() {
 	if (myThread.joinable()) myThread.join();
+	if (previewThread.joinable()) previewThread.join();
 }
 
 
@@ -117,13 +124,13 @@ bool ConsoleInterp::readScript() {
  */
 void ConsoleInterp::reply(const string& s) {
 	console.reply(s);
-	logger.debug(("sending reply: " + s).c_str());
+	LOG_DEBUG("sending reply: %s", s.c_str());
 }
 
 /** This method implements the main loop between
  *  the PSS1 process and a separate console program.
- *  The console may connect/disconnect multiple times,
- *  but we only support one connection at a time.
+ *  Consoles may connect/disconnect multiple times,
+ *  and several may be connected at once.
  *
  *  This method processes command lines received from a remote
  *  console. It parses the command line, checks for valid
@@ -144,9 +151,18 @@ void ConsoleInterp::run() {
 
 	while (!quitFlag) {
 		if (zombieFlag) {
-			sleep_for(milliseconds(50)); continue;
+			// wait for main thread to end this thread
+			unique_lock<mutex> lck(mtx);
+			quitCond.wait(lck, [this]{ return quitFlag; });
+			continue;
 		}
 
+		// console waits end early when input arrives or end() is called
+		int timeout = 10000;
+		if (autoRunFlag)
+			timeout = max(0, min(timeout,
+					(int) (1000 * (deadline - Util::elapsedTime())) + 1));
+
 		if (autoRunFlag && Util::elapsedTime() > deadline) {
 			if (!readScript()) {
 				logger.error("script error, try again");
@@ -160,34 +176,9 @@ void ConsoleInterp::run() {
 			}
 		}
 
-		if (!console.isConnected()) {
-			logger.trace("console disconnected, attempting to reconnect");
-			int status = console.accept();
-			if (status == -1) {
-				sleep_for(milliseconds(50)); continue;
-			} else if (status < 0) {
-				cerr << "ConsoleInterp: error during accept\n";
-				logger.trace("consoleInterp: socket error "
-						 	 "while accepting connection");
-				sleep_for(milliseconds(50)); continue;
-			}
-		}
-
-		// connected, so read line from the console
+		// get next line from the console, if one arrives in time
 		string line;
-		int status = console.readline(line);
-		if (status == 0) {
-			logger.error("ConsoleInterp: lost connection to peer, "
-						 "will try to reconnect");
-			continue;
-		} else if (status == -1) {
-		 	sleep_for(milliseconds(50)); continue;
-				// no complete line available yet
-		} else if (status < 0) {
-			cerr << "ConsoleInterp: error during readline\n";
-			logger.error("ConsoleInterp: error while reading from socket");
-			break;
-		}
+		if (!console.nextLine(line, timeout)) continue;
 
 		// and process line
 		if (line.length() == 0) continue;
@@ -202,7 +193,7 @@ void ConsoleInterp::run() {
 		} else if (words[0] == "close") {
 			logger.details("received close command");
 			reply("closing console connection");
-			console.close();
+			console.closeCurrent();
 		} else {
 			if (words[0] != "snapshot") {
 				logger.debug("received command: %s", line.c_str());
@@ -251,6 +242,10 @@ void ConsoleInterp::run() {
  *  spectrometer b			turn spectrometer on/off
  *  integrationTime [time] 	get/set integration time
  *  spectrum [bbb]			read spectrum
+ *  spectrumFrame [bbb [n]]	read spectrum and send it as a binary frame
+ *							with n values (default all)
+ *  preview (on [fps [n]]|off)	start/stop sending single-scan frames
+ *							of n values to spectrum subscribers
  *
  *  power (on|off|bb)  		turn power on/off
  *  pressure 		 		read the pressure sensors
@@ -259,6 +254,12 @@ void ConsoleInterp::run() {
  *  versionNumber 	  		get software version number
  *  logLevel levelName		get/set log level
  *  cycleNumber 			get cycleNumber
+ *  linkStats [clear]		get/reset arduino reply latency statistics
+ *  loopStats [clear]		get/reset event loop latency statistics
+ *  subscribe topic [rate]	push log, snapshot, cycle, spectrum or summary
+ *							messages to this client, at most rate per second
+ *  unsubscribe topic		stop pushing topic to this client
+ *  wakeups					get wakeups of paused and console threads
  *  reload file				re-read script or config
  */
 void ConsoleInterp::doCommand(vector<string>& words) {
@@ -367,6 +368,26 @@ void ConsoleInterp::doCommand(vector<string>& words) {
 			s += buf;
 		}
 		reply("[" + s + "]");
+	} else if (words[0] == "spectrumFrame") {
+		if (powerControl.get() != 0b11) powerControl.on();
+		int lconfig = spectrometer.getLights();
+		if (words.size() > 1) {
+			if (words[1].length() < 3) {
+				reply("usage: spectrumFrame [ bbb [ pixels ] ]");
+				return;
+			}
+			lconfig = Util::string2bits(words[1]);
+		}
+		int pixels = (words.size() > 2 ? atoi(words[2].c_str()) :
+										 Spectrometer::SPECTRUM_SIZE);
+		spectrometer.getSpectrum(lconfig);
+		interrupt.check();
+		string header, data;
+		spectrumFrame(spectrometer.spectrum, pixels, false, header, data);
+		console.sendFrame("spectrum", header, data);
+		reply("sent spectrum frame");
+	} else if (words[0] == "preview") {
+		preview(words);
 	} else if (words[0] == "power") { 
 		if (words.size() == 1) {
 			reply("power is " + Util::bits2string(powerControl.get(), 2));
@@ -436,6 +457,41 @@ void ConsoleInterp::doCommand(vector<string>& words) {
 		snapshot(words);
 	} else if (words[0] == "cycleNumber") {
 		reply("cycleNumber is " + to_string(scriptInterp.getCycleNumber()));
+	} else if (words[0] == "wakeups") {
+		// counts, and rates since the previous query
+		static double t0 = 0; static uint64_t i0 = 0, c0 = 0;
+		double now = Util::elapsedTime();
+		uint64_t i1 = interrupt.getWakeups(), c1 = console.getWakeups();
+		char buf[200];
+		snprintf(buf, sizeof(buf), "wakeups: interrupt=%llu (%.2f/s) "
+				 "console=%llu (%.2f/s)", (unsigned long long) i1,
+				 (i1 - i0) / (now - t0), (unsigned long long) c1,
+				 (c1 - c0) / (now - t0));
+		t0 = now; i0 = i1; c0 = c1;
+		reply(buf);
+	} else if (words[0] == "linkStats") {
+		if (words.size() == 2 && words[1] == "clear") {
+			arduino.clearStats(); reply("cleared link statistics");
+		} else {
+			reply(arduino.linkStats());
+		}
+	} else if (words[0] == "subscribe" && words.size() >= 2) {
+		double rate = (words.size() > 2 ? atof(words[2].c_str()) : -1);
+		if (console.subscribe(words[1], rate))
+			reply("subscribed to " + words[1]);
+		else
+			reply("invalid subscription topic " + words[1]);
+	} else if (words[0] == "unsubscribe" && words.size() >= 2) {
+		if (console.unsubscribe(words[1]))
+			reply("unsubscribed from " + words[1]);
+		else
+			reply("not subscribed to " + words[1]);
+	} else if (words[0] == "loopStats") {
+		if (words.size() == 2 && words[1] == "clear") {
+			reactor.clearStats(); reply("cleared loop statistics");
+		} else {
+			reply(reactor.stats());
+		}
 	} else if (words[0] == "optimizeConcentration") { 
 		double filtVol = 10 * .35;  // filter volume is .35 ml
 		double filtRate = 1;	// 3.5 minutes for filtered sample
@@ -520,56 +576,142 @@ void ConsoleInterp::doCommand(vector<string>& words) {
 	}
 }
 
+/** Start or stop the live spectrum preview.
+ *  While the preview is on, a separate thread reads single scans from
+ *  the spectrometer and sends them as frames to clients subscribed to
+ *  "spectrum", at a capped frame rate. The client that turns it on is
+ *  subscribed. The preview stops when it is turned off, when no client
+ *  is subscribed or when automated sampling is enabled.
+ */
+void ConsoleInterp::preview(vector<string>& words) {
+	if (words.size() >= 2 && words[1] == "off") {
+		stopPreview();
+		reply("preview off");
+	} else if (words.size() >= 2 && words[1] == "on") {
+		if (scriptInterp.samplingEnabled()) {
+			reply("cannot perform this operation while "
+				  "automated sampling is enabled");
+			return;
+		}
+		stopPreview();
+		if (powerControl.get() != 0b11) powerControl.on();
+		double fps = (words.size() > 2 ? atof(words[2].c_str()) : 5);
+		previewFps = max(.1, min((double) MAXFPS, fps));
+		previewPixels = (words.size() > 3 ? atoi(words[3].c_str()) :
+											Spectrometer::SPECTRUM_SIZE);
+		console.subscribe("spectrum", 0);
+		previewOn.store(true);
+		previewThread = thread(&ConsoleInterp::startPreview, ref(*this));
+		char buf[100];
+		snprintf(buf, sizeof(buf), "preview on at %.1f frames per second",
+				 previewFps);
+		reply(buf);
+	} else {
+		reply("usage: preview (on [fps [pixels]]|off)");
+	}
+}
+
+void ConsoleInterp::startPreview(ConsoleInterp& ci) { ci.previewLoop(); }
+
+/** Stop the preview thread, if it is running. */
+void ConsoleInterp::stopPreview() {
+	{
+		unique_lock<mutex> lck(mtx);
+		previewOn.store(false); previewCond.notify_all();
+	}
+	if (previewThread.joinable()) previewThread.join();
+}
+
+/** Main loop of the preview thread. */
+void ConsoleInterp::previewLoop() {
+	vector<double> spect; string header, data;
+	while (previewOn.load()) {
+		double t0 = Util::elapsedTime();
+		if (scriptInterp.samplingEnabled()) {
+			logger.info("ConsoleInterp: preview stopped for sampling");
+			break;
+		}
+		if (!spectrometer.getPreview(spect)) {
+			logger.warning("ConsoleInterp: preview stopped, cannot "
+						   "read spectrometer");
+			break;
+		}
+		spectrumFrame(spect, previewPixels, true, header, data);
+		if (console.publish("spectrum", header, data) == 0) break;
+
+		// cap the frame rate
+		double wait = 1/previewFps - (Util::elapsedTime() - t0);
+		if (wait <= 0) continue;
+		unique_lock<mutex> lck(mtx);
+		previewCond.wait_for(lck, milliseconds((int) (1000 * wait)),
+							 [this]{ return !previewOn.load(); });
+	}
+	previewOn.store(false);
+}
+
+/** Build a spectrum frame.
+ *  A frame consists of a JSON header followed by binary data: the
+ *  wavelengths, then the values, as little-endian 32 bit floats; if
+ *  the spectrum is downsampled, these are followed by the minimum and
+ *  maximum value in each bin.
+ *  @param spect is a spectrum
+ *  @param pixels is the number of values to be sent; if less than the
+ *  size of spect, consecutive pixels are combined into bins, each
+ *  represented by its mean wavelength and mean value
+ *  @param isPreview is true for a single-scan preview frame
+ *  @param header is used to return the frame header
+ *  @param data is used to return the binary data
+ */
+void ConsoleInterp::spectrumFrame(const vector<double>& spect, int pixels,
+								  bool isPreview, string& header,
+								  string& data) {
+	int n = min(spect.size(), spectrometer.wavelengths.size());
+	pixels = max(1, min(n, pixels));
+	bool envelope = (pixels < n);
+	vector<float> wave(pixels), value(pixels), lo(pixels), hi(pixels);
+	for (int b = 0; b < pixels; b++) {
+		int i0 = (int) ((long) b * n / pixels);
+		int i1 = (int) ((long) (b + 1) * n / pixels);
+		double wsum = 0, vsum = 0;
+		double vmin = spect[i0], vmax = spect[i0];
+		for (int i = i0; i < i1; i++) {
+			wsum += spectrometer.wavelengths[i]; vsum += spect[i];
+			vmin = min(vmin, spect[i]); vmax = max(vmax, spect[i]);
+		}
+		wave[b] = wsum / (i1 - i0); value[b] = vsum / (i1 - i0);
+		lo[b] = vmin; hi[b] = vmax;
+	}
+	data.clear();
+	data.append((const char*) wave.data(), pixels * sizeof(float));
+	data.append((const char*) value.data(), pixels * sizeof(float));
+	if (envelope) {
+		data.append((const char*) lo.data(), pixels * sizeof(float));
+		data.append((const char*) hi.data(), pixels * sizeof(float));
+	}
+
+	char buf[300];
+	snprintf(buf, sizeof(buf), "{\"seq\": %u, \"time\": %.3f, "
+		"\"preview\": %d, \"lights\": \"%s\", \"integrationTime\": %.2f, "
+		"\"pixels\": %d, \"envelope\": %d, \"bytes\": %d}",
+		(unsigned) frameSeq++, Util::elapsedTime(), isPreview ? 1 : 0,
+		Util::bits2string(spectrometer.getLights(), 3).c_str(),
+		spectrometer.getIntTime(), pixels, envelope ? 1 : 0,
+		(int) data.length());
+	header = buf;
+}
+
 /** Generate a snapshot of the system"s state.
  *
  *  Creates a dictionary containing the state, and sends
  *  a json repreresentation to console.
  */
 void ConsoleInterp::snapshot(vector<string>& words) {
-	char buf[2000];
-
-	snprintf(buf, sizeof(buf), "snapshot reply {"
-		"\"dateTime\": \"%s\", \"cycleNumber\": %ld, "
-		"\"currentLine\": %d, "
-		"\"samplingEnabled\": %d, \"hardwareConfig\": \"%s\", "
-		"\"samplePump\": %.2f, "
-		"\"referencePump\": %.2f, "
-		"\"reagent1Pump\": %.2f, "
-		"\"reagent2Pump\": %.2f, "
-		"\"referenceSupply\": %d, \"reagent1Supply\": %d, "
-		"\"reagent2Supply\": %d, "
-		"\"filterValve\": %d, \"mixValves\": \"%s\", \"portValve\": %d, "
-		"\"lights\": \"%s\", \"spectrometer\": %d, "
-		"\"power\": \"%s\", \"integrationTime\": %.1f, "
-		"\"filterPressure\": %.2f, \"maxPressure\": %.2f, "
-		"\"temperature\": %.1f, \"batteryVoltage\": %.1f, "
-		"\"depth\": %.2f, \"leak\": %d, \"location\": \"%s\"," 
-		"\"serialNumber\": \"%s\", \"deploymentLabel\": \"%s\"," 
-		"\"versionNumber\": \"%s\", \"logLevel\": \"%s\"}",
-
-		hwStatus.dateTimeString().c_str(), scriptInterp.getCycleNumber(),
-		scriptInterp.getCurrentLine(), scriptInterp.samplingEnabled(),
-		(config.getHardwareConfig() == Config::BASIC ?
-							   "BASIC" : "TWO_REAGENTS"),
-		samplePump.getCurrentRate(), referencePump.getCurrentRate(), 
-		reagent1Pump.getCurrentRate(), reagent2Pump.getCurrentRate(),
-		(int) referencePump.getLevel(true),
-		(int) reagent1Pump.getLevel(true),
-		(int) reagent2Pump.getLevel(true),
-		filterValve.state(),
-		Util::bits2string(mixValves.state(), 2).c_str(),
-		portValve.state(),
-		Util::bits2string(spectrometer.getLights(),3).c_str(),
-		(spectrometer.getStatus() ? 1 : 0),
-		Util::bits2string(powerControl.get(),2).c_str(),
-		spectrometer.getIntTime(),
-		hwStatus.filterPressure(), hwStatus.maxFilterPressure(),
-		hwStatus.temperature(), hwStatus.voltage(), hwStatus.depth(), hwStatus.leak(),
-		locationSensor.getRecordedLocation().toString().c_str(),
-		serialNumber.c_str(), config.getDeploymentLabel().c_str(),
-		versionNumber.c_str(), 
-		logger.logLevel2string(console.getLevel()).c_str());
-	console.reply(buf);
+	console.reply("snapshot reply " + snapshotString());
+}
+
+/** Get the system's state as a JSON object, as last refreshed. */
+string ConsoleInterp::snapshotString() {
+	return *telemetry.snapshot();
 }
 
 void ConsoleInterp::pumpControl(vector<string>& words) {
@@ -7,6 +7,7 @@
  */
 
 #include <vector>
+#include <algorithm>
 #include "DataStore.h"
 #include "Spectrometer.h"
 #include "Config.h"
@@ -17,6 +18,8 @@
 #include "SupplyPump.h"
 #include "ScriptInterp.h"
 #include "CollectorState.h"
+#include "Console.h"
+#include "JsonScan.h"
 
 namespace fizz {
 
@@ -32,6 +35,8 @@ extern SupplyPump reagent1Pump;
 extern SupplyPump reagent2Pump;
 extern ScriptInterp scriptInterp;
 extern CollectorState cstate;
+extern Console console;
+extern Logger logger;
 
 /** Constructor for DataStore object.
  */
@@ -41,6 +46,10 @@ DataStore::DataStore() {
 	spectrumCount = 0;
 	openFlag = false;
 	indexFlag = false;
+	pendingBytes = 0;
+	droppedEvents = 0;
+	cycleFiltered = cycleConcentrate = cycleSummaryIndex = 0;
+	modelsLoaded = false;
 }
 
 /** Initialize state variables from CollectorState object.
@@ -50,6 +59,107 @@ void DataStore::initState() {
 	cstate.getDataStoreState(currentIndex, deploymentIndex,
 							 spectrumCount, recordMap);
 	indexFlag = true;
+	if (deploymentIndex != 0) restoreSpectra();
+}
+
+/** Reload the saved spectra from the current data file.
+ *  The collector restarts after each cycle in powerSave mode, and a
+ *  cycle's summary may need spectra saved in earlier runs (e.g. a
+ *  reference measured only every few cycles). The file is replayed to
+ *  find the spectra that the labelled spectra and the current cycle
+ *  refer to, and only those are read back.
+ */
+void DataStore::restoreSpectra() {
+	string path = filePath(serialNumber, deploymentIndex);
+	ifstream ifs(path);
+	if (ifs.fail()) {
+		cerr << "DataStore: cannot read data file: " << path << "\n";
+		return;
+	}
+	/** Location of a spectrum record and its prerequisites. */
+	struct Entry { streamoff offset; int prereq1index, prereq2index; };
+	unordered_map<int,Entry> entries;
+	string line, type, label;
+	double x;
+	streamoff offset = ifs.tellg();
+	while (getline(ifs, line)) {
+		streamoff next = ifs.tellg();
+		if (!JsonScan::getString(line, "recordType", type) ||
+			!JsonScan::getNumber(line, "index", x)) {
+			offset = next; continue;
+		}
+		int index = (int) x;
+		if (type == "spectrum") {
+			Entry& e = entries[index];
+			e.offset = offset;
+			e.prereq1index = (JsonScan::getNumber(line, "prereq1index", x) ?
+							  (int) x : 0);
+			e.prereq2index = (JsonScan::getNumber(line, "prereq2index", x) ?
+							  (int) x : 0);
+			JsonScan::getString(line, "label", label);
+			if (label == "filtered") cycleFiltered = index;
+			if (label == "concentrate") cycleConcentrate = index;
+		} else if (type == "cycleSummary") {
+			cycleSummaryIndex = index;
+			cycleFiltered = cycleConcentrate = 0;
+		} else if (type == "reset") {
+			// as in saveResetRecord
+			for (auto e = entries.begin(); e != entries.end(); ) {
+				if (e->first > cycleSummaryIndex) e = entries.erase(e);
+				else e++;
+			}
+			cycleFiltered = cycleConcentrate = 0;
+		}
+		offset = next;
+	}
+
+	// read back the spectra that pruneSpectra would keep
+	vector<int> keep;
+	auto addChain = [&](int index) {
+		auto e = entries.find(index);
+		if (e == entries.end()) return;
+		keep.push_back(index);
+		keep.push_back(e->second.prereq1index);
+		keep.push_back(e->second.prereq2index);
+		auto p2 = entries.find(e->second.prereq2index);
+		if (p2 != entries.end()) keep.push_back(p2->second.prereq1index);
+	};
+	for (auto& rm : recordMap) addChain(rm.second);
+	addChain(cycleFiltered); addChain(cycleConcentrate);
+	ifs.clear();
+	for (int index : keep) {
+		auto e = entries.find(index);
+		if (e == entries.end() || savedSpectra.count(index) > 0) continue;
+		vector<double>* values = new vector<double>();
+		ifs.seekg(e->second.offset);
+		if (!getline(ifs, line) ||
+			!JsonScan::getVector(line, "spectrum", *values)) {
+			cerr << "DataStore: cannot read spectrum " << index
+				 << " from " << path << "\n";
+			delete values; continue;
+		}
+		SavedSpectrum& saved = savedSpectra[index];
+		saved.prereq1index = e->second.prereq1index;
+		saved.prereq2index = e->second.prereq2index;
+		saved.values.reset(values);
+	}
+}
+
+/** Set the name of the mission producing subsequent records.
+ *  @param name is the mission name, or the empty string when the
+ *  script does not define missions.
+ */
+void DataStore::setMission(const string& name) {
+	unique_lock<mutex> lck(dataStoreMtx);
+	mission = name;
+}
+
+/** Return mission field for a record (empty when there is no mission).
+ *  Caller is assumed to hold the lock.
+ */
+string DataStore::missionField() {
+	return (mission.length() == 0 ? string("") :
+			"\"mission\": \"" + mission + "\", ");
 }
 
 /** Open data file in which results are saved.
@@ -77,6 +187,7 @@ bool DataStore::privateOpen() {
 		return false;
 	}
 	openFlag = true;
+	fileFormats.clear();	// each file carries its own format table
 	return true;
 }
 
@@ -94,6 +205,7 @@ string DataStore::filePath(const string& serialNumber, int depIndex) {
 void DataStore::close() {
 	unique_lock<mutex> lck(dataStoreMtx);
 	if (openFlag) {
+		if (indexFlag) privateSaveEvents();
 		dataFile.close();
 		openFlag = false;
 	}
@@ -115,6 +227,8 @@ void DataStore::saveDeploymentRecord() {
 	deploymentIndex = currentIndex;
 	recordMap.clear(); recordMap["dark"] = 1; // dummy entry
 	spectrumCount = 0;
+	savedSpectra.clear();
+	cycleFiltered = cycleConcentrate = cycleSummaryIndex = 0;
 
 	if (openFlag) { dataFile.close(); openFlag = false; }
 	if (!privateOpen()) return;
@@ -164,14 +278,14 @@ void DataStore::saveCycleSummary() {
 		 "{ \"serialNumber\": %s, \"index\": %d, "
 		 "\"recordType\": \"cycleSummary\", "
 		 "\"dateTime\": \"%s\", \"deploymentIndex\": %d, "
-		 "\"cycleNumber\": %ld, "
+		 "\"cycleNumber\": %ld, %s"
 		 "\"temp\": %.1f, \"battery\": %.2f, "
 		 "\"pressure\": %.2f, \"depth\": %.2f, \"location\": \"%s\", "
 		 "\"integrationTime\": %.2f, "
-		 "\"referenceLevel\": %.1f}",
+		 "\"referenceLevel\": %.1f, ",
 		 serialNumber.c_str(), currentIndex,
 		 hwStatus.dateTimeString().c_str(), deploymentIndex,
-		 scriptInterp.getCycleNumber(),
+		 scriptInterp.getCycleNumber(), missionField().c_str(),
 		 hwStatus.temperature(), hwStatus.voltage(),
 		 hwStatus.maxFilterPressure(), hwStatus.depth(),
 		 locationSensor.getRecordedLocation().toString().c_str(),
@@ -180,17 +294,238 @@ void DataStore::saveCycleSummary() {
 	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
 		snprintf(line, sizeof(line),
 			 "\"reagent1Level\": %.1f, \"reagent2Level\": %.1f, ",
-			 reagent1Pump.getLevel(), reagent1Pump.getLevel());
+			 reagent1Pump.getLevel(), reagent2Pump.getLevel());
 		dataFile << line;
 	}
+	snprintf(line, sizeof(line),
+		 "\"nextCycleDelay\": %ld, \"delayReason\": \"%s\"}",
+		 scriptInterp.getCycleDelay(),
+		 scriptInterp.getDelayReason().c_str());
+	dataFile << line;
 	dataFile << endl << std::flush;
 
+	cycleSummaryIndex = currentIndex;
+	currentIndex += 1;
+	cstate.setDataStoreState(currentIndex, deploymentIndex,
+							 spectrumCount, recordMap);
+
+	if (cycleFiltered == 0 && cycleConcentrate == 0) return;
+
+	// gather what the summary needs, then compute it without the lock,
+	// so other records are not held up
+	vector<shared_ptr<const vector<double>>> hold;
+	Summarizer::Measurement filtered, concentrate;
+	bool haveFiltered = getMeasurement(cycleFiltered, filtered, hold);
+	bool haveConcentrate = getMeasurement(cycleConcentrate, concentrate,
+										  hold);
+	bool missing = (cycleFiltered != 0 && !haveFiltered) ||
+				   (cycleConcentrate != 0 && !haveConcentrate);
+	cycleFiltered = cycleConcentrate = 0;
+	pruneSpectra();
+	if (missing) {
+		// a partial record would disagree with the cloud's summary
+		lck.unlock();
+		logger.warning("DataStore: no summary for cycle %ld, a spectrum "
+					   "or prerequisite is missing",
+					   scriptInterp.getCycleNumber());
+		return;
+	}
+
+	// rounded as in the deployment record, to match the cloud summary
+	vector<double> wavelengths(Spectrometer::SPECTRUM_SIZE);
+	char buf[20];
+	for (int i = 0; i < Spectrometer::SPECTRUM_SIZE; i++) {
+		snprintf(buf, 20, "%.2f", spectrometer.wavelengths[i]);
+		wavelengths[i] = strtod(buf, 0);
+	}
+	snprintf(buf, 20, "%.4f", config.getWaveguideLength());
+	double waveguideLength = strtod(buf, 0);
+
+	snprintf(line, sizeof(line),
+		 "\"cycleSummaryIndex\": %d, \"cycleNumber\": %ld, %s"
+		 "\"location\": \"%s\", \"depth\": %.2f",
+		 cycleSummaryIndex, scriptInterp.getCycleNumber(),
+		 missionField().c_str(),
+		 locationSensor.getRecordedLocation().toString().c_str(),
+		 hwStatus.depth());
+	string head = line;
+	lck.unlock();
+
+	Summarizer::FieldList fields;
+	{
+		unique_lock<mutex> slck(summaryMtx);
+		if (!modelsLoaded) {
+			string dir = datapath + "/models/unia";
+			if (summarizer.loadModels(dir) < 0)
+				cerr << "DataStore: cannot read phytoplankton models from "
+					 << dir << "\n";
+			modelsLoaded = true;
+		}
+		summarizer.setDeployment(wavelengths, waveguideLength);
+		summarizer.summarize(haveFiltered ? &filtered : 0,
+							 haveConcentrate ? &concentrate : 0, fields);
+	}
+
+	lck.lock();
+	if (!openFlag) return;
+	string record = "{ \"serialNumber\": " + serialNumber + ", "
+		"\"index\": " + to_string(currentIndex) + ", "
+		"\"recordType\": \"summary\", "
+		"\"dateTime\": \"" + hwStatus.dateTimeString() + "\", "
+		"\"deploymentIndex\": " + to_string(deploymentIndex) + ", " + head;
+	for (auto& f : fields)
+		record += ", \"" + f.first + "\": " + f.second;
+	record += "}";
+	dataFile << record << endl << std::flush;
+
 	currentIndex += 1;
 	cstate.setDataStoreState(currentIndex, deploymentIndex,
 							 spectrumCount, recordMap);
+	lck.unlock();
+	console.publish("summary", record);
 	return;
 }
 
+/** Get the spectra used for a measurement.
+ *  The caller must hold the dataStore lock.
+ *  @param index is the record index of a saved spectrum, or 0
+ *  @param m is used to return pointers to the measurement's spectra
+ *  @param hold is a vector to which references to those spectra are
+ *  added, so they remain valid after the lock is released
+ *  @return true if the spectrum and all three of its prerequisites
+ *  were found, else false
+ */
+bool DataStore::getMeasurement(int index, Summarizer::Measurement& m,
+							   vector<shared_ptr<const vector<double>>>& hold) {
+	auto sp = savedSpectra.find(index);
+	if (index == 0 || sp == savedSpectra.end()) return false;
+	auto p1 = savedSpectra.find(sp->second.prereq1index);
+	auto p2 = savedSpectra.find(sp->second.prereq2index);
+	if (p1 == savedSpectra.end() || p2 == savedSpectra.end()) return false;
+	auto p21 = savedSpectra.find(p2->second.prereq1index);
+	if (p21 == savedSpectra.end()) return false;
+
+	hold.push_back(sp->second.values); m.spect = sp->second.values.get();
+	hold.push_back(p1->second.values); m.dark = p1->second.values.get();
+	hold.push_back(p2->second.values); m.ref = p2->second.values.get();
+	hold.push_back(p21->second.values); m.refDark = p21->second.values.get();
+	return true;
+}
+
+/** Discard saved spectra that can no longer be used in a summary.
+ *  A spectrum is kept if it is the latest one with some label, or is
+ *  a prerequisite of one of those, or of one of their references.
+ *  The caller must hold the dataStore lock.
+ */
+void DataStore::pruneSpectra() {
+	vector<int> keep;
+	auto addChain = [&](int index) {
+		auto sp = savedSpectra.find(index);
+		if (sp == savedSpectra.end()) return;
+		keep.push_back(index);
+		keep.push_back(sp->second.prereq1index);
+		keep.push_back(sp->second.prereq2index);
+		auto p2 = savedSpectra.find(sp->second.prereq2index);
+		if (p2 != savedSpectra.end()) keep.push_back(p2->second.prereq1index);
+	};
+	for (auto& rm : recordMap) addChain(rm.second);
+	addChain(cycleFiltered); addChain(cycleConcentrate);
+	if (keep.size() >= savedSpectra.size()) return;
+	for (auto sp = savedSpectra.begin(); sp != savedSpectra.end(); ) {
+		if (find(keep.begin(), keep.end(), sp->first) == keep.end())
+			sp = savedSpectra.erase(sp);
+		else
+			sp++;
+	}
+}
+
+/** Append a delta-encoded array to a record.
+ *  The first value is given as is, each of the others as its difference
+ *  from the previous one; unchanging values cost two characters each.
+ *  @param s is the string to which the array is appended
+ *  @param name is the name of the field
+ *  @param v is the vector of values
+ */
+static void appendDeltas(string& s, const char* name, const vector<int>& v) {
+	char buf[20];
+	s += "\""; s += name; s += "\": [";
+	int prev = 0;
+	for (unsigned i = 0; i < v.size(); i++) {
+		snprintf(buf, sizeof(buf), (i == 0 ? "%d" : ",%d"), v[i] - prev);
+		s += buf; prev = v[i];
+	}
+	s += "]";
+}
+
+/** Save a telemetry record.
+ *
+ *  A telemetry record holds the pressure, pump and valve samples that
+ *  Status recorded during a fluidics operation. Each quantity is a
+ *  delta-encoded array (see appendDeltas): time in ms, raw pressures,
+ *  pump rates in units of .01 ml/min and valve states (filter, port and
+ *  mix valves in bits 0, 1 and 2-3). The pressure calibration is included
+ *  so the raw values can be converted to psi.
+ *
+ *  @param label names the operation
+ *  @param mark is the value returned by hwStatus.markTelemetry() at the
+ *  start of the operation
+ */
+void DataStore::saveTelemetryRecord(const string& label, long mark) {
+	vector<TelemetrySample> samples;
+	long lost = hwStatus.getTelemetry(mark, samples);
+	if (samples.size() == 0) return;
+	ppair upParams, downParams;
+	hwStatus.getPressureParams(upParams, downParams);
+
+	// format outside the lock, so other records are not held up
+	bool twoReagents = (config.getHardwareConfig() == Config::TWO_REAGENTS);
+	int n = samples.size();
+	vector<int> t(n), up(n), down(n), sp(n), rp(n), r1(n), r2(n), vs(n);
+	for (int i = 0; i < n; i++) {
+		TelemetrySample& ts = samples[i];
+		// time differences are computed modulo 2^32
+		t[i] = (int) (ts.time - samples[0].time);
+		up[i] = ts.up; down[i] = ts.down;
+		sp[i] = ts.rates[0]; rp[i] = ts.rates[1];
+		r1[i] = ts.rates[2]; r2[i] = ts.rates[3];
+		vs[i] = ts.valves;
+	}
+	char line[300];
+	snprintf(line, sizeof(line),
+		 "\"label\": \"%s\", \"startTime\": %.3f, \"samples\": %d, "
+		 "\"lost\": %ld, \"pressureParams\": [%.3f, %.3f, %.3f, %.3f], ",
+		 label.c_str(), samples[0].time / 1000., n, lost,
+		 upParams.offset, upParams.scale, downParams.offset, downParams.scale);
+	string body = line;
+	appendDeltas(body, "time", t); body += ", ";
+	appendDeltas(body, "upstream", up); body += ", ";
+	appendDeltas(body, "downstream", down); body += ", ";
+	appendDeltas(body, "samplePump", sp); body += ", ";
+	appendDeltas(body, "referencePump", rp); body += ", ";
+	if (twoReagents) {
+		appendDeltas(body, "reagent1Pump", r1); body += ", ";
+		appendDeltas(body, "reagent2Pump", r2); body += ", ";
+	}
+	appendDeltas(body, "valves", vs);
+
+	unique_lock<mutex> lck(dataStoreMtx);
+	if (!privateOpen()) return;
+	if (!indexFlag) return;
+
+	snprintf(line, sizeof(line),
+		 "{ \"serialNumber\": %s, \"index\": %d, "
+		 "\"recordType\": \"telemetry\", "
+		 "\"dateTime\": \"%s\", \"deploymentIndex\": %d, %s",
+		 serialNumber.c_str(), currentIndex,
+		 hwStatus.dateTimeString().c_str(), deploymentIndex,
+		 missionField().c_str());
+	dataFile << line << body << "}" << endl << std::flush;
+
+	currentIndex += 1;
+	cstate.setDataStoreState(currentIndex, deploymentIndex,
+							 spectrumCount, recordMap);
+}
+
 /** Save a spectrum record.
  *
  *  A new spectrum record is added to the data file.
@@ -259,15 +594,26 @@ void DataStore::saveSpectrumRecord(vector<double>& spectrum,
 		<< "\"deploymentIndex\": " << deploymentIndex << ", "
 		<< "\"prereq1index\": " << prereq1index << ", "
 		<< "\"prereq2index\": " << prereq2index << ", "
+		<< missionField()
 		<< "\"label\": \"" << label << "\", \"spectrum\": [";
 	char buf[20];
+	vector<double>* values = new vector<double>(Spectrometer::SPECTRUM_SIZE);
 	for (int i = 0; i < Spectrometer::SPECTRUM_SIZE; i++) {
 		snprintf(buf, 20, "%.2f", spectrum[i]);
 		dataFile << buf;
 		if (i < Spectrometer::SPECTRUM_SIZE-1) dataFile << ", ";
+		(*values)[i] = strtod(buf, 0);
 	}
 	dataFile << "]}\n" << std::flush;
 
+	// keep the values as written, for the cycle's summary record
+	SavedSpectrum& saved = savedSpectra[currentIndex];
+	saved.prereq1index = prereq1index; saved.prereq2index = prereq2index;
+	saved.values.reset(values);
+	if (label == "filtered") cycleFiltered = currentIndex;
+	if (label == "concentrate") cycleConcentrate = currentIndex;
+	pruneSpectra();
+
 	currentIndex++; spectrumCount++;
 	cstate.setDataStoreState(currentIndex, deploymentIndex,
 							 spectrumCount, recordMap);
@@ -370,12 +716,19 @@ void DataStore::saveResetRecord() {
 	char line[300];
 	snprintf(line, sizeof(line),
 		 "{ \"serialNumber\": %s, \"index\": %d, "
-		 "\"recordType\": \"reset\", "
+		 "\"recordType\": \"reset\", %s"
 		 "\"dateTime\": \"%s\", \"deploymentIndex\": %d}\n",
-		 serialNumber.c_str(), currentIndex, 
+		 serialNumber.c_str(), currentIndex, missionField().c_str(),
 		 hwStatus.dateTimeString().c_str(), deploymentIndex);
 	dataFile << line << std::flush;
 
+	// spectra since the last cycle summary are not used in summaries
+	for (auto sp = savedSpectra.begin(); sp != savedSpectra.end(); ) {
+		if (sp->first > cycleSummaryIndex) sp = savedSpectra.erase(sp);
+		else sp++;
+	}
+	cycleFiltered = cycleConcentrate = 0;
+
 	currentIndex += 1;
 	cstate.setDataStoreState(currentIndex, deploymentIndex,
 							 spectrumCount, recordMap);
@@ -418,4 +771,92 @@ void DataStore::saveDebugRecord(const string& message) {
 	return;
 }
 
+/** Save a log message in structured form.
+ *  The event is added to a list of pending events, which is saved in an
+ *  events record once it is large enough or old enough. As with debug
+ *  records, the record is only written if the main lock is available.
+ *  @param ev is the event to be saved
+ */
+void DataStore::saveEvent(const LogEvent& ev) {
+	unique_lock<mutex> eLock(eventMtx);
+	uint32_t key = EventCodec::hash(ev.format, ev.level);
+	if (eventFormats.find(key) == eventFormats.end()) {
+		if ((int) eventFormats.size() >= MAX_FORMATS) {
+			droppedEvents++; return;
+		}
+		eventFormats[key] = make_pair(ev.level, string(ev.format));
+	}
+	if ((int) pendingEvents.size() >= MAX_PENDING) {
+		droppedEvents++; return;
+	}
+	PendingEvent pe;
+	pe.key = key; pe.time = llround(1000 * ev.time);
+	pe.args.assign(ev.args, ev.argLen);
+	pendingEvents.push_back(pe);
+	pendingBytes += 3 + pe.args.length();
+	if (pendingBytes < EVENT_BYTES &&
+		pe.time - pendingEvents[0].time < EVENT_DELAY)
+		return;
+	eLock.unlock();
+
+	unique_lock<mutex> lck(dataStoreMtx, defer_lock);
+	if (!lck.try_lock()) return;
+	if (!privateOpen()) return;
+	if (!indexFlag) return;
+	privateSaveEvents();
+}
+
+/** Write the pending log events to the data file in an events record.
+ *  The record lists the formats used by its events that have not been
+ *  listed earlier in the file, as [index, key, level, format] tuples,
+ *  followed by the events in base64. Each event is a varint format index,
+ *  a varint time in ms relative to the previous event (the first is
+ *  relative to the base field), and the packed arguments.
+ *  Caller is assumed to hold the lock, with the file open.
+ */
+void DataStore::privateSaveEvents() {
+	unique_lock<mutex> eLock(eventMtx);
+	if (pendingEvents.size() == 0) return;
+	vector<PendingEvent> events;
+	events.swap(pendingEvents); pendingBytes = 0;
+	long dropped = droppedEvents; droppedEvents = 0;
+
+	string formats, packed;
+	int64_t base = events[0].time, prev = base;
+	for (PendingEvent& pe : events) {
+		auto p = fileFormats.find(pe.key);
+		int index;
+		if (p != fileFormats.end()) {
+			index = p->second;
+		} else {
+			index = fileFormats.size(); fileFormats[pe.key] = index;
+			pair<int,string>& lf = eventFormats[pe.key];
+			char buf[40];
+			snprintf(buf, sizeof(buf), "[%d, \"%08x\", %d, \"",
+					 index, pe.key, lf.first);
+			if (formats.length() > 0) formats += ", ";
+			formats += buf + EventCodec::jsonEscape(lf.second) + "\"]";
+		}
+		EventCodec::putVarint(packed, index);
+		EventCodec::putVarint(packed, pe.time - prev); prev = pe.time;
+		packed += pe.args;
+	}
+	eLock.unlock();
+
+	dataFile << "{ "
+			<< "\"serialNumber\": " << serialNumber << ", "
+			<< "\"index\": " << currentIndex << ", "
+			<< "\"recordType\": \"events\", "
+			<< "\"deploymentIndex\": " << deploymentIndex << ", "
+			<< "\"base\": " << base << ", "
+			<< "\"dropped\": " << dropped << ", "
+			<< "\"formats\": [" << formats << "], "
+			<< "\"events\": \"" << EventCodec::base64(packed) << "\" }\n"
+			<< std::flush;
+	currentIndex += 1;
+
+	cstate.setDataStoreState(currentIndex, deploymentIndex,
+							 spectrumCount, recordMap);
+}
+
 } // ends namespace
@@ -13,6 +13,28 @@ using this_thread::sleep_for;
 
 namespace fizz {
 
+namespace {
+// client record of the calling thread, cached on first use
+thread_local Interrupt* selfOwner = 0;
+thread_local InterruptClient* selfClient = 0;
+}
+
+/** Get the client record for the calling thread.
+ *  Caller is assumed to hold the lock.
+ *  @return a pointer to the client, or null if the calling thread
+ *  is not a registered client
+ */
+InterruptClient* Interrupt::self() {
+	if (selfOwner == this) return selfClient;
+	thread::id id = this_thread::get_id();
+    for (InterruptClient& c : clientList) {
+		if (c.id != id) continue;
+		selfOwner = this; selfClient = &c;
+		return &c;
+	}
+	return 0;
+}
+
 /** Register a client thread with the interrupt object.
  *  @param id is the thread identifier for the client thread
  *  @param name is used to identify client in log messages
@@ -23,8 +45,8 @@ namespace fizz {
  */
 void Interrupt::register_client(thread::id id, string name, void (*handler)()) {
     unique_lock<mutex> lck(mtx);
-	logger.trace("Interrupt:: registering client %s", name.c_str());
-    clientList.push_back(InterruptClient(id, name, handler, false,false,false));
+	LOG_TRACE("Interrupt:: registering client %s", name.c_str());
+    clientList.emplace_back(id, name, handler, false, false, false);
 }
 
 /** Request an interrupt of target thread.
@@ -39,13 +61,14 @@ void Interrupt::request(thread::id id, bool urgent) {
 	unique_lock<mutex> lck(mtx);
     for (InterruptClient& c : clientList) {
         if (id != c.id) continue;
-		logger.trace("Interrupt:: got %srequest for %s",
+		LOG_TRACE("Interrupt:: got %srequest for %s",
 					 (urgent ? "urgent " : ""), c.name.c_str());
 		if (c.active && urgent) {
 			c.active = false; c.detect = false; c.urgent = false;
             c.cleared.notify_one();
 		} else if (!c.active) {
 			c.active = true; c.urgent = urgent;
+			c.wake.notify_one();
 			if (!urgent)
 				c.detected.wait(lck, [&]{return c.detect;});
 		}
@@ -58,7 +81,7 @@ void Interrupt::clear(thread::id id) {
 	unique_lock<mutex> lck(mtx);
     for (InterruptClient& c : clientList) {
         if (c.id != id) continue;
-		logger.trace("Interrupt:: clearing interrupt for %s", c.name.c_str());
+		LOG_TRACE("Interrupt:: clearing interrupt for %s", c.name.c_str());
 		c.active = false; c.detect = false; c.urgent = false;
 		c.cleared.notify_one();
 		return;
@@ -83,11 +106,11 @@ bool Interrupt::inProgress(thread::id id) {
  */
 void Interrupt::check() {
 	unique_lock<mutex> lck(mtx);
-	thread::id id = this_thread::get_id();
-    for (InterruptClient& c : clientList) {
-        if (c.id != id) continue;
+	InterruptClient* cp = self();
+	if (cp != 0) {
+		InterruptClient& c = *cp;
 		if (!c.active) return;
-		logger.trace("Interrupt:: %srequest detected for %s",
+		LOG_TRACE("Interrupt:: %srequest detected for %s",
                      (c.urgent ? "urgent " : ""), c.name.c_str());
 		c.handler();
 		c.detect = true; c.detected.notify_one(); // allow requestor to proceed
@@ -96,7 +119,7 @@ void Interrupt::check() {
 		} else {
 			c.cleared.wait(lck, [&]{ return !c.active; });  // wait for clear
 		}
-		logger.trace("interrupt cleared in %s", c.name.c_str());
+		LOG_TRACE("interrupt cleared in %s", c.name.c_str());
 		throw InterruptException();
 	}
 }
@@ -109,10 +132,10 @@ void Interrupt::check() {
  */
 void Interrupt::selfInterrupt() {
 	unique_lock<mutex> lck(mtx);
-	thread::id id = this_thread::get_id();
-    for (InterruptClient& c : clientList) {
-        if (c.id != id) continue;
-		logger.trace("self-interrupt in %s", c.name.c_str());
+	InterruptClient* cp = self();
+	if (cp != 0) {
+		InterruptClient& c = *cp;
+		LOG_TRACE("self-interrupt in %s", c.name.c_str());
 		c.handler();
 		if (c.active && c.urgent) {
 			// we already have an urgent interrupt request
@@ -123,30 +146,37 @@ void Interrupt::selfInterrupt() {
 				// in case of pending request
 			c.cleared.wait(lck, [&]{ return !c.active; });  // wait for clear
 		}
-		logger.trace("interrupt cleared in %s", c.name.c_str());
+		LOG_TRACE("interrupt cleared in %s", c.name.c_str());
 		throw InterruptException();
 	}
 }
 
 /** Delay for a specified amount of time, while checking for interrupts.
  *
- *  The check method is called every 50 ms, during long delay intervals.
- *  If it detects an interrupt request for the pending thread, it will
- *  handle it, eventually throwing an InterruptException when interrupt clears.
+ *  The calling thread sleeps until the delay expires or request() wakes
+ *  it. If an interrupt request is pending, it is handled by check(),
+ *  eventually throwing an InterruptException when interrupt clears.
+ *  Threads that are not registered clients just sleep.
  *
  *  @param delay number of seconds to delay
  */
 void Interrupt::pause(double delay) {
-	double now = Util::elapsedTime();
-	double stopTime = now + delay;
-	while (now < stopTime) {
-		check();
-		double t0 = now;
-		sleep_for(milliseconds(min(50, ((int) (1000 * (stopTime - now))))));
-		now = Util::elapsedTime();
-		if (now - t0 > .1)
-			logger.error("Interrupt::pause: excessive delay %.3f s", now-t0);
+	steady_clock::time_point stopTime = steady_clock::now() +
+		duration_cast<steady_clock::duration>(duration<double>(max(0.,delay)));
+	unique_lock<mutex> lck(mtx);
+	InterruptClient* c = self();
+	if (c == 0) {
+		lck.unlock(); this_thread::sleep_until(stopTime); return;
+	}
+	while (!c->active) {
+		cv_status status = c->wake.wait_until(lck, stopTime);
+		wakeups++;
+		if (status == cv_status::timeout) break;
 	}
+	lck.unlock();
+	double late = duration<double>(steady_clock::now() - stopTime).count();
+	if (late > .1)
+		logger.error("Interrupt::pause: excessive delay %.3f s", late);
 	check();
 }
 
@@ -7,6 +7,7 @@
  */
 
 #include "Util.h"
+#include "Arduino.h"
 
 #include "Pump.h"
 #include "SupplyPump.h"
@@ -16,6 +17,8 @@
 #include "Spectrometer.h"
 
 #include "Config.h"
+#include "CollectorState.h"
+#include "PressureController.h"
 #include "Console.h"
 #include "ConsoleInterp.h"
 #include "DataStore.h"
@@ -27,6 +30,7 @@ using this_thread::sleep_for;
 namespace fizz {
 
 extern Logger logger;
+extern Arduino arduino;
 extern Pump samplePump;
 extern SupplyPump referencePump;
 extern SupplyPump reagent1Pump;
@@ -37,13 +41,34 @@ extern MixValves mixValves;
 extern Spectrometer spectrometer;
 extern Status hwStatus;
 extern Config config;
+extern CollectorState cstate;
+extern PressureController pressureController;
 extern Interrupt interrupt;
+extern DataStore dataStore;
+
+/** Records the telemetry for a fluidics operation. The samples recorded
+ *  by hwStatus while the object is in scope are saved in a telemetry
+ *  record when it goes out of scope, including when an exception ends
+ *  the operation.
+ */
+class TelemetryRecorder {
+public:
+	TelemetryRecorder(const string& label) : label(label) {
+		mark = hwStatus.markTelemetry();
+	}
+	~TelemetryRecorder() { dataStore.saveTelemetryRecord(label, mark); }
+private:
+	string	label;		///< name of operation
+	long	mark;		///< first telemetry sample of operation
+};
 
 /** Turn off all pumps, lights and leave valves in safe configuration
  */
 void Operations::idleMode() {
 	logger.details("going to idle mode");
 
+	pressureController.stop();
+	Arduino::Batch batch(arduino);	// send commands in one frame
 	samplePump.off(); referencePump.off();
 	filterValve.select(0); portValve.select(0);
 
@@ -62,6 +87,7 @@ void Operations::referenceSample(double volume, double refPumpRate,
 												   double samplePumpRate) {
 	logger.details("referenceSample(%.2fml, %.2fml/m, %.2fml/m)",
 					volume, refPumpRate, samplePumpRate);
+	TelemetryRecorder telemetry("referenceSample");
 
 	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
 		mixValves.select(0, 0);
@@ -129,7 +155,7 @@ bool Operations::optimizeIntegrationTime(double volume, double refPumpRate,
 void Operations::computePumpRates(double& totalRate,
 		double r1Frac, double r2Frac,
 		double& spRate, double& r1Rate, double& r2Rate) {
-	logger.trace("computePumpRates(%.2fml/m, %.3f, %.3f)",
+	LOG_TRACE("computePumpRates(%.2fml/m, %.3f, %.3f)",
 			  totalRate, r1Frac, r2Frac);
 
 	if (config.getHardwareConfig() == Config::BASIC) {
@@ -150,7 +176,7 @@ void Operations::computePumpRates(double& totalRate,
 		}
 	}
 
-	logger.trace("computePumpRates returns %.2fml/m, %.2fml/m, %.2fml/m",
+	LOG_TRACE("computePumpRates returns %.2fml/m, %.2fml/m, %.2fml/m",
 		   	spRate, r1Rate, r2Rate);
 }
 
@@ -165,6 +191,7 @@ void Operations::unfilteredSample(double volume, double totalRate,
 				  double r1Frac, double r2Frac) {
 	logger.details( "unfilteredSample(%.2fml, %.2fml/m, %.3f, %.3f)", 
 			volume, totalRate, r1Frac, r2Frac);
+	TelemetryRecorder telemetry("unfilteredSample");
 
 	if (reagent1Pump.available() < r1Frac * volume) {
 		logger.warning("running out of reagent 1");
@@ -198,15 +225,20 @@ void Operations::unfilteredSample(double volume, double totalRate,
 		reagent1Pump.off(); reagent2Pump.off(); mixValves.select(0, 0);
 	}
 
-	logger.trace("unfilteredSample returning");
+	LOG_TRACE("unfilteredSample returning");
 }
 
 /** Fill the spectrometer waveguide with a filtered seawater sample,
- *  possibly mixed with reagents. Throws PressureException if
- *  over-pressure condition is detected.
+ *  possibly mixed with reagents. For forward pumping, the pump rate is
+ *  controlled by the pressure controller, which holds the filter pressure
+ *  near its target, never exceeding the specified rate. Throws
+ *  PressureException if the filter pressure cannot be controlled.
+ *  If the controller predicts that the filter will soon clog, it is
+ *  backflushed first.
  *
- *  @param volume is the time to run the pumps (in seconds).
- *  @param totalRate is total rate of flow through spectrometer in ul/s.
+ *  @param volume is the total volume to be pumped (in ml).
+ *  @param totalRate is the maximum rate of flow through spectrometer,
+ *  in ml/m; if negative, the sample pump runs in reverse at this rate
  *  @param r1Frac fraction of total volume for reagent1.
  *  @param r2Frac fraction of total volume for reagent2.
  */
@@ -214,6 +246,12 @@ void Operations::filteredSample(double volume, double totalRate,
 				double r1Frac, double r2Frac) {
 	logger.details("filteredSample(%.2fml, %.2fml/m, %.3f, %.3f)",
 			volume, totalRate, r1Frac, r2Frac);
+	if (totalRate > 0 && pressureController.needsBackflush()) {
+		// head off a clogged filter, before it fails the cycle
+		logger.info("backflushing filter before filtered sample");
+		flushFilter();
+	}
+	TelemetryRecorder telemetry("filteredSample");
 	double absTotalRate, spRate, r1Rate, r2Rate;
 	absTotalRate = abs(totalRate);
 	computePumpRates(absTotalRate, r1Frac, r2Frac, spRate, r1Rate, r2Rate);
@@ -224,32 +262,14 @@ void Operations::filteredSample(double volume, double totalRate,
 		mixValves.select(r1Frac > 0, r2Frac > 0);
 	}
 
-	samplePump.on(spRate);
-	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
-		reagent1Pump.on(r1Rate); reagent2Pump.on(r2Rate);
-	}
-
-	double startTime = Util::elapsedTime();
-	double finishTime = startTime + (60.*(volume/absTotalRate));
-
-	if (hwStatus.overPressure()) throw PressureException();
-	double pressureCheckTime = startTime;
-
-	interrupt.check();
-	double now = Util::elapsedTime();
-	while (now < finishTime) {
-		if (now - pressureCheckTime > .5) { // check every 500 ms
-			// overPressure() has delay of about 100 ms and
-			// runs check() twice
-			if (hwStatus.overPressure())
-				throw PressureException();
-			pressureCheckTime = now;
-		} else {
-			interrupt.pause(min(0.5, finishTime - now));
-			//sleep_for(milliseconds(min(500, (int) (1000*(finishTime-now)))));
-			//interrupt.check();
+	if (totalRate > 0) {
+		controlledSample(volume, absTotalRate, r1Frac, r2Frac);
+	} else {
+		samplePump.on(spRate);
+		if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
+			reagent1Pump.on(r1Rate); reagent2Pump.on(r2Rate);
 		}
-		now = Util::elapsedTime();
+		interrupt.pause(60.*(volume/absTotalRate));
 	}
 
 	// turn off pumps and restore valves to default configuration;
@@ -262,38 +282,22 @@ void Operations::filteredSample(double volume, double totalRate,
 	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
 		mixValves.select(0, 0);
 	}
-	logger.trace("filteredSample returning");
+	LOG_TRACE("filteredSample returning");
 }
 
-/** Collect a filtered sample while adapting pump rate to avoid over-pressure.
+/** Collect a filtered sample at the highest rate the filter allows.
  *  Throws PressureException if over-pressure condition is detected.
  *  @param totalVolume is the total volume to be pumped in ml,
  *  including reagents.
  *  @param r1Frac is fraction of volume for reagent1.
  *  @param r2Frac is fraction of volume for reagent2.
-
-Notes.
-
-This method was adapted from opd and has not been used in physs.
-Code is pretty convoluted and am not confident it really makes sense.
-Should be re-examined before using it in real deployment.
-
-Summary
-
-While pumping, check the pressure every 5 seconds, adjust the
-rates to maintain pressure close to target; done using an
-iterative adjustment with a limit of 5 iterations, with 50 ms
-per iteration; also check for overpressure every 5 seconds
-
-Might be simpler to adjust rates continuously every 50 ms,
-but perhaps it's better to maintain stable rates.
-
  */
 void Operations::filteredSampleAdaptive(double totalVolume,
 					double r1Frac, double r2Frac) {
 
-	logger.details("filteredSampleByVolume(%.1f ml, %.3f, %.3f)",
+	logger.details("filteredSampleAdaptive(%.1f ml, %.3f, %.3f)",
 					totalVolume, r1Frac, r2Frac); 
+	TelemetryRecorder telemetry("filteredSampleAdaptive");
 
 	if (reagent1Pump.available() < r1Frac * totalVolume) {
 		logger.warning("running out of reagent 1");
@@ -304,17 +308,12 @@ void Operations::filteredSampleAdaptive(double totalVolume,
 		throw EmptyReservoirException();
 	}
 
-	double spFrac = 1.0 - (r1Frac + r2Frac);
-
 	double maxRate = samplePump.getMaxRate();
 	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
 		maxRate = min(min(maxRate,
 				 reagent1Pump.getMaxRate()),
 			   	 reagent2Pump.getMaxRate());
 	}
-	double minRate = maxRate/100;
-
-	double targetPressure = config.getMaxPressure() / 2.;
 
 	// select filter and set mixing valves based on pump rates;
 	filterValve.select(1);
@@ -322,108 +321,156 @@ void Operations::filteredSampleAdaptive(double totalVolume,
 		mixValves.select(r1Frac > 0, r2Frac > 0);
 	}
 
-	double rate = maxRate/5;  // start low to reduce chance of overpressure
-	double pumpedVolume = 0.;
-	while (pumpedVolume <  totalVolume) {
-		logger.debug("Pumped %.2f out of %.2f", pumpedVolume, totalVolume);
-
-		double spRate = rate * spFrac;
-		double r1Rate = rate * r1Frac;
-		double r2Rate = rate * r2Frac;
-		samplePump.on(spRate);
-		if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
-			reagent1Pump.on(r1Rate); reagent2Pump.on(r2Rate);
-		}
-
-		double pressure = hwStatus.filterPressure();
-		logger.debug("Pump rates: %.2f %.2f %.2f, pressure: %.1f",
-					 spRate, r1Rate, r2Rate, pressure);
-		if (hwStatus.overPressure())
-			throw PressureException();
-
-		double squirt; // amount pumped this iteration
-		if (!adjustRates(rate, minRate, maxRate, r1Frac, r2Frac, 
-				 targetPressure, squirt)) {
-			throw PressureException();
-		}
-		if (rate >= 0) {
-			interrupt.pause(5);
-			// note: this method only checks for overPressure
-			// every 5 seconds, but adjustRates checks every .5 sec;
-			// since rate returned by adjustRates is chosen to
-			// keep us close to targetPressure, we should be safe
-			squirt += 5.0 * (spRate + r1Rate + r2Rate);
-		}
-		pumpedVolume += squirt;
-	}
+	controlledSample(totalVolume, maxRate, r1Frac, r2Frac);
 
-	// turn off pumps and restore valves to default configuration;
-	samplePump.off();
-	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
-		reagent1Pump.off(); reagent2Pump.off();
-	}
+	// restore valves to default configuration;
 	filterValve.select(0);
 	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
 		mixValves.select(0, 0);
 	}
-	logger.trace("filteredSampleByVolume returning");
+	LOG_TRACE("filteredSampleAdaptive returning");
 }
 
-/** Attempt to adjust pump rates to achieve a specified target filter pressure.
- *  @param currentRate is the current total pump rate on input; it is
- *  modified by this method.
- *  @param minRate is the minimum allowed value for currentRate.
- *  @param maxRate is the maximum allowed value for currentRate.
- *  @param r1Frac is the fraction of the pumped volume for reagent1.
- *  @param r2Frac is the fraction of the pumped volume for reagent2.
- *  @param targetPressure is the filter pressure target to use in the
- *  control loop; should be substantially smaller than the maximum
- *  safe filter pressure.
- *  @param volPumped is the total volume pumped during execution of this
- *  method.
- *  @param return false
+/** Pump a filtered sample under control of the pressure controller.
+ *  Valves must be configured by the caller. Returns once the volume
+ *  has been pumped. Throws PressureException if the controller cannot
+ *  keep the pressure below the maximum, or if the filter is so clogged
+ *  that pumping takes more than five times as long as it should.
+ *  @param volume is the total volume to be pumped in ml
+ *  @param maxRate is the maximum total pump rate in ml/m
+ *  @param r1Frac is the fraction of volume for reagent1.
+ *  @param r2Frac is the fraction of volume for reagent2.
  */
-bool Operations::adjustRates(double& currentRate,
-		 double minRate, double maxRate, double r1Frac, double r2Frac,
-		 double targetPressure, double& volPumped) {
-	logger.trace("Operations::adjustRates(%.2fml/m, %.2fml/m, %.2fml/m, "
-			 "%.3f, %.3f, %.1fpsi, %.1fml",
-			 currentRate, minRate, maxRate, r1Frac, r2Frac,
-			 targetPressure, volPumped);
-	double spRate, r1Rate, r2Rate;
-	computePumpRates(currentRate, r1Frac, r2Frac, spRate, r1Rate, r2Rate);
-
-	volPumped = 0;
-	for (int i = 0; i < 5; i++) {
-		if (hwStatus.overPressure())
-			throw PressureException();
-
-		double currentPressure = hwStatus.filterPressure();
-		double correction = currentRate *
-			((targetPressure - currentPressure) / targetPressure);
-		if ((correction > -.0001 && correction < .0001) ||
-			(correction > 0 && currentRate >= maxRate))
-			break;
-		double newRate = currentRate + correction;
-		newRate = min(newRate, maxRate);
-		newRate = max(newRate, minRate);
-
-		if (newRate != currentRate) {
-			computePumpRates(newRate, r1Frac, r2Frac, spRate, r1Rate, r2Rate);
-			samplePump.on(spRate);
-			if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
-				reagent1Pump.on(r1Rate); reagent2Pump.on(r2Rate);
+void Operations::controlledSample(double volume, double maxRate,
+								  double r1Frac, double r2Frac) {
+	double timeLimit = Util::elapsedTime() + 5 * 60 * (volume / maxRate);
+	pressureController.start(volume, maxRate, r1Frac, r2Frac);
+	try {
+		while (pressureController.running()) {
+			if (Util::elapsedTime() > timeLimit) {
+				pressureController.stop();
+				logger.warning("filter clogged, pumped only %.2f of %.2f ml",
+							   pressureController.pumpedVolume(), volume);
+				throw PressureException();
 			}
-			currentRate = newRate;
+			interrupt.pause(.25);
 		}
-		interrupt.pause(.5);
-		volPumped += spRate + r1Rate + r2Rate;
+	} catch (...) {
+		pressureController.stop(); throw;
 	}
-	return true;
+	pressureController.stop();
+	if (pressureController.failed()) throw PressureException();
 }
 
+/** Backflush the filter, by running the sample pump in reverse with
+ *  the filter selected, to dislodge particulates on the filter surface.
+ *  This is the same flow as a filteredSample with a negative rate.
+ */
 void Operations::flushFilter() {
-	logger.debug("flushFilter() not yet implemented");
+	TelemetryRecorder telemetry("flushFilter");
+	double volume = 1.0, rate = 2.0;
+	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
+		reagent1Pump.off(); reagent2Pump.off(); mixValves.select(0, 0);
+	}
+	filterValve.select(1);
+	samplePump.on(-rate);
+	interrupt.pause(60.*(volume/rate));
+	samplePump.off();
+	filterValve.select(0);
+}
+
+/** Acquire a preview spectrum and reduce it to a compact signature.
+ *  The signature consists of the average values in 64 bins spanning
+ *  380-750 nm, normalized by their mean, so that it reflects the shape
+ *  of the spectrum rather than its overall intensity.
+ *  @param sig is a vector in which the signature is returned
+ *  @return true on success, false if no preview is available
+ */
+bool Operations::previewSignature(vector<double>& sig) {
+	vector<double> preview;
+	if (!spectrometer.getPreview(preview)) return false;
+	const int BINS = 64; const double lo = 380, hi = 750;
+	vector<double> sum(BINS, 0.); vector<int> cnt(BINS, 0);
+	for (unsigned int i = 0; i < preview.size(); i++) {
+		double w = spectrometer.wavelengths[i];
+		if (w < lo || w >= hi) continue;
+		int b = (int) (BINS * (w - lo) / (hi - lo));
+		sum[b] += preview[i]; cnt[b]++;
+	}
+	double mean = 0;
+	sig.resize(BINS);
+	for (int b = 0; b < BINS; b++) {
+		sig[b] = (cnt[b] > 0 ? sum[b] / cnt[b] : 0);
+		mean += sig[b];
+	}
+	mean /= BINS;
+	if (mean <= 0) return false;
+	for (int b = 0; b < BINS; b++) sig[b] /= mean;
+	return true;
+}
+
+/** Compute the root-mean-square difference between two signatures.
+ *  @return the distance, or a large value if the signatures are not
+ *  comparable
+ */
+double Operations::signatureDistance(const vector<double>& a,
+									 const vector<double>& b) {
+	if (a.size() == 0 || a.size() != b.size()) return 1e9;
+	double sum = 0;
+	for (unsigned int i = 0; i < a.size(); i++)
+		sum += (a[i] - b[i]) * (a[i] - b[i]);
+	return sqrt(sum / a.size());
+}
+
+/** Keep pumping until the waveguide spectrum settles, or a time limit.
+ *  The pumps are assumed to be running and the lights on. Preview
+ *  spectra are taken twice a second. The step ends once the previews
+ *  have changed (so the new fluid, or a bubble, has reached the
+ *  waveguide) and then three successive previews differ from their
+ *  predecessors by less than the configured flush tolerance and (if a
+ *  target signature is given) lie within twice the tolerance of the
+ *  target. A waveguide that is stable from the start gives no evidence
+ *  that the fluid path was displaced, so that step runs its full time.
+ *  At least 40% of the time limit is always used.
+ *  When spectral termination is disabled or no previews are
+ *  available, this just pauses for the time limit.
+ *  @param step is a name for the step, used in log messages
+ *  @param maxTime is the maximum time for the step in seconds
+ *  @param target is the signature expected at the end of the step,
+ *  or an empty vector
+ *  @param last is used to return the last signature observed
+ *  @return true if the spectrum converged before the time limit
+ */
+bool Operations::pumpUntilClean(const char* step, double maxTime,
+								const vector<double>& target,
+								vector<double>& last) {
+	double tolerance = config.getFlushTolerance();
+	double start = Util::elapsedTime();
+	double now = start;
+	last.clear();
+	int stable = 0;
+	bool changed = false;	// set once a preview differs from the last
+	while (tolerance > 0 && now - start < maxTime) {
+		interrupt.pause(min(0.5, maxTime - (now - start)));
+		vector<double> sig;
+		if (!previewSignature(sig)) break;
+		now = Util::elapsedTime();
+		bool settled = signatureDistance(sig, last) < tolerance;
+		if (!settled && last.size() > 0) changed = true;
+		if (settled && (target.size() == 0 ||
+						signatureDistance(sig, target) < 2 * tolerance))
+			stable++;
+		else
+			stable = 0;
+		last.swap(sig);
+		if (changed && stable >= 3 && now - start >= .4 * maxTime) {
+			logger.details("%s converged after %.1f of %.1f seconds",
+						   step, now - start, maxTime);
+			return true;
+		}
+	}
+	if (now - start < maxTime) interrupt.pause(maxTime - (now - start));
+	return false;
 }
 
 /** Flush system at end of sample cycle.
@@ -436,24 +483,46 @@ void Operations::flushFilter() {
  *  tubing does not contain reference fluid.
  */
 void Operations::flush() {
+	TelemetryRecorder telemetry("flush");
+	vector<double> none, last;
+	if (config.getFlushTolerance() > 0) spectrometer.setLights(0b111);
+		// lights stay on, so that each step can end as soon as the
+		// waveguide spectrum settles
+
 	filterValve.select(0);
 	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
 		logger.details("flushing mixing coils");
 		samplePump.on(4);
-		mixValves.select(1,0); interrupt.pause(10.0); 
-		mixValves.select(1,1); interrupt.pause(5.0); 
-		mixValves.select(0,1); interrupt.pause(10.0);
+		mixValves.select(1,0); pumpUntilClean("coil1 flush", 10., none, last);
+		mixValves.select(1,1); pumpUntilClean("coil flush", 5., none, last);
+		mixValves.select(0,1); pumpUntilClean("coil2 flush", 10., none, last);
 	}
 
 	logger.details("flushing filter and waveguide");
 	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
 		mixValves.select(0, 0);
 	}
-	samplePump.on(4); interrupt.pause(30); samplePump.off();
+	samplePump.on(4); pumpUntilClean("sample flush", 30., none, last);
+	samplePump.off();
 
 	if (referencePump.isEnabled()) {
-		referencePump.on(4); interrupt.pause(15); referencePump.off();
+		// end the reference flush once the waveguide matches the
+		// spectrum recorded at the end of earlier flushes
+		vector<double> target;
+		cstate.getFlushSignature(target);
+		referencePump.on(4);
+		bool done = pumpUntilClean("reference flush", 15., target, last);
+		referencePump.off();
+		if (done || (last.size() > 0 &&
+					 signatureDistance(last, target) > 2 *
+					 config.getFlushTolerance())) {
+			// update the signature when the flush converged, or when a
+			// full-length flush no longer matches the old signature
+			// (for example, after a change of reference fluid)
+			cstate.setFlushSignature(last);
+		}
 	}
+	spectrometer.setLights(0b000);
 
 /*
 Note: we flush with unfiltered water because we do not want to
@@ -505,27 +574,32 @@ Of course, the second choice is easier to implement.
  *  1/16" which gives a volume of .05 ml per inch of tubing.
  */
 void Operations::purgeBubbles() {
+	{
+		// flush saves its own record, so this one ends before it starts
+		TelemetryRecorder telemetry("purgeBubbles");
 
-	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
-		reagent1Pump.off(); reagent2Pump.off(); mixValves.select(0,0);
-	}
-	samplePump.off(); referencePump.off(); filterValve.select(0);
-		// port valves are configured before calling
+		if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
+			reagent1Pump.off(); reagent2Pump.off(); mixValves.select(0,0);
+		}
+		samplePump.off(); referencePump.off(); filterValve.select(0);
+			// port valves are configured before calling
 
-	logger.details("purging air bubbles");
+		logger.details("purging air bubbles");
 
-	// run reference pump long enough to clear "stub"
-	double rate = 4.0;
-	if (referencePump.isEnabled()) {
-		referencePump.on(rate); interrupt.pause(10.0); referencePump.off();
-	}
-	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
-		// run reagent pumps long enough to clear bubbles from
-		// supply tubing
-		mixValves.select(1,0);
-		reagent1Pump.on(rate); interrupt.pause(10.0); reagent1Pump.off();
-		mixValves.select(0,1);
-		reagent2Pump.on(rate); interrupt.pause(10.0); reagent2Pump.off();
+		// run reference pump long enough to clear "stub"; these steps
+		// clear tubing the waveguide cannot see, so they are not cut short
+		double rate = 4.0;
+		if (referencePump.isEnabled()) {
+			referencePump.on(rate); interrupt.pause(10.0); referencePump.off();
+		}
+		if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
+			// run reagent pumps long enough to clear bubbles from
+			// supply tubing
+			mixValves.select(1,0);
+			reagent1Pump.on(rate); interrupt.pause(10.0); reagent1Pump.off();
+			mixValves.select(0,1);
+			reagent2Pump.on(rate); interrupt.pause(10.0); reagent2Pump.off();
+		}
 	}
 	flush(); // use flush to complete the purge, flush reagents and
 		 // leave spectrometer with reference fluid
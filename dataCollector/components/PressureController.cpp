@@ -0,0 +1,225 @@
+/** @file PressureController.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#include "PressureController.h"
+#include "Pump.h"
+#include "SupplyPump.h"
+#include "Status.h"
+#include "Config.h"
+#include "CollectorState.h"
+#include "Operations.h"
+
+using std::this_thread::sleep_until;
+
+namespace fizz {
+
+extern Logger logger;
+extern Pump samplePump;
+extern SupplyPump reagent1Pump;
+extern SupplyPump reagent2Pump;
+extern Status hwStatus;
+extern Config config;
+extern CollectorState cstate;
+
+/** Constructor for PressureController object. */
+PressureController::PressureController() {
+	volume = 0; maxRate = minRate = 0; r1Frac = r2Frac = 0;
+	pumped = 0; rate = 0;
+	filterResistance = 0; resistanceTrend = 0;
+	failFlag = false;
+	activeFlag = false; quitFlag = false;
+}
+
+/** Load state variables.
+ *  Should only be called from main thread before other threads start running.
+ */
+void PressureController::initState() {
+	cstate.getFilterResistance(filterResistance, resistanceTrend);
+}
+
+/** Start pumping a filtered sample under closed-loop control.
+ *  The filter valve and mixing valves must be configured by the caller.
+ *  @param volume is the total volume to be pumped in ml, including reagents
+ *  @param maxRate is the maximum total pump rate in ml/m
+ *  @param r1Frac is the fraction of the volume for reagent1
+ *  @param r2Frac is the fraction of the volume for reagent2
+ */
+void PressureController::start(double volume, double maxRate,
+							   double r1Frac, double r2Frac) {
+	stop();
+	unique_lock<mutex> lck(pcMtx);
+	this->volume = volume; this->maxRate = maxRate;
+	this->minRate = maxRate / 100;
+	this->r1Frac = r1Frac; this->r2Frac = r2Frac;
+	pumped = 0; rate = 0; failFlag = false;
+	quitFlag = false; activeFlag = true;
+	myThread = thread(startThread, ref(*this));
+}
+
+/** Stop the control loop and turn off the pumps.
+ *  Returns after the controller thread has terminated.
+ */
+void PressureController::stop() {
+	quitFlag = true;
+	if (myThread.joinable()) myThread.join();
+	activeFlag = false;
+}
+
+/** Work-around used to initiate thread execution. */
+void PressureController::startThread(PressureController& pc) {
+	pc.run();
+}
+
+/** Set the pump rates for a given total rate.
+ *  @param newRate is the total pump rate; the rates for the sample
+ *  pump and reagent pumps are set in proportion to the reagent fractions
+ */
+void PressureController::setRate(double newRate) {
+	double spRate = 0, r1Rate = 0, r2Rate = 0;
+	Operations::computePumpRates(newRate, r1Frac, r2Frac,
+								 spRate, r1Rate, r2Rate);
+	samplePump.on(spRate);
+	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
+		reagent1Pump.on(r1Rate); reagent2Pump.on(r2Rate);
+	}
+	unique_lock<mutex> lck(pcMtx);
+	rate = newRate;
+}
+
+/** Control loop, run by the controller thread.
+ *  The rate is set to u0 + kp*e + ki*I where e is the difference between
+ *  the target pressure and the current filter pressure, I is the integral
+ *  of e and u0 is the starting rate. The integral is frozen while the
+ *  rate is saturated (anti-windup). If the pressure exceeds the maximum,
+ *  the rate is cut to the minimum immediately; if it stays above the
+ *  maximum for a full second at the minimum rate, the loop gives up.
+ */
+void PressureController::run() {
+	const double dt = 0.05;		// control interval in seconds
+	double targetFrac, kpNorm, kiNorm;
+	config.getPressureControl(targetFrac, kpNorm, kiNorm);
+	double maxPressure = config.getMaxPressure();
+	double target = targetFrac * maxPressure;
+	double kp = kpNorm * maxRate / target;	// (ml/m) per psi
+	double ki = kiNorm * maxRate / target;	// (ml/m) per psi-second
+
+	logger.details("PressureController: pumping %.2f ml, max rate %.2f ml/m, "
+				   "target %.1f psi", volume, maxRate, target);
+
+	double u0 = maxRate / 5;	// start low to avoid pressure spike
+	double integral = 0; double overTime = 0;
+	double sumPQ = 0, sumQQ = 0;	// for resistance estimate
+	double vol = 0; bool fail = false;
+	setRate(u0); double u = u0;
+
+	auto nextTime = chrono::steady_clock::now();
+	while (!quitFlag) {
+		nextTime += chrono::milliseconds(50);
+		sleep_until(nextTime);
+
+		double p = hwStatus.filterPressure();
+		vol += u * dt / 60;
+		if (vol >= volume) break;
+
+		// least-squares fit of p = R*q, with old samples fading out
+		if (u > 2 * minRate) {
+			sumPQ = .99 * sumPQ + p * u; sumQQ = .99 * sumQQ + u * u;
+		}
+
+		double newRate;
+		if (p > maxPressure) {
+			overTime += dt;
+			if (overTime > 1.0 && u <= minRate) {
+				logger.warning("PressureController: cannot hold pressure "
+							   "below %.1f psi", maxPressure);
+				fail = true; break;
+			}
+			newRate = minRate;
+			integral = (minRate - u0) / ki;	// restart from minimum
+		} else {
+			overTime = 0;
+			double e = target - p;
+			newRate = u0 + kp * e + ki * (integral + e * dt);
+			if ((newRate < maxRate || e < 0) && (newRate > minRate || e > 0))
+				integral += e * dt;
+			newRate = max(minRate, min(maxRate, newRate));
+		}
+		// avoid flooding the serial link with tiny rate changes
+		if (fabs(newRate - u) > .02 * maxRate ||
+			(newRate != u && (newRate == minRate || newRate == maxRate))) {
+			setRate(newRate); u = newRate;
+		}
+		unique_lock<mutex> lck(pcMtx);
+		pumped = vol;
+	}
+	samplePump.off();
+	if (config.getHardwareConfig() == Config::TWO_REAGENTS) {
+		reagent1Pump.off(); reagent2Pump.off();
+	}
+	if (!quitFlag && !fail && sumQQ > 0) updateResistance(sumPQ / sumQQ);
+
+	unique_lock<mutex> lck(pcMtx);
+	pumped = vol; rate = 0; failFlag = fail;
+	activeFlag = false;
+	logger.details("PressureController: pumped %.2f ml", vol);
+}
+
+/** Update the filter resistance estimate at the end of a sample.
+ *  The trend is an exponentially weighted average of the change in
+ *  resistance from one sample to the next. A large drop in resistance
+ *  indicates the filter was backflushed or replaced, so the trend is reset.
+ *  @param r is the resistance measured for the sample just taken
+ */
+void PressureController::updateResistance(double r) {
+	unique_lock<mutex> lck(pcMtx);
+	if (filterResistance <= 0 || r < .5 * filterResistance) {
+		resistanceTrend = 0;
+	} else {
+		resistanceTrend = .7 * resistanceTrend + .3 * (r - filterResistance);
+	}
+	filterResistance = r;
+	lck.unlock();
+	cstate.setFilterResistance(filterResistance, resistanceTrend);
+	double left = samplesLeft();
+	if (left >= 0 && left < 3) {
+		logger.warning("PressureController: filter resistance %.3f psi "
+					   "per ml/m, backflush needed within %.0f samples",
+					   r, left);
+	} else {
+		logger.details("PressureController: filter resistance %.3f psi "
+					   "per ml/m", r);
+	}
+}
+
+/** Predict the number of samples that can be taken before the filter
+ *  needs to be backflushed. The filter is considered clogged when holding
+ *  the target pressure limits the flow to a quarter of the maximum rate.
+ *  @return the predicted number of samples, or -1 if the filter
+ *  resistance is not increasing
+ */
+double PressureController::samplesLeft() {
+	double targetFrac, kpNorm, kiNorm;
+	config.getPressureControl(targetFrac, kpNorm, kiNorm);
+	double critical = targetFrac * config.getMaxPressure()
+					  / (.25 * samplePump.getMaxRate());
+	unique_lock<mutex> lck(pcMtx);
+	if (filterResistance >= critical) return 0;
+	if (resistanceTrend <= 0) return -1;
+	return (critical - filterResistance) / resistanceTrend;
+}
+
+/** Determine if the filter should be backflushed soon.
+ *  @return true if fewer than three samples are predicted before
+ *  the filter becomes clogged
+ */
+bool PressureController::needsBackflush() {
+	double left = samplesLeft();
+	return left >= 0 && left < 3;
+}
+
+} // ends namespace
@@ -6,6 +6,7 @@
  *  This software was developed for Mote Marine Research Laboratory.
  */
 
+#include <algorithm>
 #include "Util.h"
 
 #include "Pump.h"
@@ -33,6 +34,8 @@ using std::this_thread::sleep_for;
 namespace fizz {
 
 extern Logger logger;
+extern LogTarget log2stderr;
+extern LogTarget log2debug;
 extern Pump samplePump;
 extern SupplyPump referencePump;
 extern SupplyPump reagent1Pump;
@@ -61,6 +64,11 @@ ScriptInterp::ScriptInterp() {
 	cycleNumber = 1;
 	currentLine = 0;
 	zombieFlag = false;
+	bandsValid = false;
+	band440 = band676 = 0;
+	cycleDelay = 0;
+	currentMission = -1;
+	sampling.store(true);
 }
 
 /** Load state variables.
@@ -68,6 +76,7 @@ ScriptInterp::ScriptInterp() {
  */
 void ScriptInterp::initState() {
 	cycleNumber = cstate.getCycleNumber();
+	cstate.getMissionState(missionState);
 }
 
 /** Read the script file, check syntax and save in the script vector.
@@ -85,6 +94,7 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 		return -1;
 	}
 	script.clear();		// required when re-starting script
+	missions.clear();
 
 	logger.info("ScriptInterp: opened %s", scriptFileName.c_str());
 	const int maxDepth = 100;
@@ -106,10 +116,10 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 		if (line.length() == 0) continue;
 		int i = line.find('#');
 		if (i >= 0) line.erase(i); // strip comments;
-		Util::split(line, 5, words);
+		Util::split(line, 8, words);
 		if (words.size() == 0) continue;   // ignore blank lines;
 
-		logger.trace("ScriptInterp: parsing %s", line.c_str());
+		LOG_TRACE("ScriptInterp: parsing %s", line.c_str());
 
 		// check for run directive - it must come first
 		if (words[0].compare("run") == 0) {
@@ -121,6 +131,25 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 			continue;
 		}
 
+		// mission directive ends the previous mission (if any)
+		// and starts a new one
+		if (words[0].compare("mission") == 0) {
+			if (scriptStep != 0 && missions.size() == 0) {
+				scriptFile.close(); return lineNumber;
+			}
+			if (missions.size() > 0) {
+				if (!endBlock(parseStack, top)) {
+					scriptFile.close(); return lineNumber;
+				}
+				missions.back().endStep = scriptStep = script.size();
+			}
+			indent = 0;
+			if (!parseMission(words, scriptStep)) {
+				scriptFile.close(); return lineNumber;
+			}
+			continue;
+		}
+
 		// parse line of input, returning if exception thrown
 		try { 
 			if (!parseLine(words, line, lineNumber)) {
@@ -130,11 +159,11 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 			scriptFile.close(); return lineNumber;
 		}
 
-		logger.trace("ScriptInterp: script[%ld]=%s", scriptStep,
+		LOG_TRACE("ScriptInterp: script[%ld]=%s", scriptStep,
 			     script[scriptStep].toString().c_str());
   
 		i = line.find(words[0]);
-		logger.trace("handling indent new=%d old=%d", i, indent);
+		LOG_TRACE("handling indent new=%d old=%d", i, indent);
 		if (i > indent) {
 			if (top > maxDepth - 1 || scriptStep == 0 ||
 				  (script[scriptStep-1].op != On and 
@@ -149,7 +178,7 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 				// a "repeat" command);
 			indent = i;
 			top++;
-			logger.trace("ScriptInterp: increasing indent");
+			LOG_TRACE("ScriptInterp: increasing indent");
 		} else if (i < indent) {
 			top--;
 			if (top < 0 || script[scriptStep-1].op == On ||
@@ -169,11 +198,11 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 				Command cmd(RepeatEnd, 0);
 				cmd.repeatEnd.firstStep = step;
 				script.insert(script.end()-1, cmd);
-				logger.trace("ScriptInterp: script[%d]=%s",
+				LOG_TRACE("ScriptInterp: script[%d]=%s",
 					scriptStep,
 					script[scriptStep].toString().c_str());
 				scriptStep++;
-				logger.trace("ScriptInterp: script[%d]=%s",
+				LOG_TRACE("ScriptInterp: script[%d]=%s",
 					scriptStep,
 					script[scriptStep].toString().c_str());
 				script[step].repeat.nextStep = scriptStep;
@@ -182,7 +211,7 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 					// past body of loop when loop counter
 					// reaches limit
 			}
-			logger.trace("ScriptInterp: decreasing indent");
+			LOG_TRACE("ScriptInterp: decreasing indent");
 		} else { // no change to indent;
 			// previous command must not be "on" or "repeat";
 			if (scriptStep != 0 &&
@@ -194,14 +223,38 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 		scriptStep++;
 	}
 
-	// unwind stack at end of script;
+	if (!endBlock(parseStack, top)) {
+		scriptFile.close(); return lineNumber;
+	}
+	if (missions.size() > 0) missions.back().endStep = script.size();
+	for (Mission& m : missions) {
+		m.fluidPerRun = fluidUsage(m.firstStep, m.endStep);
+		logger.details("ScriptInterp: mission %s, steps %ld-%ld, "
+					   "period %ld, %.1f ml per run", m.name.c_str(),
+					   m.firstStep, m.endStep-1, m.period, m.fluidPerRun);
+	}
+
+	scriptFile.close();
+	logger.details("successfully parsed script");
+	return 0;
+}
+
+/** Finish a block of script commands at the end of a mission or the
+ *  end of the script.
+ *  Unwinds the parse stack, completing any on and repeat commands
+ *  that are still open, then adds a dummy pause to end the block.
+ *  @param parseStack is the stack used to track indentation
+ *  @param top is the index of the first unused slot on the stack
+ *  @return false if an error was detected, else true
+ */
+bool ScriptInterp::endBlock(vector<pair<int,int>>& parseStack, int& top) {
+	long scriptStep = script.size();
 	while (top > 0) {	
 		top--;
 		if (script[scriptStep-1].op == On ||
 		    script[scriptStep-1].op == Repeat) {
-			scriptFile.close(); return lineNumber;
+			return false;
 		}
-		indent = parseStack[top].first;
 		int step = parseStack[top].second;
 		if (script[step].op == On) {
 			script[step].on.nextStep = scriptStep;
@@ -213,21 +266,94 @@ int ScriptInterp::readScript(const string& scriptFileName) {
 			Command cmd(RepeatEnd, 0);
 			cmd.repeatEnd.firstStep = step;
 			script.push_back(cmd);
-			logger.trace("ScriptInterp: script[%d]=%s", scriptStep,
+			LOG_TRACE("ScriptInterp: script[%d]=%s", scriptStep,
 				     script[scriptStep].toString().c_str());
 			scriptStep++;
 			script[step].repeat.nextStep = scriptStep;
 		}
-		logger.trace("ScriptInterp: decreasing indent");
+		LOG_TRACE("ScriptInterp: decreasing indent");
 	}
-	// add dummy pause to end of script
+	// add dummy pause to end of block
 	Command cmd(Pause, 0);
 	cmd.pause.delay = 0.;
 	script.push_back(cmd);
+	return true;
+}
 
-	scriptFile.close();
-	logger.details("successfully parsed script");
-	return 0;
+/** Parse a mission directive and add a new mission.
+ *  The directive has the form
+ *  mission name period [window=hh:mm-hh:mm] [priority=p] [runs=n] [fluid=v]
+ *  @param words is the vector of words in the directive
+ *  @param firstStep is the index of the first script step for the mission
+ *  @return false if error detected, else true
+ */
+bool ScriptInterp::parseMission(vector<string>& words, long firstStep) {
+	if (words.size() < 3) return false;
+	Mission m;
+	m.name = words[1];
+	if (m.name.find_first_of(":.\"") != string::npos) return false;
+	for (Mission& x : missions)
+		if (x.name == m.name) return false;
+	m.period = strtol(words[2].c_str(),0,0);
+	if (m.period < 1) return false;
+	m.firstStep = m.endStep = firstStep;
+	m.winStart = 0; m.winEnd = 1440; m.priority = 1;
+	m.maxRuns = 0; m.maxFluid = 0; m.fluidPerRun = 0;
+	for (unsigned int i = 3; i < words.size(); i++) {
+		size_t j = words[i].find('=');
+		if (j == string::npos) return false;
+		string key = words[i].substr(0,j);
+		string value = words[i].substr(j+1);
+		if (key == "window") {
+			int h1, m1, h2, m2;
+			if (sscanf(value.c_str(), "%d:%d-%d:%d",
+					   &h1, &m1, &h2, &m2) != 4)
+				return false;
+			m.winStart = 60*h1 + m1; m.winEnd = 60*h2 + m2;
+			if (m.winStart < 0 || m.winStart >= 1440 ||
+				m.winEnd <= 0 || m.winEnd > 1440 || m.winStart == m.winEnd)
+				return false;
+		} else if (key == "priority") {
+			m.priority = atoi(value.c_str());
+		} else if (key == "runs") {
+			m.maxRuns = atoi(value.c_str());
+		} else if (key == "fluid") {
+			m.maxFluid = atof(value.c_str());
+		} else {
+			return false;
+		}
+	}
+	missions.push_back(m);
+	return true;
+}
+
+/** Estimate the volume of reference fluid and reagents used by
+ *  a range of script steps. Commands controlled by on directives are
+ *  included, so the estimate is conservative.
+ *  @param firstStep is the first step in the range
+ *  @param endStep is the step following the last step in the range
+ *  @return the volume in ml
+ */
+double ScriptInterp::fluidUsage(long firstStep, long endStep) {
+	double vol = 0;
+	for (long i = firstStep; i < endStep; i++) {
+		Command& cmd = script[i];
+		if (cmd.op == ReferenceSample) {
+			vol += cmd.refSample.volume;
+		} else if (cmd.op == OptimizeIntTime) {
+			vol += cmd.optimizeIntTime.volume;
+		} else if (cmd.op == FilteredSample) {
+			vol += cmd.filSample.volume *
+				   (cmd.filSample.frac1 + cmd.filSample.frac2);
+		} else if (cmd.op == UnfilteredSample) {
+			vol += cmd.unfSample.volume *
+				   (cmd.unfSample.frac1 + cmd.unfSample.frac2);
+		} else if (cmd.op == FilteredSampleAdaptive) {
+			vol += cmd.fsaSample.volume *
+				   (cmd.fsaSample.frac1 + cmd.fsaSample.frac2);
+		}
+	}
+	return vol;
 }
 
 /** Parse one line of the script and append internal representation 
@@ -377,6 +503,7 @@ bool ScriptInterp::parseLine(vector<string>& words, string& line, int lineNum) {
  *  to pumps, valves and lights.
  */
 void scriptIntHandler() {
+	Arduino::Batch batch(arduino);
 	Operations::idleMode(); powerControl.off();
 		// note communication is not disabled
 }
@@ -410,7 +537,7 @@ void ScriptInterp::startThread(ScriptInterp& si) {
 void ScriptInterp::end() {
 	unique_lock<mutex> lck(mtx);
     logger.details("ScriptInterp: terminating thread");
-    quitFlag = true;
+    quitFlag = true; sampling.store(false);
 	interrupt.request(thread_id, true);
 }
 
@@ -434,6 +561,7 @@ void ScriptInterp::join() {
 void ScriptInterp::stop() {
     unique_lock<mutex> lck(mtx);
     logger.details("ScriptInterp: suspending sample collection");
+	sampling.store(false);
 	if (!interrupt.inProgress(thread_id)) interrupt.request(thread_id);
 }
 
@@ -444,7 +572,7 @@ void ScriptInterp::stop() {
 void ScriptInterp::resume() {
 	unique_lock<mutex> lck(mtx);
     logger.details("ScriptInterp: resuming sample collection");
-	interrupt.clear(thread_id);
+	interrupt.clear(thread_id); sampling.store(true);
 }
 
 /** Restart execution of the sample collection thread.
@@ -455,14 +583,24 @@ void ScriptInterp::resume() {
 void ScriptInterp::start() {
     unique_lock<mutex> lck(mtx);
     logger.details("ScriptInterp: starting sample collection");
-	setCycleNumber(1); interrupt.clear(thread_id);
+	setCycleNumber(1); interrupt.clear(thread_id); sampling.store(true);
 }
 
-/** Return true if sampling is turned on, else false.
+/** Re-read the config file, after it has been changed.
+ *  Applies the new log levels and failure handling, and saves the
+ *  new config in the data file, as the console's reload command does.
  */
-bool ScriptInterp::samplingEnabled() {
-    unique_lock<mutex> lck(mtx);
-	return !interrupt.inProgress(thread_id);
+void ScriptInterp::reloadConfig() {
+	if (!config.read()) {
+		logger.error("ScriptInterp: cannot reload changed config file");
+		return;
+	}
+	log2stderr.setLevel(config.getLogLevel("stderr"));
+	log2debug.setLevel(config.getLogLevel("debug"));
+	if (arduino.isEquipped())
+		arduino.send(config.getIgnoreFailures() ? "F0" : "F1");
+	dataStore.saveConfigRecord();
+	logger.info("ScriptInterp: config file changed, reloaded and saved");
 }
 
 /** Run the script repeatedly, sleeping between sample cycles.  */
@@ -474,6 +612,9 @@ void ScriptInterp::run() {
 
 	int failedCycleCount = 0;
 	while (!quitFlag) {
+		// edits to the config file take effect at the next cycle
+		if (config.changed()) reloadConfig();
+
 		powerControl.on();
 		if (dataStore.getSpectrumCount() > 2000) {
 			setCycleNumber(1);
@@ -488,26 +629,25 @@ void ScriptInterp::run() {
 		}
 
 		try {
-			portValve.select(
-				config.getPortSwitching() ? (cycleNumber & 1) : 0);
-			if (cycleNumber == 1) {
+			// select missions to run now; -1 means the whole script
+			vector<int> batch;
+			if (missions.size() == 0) {
+				batch.push_back(-1);
+			} else {
+				if (cycleNumber == 1) resetMissions();
+				long now = currentMinute();
+				if (scheduleMissions(now, batch) > now) batch.clear();
+			}
+			if (cycleNumber == 1 && batch.size() > 0) {
+				portValve.select(
+					config.getPortSwitching() ? (cycleNumber & 1) : 0);
 				Operations::purgeBubbles();
 				dataStore.saveDeploymentRecord();
 				dataStore.saveConfigRecord();
 				dataStore.saveScriptRecord();
 				dataStore.saveMaintLogRecord();
 			}
-			sampleCycle(cycleNumber);
-			portValve.select(
-				config.getPortSwitching() ? ((cycleNumber+1) & 1) : 0);
-			Operations::flush();
-				// flush mixing coils (if present), filter and
-				// waveguide; do this using port valve config
-				// for next cycle, so that intake tubing does
-				// not contain ref fluid at start of next cycle
-			setCycleNumber(cycleNumber+1);
-				// increment after flush, so that if interrupted
-				// during flush, will not advance to next cycle
+			for (int i : batch) runMission(i);
 			failedCycleCount = 0;
 		} catch(PressureException& e) {
 			Operations::idleMode();
@@ -532,12 +672,12 @@ void ScriptInterp::run() {
 		}
 
 		// delay until next cycle
-		if (interCyclePeriod == 0) continue;
+		long delta = nextCycleDelay();
+		if (delta == 0) continue;
 
 		powerControl.off();
 		dataStore.close();
 
-		long delta = nextCycleDelay();
 		logger.details("ScriptInterp: going to sleep until next cycle "
 					"(%d minutes)", delta);
 
@@ -557,8 +697,14 @@ void ScriptInterp::run() {
 		try {
 			Operations::idleMode(); 
 			double wakeTime = Util::elapsedTime() + 60. * delta;
-			while (Util::elapsedTime() < wakeTime) {
-				interrupt.pause(5); arduino.log();
+			double now = Util::elapsedTime();
+			while (now < wakeTime) {
+				// when the arduino pushes its log messages, there's
+				// no need to wake up to collect them
+				interrupt.pause(arduino.isLogPushed() ?
+								wakeTime - now : min(5., wakeTime - now));
+				arduino.log();
+				now = Util::elapsedTime();
 			}
 			if (!commLink.isActive()) {
 				commLink.enable();
@@ -577,11 +723,199 @@ void ScriptInterp::run() {
 	return;
 }
 
-/** Compute number of minutes to start of next cycle.
+/** Run one sample cycle for a mission, then flush.
+ *  @param i is the index of the mission, or -1 to run the whole script
+ *  when the script does not define missions
+ */
+void ScriptInterp::runMission(int i) {
+	long now = currentMinute();
+	currentMission = i;
+	dataStore.setMission(i < 0 ? "" : missions[i].name);
+	portValve.select(config.getPortSwitching() ? (cycleNumber & 1) : 0);
+	if (i < 0) {
+		sampleCycle(cycleNumber, 0, script.size());
+	} else {
+		Mission& m = missions[i];
+		MissionState& ms = stateOf(m);
+		logger.info("running mission %s, cycle %ld", m.name.c_str(),
+					ms.cycleCount+1);
+		sampleCycle(ms.cycleCount+1, m.firstStep, m.endStep);
+	}
+	portValve.select(
+		config.getPortSwitching() ? ((cycleNumber+1) & 1) : 0);
+	Operations::flush();
+		// flush mixing coils (if present), filter and
+		// waveguide; do this using port valve config
+		// for next cycle, so that intake tubing does
+		// not contain ref fluid at start of next cycle
+	if (i >= 0) {
+		Mission& m = missions[i];
+		MissionState& ms = stateOf(m);
+		if (ms.day != now / 1440) {
+			ms.day = now / 1440; ms.runs = 0; ms.fluid = 0;
+		}
+		ms.lastRun = now; ms.cycleCount++;
+		ms.runs++; ms.fluid += m.fluidPerRun;
+		long minPeriod, maxPeriod; double threshold; string label;
+		ms.delay = (config.getAdaptiveSampling(minPeriod, maxPeriod,
+											   threshold, label) &&
+					bandsValid ? cycleDelay : 0);
+		cstate.setMissionState(missionState);
+	}
+	currentMission = -1;
+	setCycleNumber(cycleNumber+1);
+		// increment after flush, so that if interrupted
+		// during flush, will not advance to next cycle
+}
+
+/** Get the current time in minutes.
  *  Uses arduino real-time clock if available.
+ *  @return the number of minutes since the start of 1970
+ */
+long ScriptInterp::currentMinute() {
+	string s = hwStatus.dateTimeString();
+	struct tm t; memset(&t, 0, sizeof(t));
+	if (strptime(s.c_str(), "%Y-%m-%d %H:%M:%S", &t) == 0)
+		return time(0) / 60;
+	return timegm(&t) / 60;
+}
+
+/** Get the scheduling state for a mission, creating it if needed. */
+MissionState& ScriptInterp::stateOf(const Mission& m) {
+	auto p = missionState.find(m.name);
+	if (p != missionState.end()) return p->second;
+	MissionState& ms = missionState[m.name];
+	ms.lastRun = -1; ms.cycleCount = 0;
+	ms.day = 0; ms.runs = 0; ms.fluid = 0; ms.delay = 0;
+	return ms;
+}
+
+/** Reset the missions, so that all run at the next opportunity.
+ *  Daily budgets are not reset.
+ */
+void ScriptInterp::resetMissions() {
+	for (Mission& m : missions) {
+		MissionState& ms = stateOf(m);
+		ms.lastRun = -1; ms.cycleCount = 0; ms.delay = 0;
+	}
+	cstate.setMissionState(missionState);
+}
+
+/** Determine if a time falls within the time-of-day window for a mission.
+ *  @param m is a mission
+ *  @param t is a time in minutes
+ */
+bool ScriptInterp::inWindow(const Mission& m, long t) {
+	int tod = t % 1440;
+	if (m.winStart < m.winEnd)
+		return tod >= m.winStart && tod < m.winEnd;
+	return tod >= m.winStart || tod < m.winEnd;
+}
+
+/** Determine if a mission has used its daily budget.
+ *  @param m is a mission
+ *  @param t is a time in minutes
+ *  @return true if running the mission at time t would exceed the
+ *  budget for the day containing t
+ */
+bool ScriptInterp::overBudget(const Mission& m, long t) {
+	MissionState& ms = stateOf(m);
+	if (ms.day != t / 1440) return false;
+	return (m.maxRuns > 0 && ms.runs >= m.maxRuns) ||
+		   (m.maxFluid > 0 && ms.fluid + m.fluidPerRun > m.maxFluid);
+}
+
+/** Compute the time when a mission is next due to run.
+ *  @param m is a mission
+ *  @param now is the current time in minutes
+ *  @return the first time, no earlier than now, at which the mission
+ *  should run, taking into account its window and budget
+ */
+long ScriptInterp::missionDue(const Mission& m, long now) {
+	MissionState& ms = stateOf(m);
+	long due;
+	if (ms.lastRun < 0) {
+		due = now;
+	} else if (ms.delay > 0) {
+		due = ms.lastRun + ms.delay;
+	} else {
+		// align runs to multiples of the period, allowing for runs
+		// that started early to share a wake-up with another mission
+		due = ((ms.lastRun + m.period/4) / m.period + 1) * m.period;
+	}
+	if (due < now) due = now;
+	for (int i = 0; i < 4; i++) {
+		if (!inWindow(m, due)) {
+			long day = due / 1440;
+			long start = 1440 * day + m.winStart;
+			due = (start > due ? start : start + 1440);
+		} else if (overBudget(m, due)) {
+			due = 1440 * (due / 1440 + 1);
+		} else {
+			break;
+		}
+	}
+	return due;
+}
+
+/** Select the next missions to run.
+ *  The missions that are due earliest are selected, along with any
+ *  that come due within a quarter of their period afterwards and can
+ *  run at that time. Running these together minimizes the number of
+ *  wake-ups in powerSave mode.
+ *  @param now is the current time in minutes
+ *  @param batch is a vector in which the indices of the selected missions
+ *  are returned, in the order in which they should run (highest priority
+ *  first)
+ *  @return the time at which the selected missions should run
+ */
+long ScriptInterp::scheduleMissions(long now, vector<int>& batch) {
+	vector<long> due(missions.size());
+	long first = -1;
+	for (unsigned int i = 0; i < missions.size(); i++) {
+		due[i] = missionDue(missions[i], now);
+		if (first < 0 || due[i] < first) first = due[i];
+	}
+	batch.clear();
+	for (unsigned int i = 0; i < missions.size(); i++) {
+		Mission& m = missions[i];
+		if (due[i] == first ||
+			(due[i] - first <= m.period/4 && inWindow(m, first) &&
+			 !overBudget(m, first)))
+			batch.push_back(i);
+	}
+	sort(batch.begin(), batch.end(), [&](int a, int b) {
+		return missions[a].priority != missions[b].priority ?
+			   missions[a].priority > missions[b].priority : due[a] < due[b];
+	});
+	return first;
+}
+
+/** Compute number of minutes to start of next cycle.
+ *  When the script defines missions, this is the time until the next
+ *  mission is due. When adaptive sampling is enabled, this is the delay chosen by
+ *  planNextCycle at the end of the last cycle; otherwise, cycles are
+ *  aligned to wall-clock time using the interCyclePeriod.
  *  @return number of minutes to next cycle.
  */
 long ScriptInterp::nextCycleDelay() {
+	if (missions.size() > 0) {
+		vector<int> batch; long now = currentMinute();
+		return scheduleMissions(now, batch) - now;
+	}
+	long minPeriod, maxPeriod; double threshold; string label;
+	if (config.getAdaptiveSampling(minPeriod, maxPeriod, threshold, label) &&
+		cycleDelay > 0)
+		return cycleDelay;
+	return fixedCycleDelay();
+}
+
+/** Compute number of minutes to start of next cycle, for fixed schedule.
+ *  Uses arduino real-time clock if available.
+ *  @return number of minutes to next cycle.
+ */
+long ScriptInterp::fixedCycleDelay() {
+	if (interCyclePeriod <= 0) return 0;
 	string s = hwStatus.dateTimeString();
 	// format YYYY-mm-dd hh:mm:ss
 	int hours = atoi(s.substr(11,2).c_str());
@@ -589,16 +923,109 @@ long ScriptInterp::nextCycleDelay() {
 	return interCyclePeriod - (minutes % interCyclePeriod);
 }
 
+/** Measure absorbance in the 440 and 676 nm bands for a spectrum.
+ *  The values are computed from the dark-corrected intensity per ms
+ *  of integration time, averaged over a 10 nm band. They are not
+ *  referenced to a blank, but changes in these values track changes
+ *  in absorbance, since the reference intensity cancels out.
+ *  @param spect is the spectrum of the sample
+ *  @param darkLabel is the label of the dark spectrum for the sample
+ */
+void ScriptInterp::measureBands(const vector<double>& spect,
+								const string& darkLabel) {
+	auto dp = spectra.find(darkLabel);
+	const vector<double>* dark = (dp == spectra.end() ? 0 : &dp->second);
+	double intTime = spectrometer.getIntTime();
+	if (intTime <= 0) return;
+
+	double band[2]; const double center[2] = { 440, 676 };
+	vector<double>& wave = spectrometer.wavelengths;
+	for (int b = 0; b < 2; b++) {
+		double sum = 0; int n = 0;
+		for (unsigned int i = 0; i < wave.size() && i < spect.size(); i++) {
+			if (wave[i] < center[b] - 5 || wave[i] > center[b] + 5)
+				continue;
+			sum += spect[i] - (dark != 0 ? (*dark)[i] : 0);
+			n++;
+		}
+		if (n == 0) return;
+		band[b] = -log10(max(sum / (n * intTime), 1e-6));
+	}
+	band440 = band[0]; band676 = band[1]; bandsValid = true;
+}
+
+/** Choose the delay until the next sample cycle.
+ *  With adaptive sampling, the change in band absorbance relative to
+ *  a running baseline (an exponentially weighted moving average) is
+ *  used to select a delay between the configured bounds. Large changes
+ *  select the shortest period, no change selects the longest.
+ *  The baseline is saved in the state file, so that it survives
+ *  restarts in powerSave mode. Sets cycleDelay and delayReason.
+ */
+void ScriptInterp::planNextCycle() {
+	long minPeriod, maxPeriod; double threshold; string label;
+	long period = (currentMission >= 0 ? missions[currentMission].period
+									   : interCyclePeriod);
+	if (!config.getAdaptiveSampling(minPeriod, maxPeriod, threshold, label)) {
+		if (currentMission >= 0) {
+			cycleDelay = period; delayReason = "mission period";
+		} else {
+			cycleDelay = fixedCycleDelay(); delayReason = "fixed period";
+		}
+		return;
+	}
+	long defaultDelay = max(minPeriod, min(maxPeriod, period));
+	if (!bandsValid) {
+		cycleDelay = defaultDelay;
+		delayReason = "no " + label + " spectrum";
+		return;
+	}
+	const double alpha = 0.25;		// weight of newest value in baseline
+	double b440, b676;
+	int count = cstate.getBaseline(b440, b676);
+	if (count == 0) {
+		cstate.setBaseline(1, band440, band676);
+		cycleDelay = defaultDelay;
+		delayReason = "initializing baseline";
+		return;
+	}
+	double d440 = fabs(band440 - b440); double d676 = fabs(band676 - b676);
+	double change = max(d440, d676);
+	int wave = (d440 >= d676 ? 440 : 676);
+
+	char buf[100];
+	if (change >= threshold) {
+		cycleDelay = minPeriod;
+		snprintf(buf, sizeof(buf), "change %.4f at %dnm exceeds %.4f",
+				 change, wave, threshold);
+	} else {
+		cycleDelay = lround(maxPeriod -
+							(maxPeriod - minPeriod) * change / threshold);
+		snprintf(buf, sizeof(buf), "change %.4f at %dnm below %.4f",
+				 change, wave, threshold);
+	}
+	delayReason = buf;
+	cstate.setBaseline(count + 1, (1 - alpha) * b440 + alpha * band440,
+									(1 - alpha) * b676 + alpha * band676);
+}
+
 /** Perform a single sample cycle - one pass through the script.
- *  @param cycleNumber is the index of the current cycle.
- *  @return true if cycle completed successfully, else false.
+ *  @param cycleNumber is the index of the current cycle (for a mission,
+ *  the number of the mission's cycle)
+ *  @param firstStep is the first script step in the cycle
+ *  @param endStep is the step following the last step in the cycle
  */
-void ScriptInterp::sampleCycle(int cycleNumber) {
+void ScriptInterp::sampleCycle(long cycleNumber, long firstStep,
+							   long endStep) {
 	logger.border();
 	string dateTime = hwStatus.dateTimeString();
-	logger.info("starting cycle %2d at %s", cycleNumber, dateTime.c_str());
+	logger.info("starting cycle %2ld at %s", cycleNumber, dateTime.c_str());
+	console.publish("cycle", "{\"event\": \"start\", \"cycle\": " +
+					to_string(cycleNumber) + ", \"dateTime\": \"" +
+					dateTime + "\"}");
 
 	hwStatus.clearMaxFilterPressure(); hwStatus.recordDepth();
+	bandsValid = false;
 
 	// cycle lights to warmup at start of sample cycle
 	spectrometer.setLights(0b111); interrupt.pause(2);
@@ -607,8 +1034,8 @@ void ScriptInterp::sampleCycle(int cycleNumber) {
 	spectrometer.setLights(0b000); interrupt.pause(2);
 
 	// execute the script
-	unsigned int step = 0;
-	while (step < script.size()) {
+	long step = firstStep;
+	while (step < endStep) {
 		Command& cmd = script[step];
 		if (cmd.line > 0) currentLine = cmd.line;
 		int nextStep = step + 1;
@@ -619,7 +1046,7 @@ void ScriptInterp::sampleCycle(int cycleNumber) {
 			throw InterruptException();
 		}
 
-		logger.trace("ScriptInterp::sampleCycle: %s",
+		LOG_TRACE("ScriptInterp::sampleCycle: %s",
 			     cmd.toString().c_str());
 //cerr << "command: " << cmd.toString() << endl;
 		if (cmd.op == On) {
@@ -658,6 +1085,7 @@ void ScriptInterp::sampleCycle(int cycleNumber) {
 			spectrometer.getSpectrum(0b110);
 			vector<double>& spect = spectrometer.spectrum;
 			dataStore.saveSpectrumRecord(spect, *cmd.getDark.label);
+			spectra[*cmd.getDark.label] = spect;
 		} else if (cmd.op == GetSpectrum) {
 			spectrometer.getSpectrum(0b111);
 			vector<double>& spect = spectrometer.spectrum;
@@ -665,6 +1093,12 @@ void ScriptInterp::sampleCycle(int cycleNumber) {
 				*cmd.getSpectrum.label,
 				*cmd.getSpectrum.prereq1label,
 				*cmd.getSpectrum.prereq2label);
+			spectra[*cmd.getSpectrum.label] = spect;
+			long minPeriod, maxPeriod; double threshold; string label;
+			if (config.getAdaptiveSampling(minPeriod, maxPeriod,
+										   threshold, label) &&
+				*cmd.getSpectrum.label == label)
+				measureBands(spect, *cmd.getSpectrum.prereq1label);
 		} else if (cmd.op == CheckLights) {
 			bool lightStatus = spectrometer.checkLights();
 			if (!lightStatus)
@@ -687,7 +1121,7 @@ void ScriptInterp::sampleCycle(int cycleNumber) {
 		step = nextStep;
 		arduino.log();
 	}
-	logger.info("ending cycle %2d at %s", cycleNumber,
+	logger.info("ending cycle %2ld at %s", cycleNumber,
 		    hwStatus.dateTimeString().c_str());
 	currentLine = 0;  // end of cycle, no longer in script
 	// send key status information to logger and the dataStore
@@ -695,6 +1129,12 @@ void ScriptInterp::sampleCycle(int cycleNumber) {
 		    "integ time: %.2fms",
 			hwStatus.temperature(), hwStatus.voltage(),
 			hwStatus.maxFilterPressure(), spectrometer.getIntTime());
+	planNextCycle();
+	logger.info("next cycle in %ld minutes (%s)", cycleDelay,
+				delayReason.c_str());
+	console.publish("cycle", "{\"event\": \"end\", \"cycle\": " +
+					to_string(cycleNumber) + ", \"nextCycle\": " +
+					to_string(cycleDelay) + "}");
 	dataStore.saveCycleSummary();
 	logger.border();
 }
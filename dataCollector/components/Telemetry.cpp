@@ -0,0 +1,102 @@
+/** @file Telemetry.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#include "Telemetry.h"
+#include "Pump.h"
+#include "SupplyPump.h"
+#include "Valve.h"
+#include "MixValves.h"
+#include "LocationSensor.h"
+#include "Status.h"
+#include "Spectrometer.h"
+#include "PowerControl.h"
+#include "Config.h"
+#include "Console.h"
+#include "ScriptInterp.h"
+
+namespace fizz {
+
+extern Logger logger;
+
+extern Pump samplePump;
+extern SupplyPump referencePump;
+extern SupplyPump reagent1Pump;
+extern SupplyPump reagent2Pump;
+extern Valve portValve;
+extern Valve filterValve;
+extern MixValves mixValves;
+extern Spectrometer spectrometer;
+extern LocationSensor locationSensor;
+extern Status hwStatus;
+extern PowerControl powerControl;
+
+extern Config config;
+extern Console console;
+extern ScriptInterp scriptInterp;
+
+extern string serialNumber;
+extern string versionNumber;
+
+Telemetry::Telemetry() {
+	refreshTime.store(0);
+}
+
+/** Refresh the snapshot.
+ *  Uses getters that return cached values without locking, so this
+ *  does not wait for a spectrum acquisition, a pump command or a
+ *  suspension of the script thread to finish.
+ */
+void Telemetry::refresh() {
+	char buf[2000];
+
+	snprintf(buf, sizeof(buf), "{"
+		"\"dateTime\": \"%s\", \"cycleNumber\": %ld, "
+		"\"currentLine\": %d, "
+		"\"samplingEnabled\": %d, \"hardwareConfig\": \"%s\", "
+		"\"samplePump\": %.2f, "
+		"\"referencePump\": %.2f, "
+		"\"reagent1Pump\": %.2f, "
+		"\"reagent2Pump\": %.2f, "
+		"\"referenceSupply\": %d, \"reagent1Supply\": %d, "
+		"\"reagent2Supply\": %d, "
+		"\"filterValve\": %d, \"mixValves\": \"%s\", \"portValve\": %d, "
+		"\"lights\": \"%s\", \"spectrometer\": %d, "
+		"\"power\": \"%s\", \"integrationTime\": %.1f, "
+		"\"filterPressure\": %.2f, \"maxPressure\": %.2f, "
+		"\"temperature\": %.1f, \"batteryVoltage\": %.1f, "
+		"\"depth\": %.2f, \"leak\": %d, \"location\": \"%s\"," 
+		"\"serialNumber\": \"%s\", \"deploymentLabel\": \"%s\"," 
+		"\"versionNumber\": \"%s\", \"logLevel\": \"%s\"}",
+
+		hwStatus.dateTimeString().c_str(), scriptInterp.getCycleNumber(),
+		scriptInterp.getCurrentLine(), scriptInterp.samplingEnabled(),
+		(config.getHardwareConfig() == Config::BASIC ?
+							   "BASIC" : "TWO_REAGENTS"),
+		samplePump.getCurrentRate(), referencePump.getCurrentRate(), 
+		reagent1Pump.getCurrentRate(), reagent2Pump.getCurrentRate(),
+		(int) referencePump.peekLevel(),
+		(int) reagent1Pump.peekLevel(),
+		(int) reagent2Pump.peekLevel(),
+		filterValve.state(),
+		Util::bits2string(mixValves.state(), 2).c_str(),
+		portValve.state(),
+		Util::bits2string(spectrometer.getLights(),3).c_str(),
+		(spectrometer.getStatus() ? 1 : 0),
+		Util::bits2string(powerControl.get(),2).c_str(),
+		spectrometer.getIntTime(),
+		hwStatus.filterPressure(), hwStatus.maxFilterPressure(),
+		hwStatus.temperature(), hwStatus.voltage(), hwStatus.depth(), hwStatus.leak(),
+		locationSensor.getRecordedLocation().toString().c_str(),
+		serialNumber.c_str(), config.getDeploymentLabel().c_str(),
+		versionNumber.c_str(), 
+		logger.logLevel2string(console.getLevel()).c_str());
+	atomic_store(&current, make_shared<const string>(buf));
+	refreshTime.store(Util::elapsedTime());
+}
+
+} // ends namespace
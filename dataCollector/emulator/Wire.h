@@ -0,0 +1,78 @@
+/** \file Wire.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+/** Arduino api used by the arduino firmware, as provided by the emulator.
+ *  The firmware includes this file in place of the Arduino library's
+ *  Wire.h, so it can be compiled and run unchanged on a linux host.
+ *  The serial port is connected to a pseudo-terminal, the i2c devices
+ *  (DACs, port extender and real-time clock) and analog inputs are
+ *  simulated by arduinoEmulator.cpp.
+ */
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum { INPUT = 0, OUTPUT = 1, LOW = 0, HIGH = 1 };
+enum { A0 = 14, A1, A2, A3, A4, A5, A6, A7 };
+
+unsigned long millis();
+unsigned long micros();
+void	delay(unsigned long);
+void	pinMode(int, int);
+void	digitalWrite(int, int);
+int		analogRead(int);
+
+void	setup();
+void	loop();
+
+/** Serial port; input and output go through the emulator's pty. */
+class SerialPort {
+public:
+	void	begin(long) {}
+	void	setTimeout(long t) { timeout = t; }
+	operator bool() const { return true; }
+
+	int		available();
+	int		peek();
+	int		read();
+	size_t	readBytes(char*, size_t);
+	size_t	readBytesUntil(char, char*, size_t);
+
+	size_t	print(const char*);
+	size_t	write(uint8_t);
+	size_t	write(const uint8_t*, size_t);
+private:
+	long	timeout = 1000;		///< ms to wait in readBytes
+	int		timedRead();
+};
+
+/** I2C bus, connected to the simulated devices. */
+class TwoWire {
+public:
+	void	begin() {}
+	void	beginTransmission(int);
+	size_t	write(uint8_t);
+	int		endTransmission();
+	uint8_t	requestFrom(int, uint8_t);
+	int		available();
+	int		read();
+private:
+	int		adr = 0;			///< address of current transmission
+	uint8_t	txBuf[32];			///< bytes of current transmission
+	int		txLen = 0;
+	uint8_t	rxBuf[32];			///< bytes returned by requestFrom
+	int		rxLen = 0;
+	int		rxNext = 0;
+};
+
+extern SerialPort Serial;
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,506 @@
+/** @file arduinoEmulator.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+/** Arduino emulator, for exercising the serial link and the hardware
+ *  classes on a linux host, without the PHySS hardware.
+
+Usage: arduinoEmulator [options]
+
+  -link path      create a symbolic link to the pty (e.g. /tmp/ttyArduino)
+  -latency m[:j]  delay each reply by m ms, plus up to j ms of jitter
+  -drop p         drop a reply with probability p
+  -corrupt p      change one byte of a reply with probability p
+  -noise p        send random bytes ahead of a reply with probability p
+  -lose p         discard input from the host with probability p
+  -seed n         seed for the random number generator
+  -standalone     emulate an arduino with no control board
+  -noclock        emulate an arduino with no real-time clock
+  -leak           report a leak
+  -flow f         sample pump flow at full speed in ml/min (default 10)
+  -resistance r   filter pressure in psi per ml/min, for a new filter
+                  (default 1)
+  -clog v         filtered volume (ml) that doubles the filter
+                  resistance (default 100)
+
+The emulator runs the arduino firmware (hardware/arduinoFirmware.c)
+on the master side of a pseudo-terminal, against simulated i2c devices
+and analog inputs. The name of the pty is printed on startup. To use
+it, set arduinoDevice in the collector's config file to the pty (or
+the link), or give it as the argument to basicTest.
+
+The sample pump, filter valve and pressure sensors follow a simple
+model: the pressure across the filter is proportional to the flow,
+and the filter resistance grows with the volume filtered. Injected
+faults are applied to whole replies, and counts of them are printed
+on exit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+#include <deque>
+#include <random>
+#include "Wire.h"
+
+using namespace std;
+
+// pins and i2c addresses used by the firmware; must match arduinoFirmware.c
+const int pvPwr = 3;			// power for pumps and valves
+const int samplePumpPin = 4;	// pump[1]
+const int filterValvePin = 10;	// valve[1]
+const int leakPin = A6;
+const int tempPin = A3;
+const int pres1Pin = A1;
+const int pres2Pin = A2;
+const int vbatPin = A7;
+
+const int dac1 = 16;
+const int dac2 = 18;
+const int portXtender = 34;
+const int clkAdr = 0x68;
+
+SerialPort Serial;
+TwoWire Wire;
+
+static int ptyFd = -1;			// master side of pty
+static string inBuf;			// input received, not yet read by firmware
+static string outBuf;			// output from current call to loop()
+
+/** A reply waiting for its (injected) latency to expire. */
+struct Pending {
+	unsigned long due;			// time to send, in us
+	string	bytes;
+};
+static deque<Pending> outQ;
+
+static volatile sig_atomic_t quit = 0;
+
+/** Fault injection parameters. */
+static struct {
+	double	latency = 0;		// ms added to every reply
+	double	jitter = 0;			// max random ms added to latency
+	double	drop = 0;			// probability that a reply is dropped
+	double	corrupt = 0;		// probability that a reply is changed
+	double	noise = 0;			// probability of garbage before a reply
+	double	lose = 0;			// probability that input is discarded
+} faults;
+
+/** Counts of replies and injected faults. */
+static struct {
+	long	replies = 0;
+	long	dropped = 0;
+	long	corrupted = 0;
+	long	noisy = 0;
+	long	lost = 0;
+} counts;
+
+static mt19937 rng;
+static uniform_real_distribution<double> unif(0., 1.);
+
+// simulated devices
+static int pins[100];			// states of arduino pins
+static unsigned int xtenderPins = 0; // states of port extender pins
+static int dacValue[2][4];		// DAC channel values
+static bool boardPresent = true;	// false to emulate missing control board
+static bool clockPresent = true;	// false to emulate missing clock
+static bool leakFlag = false;		// true to report a leak
+static long clockOffset = 0;	// seconds from system clock to emulated rtc
+
+/** Simple model of the sample pump, filter and pressure sensors. */
+static struct Fluidics {
+	double	maxFlow = 10;		// ml/min with sample pump at full speed
+	double	resistance = 1;		// psi per ml/min across a new filter
+	double	clogVolume = 100;	// filtered volume that doubles resistance
+	double	filtered = 0;		// ml pumped through the filter so far
+	double	up = 1;				// upstream pressure (psi)
+	double	down = 1;			// downstream pressure (psi)
+	unsigned long lastUpdate = 0;	// time of last update, in us
+
+	void	update();
+} fluidics;
+
+/** Get the state of a digital output.
+ *  @param pin is an arduino pin, or 80 plus a port extender pin
+ *  @return the pin state (0 or 1)
+ */
+static int pinState(int pin) {
+	if (pin < 80) return pins[pin];
+	return (xtenderPins >> (pin - 80)) & 1;
+}
+
+/** Advance the fluidics model to the current time.
+ *  The pressures approach their steady state values with a time
+ *  constant of 300 ms.
+ */
+void Fluidics::update() {
+	unsigned long now = micros();
+	double dt = (now - lastUpdate) * 1e-6;
+	lastUpdate = now;
+	if (dt <= 0) return;
+
+	double speed = 0;	// fraction of full speed (2048 means stopped)
+	if (pinState(pvPwr) && pinState(samplePumpPin))
+		speed = (dacValue[0][0] - 2048) / 2047.;
+	double flow = fabs(speed) * maxFlow;
+
+	double r = 0;
+	if (pinState(filterValvePin)) {
+		r = resistance * (1 + filtered / clogVolume);
+		filtered += flow * dt / 60;
+	}
+	double upTarget = 1 + (r + .2) * flow;
+	double downTarget = 1 + .2 * flow;
+	double a = 1 - exp(-dt / .3);
+	up += a * (upTarget - up);
+	down += a * (downTarget - down);
+}
+
+/** Get the time since the emulator started.
+ *  @return the time in us
+ */
+unsigned long micros() {
+	static struct timespec t0 = { 0, 0 };
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	if (t0.tv_sec == 0 && t0.tv_nsec == 0) t0 = t;
+	return (t.tv_sec - t0.tv_sec) * 1000000ul +
+		   (t.tv_nsec - t0.tv_nsec) / 1000;
+}
+
+unsigned long millis() { return micros() / 1000; }
+
+void delay(unsigned long ms) { usleep(1000 * ms); }
+
+void pinMode(int, int) {}
+
+void digitalWrite(int pin, int state) {
+	if (pin >= 0 && pin < 100) pins[pin] = (state != LOW);
+}
+
+/** Read a simulated analog input.
+ *  Battery and temperature use the default scaling in the Status class
+ *  (1024 counts for 16.2 V and 100 C), pressures use 1024 counts for
+ *  50 psi, with a count of noise.
+ */
+int analogRead(int pin) {
+	int noise = (int) (rng() % 3) - 1;
+	switch (pin) {
+	case vbatPin:	return (int) (12.6 * 1024 / 16.2);
+	case tempPin:	return (int) (25. * 1024 / 100);
+	case pres1Pin:
+		fluidics.update();
+		return max(0, min(1023, (int) (fluidics.up * 1024 / 50) + noise));
+	case pres2Pin:
+		fluidics.update();
+		return max(0, min(1023, (int) (fluidics.down * 1024 / 50) + noise));
+	case leakPin:	return (leakFlag ? 100 : 1000);
+	default:		return 0;
+	}
+}
+
+/** Read input from the pty, if any.
+ *  @param waitMs is the maximum time to wait for input, in ms
+ *  @return true if input was added to inBuf
+ */
+static bool fillInput(int waitMs) {
+	struct pollfd pfd = { ptyFd, POLLIN, 0 };
+	if (poll(&pfd, 1, waitMs) <= 0 || !(pfd.revents & POLLIN)) return false;
+	char buf[256];
+	int n = ::read(ptyFd, buf, sizeof(buf));
+	if (n <= 0) return false;
+	if (faults.lose > 0 && unif(rng) < faults.lose) {
+		counts.lost++; return false;
+	}
+	inBuf.append(buf, n);
+	return true;
+}
+
+int SerialPort::available() {
+	if (inBuf.empty()) fillInput(0);
+	return inBuf.length();
+}
+
+int SerialPort::peek() {
+	return (available() > 0 ? (uint8_t) inBuf[0] : -1);
+}
+
+int SerialPort::read() {
+	if (available() == 0) return -1;
+	int c = (uint8_t) inBuf[0];
+	inBuf.erase(0, 1);
+	return c;
+}
+
+/** Read a byte, waiting up to the timeout for it to arrive. */
+int SerialPort::timedRead() {
+	unsigned long t0 = millis();
+	while (inBuf.empty()) {
+		long left = timeout - (long) (millis() - t0);
+		if (left <= 0) return -1;
+		fillInput(left);
+	}
+	return read();
+}
+
+size_t SerialPort::readBytes(char* buf, size_t len) {
+	size_t i = 0;
+	while (i < len) {
+		int c = timedRead();
+		if (c < 0) break;
+		buf[i++] = c;
+	}
+	return i;
+}
+
+size_t SerialPort::readBytesUntil(char term, char* buf, size_t len) {
+	size_t i = 0;
+	while (i < len) {
+		int c = timedRead();
+		if (c < 0 || c == term) break;
+		buf[i++] = c;
+	}
+	return i;
+}
+
+size_t SerialPort::print(const char* s) {
+	outBuf.append(s); return strlen(s);
+}
+
+size_t SerialPort::write(uint8_t c) {
+	outBuf += (char) c; return 1;
+}
+
+size_t SerialPort::write(const uint8_t* p, size_t n) {
+	outBuf.append((const char*) p, n); return n;
+}
+
+static int bcd(int v) { return ((v / 10) << 4) | (v % 10); }
+static int unbcd(int v) { return 10 * ((v >> 4) & 0xf) + (v & 0xf); }
+
+/** Carry out a write to a simulated i2c device.
+ *  @return true if the device acknowledged the write
+ */
+static bool i2cWrite(int adr, uint8_t* buf, int n) {
+	if (adr == dac1 || adr == dac2) {
+		if (!boardPresent) return false;
+		if (n == 3 && (buf[0] & 0xf0) == 0x30) {
+			dacValue[adr == dac1 ? 0 : 1][buf[0] & 3] =
+				(buf[1] << 4) | (buf[2] >> 4);
+		}
+		return true;
+	} else if (adr == portXtender) {
+		if (!boardPresent) return false;
+		if (n == 2 && buf[0] == 0x12)
+			xtenderPins = (xtenderPins & 0xff00) | buf[1];
+		else if (n == 2 && buf[0] == 0x13)
+			xtenderPins = (xtenderPins & 0x00ff) | (buf[1] << 8);
+		return true;
+	} else if (adr == clkAdr) {
+		if (!clockPresent) return false;
+		if (n == 8 && buf[0] == 0) {
+			// registers: ss mm hh day-of-week DD MM YY
+			struct tm tm;
+			memset(&tm, 0, sizeof(tm));
+			tm.tm_sec = unbcd(buf[1]); tm.tm_min = unbcd(buf[2]);
+			tm.tm_hour = unbcd(buf[3]); tm.tm_mday = unbcd(buf[5]);
+			tm.tm_mon = unbcd(buf[6]) - 1; tm.tm_year = 100 + unbcd(buf[7]);
+			clockOffset = timegm(&tm) - time(0);
+		}
+		return true;
+	}
+	return false;
+}
+
+/** Carry out a read from a simulated i2c device.
+ *  @return the number of bytes returned in buf
+ */
+static int i2cRead(int adr, uint8_t* buf, int n) {
+	if (adr != clkAdr || !clockPresent || n < 7) return 0;
+	time_t t = time(0) + clockOffset;
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	buf[0] = bcd(tm.tm_sec); buf[1] = bcd(tm.tm_min);
+	buf[2] = bcd(tm.tm_hour); buf[3] = bcd(tm.tm_wday + 1);
+	buf[4] = bcd(tm.tm_mday); buf[5] = bcd(tm.tm_mon + 1);
+	buf[6] = bcd(tm.tm_year % 100);
+	return 7;
+}
+
+void TwoWire::beginTransmission(int a) { adr = a; txLen = 0; }
+
+size_t TwoWire::write(uint8_t b) {
+	if (txLen < (int) sizeof(txBuf)) txBuf[txLen++] = b;
+	return 1;
+}
+
+int TwoWire::endTransmission() {
+	return i2cWrite(adr, txBuf, txLen) ? 0 : 2;  // 2 means no ack
+}
+
+uint8_t TwoWire::requestFrom(int a, uint8_t n) {
+	rxLen = i2cRead(a, rxBuf, min((int) n, (int) sizeof(rxBuf)));
+	rxNext = 0;
+	return rxLen;
+}
+
+int TwoWire::available() { return rxLen - rxNext; }
+
+int TwoWire::read() { return (rxNext < rxLen ? rxBuf[rxNext++] : -1); }
+
+/** Queue the output from the last call to loop(), injecting faults. */
+static void queueOutput() {
+	if (outBuf.empty()) return;
+	string s; s.swap(outBuf);
+	counts.replies++;
+	if (faults.drop > 0 && unif(rng) < faults.drop) {
+		counts.dropped++; return;
+	}
+	if (faults.corrupt > 0 && unif(rng) < faults.corrupt) {
+		s[rng() % s.length()] ^= (char) (1 + rng() % 255);
+		counts.corrupted++;
+	}
+	if (faults.noise > 0 && unif(rng) < faults.noise) {
+		string junk;
+		int n = 1 + rng() % 8;
+		for (int i = 0; i < n; i++) junk += (char) (rng() % 256);
+		s = junk + s;
+		counts.noisy++;
+	}
+	unsigned long due = micros() +
+		(unsigned long) (1000 * (faults.latency + faults.jitter * unif(rng)));
+	if (!outQ.empty() && due < outQ.back().due)
+		due = outQ.back().due;	// serial link never reorders bytes
+	outQ.push_back({ due, s });
+}
+
+/** Send the queued output whose time has come. */
+static void sendOutput() {
+	unsigned long now = micros();
+	while (!outQ.empty() && outQ.front().due <= now) {
+		const string& s = outQ.front().bytes;
+		size_t i = 0;
+		while (i < s.length()) {
+			int n = ::write(ptyFd, s.data() + i, s.length() - i);
+			if (n < 0) {
+				if (errno == EINTR || errno == EAGAIN) continue;
+				fprintf(stderr, "arduinoEmulator: write error: %s\n",
+						strerror(errno));
+				quit = 1; return;
+			}
+			i += n;
+		}
+		outQ.pop_front();
+	}
+}
+
+/** Create the pseudo-terminal.
+ *  @return the name of the slave side, or the empty string on failure
+ */
+static string openPty() {
+	ptyFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (ptyFd < 0 || grantpt(ptyFd) < 0 || unlockpt(ptyFd) < 0)
+		return "";
+	char* name = ptsname(ptyFd);
+	if (name == 0) return "";
+	// keep the slave side open, so the pty persists when clients close it
+	int sfd = open(name, O_RDWR | O_NOCTTY);
+	if (sfd < 0) return "";
+	struct termios tty;
+	if (tcgetattr(sfd, &tty) == 0) {
+		cfmakeraw(&tty); tcsetattr(sfd, TCSANOW, &tty);
+	}
+	return string(name);
+}
+
+static void onSignal(int) { quit = 1; }
+
+static void usage() {
+	fprintf(stderr, "usage: arduinoEmulator [-link path] "
+		"[-latency ms[:jitter]] [-drop p]\n\t[-corrupt p] [-noise p] "
+		"[-lose p] [-seed n] [-standalone] [-noclock]\n\t[-leak] "
+		"[-flow f] [-resistance r] [-clog v]\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	string link;
+	for (int i = 1; i < argc; i++) {
+		string opt = argv[i];
+		bool hasArg = (i+1 < argc);
+		if (opt == "-standalone") { boardPresent = false; continue; }
+		if (opt == "-noclock") { clockPresent = false; continue; }
+		if (opt == "-leak") { leakFlag = true; continue; }
+		if (!hasArg) usage();
+		const char* arg = argv[++i];
+		if (opt == "-link") link = arg;
+		else if (opt == "-latency") {
+			if (sscanf(arg, "%lf:%lf", &faults.latency, &faults.jitter) < 1)
+				usage();
+		} else if (opt == "-drop") faults.drop = atof(arg);
+		else if (opt == "-corrupt") faults.corrupt = atof(arg);
+		else if (opt == "-noise") faults.noise = atof(arg);
+		else if (opt == "-lose") faults.lose = atof(arg);
+		else if (opt == "-seed") rng.seed(atol(arg));
+		else if (opt == "-flow") fluidics.maxFlow = atof(arg);
+		else if (opt == "-resistance") fluidics.resistance = atof(arg);
+		else if (opt == "-clog") fluidics.clogVolume = atof(arg);
+		else usage();
+	}
+
+	string device = openPty();
+	if (device.length() == 0) {
+		fprintf(stderr, "arduinoEmulator: cannot open pty: %s\n",
+				strerror(errno));
+		exit(1);
+	}
+	if (link.length() > 0) {
+		unlink(link.c_str());
+		if (symlink(device.c_str(), link.c_str()) < 0) {
+			fprintf(stderr, "arduinoEmulator: cannot create link %s: %s\n",
+					link.c_str(), strerror(errno));
+			exit(1);
+		}
+	}
+	fprintf(stderr, "arduinoEmulator: device is %s\n",
+			(link.length() > 0 ? link : device).c_str());
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onSignal;
+	sigaction(SIGINT, &sa, 0); sigaction(SIGTERM, &sa, 0);
+
+	micros(); // start the clock
+	setup();
+	while (!quit) {
+		loop();
+		queueOutput(); sendOutput();
+		// wait for input, or until the next reply is due
+		int wait = 1;
+		if (!outQ.empty()) {
+			long left = ((long) (outQ.front().due - micros())) / 1000;
+			wait = max(0L, min((long) wait, left));
+		}
+		if (inBuf.empty()) fillInput(wait);
+	}
+
+	if (link.length() > 0) unlink(link.c_str());
+	fprintf(stderr, "arduinoEmulator: %ld replies, %ld dropped, "
+			"%ld corrupted, %ld with noise, %ld inputs lost\n",
+			counts.replies, counts.dropped, counts.corrupted,
+			counts.noisy, counts.lost);
+	return 0;
+}
@@ -0,0 +1,201 @@
+/** @file eventDecoder.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+/** Decode the log messages in raw data files.
+
+Usage: eventDecoder [-json] [file ...]
+
+Reads raw data files (or stdin) and writes the log messages found in
+their events records, one per line, in the same form they take in the
+debug file. With -json, each message is written as a JSON object with
+fields time, level, id, message and args. Text debug records are passed
+through as well, so files from either form of logging can be decoded.
+ */
+
+#include "stdinc.h"
+#include <vector>
+#include <unordered_map>
+#include "Logger.h"
+#include "EventCodec.h"
+
+using namespace fizz;
+
+namespace {
+
+/** Format table entry. */
+struct Format {
+	string	key;		///< hash of format and level, in hex
+	int		level;		///< log level
+	string	format;		///< format string
+};
+
+bool jsonOut = false;
+Logger lg;				// used for level names
+
+/** Parse a JSON string.
+ *  @param p points to the opening quote; it is advanced past the string
+ *  @param s is used to return the unescaped string
+ *  @return true on success
+ */
+bool parseString(const char*& p, string& s) {
+	s.clear();
+	if (*p != '"') return false;
+	for (p++; *p != 0 && *p != '"'; p++) {
+		if (*p != '\\') { s += *p; continue; }
+		p++;
+		switch (*p) {
+		case 'n': s += '\n'; break;
+		case 't': s += '\t'; break;
+		case 'u': s += (char) strtol(string(p+1, 4).c_str(), 0, 16);
+				  p += 4; break;
+		case 0: return false;
+		default: s += *p;
+		}
+	}
+	if (*p != '"') return false;
+	p++; return true;
+}
+
+/** Find the value of a field in a record.
+ *  @param line is the record
+ *  @param name is the field name
+ *  @return a pointer to the start of the value, or null if not present
+ */
+const char* findField(const string& line, const string& name) {
+	string::size_type i = line.find("\"" + name + "\": ");
+	if (i == string::npos) return 0;
+	return line.c_str() + i + name.length() + 4;
+}
+
+void skipSpace(const char*& p) { while (*p == ' ') p++; }
+
+/** Write one message in the selected form. */
+void output(double time, int level, const string& key, const string& message,
+			const vector<string>& args) {
+	if (jsonOut) {
+		cout << "{ \"time\": " << fixed << setprecision(3) << time
+			 << ", \"level\": \"" << lg.logLevel2string(level) << "\""
+			 << ", \"id\": \"" << key << "\""
+			 << ", \"message\": \"" << EventCodec::jsonEscape(message) << "\""
+			 << ", \"args\": [";
+		for (unsigned i = 0; i < args.size(); i++)
+			cout << (i == 0 ? "" : ", ") << args[i];
+		cout << "] }\n";
+	} else {
+		string name = lg.logLevel2string(level);
+		for (char& c : name) c = toupper(c);
+		char tbuf[20]; snprintf(tbuf, sizeof(tbuf), "%.3f", time);
+		cout << message << " [" << name << " " << tbuf << "]\n";
+	}
+}
+
+/** Decode an events record.
+ *  @param line is the record
+ *  @param formats is the format table for the current file
+ *  @return true on success, false if the record is malformed
+ */
+bool decodeEvents(const string& line, unordered_map<int,Format>& formats) {
+	const char* p = findField(line, "base");
+	if (p == 0) return false;
+	int64_t t = strtoll(p, 0, 10);
+
+	p = findField(line, "dropped");
+	long dropped = (p != 0 ? atol(p) : 0);
+
+	p = findField(line, "formats");
+	if (p == 0 || *p++ != '[') return false;
+	skipSpace(p);
+	while (*p == '[') {
+		p++;
+		Format f;
+		int index = strtol(p, (char**) &p, 10);
+		skipSpace(p); if (*p++ != ',') return false; skipSpace(p);
+		if (!parseString(p, f.key)) return false;
+		skipSpace(p); if (*p++ != ',') return false; skipSpace(p);
+		f.level = strtol(p, (char**) &p, 10);
+		skipSpace(p); if (*p++ != ',') return false; skipSpace(p);
+		if (!parseString(p, f.format)) return false;
+		if (*p++ != ']') return false;
+		formats[index] = f;
+		skipSpace(p); if (*p == ',') p++; skipSpace(p);
+	}
+	if (*p != ']') return false;
+
+	p = findField(line, "events");
+	string b64, bytes;
+	if (p == 0 || !parseString(p, b64) || !EventCodec::unbase64(b64, bytes))
+		return false;
+	if (dropped > 0)
+		cerr << "eventDecoder: " << dropped << " messages dropped "
+			 << "before time " << fixed << setprecision(3) << t/1000.
+			 << endl;
+
+	const uint8_t* bp = (const uint8_t*) bytes.data();
+	const uint8_t* end = bp + bytes.length();
+	string message; vector<string> args;
+	while (bp < end) {
+		int64_t index, dt;
+		if (!EventCodec::getVarint(bp, end, index) ||
+			!EventCodec::getVarint(bp, end, dt))
+			return false;
+		auto fp = formats.find(index);
+		if (fp == formats.end()) return false;
+		t += dt;
+		Format& f = fp->second;
+		if (!EventCodec::unpack(f.format, bp, end, message, args))
+			return false;
+		output(t/1000., f.level, f.key, message, args);
+	}
+	return true;
+}
+
+/** Pass through the message in a debug record. */
+void decodeDebug(const string& line) {
+	const char* p = findField(line, "message");
+	string message;
+	if (p == 0 || !parseString(p, message)) return;
+	if (!jsonOut) { cout << message << "\n"; return; }
+	cout << "{ \"message\": \"" << EventCodec::jsonEscape(message)
+		 << "\" }\n";
+}
+
+/** Decode the records in one file. */
+void decodeFile(istream& in, const string& name) {
+	unordered_map<int,Format> formats;
+	string line; int lineNum = 0;
+	while (getline(in, line)) {
+		lineNum++;
+		if (line.find("\"recordType\": \"events\"") != string::npos) {
+			if (!decodeEvents(line, formats))
+				cerr << "eventDecoder: " << name << ", line " << lineNum
+					 << ": malformed events record" << endl;
+		} else if (line.find("\"recordType\": \"debug\"") != string::npos) {
+			decodeDebug(line);
+		}
+	}
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	int i = 1;
+	if (i < argc && strcmp(argv[i], "-json") == 0) { jsonOut = true; i++; }
+	if (i == argc) {
+		decodeFile(cin, "stdin");
+		return 0;
+	}
+	for ( ; i < argc; i++) {
+		ifstream in(argv[i]);
+		if (in.fail()) {
+			cerr << "eventDecoder: cannot open " << argv[i] << endl;
+			return 1;
+		}
+		decodeFile(in, argv[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+/** Compare the results of the spectral program to golden results.
+ *
+ *  usage: spectral < suite.in | node compare.js suite.in suite.expect
+ *
+ *  Reads the results from stdin and compares them, line by line, to the
+ *  expected results. Each number must agree with the expected one to
+ *  within the tolerance for its request's op, relative to the largest
+ *  magnitude in the vector it belongs to (or to itself, for a scalar).
+ *  Each disagreement is reported, and the exit status is non-zero if
+ *  there are any.
+ */
+
+const fs = require('fs');
+
+/** Maximum relative error for each op. The native library does the
+ *  javascript's arithmetic in the javascript's order where it can;
+ *  these allow for the places where it cannot, mostly differences of
+ *  an ulp or so between V8's exp and libm's.
+ */
+const tolerance = {
+	cook: 2e-15,
+	absorption: 1e-14,
+	absorbance: 1e-14,
+	parameters: 1e-15,
+	expCurve: 1e-15,
+	smooth: 1e-15,
+	deriv: 0,
+	polySmooth: 1e-12,
+	fitModels: 0,
+	bestMatches: 0
+};
+
+let [reqFile, expectFile] = process.argv.slice(2);
+if (expectFile == undefined) {
+	console.error('usage: spectral < suite.in | ' +
+				  'node compare.js suite.in suite.expect');
+	process.exit(1);
+}
+let readLines = s => s.split('\n').filter(x => x.length > 0);
+let reqs = readLines(fs.readFileSync(reqFile, 'utf8')).map(JSON.parse);
+let expected = readLines(fs.readFileSync(expectFile, 'utf8'));
+let results = readLines(fs.readFileSync(0, 'utf8'));
+
+let failures = 0;
+let worst = {};		// largest error seen for each op
+
+/** Report a failure of case k. */
+function fail(k, msg) {
+	if (failures++ < 20)
+		console.log(`case ${k+1} (${reqs[k].op}): ${msg}`);
+}
+
+/** Compare a result to the expected value and report differences.
+ *  @param k is the case number
+ *  @param where names the value, for messages
+ *  @param x is the expected value
+ *  @param y is the value to check
+ *  @param scale is the magnitude numbers are compared relative to, or
+ *  undefined for a scalar
+ */
+function check(k, where, x, y, scale) {
+	if (typeof x == 'number') {
+		if (typeof y != 'number') {
+			fail(k, `${where} is ${JSON.stringify(y)}, expected ${x}`);
+			return;
+		}
+		let s = (scale == undefined ? Math.max(Math.abs(x), Math.abs(y)) :
+									  scale);
+		let err = (x == y ? 0 : Math.abs(x - y) / s);
+		let op = reqs[k].op;
+		worst[op] = Math.max(worst[op] || 0, err);
+		if (err > tolerance[op])
+			fail(k, `${where} is ${y}, expected ${x}`);
+	} else if (Array.isArray(x)) {
+		if (!Array.isArray(y) || y.length != x.length) {
+			fail(k, `${where} has the wrong length`); return;
+		}
+		let numeric = x.every(v => typeof v == 'number');
+		let s = (numeric ? Math.max(...x.map(Math.abs)) : undefined);
+		for (let i = 0; i < x.length; i++)
+			check(k, `${where}[${i}]`, x[i], y[i], s);
+	} else if (x != null && typeof x == 'object') {
+		if (y == null || typeof y != 'object') {
+			fail(k, `${where} is missing`); return;
+		}
+		for (let f in x) check(k, where + '.' + f, x[f], y[f], undefined);
+	} else if (x !== y) {
+		fail(k, `${where} is ${JSON.stringify(y)}, expected ${x}`);
+	}
+}
+
+if (results.length != expected.length)
+	console.log(`${results.length} results, expected ${expected.length}`);
+for (let k = 0; k < expected.length && k < results.length; k++) {
+	let y = JSON.parse(results[k]);
+	if ('error' in y) { fail(k, y.error); continue; }
+	check(k, 'result', JSON.parse(expected[k]), y, undefined);
+}
+let errs = Object.keys(worst).map(
+				op => `${op} ${worst[op].toExponential(1)}`);
+console.log(`${reqFile}: ${expected.length} cases, ${failures} failures; ` +
+			`largest errors: ${errs.join(', ')}`);
+process.exit(failures > 0 || results.length != expected.length ? 1 : 0);
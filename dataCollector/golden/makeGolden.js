@@ -0,0 +1,322 @@
+/** Generate golden test cases for the spectral program.
+ *
+ *  usage: node makeGolden.js [suite ...]
+ *
+ *  For each suite (all of them by default), this writes suite.in, holding
+ *  requests for spectral, one per line, and suite.expect, holding the
+ *  results the javascript produces for the same requests. The results
+ *  come from Library.js, as extended by summarize/analysisLibrary, so
+ *  the files only need to be regenerated when those change. The inputs
+ *  are pseudo-random, but the seeds are fixed, so regenerating with
+ *  unchanged javascript produces identical files.
+ *
+ *  "make check" runs spectral on the requests and compares its results
+ *  to the expected ones using compare.js.
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const repo = path.join(__dirname, '..', '..');
+const libSource = fs.readFileSync(
+		path.join(repo, 'analysisConsole/static/js/Library.js'), 'utf8');
+
+/** Create an instance of Library, extended by code that refers to the
+ *  instance as lib, as analysisLibrary and the mode libraries do.
+ */
+function newLibrary(extension) {
+	let lib;
+	eval(libSource + "lib = new Library();");
+	eval(extension);
+	return lib;
+}
+
+const library = newLibrary('');		// Library.js alone
+const lib = newLibrary(fs.readFileSync(
+				path.join(repo, 'summarize/analysisLibrary'), 'utf8'));
+
+let seed;
+/** Return a pseudo-random number in (0,1) (Park-Miller generator). */
+function rnd() {
+	seed = (seed * 16807) % 2147483647; return seed / 2147483647;
+}
+
+/** Make raw wavelengths spanning 320 to 823 nm, with uneven spacing
+ *  rounded to two places, as in a spectrometer's calibration.
+ */
+function wavelengths(n) {
+	let wl = [];
+	for (let i = 0; i < n; i++)
+		wl.push(Number((320 + .9*i - 1e-4*i*i + .01*rnd()).toFixed(2)));
+	return wl;
+}
+
+/** Cases for cook, absorption, absorbance, parameters and expCurve.
+ *  Each set of spectra is used with both recipes.
+ */
+function cookSuite(reqs, outs) {
+	seed = 7;
+	let n = 600, wl = wavelengths(n);
+	lib.setWavelengths(wl); lib.setWaveguideLength(0.28);
+	for (let t = 0; t < 2; t++) {
+		let dark = [], ref = [], rdark = [], spect = [];
+		let a0 = .2 + 3*rnd(), s0 = .01 + .01*rnd();
+		for (let i = 0; i < n; i++) {
+			let z = (wl[i]-550)/150;
+			dark.push(1000 + Math.floor(50*rnd()));
+			rdark.push(1000 + Math.floor(50*rnd()));
+			ref.push(rdark[i] + Math.floor(40000*Math.exp(-.5*z*z) +
+										   50*rnd()));
+			let a = a0*Math.exp(-s0*(wl[i]-440));
+			spect.push(dark[i] + Math.floor((ref[i]-rdark[i]) *
+											Math.exp(-.28*a) + 30*rnd()));
+		}
+		let prereq = [dark, ref, rdark];
+		for (let recipe of ["classic", "nuvo"]) {
+			let head = (reqs.length == 0 ?
+						{wavelengths: wl, waveguideLength: 0.28} : {});
+			let absorp = lib.absorption(spect, prereq, wl, recipe);
+			let [a440, slope] = lib.absorptionParameters(absorp);
+			reqs.push(Object.assign(head, {recipe, op: "absorption",
+										   spectrum: spect, prereq}));
+			outs.push({absorption: absorp, a440, slope});
+			reqs.push({op: "absorbance", spectrum: spect, prereq});
+			outs.push({absorbance:
+						lib.absorbance(spect, prereq, wl, recipe)});
+			reqs.push({op: "cook", spectrum: spect, dark});
+			outs.push({cooked: lib.cook(spect, dark, wl, recipe)});
+			reqs.push({op: "parameters", absorption: absorp});
+			outs.push({a440, slope});
+			reqs.push({op: "expCurve", a440, slope});
+			outs.push({curve: lib.absorpExpCurve(a440, slope)});
+		}
+	}
+}
+
+/** Cases for smooth, with both ways of handling the ends, deriv and
+ *  polySmooth, on vectors of varying length and filter parameters.
+ */
+function filterSuite(reqs, outs) {
+	seed = 11;
+	for (let t = 0; t < 8; t++) {
+		let n = 200 + Math.floor(200*rnd()), v = [];
+		for (let i = 0; i < n; i++) v.push(100*Math.sin(i/20) + 10*rnd());
+		let width = 3 + Math.floor(40*rnd()), sigma = 2 + 20*rnd();
+		reqs.push({op: "smooth", vector: v, width, sigma});
+		outs.push({smoothed: library.smooth(v, [width, sigma])});
+		reqs.push({op: "smooth", vector: v, width, sigma,
+				   edges: "analysisLibrary"});
+		outs.push({smoothed: lib.smooth(v, [width, sigma])});
+		let degree = 3 + Math.floor(5*rnd());
+		let dwidth = 5 + Math.floor(25*rnd());
+		let k = Math.floor(degree*rnd()), delta = (t%2 ? 1 : .5);
+		reqs.push({op: "deriv", vector: v, k, degree, width: dwidth, delta});
+		outs.push({deriv: lib.deriv(v, k, [degree, dwidth], delta)});
+		let dvx = Math.floor((degree+1)*rnd());
+		reqs.push({op: "polySmooth", vector: v, degree, width: dwidth, dvx});
+		outs.push({smoothed: lib.polySmooth(v, degree, dwidth, dvx)});
+	}
+}
+
+/** Return a simple fourth derivative of a vector. It stands in for
+ *  sderiv in the model suite; spectral is given the derivatives, so
+ *  they need not match the library's.
+ */
+function fourth(x) {
+	let y = new Array(x.length).fill(0);
+	for (let i = 2; i < x.length-2; i++)
+		y[i] = x[i-2] - 4*x[i-1] + 6*x[i] - 4*x[i+1] + x[i+2];
+	return y;
+}
+
+/** Cases for fitModels and bestMatches, using the fitting code in
+ *  analysisConsole/modeLibs/standard. The models are sums of gaussian
+ *  peaks and the targets are weighted sums of three models plus a
+ *  background and noise. Each request is made with one thread and
+ *  with four.
+ */
+function modelSuite(reqs, outs) {
+	seed = 13;
+	let src = fs.readFileSync(
+				path.join(repo, 'analysisConsole/modeLibs/standard'),
+				'utf8').split('\n');
+	let first = src.findIndex(l => l.includes('lib.backSettings = ['));
+	let last = src.findIndex(l => l.includes('lib.preprocess = function'));
+	let mlib = newLibrary(src.slice(first, last).join('\n'));
+
+	let n = 12, len = 200, modelCount = 3, approxCount = 5;
+	mlib.sderiv = (x, k) => fourth(x);
+	mlib.cookedWavelengths = new Array(len);
+	mlib.SIM_LO = len/10; mlib.SIM_HI = len - len/10;
+	let absorbModels = [];
+	for (let m = 0; m < n; m++) {
+		let v = new Array(len).fill(0);
+		for (let p = 0; p < 4; p++) {
+			let c = len*rnd(), w = 5 + 30*rnd(), h = rnd();
+			for (let i = 0; i < len; i++)
+				v[i] += h*Math.exp(-.5*((i-c)/w)**2);
+		}
+		absorbModels.push(v);
+	}
+	let fourthModels = absorbModels.map(fourth);
+	let backModels = mlib.backSettings.map(x => mlib.backComponent(x));
+	let range = [mlib.SIM_LO, mlib.SIM_HI];
+	let gram = A => A.map(x => A.map(y => mlib.dotProduct(x, y, range)));
+	mlib.absorbModels = absorbModels; mlib.fourthModels = fourthModels;
+	mlib.backModels = backModels;
+	mlib.fourthDotProds = gram(fourthModels);
+	mlib.backDotProds = gram(backModels);
+
+	for (let threads of [1, 4]) {
+		seed = 17;
+		for (let t = 0; t < 3; t++) {
+			let absorb = new Array(len).fill(0);
+			for (let k = 0; k < 3; k++) {
+				let m = Math.floor(n*rnd()), w = rnd();
+				for (let i = 0; i < len; i++)
+					absorb[i] += w*absorbModels[m][i];
+			}
+			for (let i = 0; i < len; i++)
+				absorb[i] += .3*(1-i/len)**2 + .02*(rnd()-.5);
+			let spect = fourth(absorb);
+			let helper = mlib.vectorFitHelper(spect, fourthModels,
+											  mlib.fourthDotProds, range);
+			// model sets are sent once and remain in effect
+			let first = (reqs.length == 0);
+			for (let posOnly of [false, true]) {
+				let models = (reqs.length == 0 ?
+							  {models: fourthModels, lo: range[0],
+							   hi: range[1]} : {});
+				reqs.push(Object.assign(models, {op: "fitModels", spect,
+								modelCount, approxCount, posOnly, threads}));
+				outs.push({matches: mlib.fitModels(spect, fourthModels,
+								modelCount, approxCount, posOnly, helper)});
+			}
+			let models = (first ?
+						  {absorbModels, fourthModels, backModels} : {});
+			reqs.push(Object.assign(models, {op: "bestMatches", absorb,
+								fourth: spect, modelCount, approxCount,
+								threads}));
+			outs.push({matches: mlib.findBestMatches(absorb, modelCount,
+													 approxCount)});
+		}
+	}
+}
+
+/** Case for summarize: a raw data file with six sample cycles, one with
+ *  too little absorption for the cdom parameters and one preceded by a
+ *  reset, and the summary file summarize.js writes for it. The lines of
+ *  the raw file are returned in reqs and those of the summary in outs.
+ */
+function summarySuite(reqs, outs) {
+	seed = 19;
+	let n = 600, wl = wavelengths(n).map(w => w.toFixed(2));
+	let index = 1, labels = {};
+	let f2 = v => '[' + v.map(x => x.toFixed(2)).join(', ') + ']';
+	reqs.push(`{ "serialNumber": 99, "index": ${index++}, ` +
+			  `"recordType": "deployment", ` +
+			  `"dateTime": "2026-10-18 10:00:00", "label": "golden", ` +
+			  `"spectSerialNumber": "X", "waveguideLength": 0.2800, ` +
+			  `"wavelengths": [${wl.join(', ')}], ` +
+			  `"correctionCoef": [1.0e+00] }`);
+	// add a spectrum record holding base plus noise and, if absorb is
+	// given, a lamp seen through absorbance absorb(w)
+	let peak = 0;		// lamp intensity
+	let spectrum = (label, base, absorb, p1, p2) => {
+		let v = [];
+		for (let i = 0; i < n; i++) {
+			let w = +wl[i];
+			let lamp = peak*Math.exp(-(((w-560)/160)**2)) + 2000;
+			v.push(base[i] + (absorb ? lamp*Math.exp(-absorb(w)) : 0) +
+				   20*(rnd()-.5));
+		}
+		labels[label] = index;
+		reqs.push(`{ "serialNumber": 99, "index": ${index++}, ` +
+				  `"recordType": "spectrum", ` +
+				  `"dateTime": "2026-10-18 10:00:${index%60}", ` +
+				  `"deploymentIndex": 1, ` +
+				  `"prereq1index": ${p1 ? labels[p1] : 0}, ` +
+				  `"prereq2index": ${p2 ? labels[p2] : 0}, ` +
+				  `"label": "${label}", "spectrum": ${f2(v)}}`);
+		return v;
+	};
+	// add the spectra for cycle c; with partial, stop after the
+	// filtered spectrum, as if the cycle was interrupted; the lamp is
+	// dimmer in odd cycles, so their cdom_QA is at best marginal
+	let cycle = (c, partial) => {
+		peak = (c%2 == 0 ? 50000 : 30000);
+		let base = [];
+		for (let i = 0; i < n; i++) base.push(1500 + 50*rnd() + .01*i);
+		let dark = spectrum('dark', base);
+		spectrum('reference', dark, w => 0, 'dark');
+		let s = .012 + .006*rnd();
+		let a0 = (.3 + 2*rnd()) * .28 * (c == 3 ? .05 : 1);
+		let cdom = w => a0*Math.exp(-s*(w-440));
+		spectrum('filtered', dark, cdom, 'dark', 'reference');
+		if (partial) return;
+		let center = 420 + 60*rnd();
+		spectrum('concentrate', dark,
+				 w => cdom(w) + .4*Math.exp(-(((w-center)/25)**2)) +
+					  .25*Math.exp(-(((w-675)/12)**2)),
+				 'dark', 'reference');
+	};
+	for (let c = 0; c < 6; c++) {
+		if (c == 4) {
+			cycle(c, true);
+			reqs.push(`{ "serialNumber": 99, "index": ${index++}, ` +
+					  `"recordType": "reset", "dateTime": "x", ` +
+					  `"deploymentIndex": 1}`);
+		}
+		cycle(c, false);
+		reqs.push(`{ "serialNumber": 99, "index": ${index++}, ` +
+				  `"recordType": "cycleSummary", ` +
+				  `"dateTime": "2026-10-18 11:0${c}:00", ` +
+				  `"deploymentIndex": 1, "cycleNumber": ${c+1}, ` +
+				  `"temp": 20.0, "depth": ${(1.25*c).toFixed(2)}, ` +
+				  `"location": "[N27.3,W82.5]", "nextCycleDelay": 0, ` +
+				  `"delayReason": ""}`);
+	}
+
+	// run a copy of summarize.js on it, with the paths changed to
+	// refer to this repo and a scratch data directory
+	const os = require('os');
+	const child = require('child_process');
+	let dir = fs.mkdtempSync(path.join(os.tmpdir(), 'golden'));
+	fs.symlinkSync(path.join(repo, 'analysisConsole/models'),
+				   path.join(dir, 'models'));
+	fs.mkdirSync(path.join(dir, 'sn99/raw'), {recursive: true});
+	fs.mkdirSync(path.join(dir, 'sn99/summary'));
+	fs.writeFileSync(path.join(dir, 'sn99/raw/dep000001'),
+					 reqs.join('\n') + '\n');
+	let script = fs.readFileSync(path.join(repo, 'summarize/summarize.js'),
+								 'utf8')
+		.replace("'/usr/local/physs/analysisConsole'",
+				 JSON.stringify(path.join(repo, 'analysisConsole')))
+		.replace("'./analysisLibrary'",
+				 JSON.stringify(path.join(repo, 'summarize/analysisLibrary')))
+		.replace("'/usr/local/physsData'", JSON.stringify(dir));
+	fs.writeFileSync(path.join(dir, 'summarize.js'), script);
+	child.execFileSync('node', [path.join(dir, 'summarize.js')],
+					   {timeout: 60000});
+	let summary = fs.readFileSync(path.join(dir, 'sn99/summary/dep000001'),
+								  'utf8');
+	fs.rmSync(dir, {recursive: true});
+	outs.push(...summary.split('\n').filter(x => x.length > 0));
+}
+
+const suites = { cook: cookSuite, filter: filterSuite, model: modelSuite,
+				 summary: summarySuite };
+
+let names = process.argv.slice(2);
+if (names.length == 0) names = Object.keys(suites);
+for (let name of names) {
+	if (!(name in suites)) {
+		console.error('makeGolden: unknown suite ' + name); process.exit(1);
+	}
+	let reqs = [], outs = [];
+	suites[name](reqs, outs);
+	let lines = v => v.map(x => (typeof x == 'string' ? x :
+										 JSON.stringify(x)) + '\n').join('');
+	fs.writeFileSync(path.join(__dirname, name + '.in'), lines(reqs));
+	fs.writeFileSync(path.join(__dirname, name + '.expect'), lines(outs));
+}
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <algorithm>
 #include "Logger.h"
 
 using namespace chrono;
@@ -18,21 +19,45 @@ namespace fizz {
 
 extern Logger logger;
 
+thread_local vector<string>* Arduino::batchCmds = 0;
+
 Arduino::Arduino() {
-	quit = false;
+	fd = -1; wakeFds[0] = wakeFds[1] = -1; reactor = 0;
+	quit.store(false);
 	ready.store(false);
 	equipped.store(false);
+	framed.store(false);
+	binary.store(false);
+	logPush.store(false);
+	seqNum = 0;
 	failureCount = 0;
+	statusHandler = 0; streamPeriod = 0; lastStreamTime = 0;
+	clearStats();
 }
 
 Arduino::~Arduino() {}
 
+/** Constructor for Batch objects.
+ *  @param ard is the arduino to which the batched commands are sent
+ */
+Arduino::Batch::Batch(Arduino& ard) : ard(ard) {
+	outer = (batchCmds == 0);
+	if (outer) batchCmds = &cmds;
+}
+
+/** Destructor for Batch objects; sends the held commands. */
+Arduino::Batch::~Batch() {
+	if (!outer) return;
+	batchCmds = 0;
+	if (cmds.size() > 0) ard.sendBatch(cmds);
+}
+
 bool Arduino::setupSerialLink(int fd) {
 	struct termios tty;
 
 	if (tcgetattr(fd, &tty) < 0) {
-		printf("Error from tcgetattr: %s\n", strerror(errno));
-		return -1;
+		logger.error("Arduino: error from tcgetattr: %s\n", strerror(errno));
+		return false;
 	}
 
 	cfsetospeed(&tty, B115200);
@@ -51,9 +76,9 @@ bool Arduino::setupSerialLink(int fd) {
 	tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
 	tty.c_oflag &= ~OPOST;
 
-	/* wait up to a second for data */
+	/* reads return immediately; reader uses poll to wait for data */
 	tty.c_cc[VMIN] = 0;
-	tty.c_cc[VTIME] = 10;
+	tty.c_cc[VTIME] = 0;
 
 	if (tcsetattr(fd, TCSANOW, &tty) != 0) {
 		logger.error("Arduino: serial setup error: %s\n", strerror(errno));
@@ -62,8 +87,23 @@ bool Arduino::setupSerialLink(int fd) {
 	return true;
 }
 
-bool Arduino::start() {
-	for (int i = 0; i < 10; i++) {
+/** Open the serial link and check that the arduino is responding.
+ *  @param device is the path name of the serial device; if empty,
+ *  the first of /dev/ttyUSB0 to /dev/ttyUSB9 that can be opened is used
+ *  @param r is a running Reactor that is to watch the serial link;
+ *  if null, a reader thread is started to do so
+ *  @return true on success, else false
+ */
+bool Arduino::start(const string& device, Reactor* r) {
+	if (device.length() > 0) {
+		fd = open(device.c_str(), O_RDWR | O_NOCTTY);
+		if (fd < 0) {
+			logger.debug("Arduino: unable to open %s: %s",
+						 device.c_str(), strerror(errno));
+			return false;
+		}
+	}
+	for (int i = 0; fd < 0 && i < 10; i++) {
 		char fnam[50];
 		snprintf(fnam, sizeof(fnam)-1, "/dev/ttyUSB%d", i);
 		fd = open(fnam, O_RDWR | O_NOCTTY);
@@ -77,10 +117,29 @@ bool Arduino::start() {
 		logger.debug("Arduino: unable to configure serial link");
 		return false;
 	}
+	reactor = r;
+	if (reactor == 0 && pipe(wakeFds) < 0) {
+		logger.debug("Arduino: unable to create pipe: %s", strerror(errno));
+		wakeFds[0] = wakeFds[1] = -1;
+		return false;
+	}
 	sleep_for(seconds(2));
 
-	quit = false;
-	readerThread = thread(&Arduino::startReader, ref(*this));
+	quit.store(false);
+	if (reactor != 0) {
+		int rfd = fd;
+		bool ok = reactor->addFd(fd, EPOLLIN, [this, rfd](uint32_t events) {
+			if (!readInput(events)) {
+				reactor->removeFd(rfd); linkDown();
+			}
+		});
+		if (!ok) {
+			logger.debug("Arduino: unable to watch serial link");
+			return false;
+		}
+	} else {
+		readerThread = thread(&Arduino::startReader, ref(*this));
+	}
 	sleep_for(seconds(1)); // allow reader to run
 
 	failureCount = 0;
@@ -91,86 +150,366 @@ bool Arduino::start() {
 	}
 	ready.store(true);
 
+	// check if firmware echoes sequence tags (and so supports frames)
+	framed.store(true);
+	if (command("ehello") != "hello") framed.store(false);
+	if (isFramed() && command("V") == "2") {
+		binary.store(true);
+		if (command("ehello") != "hello") {
+			logger.debug("Arduino: binary frames failed, using text");
+			binary.store(false);
+		}
+	}
+	failureCount = 0;
+
+	// have the arduino send log messages as they occur
+	logPush.store(command("L1") == "1");
+
 	s = command("H");
 	if (s == "1") equipped.store(true);
 
-	logger.debug("Arduino: arduino is active and %s equipped",
-				(s == "1" ? "is" : "not"));
+	logger.debug("Arduino: arduino is active and %s equipped%s",
+				(s == "1" ? "is" : "not"),
+				(isBinary() ? ", using binary frames" :
+				 isFramed() ? ", using tagged frames" : ""));
 
 	return true;
 }
 
 void Arduino::startReader(Arduino& ard) { ard.reader(); }
 
+/** Stop the reader thread and close the serial link.
+ *  Any command in progress is allowed to complete first.
+ */
 void Arduino::finish() {
 	unique_lock<mutex> lck(ardMtx);
-	quit = true;
+	ready.store(false);
+	logPush.store(false);
+	quit.store(true);
+	if (reactor != 0 && fd >= 0) reactor->removeFd(fd);
+	reactor = 0;
+	if (wakeFds[1] >= 0 && write(wakeFds[1], "q", 1) < 0)
+		logger.debug("Arduino: cannot wake reader: %s", strerror(errno));
 	if (readerThread.joinable()) readerThread.join();
-	close(fd);
+	if (fd >= 0) close(fd);
+	if (wakeFds[0] >= 0) { close(wakeFds[0]); close(wakeFds[1]); }
+	fd = -1; wakeFds[0] = wakeFds[1] = -1;
 	logger.debug("Arduino: closed connection");
 }
 
+/** Reader thread.
+ *  Waits for input from the serial link or a wakeup on the pipe;
+ *  exits when quit is set or the serial link fails.
+ */
 void Arduino::reader() {
-	char cbuf[1024];
+	struct pollfd pfd[2];
+	pfd[0].fd = fd; pfd[0].events = POLLIN;
+	pfd[1].fd = wakeFds[0]; pfd[1].events = POLLIN;
+
+	while (!quit.load()) {
+		int rc = poll(pfd, 2, -1);
+		if (rc < 0) {
+			if (errno == EINTR) continue;
+			logger.debug("Arduino: poll error: %s", strerror(errno));
+			break;
+		}
+		if (pfd[1].revents != 0) break;
+		if (!readInput(pfd[0].revents)) break;
+	}
+	linkDown();
+}
 
-	while (true) {
-		int n = read(fd, cbuf, sizeof(cbuf)-1);
-		if (quit) break;
-		if (n == 0) continue;
-		if (n < 0) {
-			logger.debug("Arduino: read error: %s\n", strerror(errno));
+/** Wake up any command waiting for a reply, after the reader stops. */
+void Arduino::linkDown() {
+	unique_lock<mutex> lck(bufMtx);
+	replyReady.notify_all();
+}
+
+/** Read the input available on the serial link.
+ *  Splits the input into lines and binary frames, and passes complete
+ *  ones to command() or the stream and log handlers.
+ *  @param revents is the set of poll events reported for the link
+ *  @return false if the link has failed, else true
+ */
+bool Arduino::readInput(int revents) {
+	char cbuf[1024];
+	if (revents & (POLLERR | POLLNVAL)) {
+		logger.debug("Arduino: serial link error");
+		return false;
+	}
+	int n = read(fd, cbuf, sizeof(cbuf));
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN) return true;
+		logger.debug("Arduino: read error: %s", strerror(errno));
+		return false;
+	}
+	if (n == 0) {
+		if (revents & POLLHUP) {
+			logger.debug("Arduino: serial link closed");
+			return false;
+		}
+		return true;
+	}
+	// split input into lines and binary frames, and pass
+	// complete ones to command()
+	partial.append(cbuf, n);
+	unsigned int i = 0;
+	while (i < partial.length()) {
+		if ((uint8_t) partial[i] == SYNC) {
+			if (partial.length() < i + 4) break;
+			int len = (uint8_t) partial[i+1];
+			if (len > (int) MAXREPLY) {
+				// not a real frame; don't wait for the rest of it
+				unique_lock<mutex> lck(bufMtx);
+				crcErrors++; i++; continue;
+			}
+			if (partial.length() < i + len + 6) break;
+			uint16_t crc = ((uint8_t) partial[i+len+4] << 8) |
+							(uint8_t) partial[i+len+5];
+			if (crc16(0xffff, &partial[i+1], len+3) != crc) {
+				// skip sync byte and look for next frame
+				unique_lock<mutex> lck(bufMtx);
+				crcErrors++; i++; continue;
+			}
+			int op = (uint8_t) partial[i+3];
+			if (op == (OP_STREAM | OP_REPLY) || op == (OP_LOG | OP_REPLY)) {
+				string payload = partial.substr(i+4, len);
+				if (op == (OP_STREAM | OP_REPLY))
+					streamReport(payload, true);
+				else
+					logReport(payload);
+				i += len + 6;
+				continue;
+			}
+			// pass reply on as a line with a sequence tag
+			char tag[4];
+			snprintf(tag, sizeof(tag), "@%02x", (uint8_t) partial[i+2]);
+			string line = tag + partial.substr(i+4, len);
+			addLine(line, false);
+			i += len + 6;
+			continue;
+		}
+		// text lines never contain a sync byte, so anything
+		// preceding a sync byte is the remnant of a damaged frame
+		size_t j = partial.find_first_of(string("\n") + (char) SYNC, i);
+		if (j == string::npos) break;
+		if (partial[j] == '\n') {
+			string line = partial.substr(i, j-i);
+			if (line.length() >= 2 && line[0] == '!') {
+				// status report or log messages, not a reply
+				size_t k = line.find_last_not_of(".");
+				string body = line.substr(2, k-1);
+				if (line[1] == 's') streamReport(body, false);
+				else if (line[1] == 'x') logReport(body);
+			} else {
+				addLine(line);
+			}
+			i = j + 1;
 		} else {
-			cbuf[n] = 0;
-			bufMtx.lock(); buf += cbuf; bufMtx.unlock();
+			i = j;
 		}
 	}
+	partial.erase(0, i);
+	return true;
 }
 
+/** Add a line received from the arduino to the list of unconsumed lines.
+ *  @param line is a line of input, without the newline
+ *  @param text is true for a line of text, in which case a trailing
+ *  '.' or '+' is stripped, for backward compatibility
+ */
+void Arduino::addLine(string& line, bool text) {
+	int n = line.length();
+	if (text && n > 0 && (line[n-1] == '.' || line[n-1] == '+'))
+		line.erase(n-1);
+	unique_lock<mutex> lck(bufMtx);
+	if (lines.size() >= MAXLINES) lines.pop_front();
+	lines.push_back(line);
+	replyReady.notify_all();
+}
+
+/** Handle a status report streamed by the arduino.
+ *  Called by the reader thread; the status handler is called without
+ *  holding any lock, so it may take its time.
+ *  @param s is the report, packed or as text
+ *  @param packed is true if s is a packed report from a binary frame
+ */
+void Arduino::streamReport(const string& s, bool packed) {
+	StatusReport sr;
+	if (!(packed ? unpackStatus(s, sr) : parseStatus(s, sr))) return;
+	unique_lock<mutex> lck(bufMtx);
+	streamCount++; lastStreamTime = Util::elapsedTime();
+	StatusHandler handler = statusHandler;
+	lck.unlock();
+	if (handler != 0) (*handler)(sr);
+}
+
+/** Log messages pushed by the arduino.
+ *  Called by the reader thread.
+ *  @param s is the contents of the arduino's log buffer
+ */
+void Arduino::logReport(const string& s) {
+	size_t i = s.find_first_not_of(" ");
+	if (i != string::npos)
+		LOG_TRACE("arduino log: %s", s.substr(i).c_str());
+}
+
+/** Ask the arduino to stream status reports.
+ *  Reports are passed to a handler by the reader thread, as they arrive,
+ *  saving a query/reply round trip for every status update. Firmware
+ *  that does not support streaming ignores the request; callers can
+ *  use isStreaming() to check that reports are arriving.
+ *  @param period is the time between reports in ms (0 stops streaming)
+ *  @param handler is called with each report received
+ */
+void Arduino::streamStatus(int period, StatusHandler handler) {
+	unique_lock<mutex> lck(bufMtx);
+	statusHandler = (period > 0 ? handler : 0);
+	streamPeriod = max(period, 0);
+	lck.unlock();
+	command("W" + to_string(max(period, 0)));
+}
+
+/** Determine if status reports are arriving from the arduino.
+ *  @return true if streaming was requested and a report has
+ *  arrived recently
+ */
+bool Arduino::isStreaming() {
+	unique_lock<mutex> lck(bufMtx);
+	if (streamPeriod == 0 || lastStreamTime == 0) return false;
+	double limit = max(.5, 10 * streamPeriod / 1000.);
+	return Util::elapsedTime() - lastStreamTime < limit;
+}
+
+/** Send a command to the arduino and return its reply.
+ *  Any commands held by a batch in the calling thread are sent first.
+ *  @param s is the command string
+ *  @param force causes the command to be sent even when the arduino
+ *  is not yet ready (used during startup)
+ *  @return the reply, or the empty string if there was none
+ */
 string Arduino::command(const string& s, bool force) {
 	if (!force && !isReady()) return "";
-	unique_lock<mutex> lck(ardMtx);
+	if (batchCmds != 0 && batchCmds->size() > 0) flushBatch();
+	return transact(s);
+}
 
-	// clear buffer before sending command
-	bufMtx.lock(); buf.clear(); bufMtx.unlock();
+/** Send a command for which no reply is needed.
+ *  If the calling thread has a batch in scope, the command is added
+ *  to the batch, otherwise it is sent immediately.
+ *  @param s is the command string
+ */
+void Arduino::send(const string& s) {
+	if (!isReady()) return;
+	if (batchCmds != 0) { batchCmds->push_back(s); return; }
+	command(s);
+}
 
-	string reply; unsigned int i, j;
-	i = 0; // all characters up to buf[i-1] have been examined
-	for (int k = 0; k < 25; k++) {
-		if (k == 0 || k == 8 || k == 16) {
-			// retry up to 2 times
-			if (write(fd, (s + ".\n").c_str(), s.length() + 2) < 0) {
-				logger.debug("arduino write failure, disabling");
-				ready.store(false);
-				return "";
-			}
+/** Get the sequence tag for the next command.
+ *  Caller must hold ardMtx.
+ *  @return a tag of the form @hh, or the empty string if the firmware
+ *  does not support tags
+ */
+string Arduino::nextTag() {
+	if (!isFramed()) return "";
+	char tag[4];
+	snprintf(tag, sizeof(tag), "@%02x", seqNum);
+	seqNum = (seqNum + 1) & 0xff;
+	return string(tag);
+}
+
+/** Encode a command for transmission.
+ *  @param tag is the sequence tag for the command (may be empty)
+ *  @param s is the command string
+ *  @param op is the op code, when binary frames are used
+ *  @return the bytes to be sent to the arduino
+ */
+string Arduino::encode(const string& tag, const string& s, int op) {
+	if (!isBinary()) return tag + s + ".\n";
+	string frame;
+	frame += (char) SYNC; frame += (char) s.length();
+	frame += (char) strtol(tag.substr(1).c_str(), 0, 16);
+	frame += (char) op; frame += s;
+	uint16_t crc = crc16(0xffff, &frame[1], s.length() + 3);
+	frame += (char) (crc >> 8); frame += (char) (crc & 0xff);
+	return frame;
+}
+
+/** Update a CRC-16 (CCITT polynomial) with a block of bytes.
+ *  @param crc is the initial crc value (0xffff at start of frame)
+ *  @param p points to the bytes
+ *  @param n is the number of bytes
+ *  @return the updated crc
+ */
+uint16_t Arduino::crc16(uint16_t crc, const char* p, int n) {
+	while (n-- > 0) {
+		crc ^= ((uint16_t) (uint8_t) *p++) << 8;
+		for (int i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+	return crc;
+}
+
+/** Remove the reply with a given tag from the list of received lines.
+ *  Caller must hold bufMtx.
+ *  @param tag is the sequence tag of the reply (if empty, the first
+ *  line is taken)
+ *  @param reply is used to return the reply, with its tag removed
+ *  @return true if the reply was found
+ */
+bool Arduino::takeReply(const string& tag, string& reply) {
+	for (auto p = lines.begin(); p != lines.end(); p++) {
+		if (tag.length() > 0 && p->compare(0, tag.length(), tag) != 0)
+			continue;
+		reply = p->substr(tag.length());
+		lines.erase(p);
+		return true;
+	}
+	return false;
+}
+
+/** Send a command to the arduino and wait for its reply.
+ *  The command is resent if there is no reply within 40 ms,
+ *  and abandoned if there is still no reply after 125 ms.
+ *  @param s is the command string
+ *  @param op is the op code, when binary frames are used
+ *  @return the reply, or the empty string if there was none
+ */
+string Arduino::transact(const string& s, int op) {
+	unique_lock<mutex> lck(ardMtx);
+
+	// discard stale replies before sending command
+	unique_lock<mutex> blck(bufMtx);
+	lines.clear();
+	blck.unlock();
+
+	const int deadline[] = { 40, 80, 125 }; // in ms from first send
+	string tag = nextTag();
+	string cmd = encode(tag, s, op);
+	string reply;
+	auto t0 = steady_clock::now();
+	for (int k = 0; k < 3; k++) {
+		if (write(fd, cmd.c_str(), cmd.length()) < 0) {
+			logger.debug("arduino write failure, disabling");
+			ready.store(false);
+			return "";
 		}
-		sleep_for(milliseconds(5));
-		bufMtx.lock();
-		if (i >= buf.length()) {
-			bufMtx.unlock(); continue;
-		}
-		// examine new characters
-		j = i;
-		while (j < buf.length() && buf[j] != '\n') j++;
-		if (j < buf.length()) {
-			// buf[j] == '\n'
-
-			// complicated for backward compatibility
-			if (j > 0 && (buf[j-1] == '.' || buf[j-1] == '+'))
-				reply += buf.substr(i, (j-1)-i);
-			else
-				reply += buf.substr(i, j-i);
-
-			buf.clear();
-			bufMtx.unlock();
+		blck.lock();
+		if (k > 0) retryCount++;
+		bool found = replyReady.wait_until(blck,
+			t0 + milliseconds(deadline[k]),
+			[&]() { return takeReply(tag, reply) || quit.load(); });
+		if (found && !quit.load()) {
+			duration<double> t = steady_clock::now() - t0;
+			recordLatency(t.count());
+			blck.unlock();
 			failureCount = 0;
 			return reply;
 		}
-		// not done yet
-		reply += buf.substr(i);
-		i = buf.length();
-		bufMtx.unlock();
+		blck.unlock();
+		if (quit.load()) return "";
 	}
+	blck.lock(); timeoutCount++; blck.unlock();
 	if (failureCount > 2)
 		logger.debug("Arduino: no reply to command (%d, %s)",
 					  failureCount+1, s.c_str());
@@ -181,44 +520,298 @@ string Arduino::command(const string& s, bool force) {
 	return "";
 }
 
+/** Send a sequence of queries without waiting for each reply in turn.
+ *  Queries are sent as long as the total length of the outstanding
+ *  ones fits in the arduino's input buffer; replies are matched to
+ *  queries using their sequence tags. If the firmware does not
+ *  support tags, the queries are sent one at a time.
+ *  @param queries is a vector of query strings
+ *  @param replies is used to return the replies; replies[i] is the
+ *  reply to queries[i], or the empty string if there was no reply
+ *  @return the number of queries that received a reply
+ */
+int Arduino::pipeline(const vector<string>& queries, vector<string>& replies) {
+	int n = queries.size();
+	replies.assign(n, "");
+	if (!isReady()) return 0;
+	if (batchCmds != 0 && batchCmds->size() > 0) flushBatch();
+	if (!isFramed()) {
+		int count = 0;
+		for (int i = 0; i < n; i++) {
+			replies[i] = transact(queries[i]);
+			if (replies[i].length() > 0) count++;
+		}
+		return count;
+	}
+
+	struct Pending {
+		int		index;		// index of query
+		string	tag;		// sequence tag
+		string	msg;		// encoded query, as sent
+		steady_clock::time_point t0;	// time of first send
+		int		tries;		// number of times sent
+	};
+	const int deadline[] = { 40, 80, 125 }; // in ms from first send
+
+	unique_lock<mutex> lck(ardMtx);
+	unique_lock<mutex> blck(bufMtx);
+	lines.clear();
+	blck.unlock();
+
+	deque<Pending> pending; int bytes = 0;
+	int next = 0; int count = 0;
+	while (next < n || pending.size() > 0) {
+		// send as many queries as will fit
+		while (next < n) {
+			int len = queries[next].length() + 6; // tag/header and trailer
+			if (pending.size() > 0 && bytes + len > MAXFRAME) break;
+			Pending q;
+			q.index = next; q.tag = nextTag();
+			q.msg = encode(q.tag, queries[next]);
+			q.t0 = steady_clock::now(); q.tries = 1;
+			if (write(fd, q.msg.c_str(), q.msg.length()) < 0) {
+				logger.debug("arduino write failure, disabling");
+				ready.store(false);
+				return count;
+			}
+			bytes += q.msg.length(); pending.push_back(q); next++;
+		}
+
+		// wait for a reply to one of the pending queries
+		auto wakeup = pending.front().t0 +
+					  milliseconds(deadline[pending.front().tries-1]);
+		for (Pending& q : pending) {
+			auto t = q.t0 + milliseconds(deadline[q.tries-1]);
+			if (t < wakeup) wakeup = t;
+		}
+		blck.lock();
+		replyReady.wait_until(blck, wakeup, [&]() {
+			return quit.load() || (lines.size() > 0); });
+		if (quit.load()) return count;
+
+		// collect replies and retry or abandon overdue queries
+		auto now = steady_clock::now();
+		for (auto p = pending.begin(); p != pending.end(); ) {
+			if (takeReply(p->tag, replies[p->index])) {
+				duration<double> t = now - p->t0;
+				recordLatency(t.count());
+				count++; bytes -= p->msg.length();
+				p = pending.erase(p);
+			} else if (now >= p->t0 + milliseconds(deadline[p->tries-1])) {
+				if (p->tries < 3) {
+					retryCount++; p->tries++;
+					if (write(fd, p->msg.c_str(), p->msg.length()) < 0)
+						logger.debug("Arduino: write failure on retry");
+					p++;
+				} else {
+					timeoutCount++; bytes -= p->msg.length();
+					p = pending.erase(p);
+				}
+			} else {
+				p++;
+			}
+		}
+		lines.clear();	// anything left is stale
+		blck.unlock();
+	}
+	failureCount = 0;
+	return count;
+}
+
+/** Send the commands held by the calling thread's batch. */
+void Arduino::flushBatch() {
+	vector<string> cmds;
+	cmds.swap(*batchCmds);
+	sendBatch(cmds);
+}
+
+/** Send a list of commands in as few compound frames as possible.
+ *  @param cmds is a vector of commands for which no reply is needed
+ */
+void Arduino::sendBatch(vector<string>& cmds) {
+	if (!isReady()) return;
+	if (!isFramed()) {
+		for (string& c : cmds) transact(c);
+		return;
+	}
+	unsigned int i = 0;
+	while (i < cmds.size()) {
+		// pack commands until frame is full; tag and ".\n" take 5 bytes
+		string frame = cmds[i++]; int k = 1;
+		while (i < cmds.size() &&
+			   frame.length() + cmds[i].length() + 7 <= MAXFRAME) {
+			frame += ";" + cmds[i++]; k++;
+		}
+		if (k == 1) { transact(frame); continue; }
+		string reply = transact("#" + frame);
+		if ((int) count(reply.begin(), reply.end(), ';') != k-1)
+			logger.debug("Arduino: incomplete reply to frame %s",
+						 frame.c_str());
+	}
+}
+
+/** Add a reply latency to the statistics.
+ *  Caller must hold bufMtx.
+ *  @param t is the time from the first send to the reply, in seconds
+ */
+void Arduino::recordLatency(double t) {
+	replyCount++; totalLatency += t;
+	minLatency = min(minLatency, t); maxLatency = max(maxLatency, t);
+	int i = 0; double bound = .00025;
+	while (i < NBINS-1 && t >= bound) { i++; bound *= 2; }
+	hist[i]++;
+}
+
+/** Reset the reply latency statistics. */
+void Arduino::clearStats() {
+	unique_lock<mutex> lck(bufMtx);
+	replyCount = timeoutCount = retryCount = crcErrors = streamCount = 0;
+	minLatency = 1e9; maxLatency = totalLatency = 0;
+	for (int i = 0; i < NBINS; i++) hist[i] = 0;
+}
+
+/** Get a summary of the reply latency statistics.
+ *  @return a string listing the number of replies, timeouts and retries,
+ *  the min/avg/max latency and a histogram of latencies in ms;
+ *  each histogram entry has the form "<b:n", meaning that n replies
+ *  had latency less than b ms (and at least the previous bound)
+ */
+string Arduino::linkStats() {
+	unique_lock<mutex> lck(bufMtx);
+	char sbuf[200];
+	snprintf(sbuf, sizeof(sbuf), "replies=%ld timeouts=%ld retries=%ld "
+		"crcErrors=%ld streamed=%ld latency(ms) min=%.2f avg=%.2f "
+		"max=%.2f\nhistogram:",
+		replyCount, timeoutCount, retryCount, crcErrors, streamCount,
+		(replyCount > 0 ? 1000 * minLatency : 0.),
+		(replyCount > 0 ? 1000 * totalLatency / replyCount : 0.),
+		1000 * maxLatency);
+	string s = sbuf;
+	double bound = .25;
+	for (int i = 0; i < NBINS; i++) {
+		if (i < NBINS-1)
+			snprintf(sbuf, sizeof(sbuf), " <%g:%ld", bound, hist[i]);
+		else
+			snprintf(sbuf, sizeof(sbuf), " >=%g:%ld", bound/2, hist[i]);
+		s += sbuf; bound *= 2;
+	}
+	return s;
+}
+
+/** Get a status report from the arduino.
+ *  @param sr is used to return the status values
+ *  @return true on success, false if no valid report was received
+ */
+bool Arduino::getStatus(StatusReport& sr) {
+	if (!isReady()) return false;
+	if (batchCmds != 0 && batchCmds->size() > 0) flushBatch();
+	if (isBinary()) return unpackStatus(transact("", OP_STATUS), sr);
+	return parseStatus(transact("s"), sr);
+}
+
+/** Decode a packed status report.
+ *  @param r is the report, as sent in a binary frame
+ *  @param sr is used to return the status values
+ *  @return true on success, false if the report is malformed
+ */
+bool Arduino::unpackStatus(const string& r, StatusReport& sr) {
+	if (r.length() != STATUS_LEN) return false;
+	const uint8_t* p = (const uint8_t*) r.data();
+	sr.rtc.clear();
+	sr.battery = (p[0] << 8) | p[1];
+	sr.temperature = (p[2] << 8) | p[3];
+	sr.pressure1 = (p[4] << 8) | p[5];
+	sr.pressure2 = (p[6] << 8) | p[7];
+	sr.leak = (p[8] != 0);
+	if (p[9]) {
+		// clock registers are BCD, so print them in hex
+		char tbuf[24];
+		snprintf(tbuf, sizeof(tbuf), "%02x %02x %02x %02x %02x %02x %02x",
+				 p[10], p[11], p[12], p[13], p[14], p[15], p[16]);
+		sr.rtc = tbuf;
+	}
+	return true;
+}
+
+/** Decode a status report sent as text.
+ *  @param s is the report (the reply to the s command)
+ *  @param sr is used to return the status values
+ *  @return true on success, false if the report is malformed
+ */
+bool Arduino::parseStatus(const string& s, StatusReport& sr) {
+	sr.rtc.clear();
+	string line = s; vector<string> words;
+	Util::split(line, 12, words);
+	if (words.size() < 5) return false;
+	sr.battery = atoi(words[0].c_str());
+	sr.temperature = atoi(words[1].c_str());
+	sr.pressure1 = atoi(words[2].c_str());
+	sr.pressure2 = atoi(words[3].c_str());
+	sr.leak = (words[4] == "1");
+	if (words.size() == 12) {
+		sr.rtc = words[5];
+		for (int i = 6; i < 12; i++) sr.rtc += " " + words[i];
+	}
+	return true;
+}
+
+/** Get the arduino's log messages and add them to the log.
+ *  Does nothing when the arduino pushes its messages as they occur.
+ */
 void Arduino::log() {
-	string s = query("x");
-	if (s.length() > 2)
-		logger.trace("arduino log: %s", s.c_str());
+	if (logPush.load()) return;
+	// with binary frames, the log may be returned in several pieces
+	for (int i = 0; i < 8; i++) {
+		string s = query("x");
+		if (s.length() > 2)
+			LOG_TRACE("arduino log: %s", s.c_str());
+		if (!isBinary() || s.length() < MAXREPLY) break;
+	}
 }
 
-int	Arduino::stressTest(int n, double period) {
-	int count = 0; double tmin = 10.; double tmax = 0.; double ttot = 0.;
-	int miss = 0;
-	for (int i = 0; i < n; i++) {
+/** Send a series of echo queries to the arduino and check the replies.
+ *  The latency statistics are reset at the start and logged at the end.
+ *  @param n is the number of queries
+ *  @param period is the time between successive queries in seconds
+ *  (or groups of queries, when pipelining)
+ *  @param pipelined if true, queries are sent in groups of 8 using
+ *  pipeline(), rather than one at a time
+ *  @return the number of missing or incorrect replies
+ */
+int	Arduino::stressTest(int n, double period, bool pipelined) {
+	clearStats();
+	int count = 0; int miss = 0;
+	int groupSize = (pipelined ? 8 : 1);
+	double tstart = Util::elapsedTime();
+	for (int i = 0; i < n; i += groupSize) {
 		double t0 = Util::elapsedTime();
-		string s = query("e" + to_string(i));
-		double t = Util::elapsedTime();
-
-		double delay = t - t0;
-		if (s.length() == 0) {
-			miss++; 
-			//query("eOOPS");
-			//logger.error("log: %s", query("x").c_str());
+		vector<string> queries, replies;
+		for (int j = i; j < min(n, i + groupSize); j++)
+			queries.push_back("e" + to_string(j));
+		if (pipelined) {
+			pipeline(queries, replies);
 		} else {
-			tmax = max(tmax, delay);
-			ttot += delay;
-			tmin = min(tmin, delay);
-			int ii = atoi(s.c_str());
-			if (ii != i) {
+			replies.push_back(query(queries[0]));
+		}
+
+		for (unsigned int j = 0; j < replies.size(); j++) {
+			if (replies[j].length() == 0) {
+				miss++; continue;
+			}
+			int ii = atoi(replies[j].c_str());
+			if (ii != i + (int) j) {
 				count++;
-				logger.error("bad return value (%d, %d)", i, ii);
+				logger.error("bad return value (%d, %d)", i + j, ii);
 			}
 		}
 
-		//if (i % 20 == 19) query("x");
-
-		t = Util::elapsedTime();
-		delay = t - t0;
+		double delay = Util::elapsedTime() - t0;
 		if (delay < period)
 			sleep_for(milliseconds((int) (1000 * (period - delay))));
 	}
-	logger.error("tmin=%d tavg=%d tmax=%d", tmin, ttot/(n-miss), tmax);
+	logger.info("stressTest: %d queries in %.3f s, %d missed, %d bad\n%s",
+				n, Util::elapsedTime() - tstart, miss, count,
+				linkStats().c_str());
 	return count+miss;
 }
 
@@ -16,7 +16,8 @@ extern Config config;
 /** Constructor for a pressureSensor object.
  */
 LocationSensor::LocationSensor() {
-	recordedLocation = { 0.0, 0.0 };
+	Coord origin = { 0.0, 0.0 };
+	recordedLocation.store(origin);
 }
 
 /** Determine the current location.
@@ -68,9 +68,9 @@ void Pump::on(double rate) {
 	}
 	
 	if (rate != 0) {
-		logger.debug("%s on at rate %.3f", name.c_str(), rate);
+		LOG_DEBUG("%s on at rate %.3f", name.c_str(), rate);
 	} else if (currentRate != 0) {
-		logger.debug("%s off", name.c_str());
+		LOG_DEBUG("%s off", name.c_str());
 	}
 	currentRate = rate;
 
@@ -166,9 +166,9 @@ void Spectrometer::initState() {
  */
 bool Spectrometer::getSpectrum(int lconfig) {
 	unique_lock<mutex> lck(spectMtx);
-	logger.details("getSpectrum(%d)", lconfig);
+	LOG_DETAILS("getSpectrum(%d)", lconfig);
 	bool status = privateGetSpectrum(lconfig);
-	logger.trace("getSpectrum returning");
+	LOG_TRACE("getSpectrum returning");
 	return status;
 }
 
@@ -228,12 +228,37 @@ bool Spectrometer::privateGetSpectrum(int lconfig) {
 	spectAvg /= spectrum.size();
 	logger.details("spectrum: avg=%.0f, max=%.0f, maxWave=%.0f, "
 				   "i440=%.0f intTime=%.1f",
-			   	   spectAvg, spectMax, waveMax, spectrum[i440], intTime);
+			   	   spectAvg, spectMax, waveMax, spectrum[i440], intTime.load());
 	privateSetLights(0b000);
 	spectrum[0] = 0;
 	return true;
 }
 
+/** Acquire a single-scan preview spectrum.
+ *  Unlike getSpectrum, this does not cycle the lights or average
+ *  several scans, so it is fast enough to monitor the waveguide while
+ *  pumps are running. The caller is responsible for turning on the lights.
+ *  @param preview is a vector in which the spectrum is returned
+ *  @return true on success, false on failure or if there is no
+ *  spectrometer
+ */
+bool Spectrometer::getPreview(vector<double>& preview) {
+	unique_lock<mutex> lck(spectMtx);
+	if (noSpect) return false;
+	int errorCode;
+	double spect[SPECTRUM_SIZE];
+	int ssize = sb->spectrometerGetFormattedSpectrum(
+		deviceId, spectId, &errorCode, spect, SPECTRUM_SIZE);
+	if (ssize != SPECTRUM_SIZE) {
+		logger.error("Spectrometer::getPreview: "
+				 	 "unexpected spectrum length: %d", ssize);
+		return false;
+	}
+	spect[0] = spect[1] = 0; // ignore spurious values
+	preview.assign(spect, spect + SPECTRUM_SIZE);
+	return true;
+}
+
 /** Set integration time in milliseconds.
  *  @param itime is the specified integration time
  */
@@ -265,7 +290,7 @@ void Spectrometer::privateSetIntTime(double itime) {
  */
 void Spectrometer::setLights(int lconfig) {
 	unique_lock<mutex> lck(spectMtx);
-	logger.trace("Spectrometer::setLights(config=%s)",
+	LOG_TRACE("Spectrometer::setLights(config=%s)",
 			 	 Util::bits2string(lconfig,3).c_str());
 	privateSetLights(lconfig);
 }
@@ -276,7 +301,7 @@ void Spectrometer::privateSetLights(int lconfig) {
 }
 
 int Spectrometer::getLights() {
-	return lconfig;
+	return lconfig.load();
 		// no locking, since only used for gui display and don't
 		// want to wait during spectrum acquisition
 }
@@ -295,7 +320,7 @@ int Spectrometer::getLights() {
  *  range
  */
 bool Spectrometer::adjustIntTime() {
-    logger.trace( "adjustIntTime()", intTime);
+    LOG_TRACE( "adjustIntTime()", intTime.load());
 
 	for (int i = 0; i < 10; i++) {
     	getSpectrum(0b111);
@@ -308,7 +333,7 @@ bool Spectrometer::adjustIntTime() {
 			break;
 		}
 	}
-	logger.trace("adjustIntTime returning (true, %.2f)", intTime);
+	LOG_TRACE("adjustIntTime returning (true, %.2f)", intTime.load());
 	return true;
 }
 
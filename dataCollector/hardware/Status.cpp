@@ -8,6 +8,9 @@
 
 #include "Status.h"
 #include "Pump.h"
+#include "SupplyPump.h"
+#include "Valve.h"
+#include "MixValves.h"
 #include "Config.h"
 #include "Operations.h"
 #include "Arduino.h"
@@ -20,31 +23,71 @@ using std::chrono::milliseconds;
 namespace fizz {
 
 extern Pump samplePump;
+extern SupplyPump referencePump;
+extern SupplyPump reagent1Pump;
+extern SupplyPump reagent2Pump;
+extern Valve filterValve;
+extern Valve portValve;
+extern MixValves mixValves;
 extern Config config;
 extern CollectorState cstate;
 extern Arduino arduino;
+extern Status hwStatus;
 
 /** Constructor for a Status object.  */
 Status::Status() {
-	vbatParams.offset = 0; vbatParams.scale = 1024. / 16.2;
-	tempParams.offset = 0; tempParams.scale = 1024. / 100.;
-	upParams.offset = 0; upParams.scale = 1024. / 50;
-	downParams.offset = 0; downParams.scale = 1024. / 50;
-
-	vbat = raw(12., vbatParams);
-	temp = raw(25., tempParams);
-	upPressure = raw(0.1, upParams);
-	downPressure = raw(0.1, downParams);
-	leakStatus = false;
-
-	maxPressureRecorded = 0.; depthRecorded = 1;
+	cur.vbatParams.offset = 0; cur.vbatParams.scale = 1024. / 16.2;
+	cur.tempParams.offset = 0; cur.tempParams.scale = 1024. / 100.;
+	cur.upParams.offset = 0; cur.upParams.scale = 1024. / 50;
+	cur.downParams.offset = 0; cur.downParams.scale = 1024. / 50;
+
+	cur.vbat = raw(12., cur.vbatParams);
+	cur.temp = raw(25., cur.tempParams);
+	cur.upPressure = raw(0.1, cur.upParams);
+	cur.downPressure = raw(0.1, cur.downParams);
+	cur.leakStatus = false;
+	cur.dateTime = time(0);
+
+	cur.maxPressureRecorded = 0.; cur.depthRecorded = 1;
+	snap.store(cur);
+
+	telemetryCount = 0;
 } 
 
 void Status::init() {
-	upParams.offset = cstate.getPressureSensor("upstreamOffset");
-	upParams.scale = cstate.getPressureSensor("upstreamScale");
-	downParams.offset = cstate.getPressureSensor("downstreamOffset");
-	downParams.scale = cstate.getPressureSensor("downstreamScale");
+	unique_lock<mutex> lck(statusMtx);
+	cur.upParams.offset = cstate.getPressureSensor("upstreamOffset");
+	cur.upParams.scale = cstate.getPressureSensor("upstreamScale");
+	cur.downParams.offset = cstate.getPressureSensor("downstreamOffset");
+	cur.downParams.scale = cstate.getPressureSensor("downstreamScale");
+	snap.store(cur);
+}
+
+/** Ask the arduino to stream status reports.
+ *  The period is set by the statusPeriod config value; if it is 0,
+ *  or there is no control board, status values are obtained by polling.
+ */
+void Status::startStreaming() {
+	int period = config.getStatusPeriod();
+	if (period > 0 && arduino.isReady() && arduino.isEquipped())
+		arduino.streamStatus(period, streamHandler);
+}
+
+/** Record a status report streamed by the arduino. */
+void Status::streamHandler(const Arduino::StatusReport& sr) {
+	hwStatus.record(sr);
+}
+
+/** Get the date and time of the last status report.
+ *  @return a string of the form "2020-06-15 13:05:26"
+ */
+string Status::dateTimeString() {
+	time_t tt = snap.load().dateTime;
+	struct tm tm;
+	gmtime_r(&tt, &tm);
+	char buf[30];
+	strftime(buf, sizeof(buf), "%F %T", &tm);
+	return string(buf);
 }
 
 /** Set pressure parameters.
@@ -76,68 +119,111 @@ bool Status::setPressure(double v) {
 		pdset& pmax = pressureData[0];
 		if (pmax.cooked < 10) return false;
 
-		upParams.scale = (pmax.up - pmin.up)/ (pmax.cooked - pmin.cooked);
-		upParams.offset = pmin.up - upParams.scale * pmin.cooked;
-		downParams.scale = (pmax.down - pmin.down)/ (pmax.cooked - pmin.cooked);
-		downParams.offset = pmin.down - downParams.scale * pmin.cooked;
-		cstate.setPressureSensor("upstreamOffset", upParams.offset);
-		cstate.setPressureSensor("downstreamOffset", downParams.offset);
-		cstate.setPressureSensor("upstreamScale", upParams.scale);
-		cstate.setPressureSensor("downstreamScale", downParams.scale);
+		ppair& up = cur.upParams; ppair& down = cur.downParams;
+		up.scale = (pmax.up - pmin.up)/ (pmax.cooked - pmin.cooked);
+		up.offset = pmin.up - up.scale * pmin.cooked;
+		down.scale = (pmax.down - pmin.down)/ (pmax.cooked - pmin.cooked);
+		down.offset = pmin.down - down.scale * pmin.cooked;
+		cstate.setPressureSensor("upstreamOffset", up.offset);
+		cstate.setPressureSensor("downstreamOffset", down.offset);
+		cstate.setPressureSensor("upstreamScale", up.scale);
+		cstate.setPressureSensor("downstreamScale", down.scale);
 		pressureData.clear();
+		snap.store(cur);
 	} else {
 		// record data
-		pressureData.push_back({ v, upPressure, downPressure });
+		pressureData.push_back({ v, cur.upPressure, cur.downPressure });
 		if (pressureData.size() > 1) // 2)  // part of simplification
 			pressureData.erase(pressureData.begin());
 	}
 	return true;
 }
 
-/* Update the status readings.
- * The results are saved in the "cache".
+/** Update the status readings.
+ *  When the arduino is streaming status reports, the readings are
+ *  updated as the reports arrive, so there is nothing to do here.
+ *  Otherwise, a status report is requested from the arduino.
  */
 void Status::update() {
-	unique_lock<mutex> lck(statusMtx);
+	if (arduino.isStreaming()) return;
+
+	Arduino::StatusReport sr;
+	if (arduino.isReady() && arduino.getStatus(sr) && arduino.isEquipped()) {
+		record(sr); return;
+	}
+	// query sent to unequipped arduino to check serial link
 
 	// set dummy values for when no arduino or no control board
-	temp = raw(25., tempParams);
-	vbat = raw(12., vbatParams);
+	unique_lock<mutex> lck(statusMtx);
+	cur.temp = raw(25., cur.tempParams);
+	cur.vbat = raw(12., cur.vbatParams);
 	double f = samplePump.getCurrentRate() / samplePump.getMaxRate();
 	f = max(.05, f);
-	upPressure = raw(25 * f, upParams);
-	downPressure = raw(5 * f, downParams);
-	leakStatus = false;
+	cur.upPressure = raw(25 * f, cur.upParams);
+	cur.downPressure = raw(5 * f, cur.downParams);
+	cur.leakStatus = false;
+	cur.dateTime = time(0);
+	snap.store(cur);
+}
 
-	time_t tt = system_clock::to_time_t(system_clock::now());
-	struct tm tm = *gmtime(&tt);
-	char buf[30];
-	strftime(buf, sizeof(buf), "%F %T", &tm);
-	dateTime = string(buf);
-
-	if (!arduino.isReady()) return;
-	string s = arduino.query("s");
-	vector<string> words;
-	Util::split(s, 12, words);
-	if (words.size() < 5 || !arduino.isEquipped()) return;
-		// query sent to unequipped arduino to check serial link
-	
-	vbat = atoi(words[0].c_str());
-	temp = atoi(words[1].c_str());
-	upPressure = atoi(words[2].c_str());
-	downPressure = atoi(words[3].c_str());
-	maxPressureRecorded = max(maxPressureRecorded,
-							  cook(upPressure, upParams) -
-							  cook(downPressure, downParams));
-	leakStatus = (words[4] == "1");
-	if (words.size() == 12) {
-		string rtc = words[5] + " " + words[6]  + " " + words[7] + " " +
-					 words[8] + " " + words[9] + " " + words[10] + " " +
-					 words[11];
-		if (Clock::rtcCheck(rtc))
-			dateTime = "20" + words[11] + "-" + words[10] + "-" + words[9] +
-					   " "  + words[7]  + ":" + words[6]  + ":" + words[5];
+/** Record the values in a status report from the arduino.
+ *  @param sr is the status report
+ */
+void Status::record(const Arduino::StatusReport& sr) {
+	// convert the clock, if valid (format: ss mm hh dd DD MM YY)
+	time_t tt = time(0);
+	if (sr.rtc.length() > 0 && Clock::rtcCheck(sr.rtc)) {
+		const string& rtc = sr.rtc;
+		struct tm tm = {};
+		tm.tm_sec = atoi(rtc.substr(0,2).c_str());
+		tm.tm_min = atoi(rtc.substr(3,2).c_str());
+		tm.tm_hour = atoi(rtc.substr(6,2).c_str());
+		tm.tm_mday = atoi(rtc.substr(12,2).c_str());
+		tm.tm_mon = atoi(rtc.substr(15,2).c_str()) - 1;
+		tm.tm_year = 100 + atoi(rtc.substr(18,2).c_str());
+		tt = timegm(&tm);
 	}
+
+	unique_lock<mutex> lck(statusMtx);
+	cur.vbat = sr.battery;
+	cur.temp = sr.temperature;
+	cur.upPressure = sr.pressure1;
+	cur.downPressure = sr.pressure2;
+	cur.maxPressureRecorded = max(cur.maxPressureRecorded,
+							  	  cook(cur.upPressure, cur.upParams) -
+							  	  cook(cur.downPressure, cur.downParams));
+	cur.leakStatus = sr.leak;
+	cur.dateTime = tt;
+	snap.store(cur);
+
+	// add a telemetry sample; pump rates and valve states are read
+	// without locking, so this never waits for a command in progress
+	TelemetrySample& ts = telemetry[telemetryCount % TELEMETRY_SIZE];
+	ts.time = (uint32_t) (1000 * Util::elapsedTime());
+	ts.up = sr.pressure1; ts.down = sr.pressure2;
+	ts.rates[0] = (int16_t) (100 * samplePump.getCurrentRate());
+	ts.rates[1] = (int16_t) (100 * referencePump.getCurrentRate());
+	ts.rates[2] = (int16_t) (100 * reagent1Pump.getCurrentRate());
+	ts.rates[3] = (int16_t) (100 * reagent2Pump.getCurrentRate());
+	ts.valves = filterValve.state() | (portValve.state() << 1) |
+				(mixValves.state() << 2);
+	telemetryCount++;
+}
+
+/** Get the telemetry samples recorded since a mark.
+ *  @param mark is a value returned by markTelemetry()
+ *  @param samples is used to return the samples recorded since mark,
+ *  oldest first
+ *  @return the number of samples recorded since mark that were
+ *  overwritten before they could be retrieved
+ */
+long Status::getTelemetry(long mark, vector<TelemetrySample>& samples) {
+	unique_lock<mutex> lck(statusMtx);
+	long first = max(mark, telemetryCount - TELEMETRY_SIZE);
+	samples.clear();
+	for (long i = first; i < telemetryCount; i++)
+		samples.push_back(telemetry[i % TELEMETRY_SIZE]);
+	return first - mark;
 }
 
 } // ends namespace
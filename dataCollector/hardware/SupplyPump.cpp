@@ -59,11 +59,21 @@ double SupplyPump::getLevel(bool quiet) {
 	unique_lock<mutex> lck(spMtx);
 	adjustLevel();
 	if (!quiet)
-		logger.trace("SupplyPump (%s)::getLevel returning %d", 
+		LOG_TRACE("SupplyPump (%s)::getLevel returning %d", 
 		     	     name.c_str(), (int) fluidLevel);
 	return fluidLevel;
 }
 
+/** Estimate the fluid level for the reservoir, without locking.
+ *  Unlike getLevel, this does not adjust the recorded level, so it
+ *  never waits for a pump command in progress; intended for displays.
+ *  @return the estimated amount of fluid in the reservoir (in milliliters)
+ */
+double SupplyPump::peekLevel() {
+	double vol = (getCurrentRate()/60.) * (Util::elapsedTime() - changeTime);
+	return max(0.0, fluidLevel - vol);
+}
+
 /** Set the fluid level for this reservoir.
  *
  *  @param level is the specified fluid level (ml)
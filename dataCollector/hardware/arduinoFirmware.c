@@ -72,12 +72,81 @@ int check4faults = 0;     // when set check for failures, otherwise ignore
 int standAlone = 1;     // set when arduino running by itself
 int noisy = 0;      // used as flag to enable debugging code
 
+// average analog data values, updated by loop and reported by s command
+int battery = 0;
+int temperature = 0;
+int pressure1 = 0;
+int pressure2 = 0;
+
+// leak sensor reading, refreshed by loop every leakPeriod ms; reading the
+// sensor blocks for 5 ms, so status reports use this cached value
+int leakDetected = 0;
+const unsigned long leakPeriod = 250;
+
+// binary frames have the form: SYNC len seq op payload[len] crc16;
+// crc16 is big-endian and covers len, seq, op and the payload
+const uint8_t SYNC = 0xa5;
+const uint8_t OP_CMD = 1;       // payload is an ascii command line
+const uint8_t OP_STATUS = 2;    // request for packed status report
+const uint8_t OP_STREAM = 3;    // unsolicited status report (with OP_REPLY)
+const uint8_t OP_LOG = 4;       // unsolicited log messages (with OP_REPLY)
+const uint8_t OP_REPLY = 0x80;  // or'ed with op in reply frames
+
+char replyBuf[100];   // reply to current binary frame
+int replyLen = 0;     // number of bytes in replyBuf
+int binaryMode = 0;   // set while handling a binary frame
+int lastSeq = -1;     // sequence number of last binary frame
+uint8_t lastOp = 0;   // op code of reply to last binary frame
+
+// processor power state variables, set by S command
+unsigned long procSleepInterval = 0;
+unsigned long procSleepTime;
+int waiting2sleep = 0;
+
+// status streaming state, set by W command
+unsigned long streamPeriod = 0;   // ms between reports (0 when off)
+unsigned long lastStream = 0;     // time of last report
+int streamBinary = 0;             // set if reports are sent as binary frames
+
+char logBuf[512]; // buffer used to store log messages
+char *logNext;    // pointer to free space in logBuf
+
+// log push state, set by L command
+int logPush = 0;                  // set if log messages are sent unasked
+int logBinary = 0;                // set if they are sent as binary frames
+
 void initLog();
+void doCommand(char*, int, int);
+void endReply(int);
+void runLine(char*, int);
+void readFrame();
+void sendFrame(uint8_t, uint8_t, char*, int);
+unsigned int crc16(unsigned int, uint8_t*, int);
+int packStatus(char*);
+void textStatus(char*);
+void streamStatus();
+int out(const char*);
+void outInt(long);
+bool getTimeRaw(uint8_t*);
 void log(char*);
 void printLog();
+void pushLog();
 void configurePortXtender();
+void writeXtender(int, int);
 void configureDACs();
+void writeDAC(int, int, int);
+int i2cSend(int, unsigned char[], int);
+void setValve(int, int);
 void setPump(int, int);
+void writePin(int, int);
+void lights(int, int, int);
+void power(int, int);
+int check4leak();
+int ctoi(char*, int);
+int hex2bytes(char*, int, char*);
+char* int2string(char*, int);
+char* ulong2string(char*, unsigned long);
+char* stringCopy(char*, char*, int);
 bool setTime(char*);
 bool getTime(char*);
 
@@ -290,7 +359,7 @@ int hex2bytes(char *hex, int n, char *buf) {
     else if (*hex >= 'a' && *hex <= 'f')
       digit = 10 + *hex - 'a';
     if (digit >= 0) {
-      if (i&1 == 0) {
+      if ((i&1) == 0) {
         buf[i/2] = digit;
       } else {
         buf[i/2] = buf[i/2] * 16 + digit;
@@ -379,19 +448,32 @@ char *stringCopy(char *to, char *from, int n) {
  *  Fx     check for faults if x=1, else do not check
  *  H      return 0 if arduino operating standAlone, else 1
  *  x      return contents of log message buffer
+ *  V      return protocol version (2 means binary frames are supported)
+ *  Wm..m  stream status reports every m..m ms (0 stops the stream)
+ *  Lx     send log messages as they occur if x=1 (returns 1), or only
+ *         in reply to x if x=0
+ *
+ *  A line may start with a sequence tag @hh (two hex digits), which is
+ *  echoed at the start of the reply, so the host can match replies
+ *  to queries when it has several outstanding.
+ *
+ *  A compound frame #c1;c2;..;cn carries several commands on one line.
+ *  They are executed in order and their replies are returned on a single
+ *  line, separated by semicolons.
+ *
+ *  Once the host has checked the protocol version, it may send binary
+ *  frames in place of lines (see readFrame). These carry a command line
+ *  or a request for a packed status report, and are protected by a CRC.
+ *
+ *  Streamed status reports are sent between replies, either as lines
+ *  of the form "!s report." or as binary frames with op code
+ *  OP_STREAM|OP_REPLY, depending on how the W command was sent.
+ *  Pushed log messages are sent the same way, as "!x messages." or
+ *  with op code OP_LOG|OP_REPLY.
  */
 void loop() { 
-  // processor power state variables
-  static unsigned long procSleepInterval = 0;
-  static unsigned long procSleepTime;
-  static int waiting2sleep = 0;
   static unsigned long failureTime = 0;
 
-  // average analog data values
-  static int battery = 0;
-  static int temperature = 0;
-  static int pressure1 = 0;
-  static int pressure2 = 0;
   
   // sums of analog readings since last update
   static long bsum = 0;
@@ -401,12 +483,10 @@ void loop() {
 
   // used to control reading of of analog input signals
   static unsigned long lastUpdate = 0;
+  static unsigned long lastLeakCheck = 0;
   static unsigned long now = 0;
   static long count = 1;
 
-  // temporary buffer and associated pointer
-  char msgBuf[100]; char *p;
-
   // if (shutdownComplete) return;
 
   // wake up main processor if it's time to do so
@@ -417,6 +497,7 @@ void loop() {
       log("proc off");
       writePin(procOff, 1); writePin(commOff, 1); power(0,0);
       procPowerState = 0; waiting2sleep = 0;
+      streamPeriod = 0; logPush = 0; // keep log until host asks for it
     } else if (t - procSleepTime > procSleepInterval) {
       log("proc on");
       writePin(commOff, 0); writePin(procOff, 0);
@@ -442,6 +523,10 @@ void loop() {
     bsum = tsum = p1sum = p2sum = 0;   
     lastUpdate = now; count = 1;
 
+    if (millis() - lastLeakCheck >= leakPeriod) {
+      leakDetected = check4leak(); lastLeakCheck = millis();
+    }
+
     // and check for critical failures
     if (check4faults && !shutdownComplete) {
       if (failureDetected) {
@@ -451,7 +536,7 @@ void loop() {
           procPowerState = 0; shutdownComplete = 1; return;
         }
       } else if (!standAlone && (battery < 600 || temperature > 768 ||
-                 check4leak())) {
+                 leakDetected)) {
         log("fault detected");
         if (procPowerState) {
           failureDetected = 1; failureTime = now;
@@ -462,11 +547,21 @@ void loop() {
     }
   }
   
-  int i, n, m, pin, adr, pspeed, state;
-  char cmd, buf[100], bytes[100];
+  int n;
+  char buf[100];
 
   static int outOfSync = 0;
 
+  if (streamPeriod > 0 && millis() - lastStream >= streamPeriod) {
+    streamStatus(); lastStream = millis();
+  }
+  if (logPush && logBuf[0] != '\0') pushLog();
+
+  // check first byte, so a binary frame is not read as a line of text
+  if (Serial.available() == 0) return;
+  if (!outOfSync && Serial.peek() == SYNC) {
+    readFrame(); return;
+  }
   n = Serial.readBytesUntil('\n', buf, sizeof(buf)-2);
     // because readBytes may return without matching \n,
     // use second delimiter . to verify that we really do have complete command;
@@ -483,177 +578,394 @@ void loop() {
 
   if (n > 0) {
     buf[n] = '\0';
-    cmd = buf[0];
-    if (cmd != 'R' && cmd != 'C' && cmd != 's' && cmd != 'x') {
-      log(buf);
+    runLine(buf, n);
+  }
+}
+
+/** Carry out the command(s) on a line.
+ *  @param seg is a null-terminated line, without the final period;
+ *  it may start with a sequence tag and may be a compound frame
+ *  @param n is the length of the line
+ */
+void runLine(char *seg, int n) {
+  char *q;
+
+  if (seg[0] == '@' && n >= 3 && !binaryMode) {
+    // echo sequence tag
+    Serial.write((uint8_t*) seg, 3); seg += 3; n -= 3;
+  }
+  if (seg[0] != '#') {
+    doCommand(seg, n, 1);
+  } else {
+    // compound frame; run each command in turn
+    seg++;
+    while (1) {
+      q = seg;
+      while (*q != ';' && *q != '\0') q++;
+      if (*q == '\0') { doCommand(seg, q - seg, 1); break; }
+      *q = '\0'; doCommand(seg, q - seg, 0);
+      seg = q + 1;
     }
-    switch (cmd) {
-    case 'e':
-      // es..s echo back the string s..s
-      Serial.print(&buf[1]); Serial.print(".\n");
-      break;
-    case 'v':
-      // vns switch valve n (1-6) to state s
-      i = buf[1]-'0'; state = buf[2]-'0';
-      setValve(i, state);
-      if (noisy) {
-        Serial.print("Setting valve "); Serial.print(i);
-        Serial.print(" to state "); Serial.print(state);
-      }
-      Serial.print(".\n");
-      break;
-    case 'p':
-      // pnssss set pump n (1-6) speed to ssss; turn on when ssss!=0
-      i = buf[1] - '0';
-      pspeed = ctoi(&buf[2], n-2);
-      setPump(i, pspeed);
-      if (noisy) {
-        Serial.print("Setting pump "); Serial.print(i);
-        Serial.print(" to speed "); Serial.print(pspeed);
-      }
-      Serial.print(".\n");
-      break;
-    case 's':
-      // generate status report
-      p = int2string(msgBuf, battery); *p++ = ' '; *p = '\0';
-      p = int2string(p, temperature); *p++ = ' '; *p = '\0';
-      p = int2string(p, pressure1); *p++ = ' '; *p = '\0';
-      p = int2string(p, pressure2); *p++ = ' '; *p = '\0';
-      p = int2string(p, check4leak()); *p++ = ' '; *p = '\0';
-      if (!getTime(p)) {
-        *p++ = 'E'; *p = '\0';
-      }
-      Serial.print(msgBuf); Serial.print(".\n");
-      break;
-    case 'l':
-      // ldts   set light state (deuterium, tungsten, shutter)
-      lights(buf[1]-'0', buf[2]-'0', buf[3]-'0');
-      Serial.print(".\n");
-      break;
-    case 'P':
-      // Ppl   power controls pumps and valves, light source
-      if (noisy) {
-        Serial.print("Setting power state to ");
-        Serial.print(&buf[1]);
-      }
-      Serial.print(".\n");
-      power(buf[1]-'0', buf[2]-'0');
-      break;
-    case 't':
-      // t  read real-time clock; return string ss mm hh dd DD MM YY
-      if (getTime(buf)) {
-        Serial.print(buf); 
-      } else {
-        Serial.print("E");
-      }
-      Serial.print(".\n");
-      break;
-    case 'T':
-      // T ss mm hh dd DD MM YY  set real-time clock
-      setTime(&buf[2]);
-      Serial.print(".\n");
-      break;
-    case 'S':
-      // Sm..m put main processor to sleep for m..m minutes
-      // after a one minute delay
-      i = ctoi(&buf[1], n-1);
-      if (i == 0) {
-        // special case used when shutting down
-        // means that main processor has completed essential shutdown steps
-        if (failureDetected) {
-          power(0,0); writePin(procOff, 1); writePin(commOff, 1);
-          procPowerState = 0; shutdownComplete = 1;
-        }
-      } else if (procSleepInterval == 0) {
-        procSleepInterval = (60000ul * i) + 30000ul;
-               // add 30 seconds for initial delay
-        procSleepTime = millis(); waiting2sleep = 1;
-      }
-      if (noisy) {
-        Serial.print("Putting processor to sleep for "); Serial.print(i);
-        Serial.print(" minutes after 30 second delay");
-      }
-      Serial.print(".\n");
-      break;
-    case 'M':
-      state = buf[1]-'0';
-      writePin(commOff, (state ? 0 : 1));
-      if (noisy) {
-        Serial.print("Turning comm link ");
-        Serial.print(state == 0 ? "off.\n" : "on");
-      }
-      Serial.print(".\n");
-      break;
-    case 'N': 
-      Serial.print("going to noisy mode.\n");
-      noisy = 1; break;
-    case 'Q':
-      Serial.print("going to quiet mode.\n");
-      noisy = 0; break;
-    case 'D':
-      // Dppb   set digital output pp to state b
-      pin = ctoi(&buf[1], n-2); state = buf[n-1]-'0';
-      writePin(pin, state);
-      if (noisy) {
-        Serial.print("Setting digital output "); Serial.print(pin);
-        Serial.print(" to state "); Serial.print(state);
-      }
-      Serial.print(".\n");
-      break;
-    case 'A':
-      // Ap return value of analog pin p
-      pin = buf[1]-'0';
-      Serial.print(analogRead(pin)); Serial.print(".\n");
-      break;
-    case 'I':
-      // Iaa hh hh .. send a sequence of bytes to i2c bus;
-      // each pair of hex digits encodes a single byte;
-      // the first pair of hex digits (aa) is the 7 bit address
-      m = hex2bytes(&buf[1], n-1, bytes);
-      adr = bytes[0];
-      i2cSend(adr, (unsigned char*) &bytes[1], m-1);
-      if (noisy) {
-        Serial.print("sending "); Serial.print(m);       
-        Serial.print(" bytes to i2c device with address ");
-        buf[0] = (adr >> 4) & 0xf; buf[1] = adr & 0xf; buf[2] = '\0';
-        buf[0] = (buf[0] <= 9 ? '0' + buf[0] : 'a' + buf[0] - 10);
-        buf[1] = (buf[1] <= 9 ? '0' + buf[1] : 'a' + buf[1] - 10);
-        Serial.print(buf);
-      }
-      Serial.print(".\n");
-      break;
-    case 'F':
-      // Fx enable fault detection if x=1, else disable
-       check4faults = (buf[1] == '1' ? 1 : 0);
-      if (noisy) {
-        Serial.print("Turning fault monitoring ");
-        Serial.print(buf[1] == '1' ? "on.\n" : "off");
+  }
+}
+
+/** Read and process a binary frame.
+ *  Frames with a bad CRC are dropped, so the host will resend them.
+ *  A frame with the same sequence number as the previous one is a
+ *  resend of a frame whose reply was lost; the saved reply is sent
+ *  again, without repeating the command.
+ */
+void readFrame() {
+  uint8_t hdr[3], crcb[2];
+  char payload[100];
+  unsigned int len, crc;
+
+  Serial.read();  // discard sync byte
+  if (Serial.readBytes((char*) hdr, 3) != 3) return;
+  len = hdr[0];
+  if (len >= sizeof(payload)) return;
+  if (Serial.readBytes(payload, len) != len) return;
+  if (Serial.readBytes((char*) crcb, 2) != 2) return;
+  crc = crc16(0xffff, hdr, 3); crc = crc16(crc, (uint8_t*) payload, len);
+  if (crc != ((((unsigned int) crcb[0]) << 8) | crcb[1])) return;
+
+  if (hdr[1] != lastSeq) {
+    binaryMode = 1; replyLen = 0; payload[len] = '\0';
+    if (hdr[2] == OP_STATUS) replyLen = packStatus(replyBuf);
+    else if (hdr[2] == OP_CMD && len > 0) runLine(payload, len);
+    binaryMode = 0;
+    lastSeq = hdr[1]; lastOp = hdr[2] | OP_REPLY;
+  }
+  sendFrame(lastSeq, lastOp, replyBuf, replyLen);
+}
+
+/** Send a binary frame.
+ *  @param seq is the sequence number
+ *  @param op is the op code
+ *  @param p points to the payload
+ *  @param n is the length of the payload
+ */
+void sendFrame(uint8_t seq, uint8_t op, char *p, int n) {
+  uint8_t hdr[4];
+  unsigned int crc;
+
+  hdr[0] = SYNC; hdr[1] = n; hdr[2] = seq; hdr[3] = op;
+  crc = crc16(0xffff, &hdr[1], 3); crc = crc16(crc, (uint8_t*) p, n);
+  Serial.write(hdr, 4); Serial.write((uint8_t*) p, n);
+  Serial.write((uint8_t) ((crc >> 8) & 0xff));
+  Serial.write((uint8_t) (crc & 0xff));
+}
+
+/** Update a CRC-16 (CCITT polynomial) with a block of bytes.
+ *  @param crc is the initial crc value (0xffff at start of frame)
+ *  @param p points to the bytes
+ *  @param n is the number of bytes
+ *  @return the updated crc
+ */
+unsigned int crc16(unsigned int crc, uint8_t *p, int n) {
+  int i;
+  while (n-- > 0) {
+    crc ^= ((unsigned int) *p++) << 8;
+    for (i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  }
+  return crc & 0xffff;
+}
+
+/** Pack a status report.
+ *  The report has 17 bytes: battery, temperature, pressure1, pressure2
+ *  as 16 bit big-endian values, the leak status, a flag that is 1 if
+ *  the clock was read, and the seven clock registers (BCD).
+ *  @param p points to a buffer with room for the report
+ *  @return the number of bytes in the report
+ */
+int packStatus(char *p) {
+  int i, v[4];
+  uint8_t t[7];
+
+  v[0] = battery; v[1] = temperature; v[2] = pressure1; v[3] = pressure2;
+  for (i = 0; i < 4; i++) {
+    p[2*i] = (v[i] >> 8) & 0xff; p[2*i+1] = v[i] & 0xff;
+  }
+  p[8] = leakDetected;
+  p[9] = getTimeRaw(t) ? 1 : 0;
+  for (i = 0; i < 7; i++) p[10+i] = (p[9] ? t[i] : 0);
+  return 17;
+}
+
+/** Format a status report as text (the reply to the s command).
+ *  @param p points to a buffer with room for the report
+ */
+void textStatus(char *p) {
+  p = int2string(p, battery); *p++ = ' '; *p = '\0';
+  p = int2string(p, temperature); *p++ = ' '; *p = '\0';
+  p = int2string(p, pressure1); *p++ = ' '; *p = '\0';
+  p = int2string(p, pressure2); *p++ = ' '; *p = '\0';
+  p = int2string(p, leakDetected); *p++ = ' '; *p = '\0';
+  if (!getTime(p)) {
+    *p++ = 'E'; *p = '\0';
+  }
+}
+
+/** Send an unsolicited status report to the host. */
+void streamStatus() {
+  char sbuf[60];
+  int n;
+
+  if (streamBinary) {
+    n = packStatus(sbuf);
+    sendFrame(0, OP_STREAM | OP_REPLY, sbuf, n);
+  } else {
+    textStatus(sbuf);
+    Serial.print("!s "); Serial.print(sbuf); Serial.print(".\n");
+  }
+}
+
+/** Add a string to the reply to the current command.
+ *  When handling a binary frame, the string is added to the reply
+ *  buffer (as much as will fit); otherwise, it is sent immediately.
+ *  @param s is a null-terminated string
+ *  @return the number of characters added to the reply
+ */
+int out(const char *s) {
+  int n = 0;
+  if (!binaryMode) {
+    Serial.print(s);
+    while (s[n] != '\0') n++;
+    return n;
+  }
+  while (s[n] != '\0' && replyLen < (int) sizeof(replyBuf))
+    replyBuf[replyLen++] = s[n++];
+  return n;
+}
+
+/** Add an integer to the reply to the current command. */
+void outInt(long v) {
+  char b[12];
+  if (v < 0) { out("-"); v = -v; }
+  ulong2string(b, (unsigned long) v); out(b);
+}
+
+/** End the reply to a command.
+ *  @param last is non-zero for the last command on a line, in which case
+ *  the reply line is terminated; otherwise, a separator is added
+ */
+void endReply(int last) {
+  if (!last) out(";");
+  else if (!binaryMode) Serial.print(".\n");
+}
+
+/** Carry out a single command and send its reply.
+ *  @param buf is a null-terminated command string
+ *  @param n is the length of buf
+ *  @param last is non-zero if this is the last command on the line
+ */
+void doCommand(char *buf, int n, int last) {
+  int i, m, pin, adr, pspeed, state;
+  char cmd, msgBuf[100], bytes[100];
+
+  if (n <= 0) { endReply(last); return; }
+  cmd = buf[0];
+  if (cmd != 'R' && cmd != 'C' && cmd != 's' && cmd != 'x') {
+    log(buf);
+  }
+  switch (cmd) {
+  case 'e':
+    // es..s echo back the string s..s
+    out(&buf[1]); endReply(last);
+    break;
+  case 'v':
+    // vns switch valve n (1-6) to state s
+    i = buf[1]-'0'; state = buf[2]-'0';
+    setValve(i, state);
+    if (noisy) {
+      out("Setting valve "); outInt(i);
+      out(" to state "); outInt(state);
+    }
+    endReply(last);
+    break;
+  case 'p':
+    // pnssss set pump n (1-6) speed to ssss; turn on when ssss!=0
+    i = buf[1] - '0';
+    pspeed = ctoi(&buf[2], n-2);
+    setPump(i, pspeed);
+    if (noisy) {
+      out("Setting pump "); outInt(i);
+      out(" to speed "); outInt(pspeed);
+    }
+    endReply(last);
+    break;
+  case 's':
+    // generate status report
+    textStatus(msgBuf); out(msgBuf); endReply(last);
+    break;
+  case 'l':
+    // ldts   set light state (deuterium, tungsten, shutter)
+    lights(buf[1]-'0', buf[2]-'0', buf[3]-'0');
+    endReply(last);
+    break;
+  case 'P':
+    // Ppl   power controls pumps and valves, light source
+    if (noisy) {
+      out("Setting power state to ");
+      out(&buf[1]);
+    }
+    endReply(last);
+    power(buf[1]-'0', buf[2]-'0');
+    break;
+  case 't':
+    // t  read real-time clock; return string ss mm hh dd DD MM YY
+    if (getTime(msgBuf)) {
+      out(msgBuf); 
+    } else {
+      out("E");
+    }
+    endReply(last);
+    break;
+  case 'T':
+    // T ss mm hh dd DD MM YY  set real-time clock
+    setTime(&buf[2]);
+    endReply(last);
+    break;
+  case 'S':
+    // Sm..m put main processor to sleep for m..m minutes
+    // after a one minute delay
+    i = ctoi(&buf[1], n-1);
+    if (i == 0) {
+      // special case used when shutting down
+      // means that main processor has completed essential shutdown steps
+      if (failureDetected) {
+        power(0,0); writePin(procOff, 1); writePin(commOff, 1);
+        procPowerState = 0; shutdownComplete = 1;
       }
-      Serial.print(".\n");
-      break;
-    case 'H':
-      // check for presence of hardware
-      Serial.print(standAlone == 1 ? 0 : 1); Serial.print(".\n");
-      break;
-    case 'x':
-      // get log messages
-      printLog();
-      break;
-    default:
-      break;
+    } else if (procSleepInterval == 0) {
+      procSleepInterval = (60000ul * i) + 30000ul;
+             // add 30 seconds for initial delay
+      procSleepTime = millis(); waiting2sleep = 1;
+    }
+    if (noisy) {
+      out("Putting processor to sleep for "); outInt(i);
+      out(" minutes after 30 second delay");
     }
+    endReply(last);
+    break;
+  case 'M':
+    state = buf[1]-'0';
+    writePin(commOff, (state ? 0 : 1));
+    if (noisy) {
+      out("Turning comm link ");
+      out(state == 0 ? "off" : "on");
+    }
+    endReply(last);
+    break;
+  case 'N': 
+    out("going to noisy mode"); endReply(last);
+    noisy = 1; break;
+  case 'Q':
+    out("going to quiet mode"); endReply(last);
+    noisy = 0; break;
+  case 'D':
+    // Dppb   set digital output pp to state b
+    pin = ctoi(&buf[1], n-2); state = buf[n-1]-'0';
+    writePin(pin, state);
+    if (noisy) {
+      out("Setting digital output "); outInt(pin);
+      out(" to state "); outInt(state);
+    }
+    endReply(last);
+    break;
+  case 'A':
+    // Ap return value of analog pin p
+    pin = buf[1]-'0';
+    outInt(analogRead(pin)); endReply(last);
+    break;
+  case 'I':
+    // Iaa hh hh .. send a sequence of bytes to i2c bus;
+    // each pair of hex digits encodes a single byte;
+    // the first pair of hex digits (aa) is the 7 bit address
+    m = hex2bytes(&buf[1], n-1, bytes);
+    adr = bytes[0];
+    i2cSend(adr, (unsigned char*) &bytes[1], m-1);
+    if (noisy) {
+      out("sending "); outInt(m);       
+      out(" bytes to i2c device with address ");
+      buf[0] = (adr >> 4) & 0xf; buf[1] = adr & 0xf; buf[2] = '\0';
+      buf[0] = (buf[0] <= 9 ? '0' + buf[0] : 'a' + buf[0] - 10);
+      buf[1] = (buf[1] <= 9 ? '0' + buf[1] : 'a' + buf[1] - 10);
+      out(buf);
+    }
+    endReply(last);
+    break;
+  case 'F':
+    // Fx enable fault detection if x=1, else disable
+     check4faults = (buf[1] == '1' ? 1 : 0);
+    if (noisy) {
+      out("Turning fault monitoring ");
+      out(buf[1] == '1' ? "on" : "off");
+    }
+    endReply(last);
+    break;
+  case 'H':
+    // check for presence of hardware
+    outInt(standAlone == 1 ? 0 : 1); endReply(last);
+    break;
+  case 'x':
+    // get log messages
+    printLog(); endReply(last);
+    break;
+  case 'L':
+    // Lx send log messages as they occur if x=1
+    logPush = (n > 1 && buf[1] == '1');
+    logBinary = binaryMode;
+    if (logPush) out("1");
+    endReply(last);
+    break;
+  case 'V':
+    // report protocol version; host checks this before using binary
+    // frames, so forget the last binary sequence number
+    lastSeq = -1;
+    outInt(2); endReply(last);
+    break;
+  case 'W':
+    // Wm..m stream status reports every m..m ms, in the same form
+    // (text or binary) as the command; W0 stops the stream
+    i = ctoi(&buf[1], n-1);
+    streamPeriod = (i <= 0 ? 0 : (i < 20 ? 20 : i));
+    streamBinary = binaryMode; lastStream = millis();
+    endReply(last);
+    break;
+  default:
+    endReply(last);
+    break;
   }
 }
 
-char logBuf[512]; // buffer used to store log messages
-char *logNext;    // pointer to free space in logBuf
-
 void initLog() { logNext = logBuf;  *logNext = '\0'; }
 
-/* Print the contents of the log buffer to the serial link. */
+/* Print the contents of the log buffer to the serial link.
+ * Anything that does not fit in the reply is kept for next time. */
 void printLog() {
-  Serial.print(logBuf); Serial.print(".\n");
-  logNext = logBuf; *logNext = '\0';
+  char *p = logBuf + out(logBuf);
+  logNext = logBuf;
+  while (*p != '\0') *logNext++ = *p++;
+  *logNext = '\0';
+}
+
+/* Send the contents of the log buffer to the host, unasked.
+ * In binary mode, anything that does not fit in a frame is sent later. */
+void pushLog() {
+  char *p;
+  int n = 0;
+
+  if (!logBinary) {
+    Serial.print("!x "); Serial.print(logBuf); Serial.print(".\n");
+    initLog(); return;
+  }
+  while (logBuf[n] != '\0' && n < (int) sizeof(replyBuf)) n++;
+  sendFrame(0, OP_LOG | OP_REPLY, logBuf, n);
+  p = logBuf + n; logNext = logBuf;
+  while (*p != '\0') *logNext++ = *p++;
+  *logNext = '\0';
 }
 
 /* Add a message to the log buffer. */
@@ -693,6 +1005,26 @@ bool setTime(char *tbuf) {
  *  @return true if able to read time value, else false
  */
 bool getTime(char *tbuf) {
+  uint8_t t[7];
+  int i;
+
+  if (!getTimeRaw(t)) return false;
+  for (i = 0; i < 7; i++) {
+    *tbuf++ = ((t[i] >> 4) & 0xf) + '0'; *tbuf++ = (t[i] & 0xf) + '0';
+    *tbuf++ = ' ';
+  }
+  *tbuf = '\0';
+  return true;
+}
+
+/** Read the real-time clock registers.
+ *  @param t is an array in which the seven registers (BCD-encoded
+ *  ss mm hh dd DD MM YY) are returned
+ *  @return true on success, false on failure
+ */
+bool getTimeRaw(uint8_t *t) {
+  int i = 0;
+
   /* set control register
   Wire.beginTransmission(clkAdr);
   Wire.write(0x0e); Wire.write(0x04);
@@ -705,13 +1037,7 @@ bool getTime(char *tbuf) {
   if (Wire.endTransmission()) return false;
   
   Wire.requestFrom(clkAdr, (uint8_t) 7);
-  int v; int i = 0;
-  while (i < 7 && Wire.available()) {
-    v = Wire.read();
-    *tbuf++ = ((v >> 4) & 0xf) + '0'; *tbuf++ = (v & 0xf) + '0'; *tbuf++ = ' ';
-    i++;
-  }
-  *tbuf = '\0';
+  while (i < 7 && Wire.available()) t[i++] = Wire.read();
   if (i != 7) return false;
   return true;
 }
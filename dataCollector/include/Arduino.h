@@ -11,48 +11,173 @@
 #include "stdinc.h" 
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <vector>
+#include "Reactor.h"
 
 using namespace std;
 
 namespace fizz {
 
-/** This class provides an api for communicating with an arduino
+/** This class provides an api for communicating with an arduino.
+ *
+ *  A reader thread waits (using poll) for input on the serial link,
+ *  splits it into lines and hands each line to the thread waiting
+ *  for a reply, through a condition variable. The reader is shut down
+ *  by writing to a pipe that it polls along with the serial link.
+ *  Alternatively, the serial link can be watched by a Reactor, which
+ *  then does the reader's work in its loop thread.
+ *  Reply latencies are recorded in a histogram that can be retrieved
+ *  using linkStats().
+ *
+ *  If the firmware supports it, each command is prefixed with a
+ *  sequence tag that the arduino echoes in its reply, so stale replies
+ *  can be recognized and several queries can be outstanding at once
+ *  (see pipeline()). Commands sent while a Batch object is in scope
+ *  are combined into compound frames, each of which is carried out
+ *  by the arduino with a single reply.
+ *
+ *  If the firmware reports protocol version 2, commands are sent in
+ *  binary frames with a CRC, and resent frames are recognized by the
+ *  arduino, so a retry never repeats an actuator command. Lines of
+ *  text are still accepted from the arduino, in either mode.
+ *
+ *  The arduino can also be asked to stream status reports at a fixed
+ *  rate (see streamStatus()); these are passed to a handler by the
+ *  reader thread, rather than being queued as replies. If the firmware
+ *  supports it, log messages are also sent as they occur and passed
+ *  directly to the logger, so log() need not query for them.
  */
 class Arduino {
 public:		Arduino();
 			~Arduino();
 
-	bool	start();
+	bool	start(const string& ="", Reactor* =0);
 	void	finish();
 
 	string	command(const string&, bool=false);
-	void	send(const string& s) { command(s); }
+	void	send(const string&);
 	string	query(const string& s, bool force=false) {
 		return command(s, force);
 	}
+	int		pipeline(const vector<string>&, vector<string>&);
 	void	log();
 	bool	isReady() { return ready.load(); };
 	bool	isEquipped() { return equipped.load(); };
+	bool	isFramed() { return framed.load(); };
+	bool	isBinary() { return binary.load(); };
+	bool	isLogPushed() { return logPush.load(); };
+
+	/** Status values reported by the arduino. */
+	struct StatusReport {
+		int		battery;		///< raw battery voltage reading
+		int		temperature;	///< raw temperature reading
+		int		pressure1;		///< raw upstream pressure reading
+		int		pressure2;		///< raw downstream pressure reading
+		bool	leak;			///< true if leak detected
+		string	rtc;			///< clock as "ss mm hh dd DD MM YY",
+								///< or empty if clock not read
+	};
+	bool	getStatus(StatusReport&);
 
-	int		stressTest(int=1000, double=.05);
+	typedef void (*StatusHandler)(const StatusReport&);
+	void	streamStatus(int, StatusHandler);
+	bool	isStreaming();
+
+	/** While a Batch object is in scope, commands sent by the thread
+	 *  that created it are held, then sent in compound frames when
+	 *  the object is destroyed (or when the thread issues a query).
+	 *  Nested batches are merged with the outermost one.
+	 */
+	class Batch {
+	public:		Batch(Arduino&);
+				~Batch();
+	private:
+		Arduino& ard;
+		vector<string> cmds;	///< commands held for this batch
+		bool	outer;			///< true for the outermost batch
+	};
+
+	string	linkStats();
+	void	clearStats();
+	int		stressTest(int=1000, double=.05, bool=false);
 private:
+	static const int NBINS = 12;	///< number of latency histogram bins
+	static const int MAXLINES = 16;	///< max number of queued reply lines
+	static const int MAXFRAME = 60;	///< max bytes in a frame, and max
+									///< bytes of outstanding queries
+
+	// binary frames: SYNC len seq op payload[len] crc16 (big-endian);
+	// crc covers len, seq, op and payload
+	static const uint8_t SYNC = 0xa5;
+	static const int OP_CMD = 1;		///< payload is a command line
+	static const int OP_STATUS = 2;		///< packed status report
+	static const int OP_STREAM = 3;		///< streamed status report
+	static const int OP_LOG = 4;		///< pushed log messages
+	static const int OP_REPLY = 0x80;	///< or'ed with op in replies
+	static const int STATUS_LEN = 17;	///< length of packed status
+	static const unsigned MAXREPLY = 100; ///< max reply in binary frame
+
 	atomic<bool> ready;		///< true when arduino communicating
 	atomic<bool> equipped;	///< true if arduino has control board
+	atomic<bool> framed;	///< true if firmware supports tags and frames
+	atomic<bool> binary;	///< true if using binary frames
+	atomic<bool> logPush;	///< true if arduino pushes log messages
+	int		seqNum;			///< sequence number for next tag
 
-	int	fd;		///< file descriptor for serial link
-	string	buf;
-	bool	quit;
+	/** commands held by the current thread's batch (null if none) */
+	static thread_local vector<string>* batchCmds;
+
+	int		fd;				///< file descriptor for serial link
+	int		wakeFds[2];		///< pipe used to stop reader thread
+	Reactor* reactor;		///< watches fd in place of reader (or null)
+	atomic<bool> quit;		///< set to tell reader thread to exit
 	thread	readerThread;
 
-	mutex	ardMtx;		///< mutual exclusion for send and query
-	mutex	bufMtx;		///< mutual exclusion for buf string
+	string	partial;		///< incomplete line received from arduino
+	deque<string> lines;	///< complete lines not yet consumed
+	condition_variable replyReady; ///< signalled when a line is added
+
+	mutex	ardMtx;			///< mutual exclusion for send and query
+	mutex	bufMtx;			///< mutual exclusion for lines and stats
+
+	int		failureCount;
+
+	// status streaming state, protected by bufMtx
+	StatusHandler statusHandler;	///< called with each streamed report
+	int		streamPeriod;	///< ms between reports (0 if not streaming)
+	double	lastStreamTime;	///< elapsed time of last streamed report
+
+	// reply latency statistics, in seconds
+	long	replyCount;		///< number of replies received
+	long	timeoutCount;	///< number of commands with no reply
+	long	retryCount;		///< number of times a command was resent
+	long	crcErrors;		///< number of reply frames with bad crc
+	long	streamCount;	///< number of streamed status reports
+	double	minLatency;
+	double	maxLatency;
+	double	totalLatency;
+	long	hist[NBINS];	///< bin i counts latencies under .25*2^i ms
 
 	bool	setupSerialLink(int);
 	void	reader();
+	bool	readInput(int);
+	void	linkDown();
+	void	addLine(string&, bool=true);
+	string	transact(const string&, int=OP_CMD);
+	string	nextTag();
+	string	encode(const string&, const string&, int=OP_CMD);
+	static uint16_t crc16(uint16_t, const char*, int);
+	bool	takeReply(const string&, string&);
+	void	streamReport(const string&, bool);
+	void	logReport(const string&);
+	static bool unpackStatus(const string&, StatusReport&);
+	static bool parseStatus(const string&, StatusReport&);
+	void	flushBatch();
+	void	sendBatch(vector<string>&);
+	void	recordLatency(double);
 	static void startReader(Arduino&);
-
-	int		failureCount;
 };
 
 } // ends namespace
@@ -18,22 +18,39 @@ using namespace std;
 
 namespace fizz {
 
+/** Scheduling state for one sampling mission (see ScriptInterp).
+ */
+struct MissionState {
+	long	lastRun;		///< minute when mission last ran (-1 if never)
+	long	cycleCount;		///< number of cycles completed by mission
+	long	day;			///< day to which runs and fluid apply
+	int		runs;			///< number of runs on that day
+	double	fluid;			///< ml of reference/reagent used on that day
+	long	delay;			///< adaptive delay to next run (0 if none)
+};
+
 /** This class holds shadow copies of state variables owned
  *  by several "client methods" and provides methods to update
- *  the shadow variables. Whenever a variable is updated, the
- *  values of all shadow variables are written to an external
- *  state file.
+ *  the shadow variables. When a variable has been updated, the
+ *  next call to flush writes the values of all shadow variables
+ *  to an external state file, so a burst of updates leads to a
+ *  single write.
  */
 class CollectorState {
 public:		CollectorState(const string&);
 	
 	bool	read();
+	bool	flush();
 
 	int 	getCycleNumber();
 	double	getMaxRate(const string&);
 	double	getSupplyLevel(const string&);
 	double	getPressureSensor(const string&);
 	double	getIntegrationTime();
+	int		getBaseline(double&, double&);
+	void	getMissionState(unordered_map<string,MissionState>&);
+	void	getFlushSignature(vector<double>&);
+	void	getFilterResistance(double&, double&);
 	void	getDataStoreState(int&, int&, int&, unordered_map<string,int>&);
 
 	void 	setCycleNumber(int);
@@ -41,10 +58,15 @@ public:		CollectorState(const string&);
 	void	setSupplyLevel(const string&, double);
 	void	setPressureSensor(const string&, double);
 	void	setIntegrationTime(double);
+	void	setBaseline(int, double, double);
+	void	setMissionState(unordered_map<string,MissionState>&);
+	void	setFlushSignature(vector<double>&);
+	void	setFilterResistance(double, double);
 	void	setDataStoreState(int, int, int, unordered_map<string,int>&);
 
 private:
 	bool	doneReading;
+	bool	dirty;			///< set when a variable changes, cleared by flush
 	string	stateFile;
 	mutex	cstateMtx;
 
@@ -66,6 +88,17 @@ private:
 
 	double	integrationTime;
 
+	int		baselineCount;		///< # of cycles in adaptive sampling baseline
+	double	baseline440;		///< running baseline absorbance at 440 nm
+	double	baseline676;		///< running baseline absorbance at 676 nm
+
+	unordered_map<string,MissionState> missionState;
+
+	vector<double> flushSignature;	///< waveguide spectrum after last flush
+
+	double	filterResistance;	///< filter pressure per unit flow rate
+	double	filterResistanceTrend;	///< change in resistance per sample
+
 	int		currentIndex;
 	int		deploymentIndex;
 	int		spectrumCount;
@@ -96,7 +129,7 @@ inline double CollectorState::get(double* p) {
 
 inline void CollectorState::set(int* p, int v) {
 	unique_lock<mutex> lck(cstateMtx);
-	if (doneReading) { *p = v; update(); return; }
+	if (doneReading) { *p = v; dirty = true; return; }
 	cerr << "CollectorState:: attempting to set state "
 		"variable before state file is read\n";
 	exit(1);
@@ -104,7 +137,7 @@ inline void CollectorState::set(int* p, int v) {
 
 inline void CollectorState::set(double* p, double v) {
 	unique_lock<mutex> lck(cstateMtx); *p = v;
-	if (doneReading) { *p = v; update(); return; }
+	if (doneReading) { *p = v; dirty = true; return; }
 	cerr << "CollectorState:: attempting to set state "
 		"variable before state file is read\n";
 	exit(1);
@@ -150,6 +183,43 @@ inline double CollectorState::getIntegrationTime() {
 	return get(&integrationTime);
 }
 
+/** Get the baseline used by the adaptive sampling schedule.
+ *  @param b440 is used to return the baseline absorbance at 440 nm
+ *  @param b676 is used to return the baseline absorbance at 676 nm
+ *  @return the number of cycles included in the baseline (0 if none)
+ */
+inline int CollectorState::getBaseline(double& b440, double& b676) {
+	unique_lock<mutex> lck(cstateMtx);
+	if (doneReading) {
+		b440 = baseline440; b676 = baseline676;
+		return baselineCount;
+	}
+	cerr << "CollectorState:: attempting to access "
+		"variable before state file is read\n";
+	exit(1);
+}
+
+inline void CollectorState::getMissionState(
+	unordered_map<string,MissionState>& m) {
+	unique_lock<mutex> lck(cstateMtx);
+	if (doneReading) { m = missionState; return; }
+	cerr << "CollectorState:: attempting to access "
+		"mission state before state file is read\n";
+	exit(1);
+}
+
+inline void CollectorState::getFlushSignature(vector<double>& sig) {
+	unique_lock<mutex> lck(cstateMtx);
+	if (doneReading) { sig = flushSignature; return; }
+	cerr << "CollectorState:: attempting to access "
+		"flush signature before state file is read\n";
+	exit(1);
+}
+
+inline void CollectorState::getFilterResistance(double& r, double& trend) {
+	r = get(&filterResistance); trend = get(&filterResistanceTrend);
+}
+
 inline void CollectorState::getDataStoreState(
 	int& x, int& d, int& sc, unordered_map<string,int>& m) {
 	unique_lock<mutex> lck(cstateMtx);
@@ -203,13 +273,54 @@ inline void CollectorState::setIntegrationTime(double t) {
 	return set(&integrationTime, t);
 }
 
+inline void CollectorState::setBaseline(int count, double b440, double b676) {
+	unique_lock<mutex> lck(cstateMtx);
+	if (doneReading) {
+		baselineCount = count; baseline440 = b440; baseline676 = b676;
+		dirty = true;
+		return;
+	}
+	cerr << "CollectorState:: attempting to set state "
+		"variable before state file is read\n";
+	exit(1);
+}
+
+inline void CollectorState::setMissionState(
+	unordered_map<string,MissionState>& m) {
+	unique_lock<mutex> lck(cstateMtx);
+	if (doneReading) { missionState = m; dirty = true; return; }
+	cerr << "CollectorState:: attempting to set "
+		"mission state before state file is read\n";
+	exit(1);
+}
+
+inline void CollectorState::setFlushSignature(vector<double>& sig) {
+	unique_lock<mutex> lck(cstateMtx);
+	if (doneReading) { flushSignature = sig; dirty = true; return; }
+	cerr << "CollectorState:: attempting to set "
+		"flush signature before state file is read\n";
+	exit(1);
+}
+
+inline void CollectorState::setFilterResistance(double r, double trend) {
+	unique_lock<mutex> lck(cstateMtx);
+	if (doneReading) {
+		filterResistance = r; filterResistanceTrend = trend;
+		dirty = true;
+		return;
+	}
+	cerr << "CollectorState:: attempting to set state "
+		"variable before state file is read\n";
+	exit(1);
+}
+
 inline void CollectorState::setDataStoreState(
 	int x, int d, int sc, unordered_map<string,int>& m) {
 	unique_lock<mutex> lck(cstateMtx);
 	if (doneReading) {
 		currentIndex = x; deploymentIndex = d; 
 		spectrumCount = sc; recordMap = m;
-		update();
+		dirty = true;
 		return;
 	}
 	cerr << "CollectorState:: attempting to set "
@@ -12,6 +12,8 @@
 #include <atomic>
 #include <mutex>
 #include <vector>
+#include <memory>
+#include <sys/stat.h>
 #include "Coord.h"
 #include "Util.h"
 #include "SocketAddress.h"
@@ -20,35 +22,15 @@ using namespace std;
 
 namespace fizz {
 
-/** This class is used to read and update configuration variables.
+/** Values of the configuration variables.
+ *  Once published by Config, an instance is never modified, so it
+ *  can be read without locking.
  */
-class Config {
-public:		Config(const string&);
-	
-	bool	read();
-
-	int		getHardwareConfig();
-	string  getConfigString();
-	Coord	getLocation();
-	string	getDeploymentLabel();
-	double	getWaveguideLength();
-	double	getMaxPressure();
-	double	getMaxDepth();
-	int		getAutoRun();
-	bool	getPowerSave();
-	bool	getPortSwitching();
-	bool	getIgnoreFailures();
-	int		getLogLevel(const string&);
-
-	enum	{ BASIC=101, TWO_REAGENTS=102 };
-private:
-	bool	doneReading;
-
-	int	execMode;
-	int	hardwareConfig;
+struct ConfigData {
+	ConfigData();
 
+	int		hardwareConfig;
 	string	configString;
-	string	configFile;
 	Coord	location;
 	string	deploymentLabel;
 	double	waveguideLength;
@@ -61,62 +43,124 @@ private:
 	int		logLevelConsole;
 	int		logLevelStderr;
 	int		logLevelDebug;
+	long	adaptMinPeriod;		///< shortest inter-cycle period (minutes)
+	long	adaptMaxPeriod;		///< longest inter-cycle period (minutes)
+	double	adaptThreshold;		///< absorbance change for shortest period
+	string	adaptLabel;			///< label of spectrum used for change metric
+	double	flushTolerance;		///< spectral change that ends a flush step
+	double	pcTarget;			///< target filter pressure, as fraction of max
+	double	pcGainP;			///< normalized proportional gain
+	double	pcGainI;			///< normalized integral gain (per second)
+	int		statusPeriod;		///< ms between streamed status reports
+	string	arduinoDevice;		///< serial device (empty for /dev/ttyUSB*)
+	bool	eventRecords;		///< save log messages in binary form
+};
+
+/** This class is used to read and update configuration variables.
+ *  Each read parses the config file into a new ConfigData object,
+ *  which then replaces the current one in a single atomic step. So
+ *  readers never wait for a read in progress and never see a partly
+ *  updated configuration. The current object is published through an
+ *  atomic pointer, so readers take no locks at all; objects that are
+ *  replaced are kept until the Config is destroyed, since a reader
+ *  may still be using one (the file is rarely reread, so few pile up).
+ */
+class Config {
+public:		Config(const string&);
+	
+	bool	read();
+	bool	changed();
+
+	int		getHardwareConfig() { return current()->hardwareConfig; }
+	string  getConfigString() { return current()->configString; }
+	Coord	getLocation() { return current()->location; }
+	string	getDeploymentLabel() { return current()->deploymentLabel; }
+	double	getWaveguideLength() { return current()->waveguideLength; }
+	double	getMaxPressure() { return current()->maxPressure; }
+	double	getMaxDepth() { return current()->maxDepth; }
+	int		getAutoRun() { return current()->autoRun; }
+	bool	getPowerSave() { return current()->powerSave; }
+	bool	getPortSwitching() { return current()->portSwitching; }
+	bool	getIgnoreFailures() { return current()->ignoreFailures; }
+	int		getLogLevel(const string&);
+	bool	getAdaptiveSampling(long&, long&, double&, string&);
+	double	getFlushTolerance() { return current()->flushTolerance; }
+	void	getPressureControl(double&, double&, double&);
+	int		getStatusPeriod();
+	string	getArduinoDevice();
+	bool	getEventRecords();
+
+	enum	{ BASIC=101, TWO_REAGENTS=102 };
+private:
+	string	configFile;
+	atomic<const ConfigData*> data;	///< current values
+	vector<unique_ptr<const ConfigData>> snapshots;
+							///< all values published, protected by readMtx
 
-	mutex	cfgMtx;		///< used to sync method calls
+	mutex	readMtx;		///< serializes calls to read
+	struct stat fileStat;	///< status of config file when last read
+
+	const ConfigData* current() { return data.load(memory_order_acquire); }
 };
 
-inline int Config::getHardwareConfig() {
-	unique_lock<mutex> lck(cfgMtx);
-	return hardwareConfig;
+inline int Config::getLogLevel(const string& s) {
+	const ConfigData* d = current();
+	return (s == "console" ? d->logLevelConsole :
+			(s == "stderr" ? d->logLevelStderr : d->logLevelDebug));
 }
 
-inline string Config::getConfigString() {
-	unique_lock<mutex> lck(cfgMtx);
-	return configString;
+/** Get the parameters for the filter pressure controller.
+ *  @param target is used to return the target pressure, as a fraction
+ *  of the maximum filter pressure
+ *  @param kp is used to return the proportional gain; a gain of 1 changes
+ *  the pump rate by the maximum rate when the pressure error equals
+ *  the target pressure
+ *  @param ki is used to return the integral gain, similarly normalized
+ */
+inline void Config::getPressureControl(double& target, double& kp, double& ki) {
+	const ConfigData* d = current();
+	target = d->pcTarget; kp = d->pcGainP; ki = d->pcGainI;
 }
 
-inline Coord Config::getLocation() {
-	unique_lock<mutex> lck(cfgMtx);
-	return location;;
+/** Get the period for status reports streamed by the arduino.
+ *  @return the time between reports in ms, or 0 if status values
+ *  are to be obtained by polling
+ */
+inline int Config::getStatusPeriod() {
+	return current()->statusPeriod;
 }
 
-inline string Config::getDeploymentLabel() {
-	unique_lock<mutex> lck(cfgMtx);
-	return deploymentLabel;
+/** Get the serial device used to communicate with the arduino.
+ *  @return the path name of the device, or the empty string if the
+ *  first available /dev/ttyUSB device is to be used
+ */
+inline string Config::getArduinoDevice() {
+	return current()->arduinoDevice;
 }
 
-inline double Config::getWaveguideLength() {
-	unique_lock<mutex> lck(cfgMtx);
-	return waveguideLength;
-}
-inline double Config::getMaxPressure() {
-	unique_lock<mutex> lck(cfgMtx);
-	return maxPressure;
-}
-inline double Config::getMaxDepth() {
-	unique_lock<mutex> lck(cfgMtx);
-	return maxDepth;
-}
-inline int Config::getAutoRun() {
-	unique_lock<mutex> lck(cfgMtx);
-	return autoRun;
-}
-inline bool Config::getPowerSave() {
-	unique_lock<mutex> lck(cfgMtx);
-	return powerSave;
-}
-inline bool Config::getPortSwitching() {
-	unique_lock<mutex> lck(cfgMtx);
-	return portSwitching;
-}
-inline bool Config::getIgnoreFailures() {
-	unique_lock<mutex> lck(cfgMtx);
-	return ignoreFailures;
+/** Determine how log messages are saved in the data file.
+ *  @return true if they are saved in binary events records, false if
+ *  they are saved as text in debug records
+ */
+inline bool Config::getEventRecords() {
+	return current()->eventRecords;
 }
-inline int Config::getLogLevel(const string& s) {
-	unique_lock<mutex> lck(cfgMtx);
-	return (s == "console" ? logLevelConsole :
-			(s == "stderr" ? logLevelStderr : logLevelDebug));
+
+/** Get the adaptive sampling parameters.
+ *  @param minPeriod is used to return the shortest inter-cycle period
+ *  @param maxPeriod is used to return the longest inter-cycle period
+ *  @param threshold is used to return the absorbance change at which
+ *  the shortest period is used
+ *  @param label is used to return the label of the spectrum from which
+ *  the change metric is computed
+ *  @return true if adaptive sampling is enabled, else false
+ */
+inline bool Config::getAdaptiveSampling(long& minPeriod, long& maxPeriod,
+										double& threshold, string& label) {
+	const ConfigData* d = current();
+	minPeriod = d->adaptMinPeriod; maxPeriod = d->adaptMaxPeriod;
+	threshold = d->adaptThreshold; label = d->adaptLabel;
+	return d->adaptMinPeriod > 0;
 }
 
 } // ends namespace
@@ -10,17 +10,39 @@
 
 #include "stdinc.h" 
 #include <mutex> 
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 #include "Util.h"
 #include "SocketAddress.h"
 #include "StreamSocket.h"
 #include "Logger.h"
 #include "LogTarget.h"
+#include "Reactor.h"
 
 using namespace std;
 
 namespace fizz {
 
-/** This class provides an interface to a remote console.
+/** This class provides an interface to remote consoles.
+ *  The listening socket and the connections are watched by a Reactor,
+ *  which accepts connections and reads input in its loop thread.
+ *  Complete lines are queued for the console interpreter, which
+ *  retrieves them using nextLine; replies go to the client that sent
+ *  the most recent line.
+ *
+ *  Several clients may be connected at once. Output to each client is
+ *  queued and sent without blocking; a client that falls too far behind
+ *  is disconnected. Clients may subscribe to topics that are pushed to
+ *  them, each at its own rate: "log" (log messages, to which all clients
+ *  are subscribed when they connect), "snapshot" (changes to snapshot
+ *  fields), "cycle" (sample cycle events), "spectrum" (spectrum
+ *  frames) and "summary" (sample cycle summaries, as saved in the data
+ *  file). Pushed lines start with '!', followed by the topic name.
+ *  A line may be followed by binary data, whose length is given in the
+ *  line, so only clients that ask for such data are sent it.
  */
 class Console : public LogTarget {
 public:		Console();
@@ -28,24 +50,68 @@ public:		Console();
 	int		getLevel() { return LogTarget::getLevel(); };
 	void	setLevel(int level) { LogTarget::setLevel(level); };
 
-	bool	open(const string&, int);
+	bool	open(const string&, int, Reactor&);
 	void	close();
-	int		accept();
-	bool	isConnected() { return connected; }
+	void	closeCurrent();
+	bool	isConnected();
 
-	int		readline(string&);
+	bool	nextLine(string&, int);
 	void	reply(const string&);
+	void	wakeup();
+	uint64_t getWakeups() { return wakeups.load(); }
+
+	bool	subscribe(const string&, double);
+	bool	unsubscribe(const string&);
+	void	publishSnapshot(const string&);
+	int		publish(const string&, const string&, const string& ="");
+	void	sendFrame(const string&, const string&, const string&);
 
 	void	logMessage(const string&, int=Logger::MAXLEVEL);
 
 private:
+	static const int MAXCLIENTS = 8;		///< max concurrent connections
+	static const int MAXQUEUE = 1 << 18;	///< max bytes queued for client
+
+	/** State of one subscription. */
+	struct Subscription {
+		double	rate;		///< max messages per second (0 for no limit)
+		double	tokens;		///< messages that may be sent now
+		double	last;		///< time tokens was last updated
+		long	dropped;	///< messages dropped since last one sent
+	};
+
+	/** State of one client connection. */
+	struct Client {
+		int		id;				///< identifies client to nextLine, reply
+		StreamSocket sock;
+		SocketAddress addr;
+		string	outq;			///< output not yet accepted by socket
+		bool	closing;		///< set when client is to be disconnected
+		unordered_map<string,Subscription> subs; ///< subscriptions by topic
+		double	snapDue;		///< time next snapshot is due
+		unordered_map<string,string> snap;	///< snapshot fields last sent
+	};
+
 	SocketAddress serverAddr;
-	SocketAddress clientAddr;
 	StreamSocket serverSock;
-	StreamSocket connSock;
+	mutex	consoleMtx;			///< protects all that follows
+
+	Reactor* reactor;			///< watches sockets, set by open
+	unordered_map<int,unique_ptr<Client>> clients; ///< clients by socket
+	int		nextId;				///< id for next client
+	int		current;			///< id of client that sent last line
+	deque<pair<int,string>> lines;	///< (client id, line) not yet retrieved
+	condition_variable lineCond;	///< signalled when line added or wakeup
+	bool	wakeFlag;			///< set by wakeup to end a wait
+	atomic<uint64_t> wakeups;	///< number of returns from nextLine
 
-	bool	connected;
-	mutex	consoleMtx;
+	void	acceptReady();
+	void	clientReady(int, uint32_t);
+	void	disconnect(int, const string&);
+	Client*	findClient(int);
+	void	output(Client&, const string&);
+	bool	admit(Subscription&, double);
+	void	reportDrops(Client&, const string&, Subscription&);
 };
 
 } // ends namespace
@@ -9,6 +9,8 @@
 
 #include "stdinc.h" 
 #include <mutex> 
+#include <condition_variable> 
+#include <atomic>
 #include "Interrupt.h"
 #include "ScriptInterp.h"
 
@@ -36,6 +38,9 @@ private:
 	void	valveControl(vector<string>&);
 	void	fluidSupplyControl(vector<string>&);
 	void	snapshot(vector<string>&);
+	string	snapshotString();
+	void	preview(vector<string>&);
+	void	spectrumFrame(const vector<double>&, int, bool, string&, string&);
 
 	string	scriptPath;
 
@@ -50,9 +55,22 @@ private:
 	void	reply(const string&);
 
 	mutex	mtx;
+	condition_variable quitCond;	///< signalled when quitFlag is set
 	thread	myThread;
 	thread::id thread_id;
 	static void startThread(ConsoleInterp&);
+
+	static const int MAXFPS = 20;	///< limit on preview frame rate
+
+	atomic<bool> previewOn;		///< cleared to stop preview thread
+	double	previewFps;			///< preview frames per second
+	int		previewPixels;		///< values per preview frame
+	atomic<uint32_t> frameSeq;	///< sequence number of next frame
+	condition_variable previewCond;	///< signalled when preview stopped
+	thread	previewThread;
+	void	previewLoop();
+	void	stopPreview();
+	static void startPreview(ConsoleInterp&);
 };
 
 } // ends namespace
@@ -12,11 +12,14 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include "Logger.h"
+#include "EventCodec.h"
 #include "Config.h"
 #include "CollectorState.h"
+#include "Summarizer.h"
 
 using namespace std;
 
@@ -39,6 +42,8 @@ public:		DataStore();
 	    return spectrumCount;
 	}
 
+	void	setMission(const string&);
+
 	void	saveDeploymentRecord();
 	void	saveScriptRecord();
 	void	saveConfigRecord();
@@ -47,20 +52,41 @@ public:		DataStore();
 	void	saveSpectrumRecord(vector<double>&, const string&,
 				   const string& = "", const string& = "");
 	void	saveCycleSummary();
+	void	saveTelemetryRecord(const string&, long);
 	void	saveDebugRecord(const string&);
+	void	saveEvent(const LogEvent&);
 
 	friend	class CollectorState;
 
 private:
 	bool	privateOpen();
+	void	privateSaveEvents();
 
 	int		currentIndex;		///< index of current record
 	int		deploymentIndex;	///< index of deployment record
 	int		spectrumCount;		///< # of spectra since last deployment record
+	string	mission;			///< name of mission producing records
 
 	unordered_map<string,int> recordMap;
 					///< map used to track record labels
 
+	/** Spectrum saved in the current deployment, as read back from the
+	 *  data file; kept while some labelled spectrum may refer to it. */
+	struct SavedSpectrum {
+		int		prereq1index;	///< index of first prerequisite, or 0
+		int		prereq2index;	///< index of second prerequisite, or 0
+		shared_ptr<const vector<double>> values;	///< spectrum values
+	};
+	unordered_map<int,SavedSpectrum> savedSpectra;
+					///< map from record index to saved spectrum
+	int		cycleFiltered;		///< last filtered spectrum, or 0
+	int		cycleConcentrate;	///< last concentrate spectrum, or 0
+	int		cycleSummaryIndex;	///< index of last cycle summary, or 0
+
+	Summarizer summarizer;		///< computes summary records
+	bool	modelsLoaded;		///< set after trying to load models
+	mutex	summaryMtx;			///< used to lock summarizer
+
 	string	filePath(const string&, int);	
 							///< path name to raw data file
 	ofstream dataFile;		///< stream for output file
@@ -72,7 +98,32 @@ private:
 	queue<string> debugStrings;	///< used to dodge deadlock
 	mutex   dbsMtx;				///< used to lock debugStrings
 
+	/** Log event waiting to be saved in an events record. */
+	struct PendingEvent {
+		uint32_t key;			///< identifies format string and level
+		int64_t	time;			///< elapsed time in ms
+		string	args;			///< packed arguments
+	};
+	static const int MAX_FORMATS = 2000;	///< limit on format table
+	static const int MAX_PENDING = 2000;	///< limit on pending events
+	static const int EVENT_BYTES = 2000;	///< target size of events
+	static const int EVENT_DELAY = 60000;	///< max ms before save
+
+	vector<PendingEvent> pendingEvents;	///< events not yet saved
+	int		pendingBytes;		///< approximate size of pendingEvents
+	long	droppedEvents;		///< events discarded since last record
+	unordered_map<uint32_t, pair<int,string>> eventFormats;
+							///< level and format for each key
+	unordered_map<uint32_t, int> fileFormats;
+							///< index of each key in current data file
+	mutex	eventMtx;		///< used to lock pending events and formats
+
 	string	encodeConfigScript(string&);
+	string	missionField();
+	void	restoreSpectra();
+	void	pruneSpectra();
+	bool	getMeasurement(int, Summarizer::Measurement&,
+						   vector<shared_ptr<const vector<double>>>&);
 };
 
 } // ends namespace
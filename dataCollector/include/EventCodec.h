@@ -0,0 +1,53 @@
+/** \file EventCodec.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef EVENTCODEC_H
+#define EVENTCODEC_H
+
+#include "stdinc.h"
+#include <vector>
+
+using namespace std;
+
+namespace fizz {
+
+/** A log message in structured form, as passed to LogTarget::logEvent.
+ *  The arguments are packed by EventCodec::pack.
+ */
+struct LogEvent {
+	double	time;			///< elapsed time when message was logged
+	int		level;			///< log level
+	const char* format;		///< printf-style format string
+	const char* args;		///< packed arguments
+	int		argLen;			///< length of packed arguments
+};
+
+/** Encoding used for structured log events. A message is represented
+ *  by its format string and its arguments, packed in binary form: each
+ *  integer as a zig-zag varint, each floating point value as 8 bytes,
+ *  each string as a varint length followed by its bytes. The format
+ *  strings are identified by a hash of the format and level, so a
+ *  table of formats can be shipped once and shared by many events.
+ */
+class EventCodec {
+public:
+	static uint32_t hash(const char*, int);
+	static bool	pack(const char*, va_list, char*, int, int&);
+	static bool	unpack(const string&, const uint8_t*&, const uint8_t*,
+					   string&, vector<string>&);
+
+	static void	putVarint(string&, int64_t);
+	static bool	getVarint(const uint8_t*&, const uint8_t*, int64_t&);
+
+	static string base64(const string&);
+	static bool	unbase64(const string&, string&);
+	static string jsonEscape(const string&);
+};
+
+} // ends namespace
+
+#endif
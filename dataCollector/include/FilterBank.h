@@ -0,0 +1,102 @@
+/** \file FilterBank.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef FILTERBANK_H
+#define FILTERBANK_H
+
+#include "stdinc.h"
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+namespace fizz {
+
+/** This class provides the linear filters used by the analysis library:
+ *  gaussian smoothing, Savitzky-Golay (polynomial window) smoothing and
+ *  derivatives, and integerization of raw spectra. Each filter is
+ *  represented by a kernel that is computed once for a given set of
+ *  parameters and cached, so later requests for the same parameters
+ *  share it. Kernels are immutable, so they may be used by several
+ *  threads at once.
+ *
+ *  Filters are applied one tap at a time across the whole vector, which
+ *  keeps the inner loops contiguous so the compiler can vectorize them,
+ *  and accumulates the terms for each output in the same order as the
+ *  javascript, so the results are the same.
+ */
+class FilterBank {
+public:
+	/** Gaussian smoothing kernel. Within width of the ends, a truncated
+	 *  window centered on the point is used; endWeight[i] is the sum of
+	 *  the taps in the window for the i-th point from the end. */
+	struct Gaussian {
+		int		width;			///< kernel has 2*width+1 taps
+		double	sigma;			///< spread of gaussian
+		vector<double> taps;	///< normalized taps
+		vector<double> endWeight; ///< renormalization for end windows
+	};
+
+	/** Savitzky-Golay kernel; applying it to a window of 2*width+1
+	 *  values gives the k-th coefficient of the least-squares polynomial
+	 *  of the given degree, which is multiplied by scale. */
+	struct SavGol {
+		int		degree;			///< degree of polynomial
+		int		width;			///< kernel has 2*width+1 taps
+		int		k;				///< index of coefficient
+		double	delta;			///< spacing of x values
+		double	scale;			///< multiplier for filter output
+		vector<double> taps;
+	};
+
+	/** Integerization plan for a set of raw wavelengths: output value i
+	 *  is the dot product of wt[i*stride .. i*stride+len[i]) with the
+	 *  raw values starting at start[i]. */
+	struct Integerizer {
+		vector<double> wavelengths;	///< raw wavelengths
+		bool	classic;		///< polynomial interpolation, else gaussian
+		double	params[2];		///< degree, width or width, sigma
+		int		lo, hi;			///< output wavelength range [lo,hi)
+		int		stride;
+		vector<int> start;
+		vector<int> len;
+		vector<double> wt;
+	};
+
+	/** Edge handling for gaussian smoothing. LIBRARY is Library.smooth,
+	 *  which leaves the first value at zero. ANALYSISLIB is the smooth
+	 *  in summarize/analysisLibrary, which copies the first value and
+	 *  stores the values near the right end in reverse order. */
+	enum Edges { LIBRARY, ANALYSISLIB };
+
+	static shared_ptr<const Gaussian> gaussian(int, double);
+	static shared_ptr<const SavGol> savgol(int, int, int, double=1);
+	static shared_ptr<const Integerizer> integerizer(const vector<double>&,
+								bool, double, double, int, int);
+
+	static void smooth(const Gaussian&, const vector<double>&,
+					   vector<double>&, Edges=LIBRARY);
+	static void smooth(const Gaussian&, const vector<vector<double>>&,
+					   vector<vector<double>>&, Edges=LIBRARY);
+	static void apply(const SavGol&, const vector<double>&, vector<double>&);
+	static void apply(const SavGol&, const vector<vector<double>>&,
+					  vector<vector<double>>&);
+	static void integerize(const Integerizer&, const vector<double>&,
+						   vector<double>&);
+
+	static bool deriv(const vector<double>&, int, int, int, vector<double>&,
+					  double=1);
+	static void polySmooth(const vector<double>&, int, int, int,
+						   vector<double>&);
+
+	static bool matrixInvert(vector<vector<double>>&);
+	static void clearCache();
+};
+
+} // ends namespace
+
+#endif
@@ -11,7 +11,8 @@
 #include "stdinc.h" 
 #include <mutex>
 #include <condition_variable>
-#include <vector>
+#include <list>
+#include <atomic>
 #include "Util.h"
 #include "Exceptions.h"
 #include "Logger.h"
@@ -42,6 +43,7 @@ struct InterruptClient {
 	bool	detect;					// set when interrupt detected by client
 	condition_variable detected;	// requestor uses to wait for detection
 	condition_variable cleared;		// client uses to wait for start/resume/end
+	condition_variable wake;		// wakes client from pause on request
 };
 
 extern Logger logger;
@@ -49,7 +51,8 @@ extern Logger logger;
 /** This class implements a Interrupt module. It allows one or more threads
  *  to be registered as "interruptible threads". Such a thread is expected
  *  to periodically check for pending interrupt requests, using the provided
- *  check or pause methds.
+ *  check or pause methds. A thread in pause sleeps until its delay expires
+ *  or an interrupt is requested, so idle threads do not wake up to poll.
  */
 class Interrupt {
 public:	
@@ -61,6 +64,7 @@ public:
 	void	check();
 	void	pause(double);
 	bool	inProgress(thread::id);
+	uint64_t getWakeups() { return wakeups.load(); }
 
 private:
 	thread::id id;		// id of the target thread
@@ -71,8 +75,13 @@ private:
 	bool	detect;		// set when target detects interrupt
 	void	(*handler)(); // called when interrupt request detected
 
-	vector<InterruptClient>  clientList;
+	list<InterruptClient>  clientList;	// list, so client addresses are stable
 	mutex	mtx;
+	atomic<uint64_t> wakeups;	// number of times a paused thread woke up
+
+	InterruptClient* self();
+public:
+	Interrupt() { wakeups.store(0); }
 };
 
 } // ends namespace
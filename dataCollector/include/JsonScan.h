@@ -0,0 +1,36 @@
+/** \file JsonScan.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef JSONSCAN_H
+#define JSONSCAN_H
+
+#include "stdinc.h"
+#include <vector>
+
+using namespace std;
+
+namespace fizz {
+
+/** Functions for extracting fields from single-line JSON records, like
+ *  those in the raw data files. Fields are located by name, without
+ *  parsing the whole record, so only flat records with distinct field
+ *  names are handled properly.
+ */
+class JsonScan {
+public:
+	static const char* findField(const string&, const string&);
+	static bool	parseString(const char*&, string&);
+	static bool	parseVector(const char*&, vector<double>&);
+
+	static bool	getString(const string&, const string&, string&);
+	static bool	getNumber(const string&, const string&, double&);
+	static bool	getVector(const string&, const string&, vector<double>&);
+};
+
+} // ends namespace
+
+#endif
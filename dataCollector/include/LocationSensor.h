@@ -13,6 +13,7 @@
 #include <string>
 #include "Coord.h"
 #include "Config.h"
+#include "SeqLock.h"
 
 namespace fizz {
 
@@ -24,22 +25,21 @@ class LocationSensor {
 public:
 		LocationSensor();
 	void	recordLocation();
-	Coord	getRecordedLocation();
+	Coord	getRecordedLocation() const;
 private:
-	Coord	recordedLocation;
-	mutex	locMtx;
+	SeqLock<Coord> recordedLocation;	///< readers never block
+	mutex	locMtx;				///< serializes calls to recordLocation
 
 	Coord	read();
 };
 
 inline void LocationSensor::recordLocation() {
 	unique_lock<mutex> lck(locMtx);
-	recordedLocation = read();
+	recordedLocation.store(read());
 }
 
-inline Coord LocationSensor::getRecordedLocation() {
-	unique_lock<mutex> lck(locMtx);
-	return recordedLocation;
+inline Coord LocationSensor::getRecordedLocation() const {
+	return recordedLocation.load();
 }
 
 
@@ -14,19 +14,38 @@ using namespace std;
 
 namespace fizz {
 
+struct LogEvent;
+
+/** Base class for an object that needs to know when the level of
+ *  a LogTarget changes.
+ */
+class LevelListener {
+public:
+	virtual void levelChanged() = 0;
+};
+
 /** This is a virtual class which serves as a base class for
  *  any class that receives log messages. A LogTarget must
- *  implement the logMessage method.
+ *  implement the logMessage method. A target that wants messages in
+ *  structured form also implements logEvent and returns true from
+ *  acceptsEvents; logEvent is then called after logMessage for each
+ *  message.
  */
 class LogTarget {
-public:		LogTarget() { logLevel.store(0); };
-			LogTarget(int level) { logLevel.store(level); };
+public:		LogTarget() : listener(0) { logLevel.store(0); };
+			LogTarget(int level) : listener(0) { logLevel.store(level); };
 
 	int		getLevel() { return logLevel.load(); }
-	void	setLevel(int level) { logLevel = level; }
+	void	setLevel(int level) {
+		logLevel = level; if (listener) listener->levelChanged();
+	}
+	void	setListener(LevelListener* lis) { listener = lis; }
 	virtual void logMessage(const string&, int) {} ;
+	virtual bool acceptsEvents() { return false; }
+	virtual void logEvent(const LogEvent&) {}
 protected:
 	atomic_int logLevel;
+	LevelListener* listener;	///< notified when logLevel changes
 };
 
 } // ends namespace
@@ -9,18 +9,64 @@
 #define LOGGER_H
 
 #include "stdinc.h" 
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "Util.h"
 #include "LogTarget.h"
+#include "EventCodec.h"
 
 using namespace std;
 
+/** Messages below this level are removed at compile time when logged
+ *  with the LOG_TRACE, LOG_DEBUG and LOG_DETAILS macros; for example,
+ *  "make all LOG_FLOOR=30" leaves out trace and debug messages.
+ */
+#ifndef LOG_FLOOR
+#define LOG_FLOOR 0
+#endif
+
+/** Log a message only if some target will accept it. Unlike the logger
+ *  methods, the arguments are not evaluated when the level is disabled,
+ *  so these should be used when the arguments are costly to compute or
+ *  the call is on a frequently executed path. They refer to the global
+ *  logger object.
+ */
+#define LOG_TRACE(...) do { \
+	if (fizz::Logger::TRACE >= LOG_FLOOR && \
+		logger.isEnabled(fizz::Logger::TRACE)) logger.trace(__VA_ARGS__); \
+	} while (0)
+#define LOG_DEBUG(...) do { \
+	if (fizz::Logger::DEBUG >= LOG_FLOOR && \
+		logger.isEnabled(fizz::Logger::DEBUG)) logger.debug(__VA_ARGS__); \
+	} while (0)
+#define LOG_DETAILS(...) do { \
+	if (fizz::Logger::DETAILS >= LOG_FLOOR && \
+		logger.isEnabled(fizz::Logger::DETAILS)) \
+		logger.details(__VA_ARGS__); \
+	} while (0)
+
 namespace fizz {
 
+struct LogRing;
+struct LogRecord;
+
 /** This class provides a simple message logging facility.
  *  Log targets are added using the addTarget method.
+ *
+ *  Logging is asynchronous. The calling thread formats its message
+ *  directly into a slot of a ring buffer owned by that thread and
+ *  returns; it never blocks on a target. A drain thread, started when
+ *  the first target is added, collects messages from all the rings,
+ *  adds the level and timestamp and passes them to the targets in
+ *  time order. When a ring is full, the message is dropped and counted;
+ *  the drain thread reports the number dropped with a warning.
+ *  Fatal messages are delivered before fatal() returns, and flush()
+ *  can be used to do the same before shutting down.
  */
-class Logger {
+class Logger : public LevelListener {
 public:		Logger();
+			~Logger();
 
 	enum {	TRACE = 10, DEBUG = 20, DETAILS = 30, INFO = 40, 
 			WARNING = 50, ERROR = 60, FATAL = 70, MAXLEVEL = 100
@@ -37,12 +83,47 @@ public:		Logger();
 	void	fatal(const char*, ...);
 	void	log(char*, int, const string&);
 	void	border(char='=');
+	void	flush();
+	uint64_t getDropCount();
+
+	bool	isEnabled(int) const;
+	void	levelChanged();
 
 	void	addTarget(LogTarget&);
 private:
-	vector<LogTarget*> targets;
+	vector<LogTarget*> targets;	///< targets, protected by targetMtx
+	atomic<int> minLevel;		///< lowest level accepted by any target
+	atomic<bool> packEvents;	///< true if some target accepts events
+	mutex	targetMtx;
+
+	vector<LogRing*> rings;		///< one ring per thread, protected by ringMtx
+	mutex	ringMtx;
+
+	thread	drainThread;		///< delivers messages to targets
+	atomic<bool> quit;			///< tells drainThread to stop
+	mutex	drainMtx;			///< held while emptying the rings
+	atomic<bool> pending;		///< set when a message is committed
+								///< after drainThread last looked
+	mutex	wakeMtx;			///< used with wakeup
+	condition_variable wakeup;	///< signalled when pending is set
+
+	LogRing* myRing();
+	void	vlog(int, const char*, const char*, va_list);
+	LogRecord* reserve(LogRing*&, int, const string&);
+	void	commit(LogRing*);
+	int		drain();
+	void	run();
 };
 
+/** Determine if a message at a given level would reach any target.
+ *  @param level is a log level
+ *  @return true if some target accepts messages at this level
+ */
+inline bool Logger::isEnabled(int level) const {
+	return level >= LOG_FLOOR &&
+		   level >= minLevel.load(memory_order_relaxed);
+}
+
 inline int Logger::string2logLevel(string& s) {
 	int level = 0;
 	if 		(s == "trace") level = Logger::TRACE;
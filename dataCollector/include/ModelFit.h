@@ -0,0 +1,76 @@
+/** \file ModelFit.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef MODELFIT_H
+#define MODELFIT_H
+
+#include "stdinc.h"
+#include <vector>
+
+using namespace std;
+
+namespace fizz {
+
+/** This class fits weighted sums of model spectra to a target spectrum,
+ *  as fitModels and findBestMatches in analysisConsole/modeLibs/standard
+ *  do, and returns the same results in the same order.
+ *
+ *  Every subset of at most some number of models is a candidate; with
+ *  posOnly, only subsets whose least squares weights are all
+ *  non-negative qualify. Results are ranked by squared error, with ties
+ *  going to the subset that SubsetLister lists first.
+ *
+ *  Rather than solving each subset from scratch, subsets are searched
+ *  depth first, extending a Cholesky factor of the Gram matrix by one
+ *  row per model added. The work of adding a row is shared by all the
+ *  subsets that extend the current one, so the error of a largest subset
+ *  takes constant time and that of any other O(k) time. A subtree
+ *  is skipped when the error of its largest possible model set (a lower
+ *  bound on the error of every subset in it) cannot beat the results
+ *  found so far. The best results are kept in heaps, one per thread.
+ */
+class ModelFit {
+public:		ModelFit(const vector<vector<double>>&, int=0, int=-1);
+
+	/** One fit of the models to a spectrum. */
+	struct Match {
+		vector<double> weights;		///< weight for each model
+		vector<double> backWeights;	///< background weights (bestMatches)
+		double	sqErr;				///< squared error of the fit
+	};
+
+	int		size() const { return models.size(); }
+	const vector<vector<double>>& getModels() const { return models; }
+
+	void	fit(const vector<double>&, int, int, bool, vector<Match>&,
+				int=1) const;
+	static void bestMatches(const vector<double>&, const vector<double>&,
+							const vector<vector<double>>&, const ModelFit&,
+							const ModelFit&, int, int, vector<Match>&,
+							int=1);
+
+	static double dotProduct(const vector<double>&, const vector<double>&,
+							 int, int);
+private:
+	vector<vector<double>> models;	///< model spectra
+	int		lo, hi;					///< index range used in fits
+	vector<vector<double>> gram;	///< dot products of model pairs
+
+	/** Cholesky factor of the Gram matrix, taking the models in reverse
+	 *  order, so its leading blocks are factors for the suffixes of the
+	 *  model list; revRank is the size of the largest one that exists */
+	vector<vector<double>> revFactor;
+	int		revRank;
+
+	struct Search;
+	bool	jsSolve(const vector<int>&, const vector<double>&, double,
+					vector<double>&, double&) const;
+};
+
+} // ends namespace
+
+#endif
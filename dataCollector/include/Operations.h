@@ -30,9 +30,13 @@ public:
 	static void unfilteredSample(double, double, double, double);
 	static void filteredSample(double, double, double, double);
 	static void filteredSampleAdaptive(double, double, double);
-	static bool adjustRates(double&, double, double, double,
-				double, double, double&);
+	static void controlledSample(double, double, double, double);
 	static void flushFilter();
+	static bool previewSignature(vector<double>&);
+	static double signatureDistance(const vector<double>&,
+									const vector<double>&);
+	static bool pumpUntilClean(const char*, double, const vector<double>&,
+							   vector<double>&);
 	static void purgeBubbles();
 	static void flush();
 	static string optimizeConcentration(
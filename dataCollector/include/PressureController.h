@@ -0,0 +1,89 @@
+/** \file PressureController.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef PRESSURECONTROLLER_H
+#define PRESSURECONTROLLER_H
+
+#include "stdinc.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "Util.h"
+
+using namespace std;
+
+namespace fizz {
+
+/** This class implements a closed-loop controller for filtered sampling.
+ *
+ *  While running, the controller thread samples the filter pressure
+ *  every 50 ms and runs a proportional-integral loop on the total
+ *  pump rate, to hold the pressure close to a target value (a fraction
+ *  of the maximum filter pressure). It integrates the volume pumped
+ *  and stops the pumps once the requested volume has been delivered.
+ *
+ *  The controller also estimates the hydraulic resistance of the
+ *  filter (pressure divided by flow rate) and tracks its growth from
+ *  one sample to the next. This is used to predict how many more
+ *  samples can be taken before the filter needs to be backflushed;
+ *  filteredSample backflushes the filter when that number is small.
+ */
+class PressureController {
+public:		PressureController();
+	void	initState();
+
+	void	start(double, double, double, double);
+	void	stop();
+
+	bool	running();
+	bool	failed();
+	double	pumpedVolume();
+	double	samplesLeft();
+	bool	needsBackflush();
+
+private:
+	double	volume;			///< volume to be pumped (ml)
+	double	maxRate;		///< maximum total pump rate (ml/m)
+	double	minRate;		///< minimum total pump rate (ml/m)
+	double	r1Frac;			///< fraction of total volume for reagent1
+	double	r2Frac;			///< fraction of total volume for reagent2
+
+	double	pumped;			///< volume pumped so far (ml)
+	double	rate;			///< current total pump rate (ml/m)
+	double	filterResistance; ///< estimated resistance (psi per ml/m)
+	double	resistanceTrend; ///< growth in resistance per sample
+	bool	failFlag;		///< set if pressure could not be controlled
+
+	atomic<bool> activeFlag; ///< true while the control loop is running
+	atomic<bool> quitFlag;	///< tells the control loop to stop
+
+	mutex	pcMtx;			///< protects shared variables
+	thread	myThread;		///< thread running control loop
+
+	void	run();
+	void	setRate(double);
+	void	updateResistance(double);
+	static	void startThread(PressureController&);
+};
+
+inline bool PressureController::running() {
+	return activeFlag;
+}
+
+inline bool PressureController::failed() {
+	unique_lock<mutex> lck(pcMtx);
+	return failFlag;
+}
+
+inline double PressureController::pumpedVolume() {
+	unique_lock<mutex> lck(pcMtx);
+	return pumped;
+}
+
+} // ends namespace
+
+#endif
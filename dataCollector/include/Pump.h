@@ -9,6 +9,7 @@
 #define PUMP_H
 
 #include <mutex>
+#include <atomic>
 #include "Logger.h" 
 
 namespace fizz {
@@ -24,10 +25,7 @@ public:
 		unique_lock<mutex> lck(puMtx);
 		return maxRate;
 	}
-	double getCurrentRate() {
-		unique_lock<mutex> lck(puMtx);
-		return currentRate;
-	}
+	double getCurrentRate() { return currentRate.load(); }
 
 	void	setMaxRate(double);
 
@@ -39,7 +37,8 @@ public:
 
 protected:
 	double	maxRate;	///< maximum flow rate
-	double	currentRate; ///< current flow rate
+	atomic<double> currentRate; ///< current flow rate; atomic so
+						///< it can be read without waiting for on()
 	string	name;		///< name of this pump
 
 private:
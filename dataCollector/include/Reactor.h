@@ -0,0 +1,92 @@
+/** \file Reactor.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "stdinc.h"
+#include "Util.h"
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <deque>
+#include <atomic>
+#include <sys/epoll.h>
+
+using namespace std;
+
+namespace fizz {
+
+/** This class implements an event loop that runs in its own thread.
+ *  File descriptors are watched using epoll, periodic timers are
+ *  timerfds watched the same way, and other threads hand work to the
+ *  loop through an eventfd. The loop thread sleeps until one of these
+ *  is ready, so nothing is polled.
+ *
+ *  Handlers run in the loop thread, one at a time, and must not block;
+ *  work that may block should be handed to another thread. The loop
+ *  records how long handlers take, how late timers fire and how long
+ *  posted tasks wait, which can be retrieved using stats().
+ */
+class Reactor {
+public:		Reactor();
+			~Reactor();
+
+	typedef function<void(uint32_t)> FdHandler;	///< gets epoll events
+	typedef function<void()> Task;
+
+	bool	start();
+	void	stop();
+	bool	inLoop();
+
+	bool	addFd(int, uint32_t, FdHandler);
+	bool	modifyFd(int, uint32_t);
+	void	removeFd(int);
+	int		addTimer(double, Task);
+	bool	setTimerPeriod(int, double);
+	void	removeTimer(int);
+	void	post(Task);
+	void	call(Task);
+
+	string	stats();
+	void	clearStats();
+private:
+	int		epfd;			///< epoll instance
+	int		evfd;			///< eventfd used to wake loop for tasks
+	thread	loopThread;
+	atomic<bool> quit;		///< tells loop to exit
+
+	/** Timer state, used only by the loop thread. */
+	struct Timer {
+		double	period;		///< seconds between expirations
+		steady_clock::time_point due; ///< time of next expiration
+		Task	task;		///< run on expiration
+	};
+
+	mutex	mtx;			///< protects handlers, timers and tasks
+	unordered_map<int, FdHandler> handlers;	///< handler for each fd
+	unordered_map<int, Timer> timers;		///< timer for each timerfd
+	deque<pair<steady_clock::time_point, Task>> tasks; ///< posted tasks
+
+	// statistics, protected by mtx
+	uint64_t loops;			///< number of wakeups of loop thread
+	uint64_t events;		///< number of events and tasks handled
+	double	maxHandler;		///< longest time in one handler (s)
+	double	sumHandler;		///< total time in handlers (s)
+	double	maxTimerLate;	///< latest timer expiration handled (s)
+	double	maxTaskWait;	///< longest wait by posted task (s)
+
+	void	run();
+	void	runTasks();
+	void	expire(int);
+	void	record(steady_clock::time_point);
+};
+
+} // ends namespace
+
+#endif
@@ -10,7 +10,9 @@
 
 #include "stdinc.h" 
 #include <mutex> 
+#include <atomic>
 #include <condition_variable> 
+#include <unordered_map> 
 #include "Util.h"
 #include "Interrupt.h"
 #include "DataStore.h"
@@ -99,6 +101,25 @@ extern CollectorState cstate;
  *  	# repeat the following commands 2 times
  *  	pause .5	# pause for 0.5 seconds
  *  	getSpectrum disc dark cdom;
+ *
+ *  A script may also define several named missions, each introduced
+ *  by a mission directive and followed by its own commands (starting
+ *  at the left margin). Mission directives replace the period from the
+ *  run directive; the cycle count in a run directive still applies to
+ *  the total number of cycles.
+ *
+ *  mission cdom 60 window=06:00-20:00 priority=2 runs=12 fluid=40
+ *  	# the cdom mission runs every 60 minutes between 6 am and 8 pm;
+ *  	# when several missions are due, those with higher priority run
+ *  	# first; runs limits the number of runs per day (a power budget)
+ *  	# and fluid limits the ml of reference fluid and reagents used
+ *  	# per day; all arguments after the period are optional
+ *  mission phyto 1440 window=11:00-13:00
+ *
+ *  Missions that come due within a quarter of their period after the
+ *  next scheduled mission are run early, in the same wake-up, so as
+ *  to minimize the number of wake-ups in powerSave mode. The on
+ *  directive counts the cycles of the mission that contains it.
  */
 class ScriptInterp {
 public:		ScriptInterp();
@@ -118,6 +139,7 @@ public:		ScriptInterp();
 
 	int		readScript(const string&);
 	bool	parseLine(vector<string>&, string&, int);
+	bool	parseMission(vector<string>&, long);
 
 	void	begin();
 	void	end();
@@ -126,7 +148,7 @@ public:		ScriptInterp();
 	void	start();
 	void	stop();
 	void	resume();
-	bool	samplingEnabled();
+	bool	samplingEnabled() const { return sampling.load(); }
 
 	string	getScriptString() { return scriptString; };
 
@@ -137,10 +159,17 @@ public:		ScriptInterp();
 	}
 	bool	zombie() { return zombieFlag; }
 
+	long	getCycleDelay() { return cycleDelay; }
+	string	getDelayReason() { return delayReason; }
+
 private:
 	void	run();
 	long	nextCycleDelay();
-	void	sampleCycle(int);
+	long	fixedCycleDelay();
+	void	runMission(int);
+	void	sampleCycle(long, long, long);
+	void	measureBands(const vector<double>&, const string&);
+	void	planNextCycle();
 
 	string	scriptString;
 
@@ -174,6 +203,10 @@ private:
 		Command() : op(Nil) {
 		}
 		Command(opIndex op, int line) : op(op), line(line) {
+			// null the string pointers, so the destructor never sees an
+			// uninitialized one, even in the compiler's analysis
+			getSpectrum.label = 0;
+			getSpectrum.prereq1label = getSpectrum.prereq2label = 0;
 			if (op == Announce) announce.line = new string();
 			else if (op == GetDark) getDark.label = new string();
 			else if (op == GetSpectrum) {
@@ -231,16 +264,56 @@ private:
 	};
 	vector<Command> script;		///< internal representation
 
+	bool	endBlock(vector<pair<int,int>>&, int&);
+
+	/** Sampling mission defined by a mission directive. */
+	struct Mission {
+		string	name;		///< name used in data records
+		long	firstStep;	///< first script step for mission
+		long	endStep;	///< step following the last step for mission
+		long	period;		///< minutes between runs
+		int		winStart;	///< start of time-of-day window (minutes)
+		int		winEnd;		///< end of time-of-day window (minutes)
+		int		priority;	///< missions with larger values run first
+		int		maxRuns;	///< maximum runs per day (0 for no limit)
+		double	maxFluid;	///< maximum ml of fluid per day (0 for no limit)
+		double	fluidPerRun; ///< ml of reference/reagent used in one run
+	};
+	vector<Mission> missions;	///< missions defined by script
+	int		currentMission;		///< index of running mission (-1 for none)
+	unordered_map<string,MissionState> missionState;
+								///< scheduling state of missions
+
+	double	fluidUsage(long, long);
+	bool	inWindow(const Mission&, long);
+	bool	overBudget(const Mission&, long);
+	MissionState& stateOf(const Mission&);
+	long	missionDue(const Mission&, long);
+	long	scheduleMissions(long, vector<int>&);
+	void	resetMissions();
+	void	reloadConfig();
+	static	long currentMinute();
+
 	long	cycleNumber;		///< current sample cycle number
 	long	maxCycleCount;		///< number of sampling cycles
 	long	interCyclePeriod;	///< number of minutes between cycles
 	int	currentLine;			///< line of script being executed
 
+	unordered_map<string,vector<double>> spectra;
+							///< most recent spectrum for each label
+	bool	bandsValid;		///< true if band absorbances measured this cycle
+	double	band440;		///< absorbance at 440 nm for current cycle
+	double	band676;		///< absorbance at 676 nm for current cycle
+	long	cycleDelay;		///< minutes until next cycle, set at end of cycle
+	string	delayReason;	///< explanation for choice of cycleDelay
+
 	bool	quitFlag;			///< used to shutdown thread
 	bool	zombieFlag;			///< set when waiting for thread to be killed
 	bool	autoRun;			///< set in autoRun mode
 
 	mutex	mtx;				///< mutual exclusion while starting/stopping
+	atomic<bool> sampling;		///< false while collection is suspended;
+								///< read without taking mtx
 	thread	myThread;			///< thread for automated sampling
 	thread::id thread_id;
 
@@ -0,0 +1,83 @@
+/** @file SeqLock.h
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include "stdinc.h"
+#include <atomic>
+
+using namespace std;
+
+namespace fizz {
+
+/** This class holds a value of a plain data type that is updated by
+ *  one writer at a time and read by any number of readers, without
+ *  readers ever blocking the writer or each other.
+ *
+ *  The value is kept in an array of atomic words, with a sequence
+ *  number that is odd while an update is in progress. A reader copies
+ *  the words and retries if the sequence number changed in the meantime.
+ *  Writers must be serialized by the caller. T must be trivially
+ *  copyable (no pointers to owned memory, no virtual methods).
+ */
+template<class T> class SeqLock {
+public:
+			SeqLock();
+	void	store(const T&);
+	T		load() const;
+private:
+	static const int NW = (sizeof(T) + sizeof(uint64_t) - 1)
+						  / sizeof(uint64_t);
+
+	atomic<unsigned> seq;		///< odd while an update is in progress
+	atomic<uint64_t> words[NW];	///< copy of value
+};
+
+template<class T> SeqLock<T>::SeqLock() {
+	seq.store(0);
+	for (int i = 0; i < NW; i++) words[i].store(0);
+}
+
+/** Store a new value.
+ *  @param v is the new value
+ */
+template<class T> void SeqLock<T>::store(const T& v) {
+	uint64_t buf[NW];
+	buf[NW-1] = 0;
+	memcpy(buf, &v, sizeof(T));
+
+	unsigned s = seq.load(memory_order_relaxed);
+	seq.store(s + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (int i = 0; i < NW; i++)
+		words[i].store(buf[i], memory_order_relaxed);
+	seq.store(s + 2, memory_order_release);
+}
+
+/** Get a consistent copy of the current value.
+ *  @return the value most recently stored
+ */
+template<class T> T SeqLock<T>::load() const {
+	uint64_t buf[NW];
+	unsigned s0, s1;
+	do {
+		s0 = seq.load(memory_order_acquire);
+		for (int i = 0; i < NW; i++)
+			buf[i] = words[i].load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		s1 = seq.load(memory_order_relaxed);
+	} while ((s0 & 1) != 0 || s0 != s1);
+	T v;
+	memcpy(&v, buf, sizeof(T));
+	return v;
+}
+
+} // ends namespace
+
+#endif
@@ -31,6 +31,7 @@ public:
 	bool	getSocketAddress(SocketAddress&);
 	bool	bind(SocketAddress&);
 	bool	nonblock();
+	int		getSocketNumber() { return sockNum; }
 
 	// static utility methods
 	static in_addr_t string2ip(const string&); 		
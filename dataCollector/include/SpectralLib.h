@@ -0,0 +1,129 @@
+/** \file SpectralLib.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef SPECTRALLIB_H
+#define SPECTRALLIB_H
+
+#include "stdinc.h"
+#include <vector>
+#include <memory>
+#include "FilterBank.h"
+
+using namespace std;
+
+namespace fizz {
+
+/** This class implements the core spectral calculations of the analysis
+ *  library (analysisConsole/static/js/Library.js, as extended by
+ *  summarize/analysisLibrary): cooking raw spectra, cdom absorption and
+ *  its parameters, absorbance, similarity indexes and the quality
+ *  checks on the spectra used to compute them.
+ *
+ *  Cooking is linear in the raw spectrum, so the smoothing filter and the
+ *  integerization weights are obtained from the FilterBank once, when the
+ *  wavelengths or the recipe are set, and each spectrum is then cooked
+ *  with a handful of contiguous multiply-add loops. All arithmetic is
+ *  done in double precision, as in the javascript, so results agree
+ *  with it to within rounding error. After setup, the const methods may
+ *  be used concurrently.
+ */
+class SpectralLib {
+public:		SpectralLib();
+
+	static const int MINWAVE = 350;		///< min cooked wavelength
+	static const int MAXWAVE = 800;		///< max+ cooked wavelength
+	static const int CDOM_MINWAVE = 390;	///< min wavelength for cdom param
+	static const int CDOM_MAXWAVE = 490;	///< max+ wavelength for cdom param
+	static const int SIM_MINWAVE = 400;	///< min wavelength for sim index
+	static const int SIM_MAXWAVE = 700;	///< max+ wavelength for sim index
+	static const int NCOOKED = MAXWAVE - MINWAVE; ///< cooked spectrum length
+
+	enum Recipe { CLASSIC, NUVO };
+
+	/** Cook settings. For the classic recipe, integerize is the degree
+	 *  and half-width of a polynomial interpolation; for nuvo, it is the
+	 *  half-width and sigma of a gaussian weighted average. */
+	struct Settings {
+		int		smoothWidth;	///< gaussian filter has 2*width+1 terms
+		double	smoothSigma;	///< spread of gaussian filter
+		double	integerize[2];	///< integerization parameters
+	};
+
+	static Settings classicSettings();
+	static Settings nuvoSettings();
+
+	void	setWavelengths(const vector<double>&);
+	void	setWaveguideLength(double);
+	void	setRecipe(Recipe, const Settings&);
+	void	setRecipe(Recipe);
+	void	setDerivSettings(int, int);
+
+	const vector<double>& getWavelengths() const { return wavelengths; }
+	double	getWaveguideLength() const { return waveguideLength; }
+	Recipe	getRecipe() const { return recipe; }
+
+	void	smooth(const vector<double>&, vector<double>&) const;
+	bool	deriv(const vector<double>&, int, vector<double>&) const;
+	void	cook(const vector<double>&, const vector<double>&,
+				 vector<double>&) const;
+	void	absorption(const vector<double>&, const vector<double>&,
+					   const vector<double>&, const vector<double>&,
+					   vector<double>&) const;
+	void	rawAbsorption(const vector<double>&, const vector<double>&,
+						  vector<double>&) const;
+	bool	absorptionParameters(const vector<double>&,
+								 double&, double&) const;
+	void	absorpExpCurve(double, double, vector<double>&) const;
+	void	absorbance(const vector<double>&, const vector<double>&,
+					   const vector<double>&, const vector<double>&,
+					   vector<double>&) const;
+	void	rawAbsorbance(const vector<double>&, const vector<double>&,
+						  vector<double>&) const;
+	double	simIndex(const vector<double>&, const vector<double>&) const;
+
+	int		qaDark(const vector<double>&) const;
+	int		qaFiltered(const vector<double>&, const vector<double>&) const;
+	int		qaUnfiltered(const vector<double>&, const vector<double>&) const;
+	int		qaReference(const vector<double>&, const vector<double>&) const;
+	int		qaAbsorption(const vector<double>&, const vector<double>&,
+						 const vector<double>&, const vector<double>&,
+						 const vector<double>&) const;
+	int		qaAbsorbance(const vector<double>&, const vector<double>&,
+						 const vector<double>&, const vector<double>&,
+						 const vector<double>&) const;
+	static string qaString(int);
+
+	static void vectorShift(const vector<double>&, vector<double>&,
+							int=50);
+	static void fitline(const vector<double>&, const vector<double>&,
+						double&, double&);
+	static bool polyfit(const vector<double>&, const vector<double>&, int,
+						vector<double>&);
+	static double angularSim(const vector<double>&, const vector<double>&,
+							 int=0, int=-1);
+private:
+	vector<double> wavelengths;	///< raw wavelengths
+	int		rawLo;				///< index of last wavelength < MINWAVE
+	int		rawHi;				///< index of first wavelength > MAXWAVE
+	double	waveguideLength;	///< in meters
+	Recipe	recipe;				///< cook recipe
+	Settings settings;			///< cook settings
+
+	int		derivDegree;		///< degree of polynomial used by deriv
+	int		derivWidth;			///< half-width of window used by deriv
+
+	shared_ptr<const FilterBank::Gaussian> gauss;	///< smoothing filter
+	shared_ptr<const FilterBank::Integerizer> plan;	///< for wavelengths
+
+	void	setupFilters();
+	void	rawRange(int, int&, int&) const;
+	double	rawAvg(const vector<double>&) const;
+};
+
+} // ends namespace
+
+#endif
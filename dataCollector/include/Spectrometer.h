@@ -31,6 +31,7 @@ public:
 
 	bool	getStatus() { return status; };
 	bool	getSpectrum(int);
+	bool	getPreview(vector<double>&);
 	double	getIntTime();
 	void	setIntTime(double);
 	void	setLights(int);
@@ -51,8 +52,8 @@ public:
 	char	serialNumber[20]; ///< spectrometer serial number
 private:
 	bool	status;			///< true if spectrometer is powered on
-	double	intTime;
-	int		lconfig;		///< bit 2 for deuterium, bit 1 for tungsten
+	atomic<double> intTime;	///< integration time in ms
+	atomic<int> lconfig;	///< bit 2 for deuterium, bit 1 for tungsten
 							///< bit 0 for shutter
 
 	SeaBreezeAPI* sb;	///< instance of seabreeze api
@@ -74,9 +75,11 @@ private:
 	void	privateSetIntTime(double);
 };
 
+/** Get the integration time.
+ *  No locking, so callers need not wait during spectrum acquisition.
+ */
 inline double Spectrometer::getIntTime() {
-	unique_lock<mutex> lck(spectMtx);
-	return intTime;
+	return intTime.load();
 }
 
 } // ends namespace
@@ -12,6 +12,8 @@
 #include <mutex>
 #include "Logger.h" 
 #include "Config.h"
+#include "Arduino.h"
+#include "SeqLock.h"
 
 namespace fizz {
 
@@ -21,11 +23,30 @@ extern Config config;
 struct ppair { double offset; double scale; };
 struct pdset { double cooked; int up; int down; };
 
-/** This class provides an api for the various hardware status variables.  */
+/** One sample of the fluidics telemetry recorded by Status. */
+struct TelemetrySample {
+	uint32_t time;			///< elapsed time in ms
+	int16_t	up;				///< raw upstream pressure
+	int16_t	down;			///< raw downstream pressure
+	int16_t	rates[4];		///< sample, reference, reagent1, reagent2
+							///< pump rates in units of .01 ml/min
+	uint8_t	valves;			///< filter, port and mix valve states
+							///< (bits 0, 1 and 2-3)
+};
+
+/** This class provides an api for the various hardware status variables.
+ *
+ *  The values are updated either by the main loop (calling update())
+ *  or, when the arduino streams status reports, by the arduino's
+ *  reader thread. Each update is published as a snapshot in a SeqLock,
+ *  so the getters never block, even while an update is in progress.
+ *  Updates are serialized by statusMtx.
+ */
 class Status {
 public:
 			Status();
 	void	init();
+	void	startStreaming();
 
 	double	voltage();
 	double	temperature();
@@ -51,84 +72,112 @@ public:
 
 	void	update();
 
+	long	markTelemetry();
+	long	getTelemetry(long, vector<TelemetrySample>&);
+	void	getPressureParams(ppair&, ppair&);
+
+	static const int TELEMETRY_SIZE = 8192;	///< samples in telemetry ring
+
 private:
-	// raw data values from arduino
-	int		vbat;
-	int		temp;
-	int		upPressure;		
-	int		downPressure;
-	bool	leakStatus;
-	string	dateTime;
-
-	// offset and scaling parameters
-	ppair	vbatParams;
-	ppair	tempParams;
-	ppair	upParams;
-	ppair	downParams;
+	/** Status values; a plain struct, so it can be held in a SeqLock. */
+	struct Reading {
+		// raw data values from arduino
+		int		vbat;
+		int		temp;
+		int		upPressure;
+		int		downPressure;
+		bool	leakStatus;
+		time_t	dateTime;
+
+		// offset and scaling parameters
+		ppair	vbatParams;
+		ppair	tempParams;
+		ppair	upParams;
+		ppair	downParams;
+
+		double	maxPressureRecorded;	///< max filter pressure
+		double  depthRecorded;
+	};
+
+	Reading	cur;				///< master copy, modified under statusMtx
+	SeqLock<Reading> snap;		///< copy of cur seen by getters
 
 	vector<pdset> pressureData;
 
-	double	maxPressureRecorded;	///< max filter pressure
-	double  depthRecorded;
+	/** ring buffer holding the most recent telemetry samples; sample i
+	 *  is at telemetry[i % TELEMETRY_SIZE] */
+	TelemetrySample telemetry[TELEMETRY_SIZE];
+	long	telemetryCount;		///< number of samples recorded
 
 	mutex	statusMtx;
-	double	cook(const int, const ppair&);
-	int		raw(const double, const ppair&);
+
+	void	record(const Arduino::StatusReport&);
+	static void streamHandler(const Arduino::StatusReport&);
+	static double cook(const int, const ppair&);
+	static int raw(const double, const ppair&);
 };
 
 inline double Status::voltage(){
-	unique_lock<mutex> lck(statusMtx);
-	return cook(vbat, vbatParams);
+	Reading r = snap.load();
+	return cook(r.vbat, r.vbatParams);
 }
 
 inline double Status::temperature(){
-	unique_lock<mutex> lck(statusMtx);
-	return cook(temp, tempParams);
+	Reading r = snap.load();
+	return cook(r.temp, r.tempParams);
 }
 
 inline double Status::upstreamPressure(){
-	unique_lock<mutex> lck(statusMtx);
-	return cook(upPressure, upParams);
+	Reading r = snap.load();
+	return cook(r.upPressure, r.upParams);
 }
 
 inline double Status::downstreamPressure(){
-	unique_lock<mutex> lck(statusMtx);
-	return cook(downPressure, downParams);
+	Reading r = snap.load();
+	return cook(r.downPressure, r.downParams);
 }
 
 inline int Status::upstreamRawPressure(){
-	unique_lock<mutex> lck(statusMtx);
-	return upPressure;
+	return snap.load().upPressure;
 }
 
 inline int Status::downstreamRawPressure(){
-	unique_lock<mutex> lck(statusMtx);
-	return downPressure;
+	return snap.load().downPressure;
 }
 
 inline double Status::filterPressure(){
-	unique_lock<mutex> lck(statusMtx);
-	return cook(upPressure, upParams) - cook(downPressure, downParams);
+	Reading r = snap.load();
+	return cook(r.upPressure, r.upParams) - cook(r.downPressure, r.downParams);
 }
 
 inline double Status::maxFilterPressure(){
-	unique_lock<mutex> lck(statusMtx);
-	return maxPressureRecorded;
+	return snap.load().maxPressureRecorded;
 }
 
 inline double Status::depth(){
-	unique_lock<mutex> lck(statusMtx);
-	return depthRecorded;
+	return snap.load().depthRecorded;
 }
 
 inline bool Status::leak() {
-	unique_lock<mutex> lck(statusMtx);
-	return leakStatus;
+	return snap.load().leakStatus;
 }
 
-inline string Status::dateTimeString() {
+/** Get the pressure sensor calibration.
+ *  @param up is used to return the upstream offset and scale
+ *  @param down is used to return the downstream offset and scale
+ */
+inline void Status::getPressureParams(ppair& up, ppair& down) {
+	Reading r = snap.load();
+	up = r.upParams; down = r.downParams;
+}
+
+/** Mark the start of a fluidics operation.
+ *  @return the number of the next telemetry sample, to be passed to
+ *  getTelemetry() at the end of the operation
+ */
+inline long Status::markTelemetry() {
 	unique_lock<mutex> lck(statusMtx);
-	return dateTime;
+	return telemetryCount;
 }
 
 inline bool Status::lowBattery() {
@@ -155,12 +204,14 @@ inline bool Status::tooDeep() {
 
 inline void	Status::clearMaxFilterPressure() {
 	unique_lock<mutex> lck(statusMtx);
-	maxPressureRecorded = 0.;
+	cur.maxPressureRecorded = 0.;
+	snap.store(cur);
 }
 
 inline void Status::recordDepth() {
 	unique_lock<mutex> lck(statusMtx);
-	depthRecorded = .685 * cook(downPressure, downParams);
+	cur.depthRecorded = .685 * cook(cur.downPressure, cur.downParams);
+	snap.store(cur);
 }
 
 /** Convert a raw value to a cooked value. */
@@ -0,0 +1,61 @@
+/** \file Summarizer.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef SUMMARIZER_H
+#define SUMMARIZER_H
+
+#include "stdinc.h"
+#include <vector>
+#include "SpectralLib.h"
+
+using namespace std;
+
+namespace fizz {
+
+/** This class computes the summary of a sample cycle that
+ *  summarize/summarize.js computes from the raw data: cdom absorption
+ *  parameters from the cycle's filtered spectrum, similarity indexes
+ *  with a set of phytoplankton models from its concentrate spectrum,
+ *  and a quality value for each. The values are formatted as
+ *  summarize.js formats them, so the two give the same results.
+ */
+class Summarizer {
+public:		Summarizer();
+
+	/** The spectra used for one measurement: the raw spectrum, its dark
+	 *  spectrum, the reference spectrum and the reference's dark. */
+	struct Measurement {
+		const vector<double>* spect;
+		const vector<double>* dark;
+		const vector<double>* ref;
+		const vector<double>* refDark;
+	};
+
+	typedef vector<pair<string,string>> FieldList; ///< names and values
+
+	int		loadModels(const string&);
+	int		modelCount() const { return models.size(); }
+	void	setDeployment(const vector<double>&, double);
+
+	void	summarize(const Measurement*, const Measurement*,
+					  FieldList&) const;
+
+	static string jsNumber(double, int=-1);
+private:
+	SpectralLib lib;			///< set up for the current deployment
+
+	/** Phytoplankton model: the fourth derivative of its absorbance. */
+	struct Model {
+		string	name;
+		vector<double> deriv;
+	};
+	vector<Model> models;		///< in the order summarize.js uses
+};
+
+} // ends namespace
+
+#endif
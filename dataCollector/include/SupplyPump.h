@@ -9,6 +9,7 @@
 #define SUPPLYPUMP_H
 
 #include <mutex>
+#include <atomic>
 
 #include "Logger.h" 
 #include "Exceptions.h"
@@ -30,6 +31,7 @@ public:
 			}
 	void	disable() { enableFlag = false; }
 	double	getLevel(bool=false);
+	double	peekLevel();
 	void	setLevel(double);
 	void	on(double);
 	void	off() { on(0); }
@@ -58,8 +60,8 @@ private:
 	bool	enableFlag;
 	double	maxLevel;
 	double	minLevel;
-	double	fluidLevel;
-	double	changeTime;
+	atomic<double> fluidLevel;	///< level at changeTime
+	atomic<double> changeTime;	///< time of last level adjustment
 
 	void	adjustLevel();
 
@@ -0,0 +1,55 @@
+/** \file Telemetry.h
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "stdinc.h"
+#include <memory>
+#include <atomic>
+#include "Util.h"
+
+using namespace std;
+
+namespace fizz {
+
+/** This class maintains a snapshot of the system's state for the console.
+ *  The snapshot is refreshed periodically by the main event loop, using
+ *  only getters that do not wait on hardware locks, and is kept as an
+ *  immutable JSON string. Readers get a shared pointer to the current
+ *  snapshot, so a request never waits for a refresh or for the hardware.
+ */
+class Telemetry {
+public:		Telemetry();
+
+	void	refresh();
+	shared_ptr<const string> snapshot();
+	double	age();
+
+private:
+	shared_ptr<const string> current;	///< accessed only atomically
+	atomic<double> refreshTime;			///< time of last refresh
+};
+
+/** Get the current snapshot.
+ *  @return a pointer to the snapshot, as a JSON object
+ */
+inline shared_ptr<const string> Telemetry::snapshot() {
+	shared_ptr<const string> s = atomic_load(&current);
+	if (s) return s;
+	refresh();		// first request, before the event loop's first refresh
+	return atomic_load(&current);
+}
+
+/** Get the age of the current snapshot, in seconds. */
+inline double Telemetry::age() {
+	return Util::elapsedTime() - refreshTime.load();
+}
+
+} // ends namespace
+
+#endif
@@ -0,0 +1,312 @@
+/** @file EventCodec.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *  This is open source software licensed under the Apache 2.0 license.
+ *  See http://www.apache.org/licenses/LICENSE-2.0 for details.
+ */
+
+#include "EventCodec.h"
+
+namespace fizz {
+
+namespace {
+
+/** One conversion specification from a format string. */
+struct Spec {
+	string	text;		///< literal text preceding the conversion
+	string	flags;		///< flags, with width and precision
+	bool	starWidth;	///< width given by an argument
+	bool	starPrec;	///< precision given by an argument
+	string	length;		///< length modifier
+	char	conv;		///< conversion character, or 0 at end of format
+};
+
+/** Parse the next conversion specification.
+ *  @param fp points to the current position in the format; it is
+ *  advanced past the specification
+ *  @param spec is used to return the specification
+ */
+void nextSpec(const char*& fp, Spec& spec) {
+	spec.text.clear(); spec.flags.clear(); spec.length.clear();
+	spec.starWidth = spec.starPrec = false; spec.conv = 0;
+	while (*fp != 0) {
+		if (*fp != '%') { spec.text += *fp++; continue; }
+		if (fp[1] == '%') { spec.text += '%'; fp += 2; continue; }
+		fp++; break;
+	}
+	if (*fp == 0) return;
+	while (*fp != 0 && strchr("-+ #0", *fp) != 0) spec.flags += *fp++;
+	if (*fp == '*') { spec.starWidth = true; spec.flags += '*'; fp++; }
+	while (isdigit(*fp)) spec.flags += *fp++;
+	if (*fp == '.') {
+		spec.flags += *fp++;
+		if (*fp == '*') { spec.starPrec = true; spec.flags += '*'; fp++; }
+		while (isdigit(*fp)) spec.flags += *fp++;
+	}
+	while (*fp != 0 && strchr("hljztL", *fp) != 0) spec.length += *fp++;
+	if (*fp != 0) spec.conv = *fp++;
+}
+
+/** Append a zig-zag varint to a buffer.
+ *  @return false if there is not enough space
+ */
+bool packVarint(char* buf, int size, int& len, int64_t v) {
+	uint64_t u = (((uint64_t) v) << 1) ^ (uint64_t) (v >> 63);
+	do {
+		if (len >= size) return false;
+		uint8_t b = u & 0x7f; u >>= 7;
+		buf[len++] = (char) (u != 0 ? b | 0x80 : b);
+	} while (u != 0);
+	return true;
+}
+
+}
+
+/** Compute the identifier for a format string at a given level.
+ *  @param format is a printf-style format string
+ *  @param level is the log level
+ *  @return a 32 bit FNV-1a hash of the level and format
+ */
+uint32_t EventCodec::hash(const char* format, int level) {
+	uint32_t h = 2166136261u;
+	h = (h ^ (uint8_t) level) * 16777619u;
+	for (const char* p = format; *p != 0; p++)
+		h = (h ^ (uint8_t) *p) * 16777619u;
+	return h;
+}
+
+/** Pack the arguments for a format string.
+ *  @param format is a printf-style format string
+ *  @param args is the argument list for format
+ *  @param buf is the buffer in which the arguments are packed
+ *  @param size is the size of buf
+ *  @param len is used to return the number of bytes used
+ *  @return true on success, false if buf is too small
+ */
+bool EventCodec::pack(const char* format, va_list args, char* buf, int size,
+					  int& len) {
+	len = 0;
+	const char* fp = format; Spec spec;
+	while (true) {
+		nextSpec(fp, spec);
+		if (spec.conv == 0) return true;
+		if (spec.starWidth && !packVarint(buf, size, len, va_arg(args, int)))
+			return false;
+		if (spec.starPrec && !packVarint(buf, size, len, va_arg(args, int)))
+			return false;
+		const string& lm = spec.length;
+		int64_t iv = 0;
+		switch (spec.conv) {
+		case 'd': case 'i': case 'c':
+			if (lm == "l") iv = va_arg(args, long);
+			else if (lm == "ll" || lm == "j") iv = va_arg(args, long long);
+			else if (lm == "z" || lm == "t") iv = va_arg(args, ssize_t);
+			else iv = va_arg(args, int);
+			if (lm == "h") iv = (short) iv;
+			else if (lm == "hh") iv = (signed char) iv;
+			if (!packVarint(buf, size, len, iv)) return false;
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			if (lm == "l") iv = va_arg(args, unsigned long);
+			else if (lm == "ll" || lm == "j")
+				iv = va_arg(args, unsigned long long);
+			else if (lm == "z" || lm == "t") iv = va_arg(args, size_t);
+			else iv = va_arg(args, unsigned);
+			if (lm == "h") iv = (unsigned short) iv;
+			else if (lm == "hh") iv = (unsigned char) iv;
+			if (!packVarint(buf, size, len, iv)) return false;
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A': {
+			double dv = (lm == "L" ? (double) va_arg(args, long double)
+								   : va_arg(args, double));
+			if (len + 8 > size) return false;
+			memcpy(buf + len, &dv, 8); len += 8;
+			break;
+		}
+		case 's': {
+			const char* s = va_arg(args, const char*);
+			if (s == 0) s = "(null)";
+			int n = strlen(s);
+			if (!packVarint(buf, size, len, n) || len + n > size)
+				return false;
+			memcpy(buf + len, s, n); len += n;
+			break;
+		}
+		case 'p':
+			iv = (int64_t) (intptr_t) va_arg(args, void*);
+			if (!packVarint(buf, size, len, iv)) return false;
+			break;
+		default:
+			return false;	// %n or unknown conversion
+		}
+	}
+}
+
+/** Format a message from its format string and packed arguments.
+ *  @param format is the format string
+ *  @param p points to the packed arguments; it is advanced past them
+ *  @param end points just past the end of the packed data
+ *  @param message is used to return the formatted message
+ *  @param argStrings is used to return the arguments as strings;
+ *  string arguments are returned as quoted, escaped JSON strings
+ *  @return true on success, false if the packed data is malformed
+ */
+bool EventCodec::unpack(const string& format, const uint8_t*& p,
+						const uint8_t* end, string& message,
+						vector<string>& argStrings) {
+	message.clear(); argStrings.clear();
+	const char* fp = format.c_str(); Spec spec;
+	char buf[500];
+	while (true) {
+		nextSpec(fp, spec);
+		message += spec.text;
+		if (spec.conv == 0) return true;
+
+		string flags = spec.flags;
+		int64_t iv;
+		for (int i = 0; i < (spec.starWidth ? 1 : 0) + (spec.starPrec ? 1 : 0);
+				i++) {
+			if (!getVarint(p, end, iv)) return false;
+			string::size_type j = flags.find('*');
+			flags.replace(j, 1, to_string(iv));
+		}
+		string fmt = "%" + flags;
+		switch (spec.conv) {
+		case 'd': case 'i': case 'c':
+			if (!getVarint(p, end, iv)) return false;
+			if (spec.conv == 'c')
+				snprintf(buf, sizeof(buf), (fmt + "c").c_str(), (int) iv);
+			else
+				snprintf(buf, sizeof(buf), (fmt + "lld").c_str(),
+						 (long long) iv);
+			argStrings.push_back(to_string(iv));
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			if (!getVarint(p, end, iv)) return false;
+			snprintf(buf, sizeof(buf), (fmt + "ll" + spec.conv).c_str(),
+					 (unsigned long long) iv);
+			argStrings.push_back(to_string((unsigned long long) iv));
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A': {
+			double dv;
+			if (end - p < 8) return false;
+			memcpy(&dv, p, 8); p += 8;
+			snprintf(buf, sizeof(buf), (fmt + spec.conv).c_str(), dv);
+			char vbuf[40]; snprintf(vbuf, sizeof(vbuf), "%.17g", dv);
+			argStrings.push_back(isfinite(dv) ? vbuf : "null");
+			break;
+		}
+		case 's': {
+			if (!getVarint(p, end, iv) || iv < 0 || iv > end - p)
+				return false;
+			string s((const char*) p, iv); p += iv;
+			snprintf(buf, sizeof(buf), (fmt + "s").c_str(), s.c_str());
+			argStrings.push_back("\"" + jsonEscape(s) + "\"");
+			break;
+		}
+		case 'p':
+			if (!getVarint(p, end, iv)) return false;
+			snprintf(buf, sizeof(buf), "%#llx", (unsigned long long) iv);
+			argStrings.push_back(to_string((unsigned long long) iv));
+			break;
+		default:
+			return false;
+		}
+		message += buf;
+	}
+}
+
+/** Append a zig-zag varint to a string.
+ *  @param s is the string
+ *  @param v is the value to be appended
+ */
+void EventCodec::putVarint(string& s, int64_t v) {
+	uint64_t u = (((uint64_t) v) << 1) ^ (uint64_t) (v >> 63);
+	do {
+		uint8_t b = u & 0x7f; u >>= 7;
+		s += (char) (u != 0 ? b | 0x80 : b);
+	} while (u != 0);
+}
+
+/** Get a zig-zag varint.
+ *  @param p points to the varint; it is advanced past it
+ *  @param end points just past the end of the data
+ *  @param v is used to return the value
+ *  @return true on success, false if the data ends first
+ */
+bool EventCodec::getVarint(const uint8_t*& p, const uint8_t* end,
+						   int64_t& v) {
+	uint64_t u = 0; int shift = 0;
+	while (true) {
+		if (p >= end || shift > 63) return false;
+		uint8_t b = *p++;
+		u |= ((uint64_t) (b & 0x7f)) << shift; shift += 7;
+		if ((b & 0x80) == 0) break;
+	}
+	v = (int64_t) (u >> 1) ^ -((int64_t) (u & 1));
+	return true;
+}
+
+static const char* b64chars =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/** Encode a byte string in base64. */
+string EventCodec::base64(const string& s) {
+	string out;
+	out.reserve(4 * ((s.length() + 2) / 3));
+	for (unsigned i = 0; i < s.length(); i += 3) {
+		uint32_t v = ((uint8_t) s[i]) << 16;
+		if (i + 1 < s.length()) v |= ((uint8_t) s[i+1]) << 8;
+		if (i + 2 < s.length()) v |= (uint8_t) s[i+2];
+		out += b64chars[(v >> 18) & 0x3f];
+		out += b64chars[(v >> 12) & 0x3f];
+		out += (i + 1 < s.length() ? b64chars[(v >> 6) & 0x3f] : '=');
+		out += (i + 2 < s.length() ? b64chars[v & 0x3f] : '=');
+	}
+	return out;
+}
+
+/** Decode a base64 string.
+ *  @param s is the encoded string
+ *  @param out is used to return the decoded bytes
+ *  @return true on success, false if s contains invalid characters
+ */
+bool EventCodec::unbase64(const string& s, string& out) {
+	out.clear();
+	uint32_t v = 0; int bits = 0;
+	for (char c : s) {
+		if (c == '=') break;
+		const char* q = strchr(b64chars, c);
+		if (q == 0 || c == 0) return false;
+		v = (v << 6) | (q - b64chars); bits += 6;
+		if (bits >= 8) {
+			bits -= 8; out += (char) ((v >> bits) & 0xff);
+		}
+	}
+	return true;
+}
+
+/** Escape a string for inclusion in a JSON string. */
+string EventCodec::jsonEscape(const string& s) {
+	string out;
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			out += '\\'; out += c;
+		} else if (c == '\n') {
+			out += "\\n";
+		} else if (c == '\t') {
+			out += "\\t";
+		} else if ((uint8_t) c < 0x20) {
+			char buf[8]; snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else {
+			out += c;
+		}
+	}
+	return out;
+}
+
+} // ends namespace
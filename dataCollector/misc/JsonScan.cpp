@@ -0,0 +1,104 @@
+/** @file JsonScan.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *  This is open source software licensed under the Apache 2.0 license.
+ *  See http://www.apache.org/licenses/LICENSE-2.0 for details.
+ */
+
+#include "JsonScan.h"
+
+namespace fizz {
+
+/** Find the value of a field in a JSON record.
+ *  @param line is the record
+ *  @param name is the field name
+ *  @return a pointer to the start of the value, or null if not present
+ */
+const char* JsonScan::findField(const string& line, const string& name) {
+	string key = "\"" + name + "\"";
+	string::size_type i = 0;
+	while ((i = line.find(key, i)) != string::npos) {
+		i += key.length();
+		const char* p = line.c_str() + i;
+		while (isspace(*p)) p++;
+		if (*p++ != ':') continue;	// a string value, not a field name
+		while (isspace(*p)) p++;
+		return p;
+	}
+	return 0;
+}
+
+/** Parse a JSON string.
+ *  @param p points to the opening quote; it is advanced past the string
+ *  @param s is used to return the unescaped string
+ *  @return true on success
+ */
+bool JsonScan::parseString(const char*& p, string& s) {
+	s.clear();
+	if (*p != '"') return false;
+	for (p++; *p != 0 && *p != '"'; p++) {
+		if (*p != '\\') { s += *p; continue; }
+		p++;
+		switch (*p) {
+		case 'n': s += '\n'; break;
+		case 't': s += '\t'; break;
+		case 'u': if (strlen(p) < 5) return false;
+				  s += (char) strtol(string(p+1, 4).c_str(), 0, 16);
+				  p += 4; break;
+		case 0: return false;
+		default: s += *p;
+		}
+	}
+	if (*p != '"') return false;
+	p++; return true;
+}
+
+/** Parse a JSON array of numbers.
+ *  @param p points to the opening bracket; it is advanced past the array
+ *  @param v is used to return the numbers
+ *  @return true on success
+ */
+bool JsonScan::parseVector(const char*& p, vector<double>& v) {
+	v.clear();
+	if (*p != '[') return false;
+	p++;
+	while (true) {
+		while (isspace(*p)) p++;
+		if (*p == ']') { p++; return true; }
+		char* q; double x = strtod(p, &q);
+		if (q == p) return false;
+		v.push_back(x); p = q;
+		while (isspace(*p)) p++;
+		if (*p == ',') p++;
+	}
+}
+
+/** Get a string field from a record.
+ *  @return true if the field is present and is a string
+ */
+bool JsonScan::getString(const string& line, const string& name, string& s) {
+	const char* p = findField(line, name);
+	return p != 0 && parseString(p, s);
+}
+
+/** Get a numeric field from a record.
+ *  @return true if the field is present and is a number
+ */
+bool JsonScan::getNumber(const string& line, const string& name, double& x) {
+	const char* p = findField(line, name);
+	if (p == 0) return false;
+	char* q; x = strtod(p, &q);
+	return q != p;
+}
+
+/** Get a numeric array field from a record.
+ *  @return true if the field is present and is an array of numbers
+ */
+bool JsonScan::getVector(const string& line, const string& name,
+						 vector<double>& v) {
+	const char* p = findField(line, name);
+	return p != 0 && parseVector(p, v);
+}
+
+} // ends namespace
@@ -7,100 +7,363 @@
  */
 
 #include "Logger.h"
+#include <algorithm>
 
 namespace fizz {
 
+/** A message waiting to be delivered to the log targets. */
+struct LogRecord {
+	double	time;			///< elapsed time when message was logged
+	int		level;			///< log level
+	bool	raw;			///< if true, text is delivered as is
+	char	levelName[12];	///< name of level, used in message suffix
+	char	text[500];		///< formatted message, unused if event set
+	int		eventLen;		///< length of event, or -1 if none
+	char	event[300];		///< format string, then packed arguments
+};
+
+/** Single producer, single consumer ring of log records. The producer
+ *  is the thread that owns the ring, the consumer is whichever thread
+ *  holds the logger's drainMtx.
+ */
+struct LogRing {
+	static const uint32_t SIZE = 128;	///< records per ring
+
+	LogRecord	recs[SIZE];
+	atomic<uint32_t> head;		///< count of records added
+	atomic<uint32_t> tail;		///< count of records removed
+	atomic<uint32_t> drops;		///< count of records dropped
+	uint32_t	reported;		///< drops already reported (consumer only)
+	atomic<bool> owned;			///< true while owning thread is alive
+
+	LogRing() : reported(0) {
+		head.store(0); tail.store(0); drops.store(0); owned.store(true);
+	}
+};
+
+namespace {
+/** Thread-local link to a thread's ring; releases it when the thread
+ *  exits, so that a later thread can reuse it.
+ */
+struct RingHolder {
+	Logger*		owner = nullptr;
+	LogRing*	ring = nullptr;
+	~RingHolder() { if (ring) ring->owned.store(false); }
+};
+thread_local RingHolder ringHolder;
+thread_local bool draining = false;	// true in thread emptying the rings
+}
+
 Logger::Logger() {
 	Util::elapsedTime(); // ensures initialization
+	minLevel.store(MAXLEVEL); packEvents.store(false); quit.store(false);
+	pending.store(false);
+}
+
+/** Destructor stops the drain thread and delivers remaining messages.
+ *  The rings are not freed, since threads that are still running
+ *  may refer to them.
+ */
+Logger::~Logger() {
+	if (drainThread.joinable()) {
+		{
+			unique_lock<mutex> lck(wakeMtx);
+			quit.store(true); wakeup.notify_one();
+		}
+		drainThread.join();
+	}
+	drain();
 }
 
 /** Add a logging target. Only used by constructors. */
 void Logger::addTarget(LogTarget& target) {
+	unique_lock<mutex> lck(targetMtx);
 	targets.push_back(&target);
+	target.setListener(this);
+	minLevel.store(min(minLevel.load(), target.getLevel()));
+	if (target.acceptsEvents()) packEvents.store(true);
+	if (!drainThread.joinable())
+		drainThread = thread(&Logger::run, this);
+}
+
+/** Recompute the minimum level over all targets; called when a target
+ *  is added or changes its level.
+ */
+void Logger::levelChanged() {
+	unique_lock<mutex> lck(targetMtx);
+	int level = MAXLEVEL;
+	for (LogTarget* t : targets) level = min(level, t->getLevel());
+	minLevel.store(level);
+}
+
+/** Get the calling thread's ring, allocating one if necessary. */
+LogRing* Logger::myRing() {
+	if (ringHolder.owner == this) return ringHolder.ring;
+	unique_lock<mutex> lck(ringMtx);
+	LogRing* ring = nullptr;
+	for (LogRing* r : rings) {
+		if (!r->owned.load()) { ring = r; break; }
+	}
+	if (ring == nullptr) {
+		ring = new LogRing(); rings.push_back(ring);
+	}
+	ring->owned.store(true);
+	ringHolder.owner = this; ringHolder.ring = ring;
+	return ring;
+}
+
+/** Reserve the next free record in the calling thread's ring.
+ *  @param ring is set to the calling thread's ring
+ *  @param level is the log level of the message
+ *  @param levelName is the name to be included in the message
+ *  @return a pointer to the reserved record, or nullptr if the message
+ *  should be discarded, either because no target accepts this level
+ *  or because the ring is full.
+ */
+LogRecord* Logger::reserve(LogRing*& ring, int level,
+						   const string& levelName) {
+	if (!isEnabled(level)) return nullptr;
+	ring = myRing();
+	uint32_t h = ring->head.load(memory_order_relaxed);
+	if (h - ring->tail.load(memory_order_acquire) >= LogRing::SIZE) {
+		ring->drops++; return nullptr;
+	}
+	LogRecord* rec = &ring->recs[h % LogRing::SIZE];
+	rec->time = Util::elapsedTime(); rec->level = level; rec->raw = false;
+	strncpy(rec->levelName, levelName.c_str(), sizeof(rec->levelName));
+	rec->levelName[sizeof(rec->levelName)-1] = 0;
+	rec->eventLen = -1;
+	return rec;
+}
+
+/** Make the most recently reserved record visible to the drain thread.
+ *  @param ring is the calling thread's ring
+ */
+void Logger::commit(LogRing* ring) {
+	uint32_t h = ring->head.load(memory_order_relaxed);
+	ring->head.store(h + 1, memory_order_release);
+	// either the drain thread sees the new head after clearing pending,
+	// or we see pending clear and wake it; the fence orders our store to
+	// head before our load of pending, as its fence does for it
+	atomic_thread_fence(memory_order_seq_cst);
+	if (pending.load(memory_order_relaxed) || pending.exchange(true))
+		return;
+	unique_lock<mutex> lck(wakeMtx);
+	wakeup.notify_one();
+}
+
+/** Format a message into the calling thread's ring. When events are
+ *  being packed, only the arguments are copied and the drain thread
+ *  formats the text; vsnprintf is the fallback for a message that
+ *  cannot be packed.
+ *  @param level is the log level
+ *  @param levelName is the name of the level
+ *  @param format is a printf-style format string
+ *  @param args is the list of arguments for the format string
+ */
+void Logger::vlog(int level, const char* levelName, const char* format,
+				  va_list args) {
+	LogRing* ring;
+	LogRecord* rec = reserve(ring, level, levelName);
+	if (rec == nullptr) return;
+	if (packEvents.load()) {
+		va_list args2;
+		va_copy(args2, args);
+		int n = strlen(format) + 1; int len;
+		if (n < (int) sizeof(rec->event) &&
+			EventCodec::pack(format, args2, rec->event + n,
+							 sizeof(rec->event) - n, len)) {
+			memcpy(rec->event, format, n);
+			rec->eventLen = n + len;
+		}
+		va_end(args2);
+	}
+	if (rec->eventLen < 0)
+		vsnprintf(rec->text, sizeof(rec->text), format, args);
+	commit(ring);
 }
 
 void Logger::trace(const char *format, ...) {
-	char buf[500];
 	va_list args;
 	va_start(args, format);
-        vsnprintf(buf, sizeof(buf), format, args);
-        va_end(args);
-        log(buf, TRACE, "TRACE");
+	vlog(TRACE, "TRACE", format, args);
+	va_end(args);
 }
 
 void Logger::debug(const char *format, ...) {
-	char buf[500];
 	va_list args;
 	va_start(args, format);
-        vsnprintf(buf, sizeof(buf), format, args);
-        va_end(args);
-        log(buf, DEBUG, "DEBUG");
+	vlog(DEBUG, "DEBUG", format, args);
+	va_end(args);
 }
 
 void Logger::details(const char *format, ...) {
-	char buf[500];
 	va_list args;
 	va_start(args, format);
-        vsnprintf(buf, sizeof(buf), format, args);
-        va_end(args);
-        log(buf, DETAILS, "DETAILS");
+	vlog(DETAILS, "DETAILS", format, args);
+	va_end(args);
 }
 
 void Logger::info(const char *format, ...) {
-	char buf[500];
 	va_list args;
 	va_start(args, format);
-        vsnprintf(buf, sizeof(buf), format, args);
-        va_end(args);
-        log(buf, INFO, "INFO");
+	vlog(INFO, "INFO", format, args);
+	va_end(args);
 }
 
 void Logger::warning(const char *format, ...) {
-	char buf[500];
 	va_list args;
 	va_start(args, format);
-        vsnprintf(buf, sizeof(buf), format, args);
-        va_end(args);
-        log(buf, WARNING, "WARNING");
+	vlog(WARNING, "WARNING", format, args);
+	va_end(args);
 }
 
 void Logger::error(const char *format, ...) {
-	char buf[500];
 	va_list args;
 	va_start(args, format);
-        vsnprintf(buf, sizeof(buf), format, args);
-        va_end(args);
-        log(buf, ERROR, "ERROR");
+	vlog(ERROR, "ERROR", format, args);
+	va_end(args);
 }
 
+/** Log a fatal message; returns after it has reached the targets. */
 void Logger::fatal(const char *format, ...) {
-	char buf[500];
 	va_list args;
 	va_start(args, format);
-        vsnprintf(buf, sizeof(buf), format, args);
-        va_end(args);
-        log(buf, FATAL, "FATAL");
+	vlog(FATAL, "FATAL", format, args);
+	va_end(args);
+	flush();
 }
 
 void Logger::log(char *buf, int level, const string& levelName) {
-	double t = Util::elapsedTime();
-	
-	char tbuf[20];
-	snprintf(tbuf, sizeof(tbuf), "%.3f", t);
-
-	string s = string(buf) + " [" + levelName + " " + string(tbuf) + "]\n";
-	for (unsigned int i = 0; i < targets.size(); i++) {
-		targets[i]->logMessage(s, level);
-	}
+	LogRing* ring;
+	LogRecord* rec = reserve(ring, level, levelName);
+	if (rec == nullptr) return;
+	strncpy(rec->text, buf, sizeof(rec->text));
+	rec->text[sizeof(rec->text)-1] = 0;
+	commit(ring);
+	if (level >= FATAL) flush();
 }
 
 void Logger::border(char c) {
+	LogRing* ring;
+	LogRecord* rec = reserve(ring, FATAL, "");
+	if (rec == nullptr) return;
+	rec->raw = true;
+	memset(rec->text, c, 50); rec->text[50] = '\n'; rec->text[51] = 0;
+	commit(ring);
+}
+
+/** Deliver all messages logged so far to the targets before returning.
+ *  Called before shutting down and after fatal errors.
+ */
+void Logger::flush() {
+	if (!draining) drain();
+}
 
-	string s(50, c); s += "\n";
-	for (unsigned int i = 0; i < targets.size(); i++) {
-		targets[i]->logMessage(s.c_str(), FATAL);
+/** Get the number of messages dropped because a ring was full. */
+uint64_t Logger::getDropCount() {
+	unique_lock<mutex> lck(ringMtx);
+	uint64_t n = 0;
+	for (LogRing* r : rings) n += r->drops.load();
+	return n;
+}
+
+/** Empty the rings, passing their messages to the targets in time order.
+ *  @return the number of messages delivered
+ */
+int Logger::drain() {
+	unique_lock<mutex> lck(drainMtx);
+	draining = true;
+
+	vector<LogRing*> rs;
+	{ unique_lock<mutex> rlck(ringMtx); rs = rings; }
+
+	struct Msg {
+		double time; int level; string text;
+		bool hasEvent; string format, args;
+	};
+	vector<Msg> batch;
+	char tbuf[20]; string text; vector<string> argStrings;
+	for (LogRing* r : rs) {
+		uint32_t t = r->tail.load(memory_order_relaxed);
+		uint32_t h = r->head.load(memory_order_acquire);
+		for ( ; t != h; t++) {
+			LogRecord& rec = r->recs[t % LogRing::SIZE];
+			Msg m; m.time = rec.time; m.level = rec.level;
+			m.hasEvent = !rec.raw && packEvents.load();
+			if (rec.eventLen >= 0) {
+				// packed: format the text here, as vlog did not
+				m.format = rec.event;
+				m.args.assign(rec.event + m.format.length() + 1,
+							  rec.eventLen - (m.format.length() + 1));
+				const uint8_t* p = (const uint8_t*) m.args.data();
+				if (!EventCodec::unpack(m.format, p, p + m.args.length(),
+										text, argStrings))
+					text = m.format;
+				if (text.length() >= sizeof(rec.text))
+					text.resize(sizeof(rec.text) - 1);
+			} else {
+				text = rec.text;
+				if (m.hasEvent) {
+					// not packed: use message text as sole argument
+					m.format = "%s";
+					EventCodec::putVarint(m.args, text.length());
+					m.args += text;
+				}
+			}
+			if (rec.raw) {
+				m.text = text;
+			} else {
+				snprintf(tbuf, sizeof(tbuf), "%.3f", rec.time);
+				m.text = text + " [" + rec.levelName + " " + tbuf + "]\n";
+			}
+			batch.push_back(m);
+		}
+		r->tail.store(t, memory_order_release);
+
+		uint32_t d = r->drops.load();
+		if (d != r->reported) {
+			double now = Util::elapsedTime();
+			snprintf(tbuf, sizeof(tbuf), "%.3f", now);
+			Msg m; m.time = now; m.level = WARNING; m.hasEvent = false;
+			m.text = "Logger: dropped " + to_string(d - r->reported) +
+					 " messages [WARNING " + tbuf + "]\n";
+			batch.push_back(m);
+			r->reported = d;
+		}
 	}
+	stable_sort(batch.begin(), batch.end(),
+				[](const Msg& a, const Msg& b) { return a.time < b.time; });
+
+	unique_lock<mutex> tlck(targetMtx);
+	for (Msg& m : batch) {
+		LogEvent ev;
+		if (m.hasEvent) {
+			ev.time = m.time; ev.level = m.level;
+			ev.format = m.format.c_str();
+			ev.args = m.args.data(); ev.argLen = m.args.length();
+		}
+		for (unsigned int i = 0; i < targets.size(); i++) {
+			targets[i]->logMessage(m.text, m.level);
+			if (m.hasEvent && targets[i]->acceptsEvents())
+				targets[i]->logEvent(ev);
+		}
+	}
+	draining = false;
+	return batch.size();
 }
 
+/** Main loop of the drain thread. Sleeps until a message is committed,
+ *  so an idle logger does not wake at all.
+ */
+void Logger::run() {
+	while (!quit.load()) {
+		pending.store(false);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (drain() > 0) continue;
+		unique_lock<mutex> lck(wakeMtx);
+		wakeup.wait(lck, [this] { return pending.load() || quit.load(); });
+	}
+}
 
 } // ends namespace
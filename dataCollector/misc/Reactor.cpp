@@ -0,0 +1,301 @@
+/** @file Reactor.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *  This is open source software licensed under the Apache 2.0 license.
+ *  See http://www.apache.org/licenses/LICENSE-2.0 for details.
+ */
+
+#include "Reactor.h"
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace fizz {
+
+namespace {
+
+/** Arm a timerfd to expire periodically, starting one period from now.
+ *  @return true on success, false on failure
+ */
+bool armTimer(int tfd, double period) {
+	struct itimerspec its;
+	its.it_interval.tv_sec = (time_t) period;
+	its.it_interval.tv_nsec = (long) (1e9 * (period - (time_t) period));
+	its.it_value = its.it_interval;
+	return timerfd_settime(tfd, 0, &its, 0) == 0;
+}
+
+}
+
+Reactor::Reactor() {
+	epfd = evfd = -1; quit.store(false);
+	clearStats();
+}
+
+Reactor::~Reactor() {
+	stop();
+}
+
+/** Create the epoll instance and start the loop thread.
+ *  @return true on success, false on failure
+ */
+bool Reactor::start() {
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epfd < 0 || evfd < 0) {
+		cerr << "Reactor::start: cannot create epoll/eventfd: "
+			 << strerror(errno) << endl;
+		return false;
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN; ev.data.fd = evfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev) < 0) return false;
+	quit.store(false);
+	loopThread = thread(&Reactor::run, this);
+	return true;
+}
+
+/** Stop the loop thread and release its resources. */
+void Reactor::stop() {
+	if (loopThread.joinable()) {
+		quit.store(true); post([]{});
+		if (inLoop()) loopThread.detach();
+		else loopThread.join();
+	}
+	unique_lock<mutex> lck(mtx);
+	for (auto& t : timers) close(t.first);
+	timers.clear(); handlers.clear(); tasks.clear();
+	if (evfd >= 0) close(evfd);
+	if (epfd >= 0) close(epfd);
+	epfd = evfd = -1;
+}
+
+/** Determine if the calling thread is the loop thread. */
+bool Reactor::inLoop() {
+	return this_thread::get_id() == loopThread.get_id();
+}
+
+/** Watch a file descriptor.
+ *  @param fd is the file descriptor
+ *  @param events is the set of epoll events to watch for (e.g. EPOLLIN)
+ *  @param handler is called in the loop thread with the events that
+ *  occurred; error and hangup events are always reported
+ *  @return true on success, false on failure
+ */
+bool Reactor::addFd(int fd, uint32_t events, FdHandler handler) {
+	unique_lock<mutex> lck(mtx);
+	handlers[fd] = handler;
+	struct epoll_event ev;
+	ev.events = events; ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		handlers.erase(fd);
+		return false;
+	}
+	return true;
+}
+
+/** Change the events watched for a file descriptor.
+ *  @param fd is a file descriptor added earlier using addFd
+ *  @param events is the new set of epoll events to watch for
+ *  @return true on success, false on failure
+ */
+bool Reactor::modifyFd(int fd, uint32_t events) {
+	unique_lock<mutex> lck(mtx);
+	if (handlers.find(fd) == handlers.end()) return false;
+	struct epoll_event ev;
+	ev.events = events; ev.data.fd = fd;
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+/** Stop watching a file descriptor. When called from another thread,
+ *  this returns after any handler in progress for fd has finished,
+ *  so the caller can then close fd safely.
+ *  @param fd is the file descriptor
+ */
+void Reactor::removeFd(int fd) {
+	if (epfd < 0) return;
+	Task remove = [this, fd]() {
+		unique_lock<mutex> lck(mtx);
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, 0);
+		handlers.erase(fd);
+	};
+	if (inLoop() || !loopThread.joinable()) remove();
+	else call(remove);
+}
+
+/** Add a periodic timer.
+ *  @param period is the time between expirations, in seconds
+ *  @param task is run in the loop thread at each expiration; if the
+ *  loop falls behind, missed expirations are combined
+ *  @return an identifier for the timer, or -1 on failure
+ */
+int Reactor::addTimer(double period, Task task) {
+	int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tfd < 0) return -1;
+	Timer t; t.period = period; t.task = task;
+	t.due = steady_clock::now() +
+			duration_cast<steady_clock::duration>(duration<double>(period));
+	if (!armTimer(tfd, period)) { close(tfd); return -1; }
+	{
+		unique_lock<mutex> lck(mtx);
+		timers[tfd] = t;
+	}
+	if (!addFd(tfd, EPOLLIN, [this, tfd](uint32_t) { expire(tfd); })) {
+		unique_lock<mutex> lck(mtx);
+		timers.erase(tfd); close(tfd);
+		return -1;
+	}
+	return tfd;
+}
+
+/** Change the period of a timer.
+ *  @param id is the identifier returned by addTimer
+ *  @param period is the new time between expirations, in seconds; the
+ *  next expiration is one period from now
+ *  @return true on success, false on failure
+ */
+bool Reactor::setTimerPeriod(int id, double period) {
+	unique_lock<mutex> lck(mtx);
+	auto p = timers.find(id);
+	if (p == timers.end() || !armTimer(id, period)) return false;
+	p->second.period = period;
+	p->second.due = steady_clock::now() +
+		duration_cast<steady_clock::duration>(duration<double>(period));
+	return true;
+}
+
+/** Remove a timer.
+ *  @param id is the identifier returned by addTimer
+ */
+void Reactor::removeTimer(int id) {
+	removeFd(id);
+	unique_lock<mutex> lck(mtx);
+	if (timers.erase(id) > 0) close(id);
+}
+
+/** Handle expiration of a timer. */
+void Reactor::expire(int tfd) {
+	uint64_t n;
+	if (read(tfd, &n, sizeof(n)) != sizeof(n) || n == 0) return;
+	unique_lock<mutex> lck(mtx);
+	auto p = timers.find(tfd);
+	if (p == timers.end()) return;
+	Timer& t = p->second;
+	steady_clock::duration period =
+		duration_cast<steady_clock::duration>(duration<double>(t.period));
+	steady_clock::time_point last = t.due + (n - 1) * period;
+	double late = duration<double>(steady_clock::now() - last).count();
+	maxTimerLate = max(maxTimerLate, late);
+	t.due = last + period;
+	Task task = t.task;
+	lck.unlock();
+	task();
+}
+
+/** Run a task in the loop thread, as soon as possible.
+ *  @param task is the task to be run
+ */
+void Reactor::post(Task task) {
+	unique_lock<mutex> lck(mtx);
+	tasks.push_back(make_pair(steady_clock::now(), task));
+	lck.unlock();
+	uint64_t one = 1;
+	if (evfd >= 0 && write(evfd, &one, sizeof(one)) < 0) {
+		// counter is saturated, so the loop will wake up anyway
+	}
+}
+
+/** Run a task in the loop thread and wait for it to finish.
+ *  @param task is the task to be run
+ */
+void Reactor::call(Task task) {
+	if (inLoop()) { task(); return; }
+	mutex doneMtx; condition_variable doneCond; bool done = false;
+	post([&]() {
+		task();
+		unique_lock<mutex> lck(doneMtx);
+		done = true; doneCond.notify_one();
+	});
+	unique_lock<mutex> lck(doneMtx);
+	doneCond.wait(lck, [&]{ return done; });
+}
+
+/** Run the tasks posted so far. */
+void Reactor::runTasks() {
+	uint64_t n;
+	if (read(evfd, &n, sizeof(n)) < 0) {
+		// nothing to read; tasks may have been run already
+	}
+	while (true) {
+		unique_lock<mutex> lck(mtx);
+		if (tasks.empty()) return;
+		pair<steady_clock::time_point, Task> t = tasks.front();
+		tasks.pop_front();
+		double wait = duration<double>(steady_clock::now() - t.first).count();
+		maxTaskWait = max(maxTaskWait, wait);
+		lck.unlock();
+		steady_clock::time_point t0 = steady_clock::now();
+		t.second();
+		record(t0);
+	}
+}
+
+/** Record the time spent in a handler that started at t0. */
+void Reactor::record(steady_clock::time_point t0) {
+	double d = duration<double>(steady_clock::now() - t0).count();
+	unique_lock<mutex> lck(mtx);
+	events++; sumHandler += d; maxHandler = max(maxHandler, d);
+}
+
+/** Main loop. */
+void Reactor::run() {
+	const int MAXEVENTS = 16;
+	struct epoll_event evs[MAXEVENTS];
+	while (!quit.load()) {
+		int n = epoll_wait(epfd, evs, MAXEVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			cerr << "Reactor::run: epoll_wait failed: "
+				 << strerror(errno) << endl;
+			break;
+		}
+		{ unique_lock<mutex> lck(mtx); loops++; }
+		for (int i = 0; i < n; i++) {
+			int fd = evs[i].data.fd;
+			if (fd == evfd) { runTasks(); continue; }
+			unique_lock<mutex> lck(mtx);
+			auto p = handlers.find(fd);
+			if (p == handlers.end()) continue;	// removed by earlier handler
+			FdHandler handler = p->second;
+			lck.unlock();
+			steady_clock::time_point t0 = steady_clock::now();
+			handler(evs[i].events);
+			record(t0);
+		}
+	}
+}
+
+/** Get statistics on the loop's latency.
+ *  @return a string reporting the number of wakeups and handler calls,
+ *  the mean and maximum time in a handler, the maximum lateness of
+ *  a timer and the maximum wait by a posted task, in ms
+ */
+string Reactor::stats() {
+	unique_lock<mutex> lck(mtx);
+	char buf[200];
+	snprintf(buf, sizeof(buf), "loops=%llu handled=%llu handler avg=%.3f "
+			 "max=%.3f timerLate max=%.3f taskWait max=%.3f (ms)",
+			 (unsigned long long) loops, (unsigned long long) events,
+			 (events > 0 ? 1000 * sumHandler / events : 0.),
+			 1000 * maxHandler, 1000 * maxTimerLate, 1000 * maxTaskWait);
+	return string(buf);
+}
+
+/** Reset the statistics. */
+void Reactor::clearStats() {
+	unique_lock<mutex> lck(mtx);
+	loops = events = 0;
+	maxHandler = sumHandler = maxTimerLate = maxTaskWait = 0;
+}
+
+} // ends namespace
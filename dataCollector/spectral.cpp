@@ -0,0 +1,388 @@
+/** @file spectral.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+/** Command line interface to the spectral analysis library.
+
+Usage: spectral [-nuvo]
+       spectral [-nuvo] -bench [count]
+
+Reads requests from stdin, one JSON object per line, and writes one JSON
+object per line with the result, so other programs (the node servers in
+particular) can use the library through a pipe. Each request has an "op"
+field and the fields listed below. The fields "wavelengths",
+"waveguideLength" and "recipe" ("classic" or "nuvo") may appear in any
+request and remain in effect for the requests that follow.
+
+  op           fields                       result fields
+  cook         spectrum, dark               cooked
+  absorption   spectrum, prereq             absorption, a440, slope
+  absorbance   spectrum, prereq             absorbance
+  parameters   absorption                   a440, slope
+  expCurve     a440, slope                  curve
+  smooth       vector, width, sigma, edges  smoothed
+  deriv        vector, k, degree, width,    deriv
+               delta
+  polySmooth   vector, degree, width, dvx   smoothed
+  fitModels    spect, models, modelCount,   matches
+               approxCount, posOnly, threads
+  bestMatches  absorb, fourth, absorbModels, matches
+               fourthModels, backModels,
+               modelCount, approxCount, threads
+
+where prereq is an array of three raw spectra: the dark spectrum for
+spectrum, the reference spectrum and the reference's dark spectrum.
+For smooth, edges is "library" (the default) to handle the ends of the
+vector as Library.smooth does, or "analysisLibrary" to handle them as
+summarize/analysisLibrary does.
+
+fitModels and bestMatches do what fitModels and findBestMatches in
+analysisConsole/modeLibs/standard do. The model fields are arrays of
+vectors; they, and the fields "lo" and "hi" that give the index range
+used in fits, remain in effect for the requests that follow, so a set
+of models need only be sent once. Each match has the fields weights and
+sqErr, and for bestMatches, backWeights.
+Malformed requests produce a result with an "error" field.
+
+With -bench, synthetic spectra are processed count times (default 2000)
+and the throughput is reported in spectra per second.
+ */
+
+#include "stdinc.h"
+#include <vector>
+#include "Util.h"
+#include "JsonScan.h"
+#include "FilterBank.h"
+#include "SpectralLib.h"
+#include "ModelFit.h"
+
+using namespace fizz;
+
+namespace {
+
+/** Get an array of vectors from a request.
+ *  @param line is the request
+ *  @param name is the name of the field
+ *  @param vv is used to return the vectors
+ *  @return true on success, false if the field is missing or malformed
+ */
+bool getVectors(const string& line, const string& name,
+				vector<vector<double>>& vv) {
+	vv.clear();
+	const char* p = JsonScan::findField(line, name);
+	if (p == 0 || *p++ != '[') return false;
+	while (true) {
+		while (isspace(*p) || (vv.size() > 0 && *p == ',')) p++;
+		if (*p == ']') return true;
+		vv.resize(vv.size() + 1);
+		if (!JsonScan::parseVector(p, vv.back())) return false;
+	}
+}
+
+/** Get the three prerequisite spectra from a request. */
+bool getPrereq(const string& line, vector<double> prereq[]) {
+	vector<vector<double>> vv;
+	if (!getVectors(line, "prereq", vv) || vv.size() < 3) return false;
+	for (int i = 0; i < 3; i++) prereq[i] = vv[i];
+	return true;
+}
+
+/** Write a vector as a JSON field. */
+void putVector(const string& name, const vector<double>& v) {
+	cout << "\"" << name << "\": [";
+	char buf[32];
+	for (unsigned i = 0; i < v.size(); i++) {
+		snprintf(buf, sizeof(buf), "%.17g", v[i]);
+		cout << (i == 0 ? "" : ", ") << buf;
+	}
+	cout << "]";
+}
+
+void putNumber(const string& name, double x) {
+	char buf[32]; snprintf(buf, sizeof(buf), "%.17g", x);
+	cout << "\"" << name << "\": " << buf;
+}
+
+/** Write a list of model fits as a JSON field. */
+void putMatches(const vector<ModelFit::Match>& matches, bool back) {
+	cout << "\"matches\": [";
+	for (unsigned i = 0; i < matches.size(); i++) {
+		cout << (i == 0 ? "" : ", ") << "{ ";
+		putVector("weights", matches[i].weights);
+		if (back) {
+			cout << ", "; putVector("backWeights", matches[i].backWeights);
+		}
+		cout << ", "; putNumber("sqErr", matches[i].sqErr); cout << " }";
+	}
+	cout << "]";
+}
+
+/** Model sets for fitModels and bestMatches, kept from one request to
+ *  the next, with the ModelFit objects built from them. */
+struct FitModels {
+	int		lo, hi;
+	vector<vector<double>> models, absorbModels, fourthModels, backModels;
+	unique_ptr<ModelFit> fit, fourthFit, backFit;
+
+	FitModels() : lo(0), hi(-1) {}
+
+	/** Set the range used in fits, discarding the ModelFit objects if it
+	 *  has changed.
+	 */
+	void setRange(int newLo, int newHi) {
+		if (newLo == lo && newHi == hi) return;
+		lo = newLo; hi = newHi;
+		fit.reset(); fourthFit.reset(); backFit.reset();
+	}
+
+	/** Update a model set from a request and build its ModelFit if it
+	 *  has none.
+	 *  @return false if the set is missing or malformed
+	 */
+	bool update(const string& line, const string& name,
+				vector<vector<double>>& mset, unique_ptr<ModelFit>& mfit) {
+		if (JsonScan::findField(line, name) != 0) {
+			if (!getVectors(line, name, mset)) return false;
+			mfit.reset();
+		}
+		if (mset.size() == 0) return false;
+		for (auto& m : mset) {
+			if (m.size() != mset[0].size() || lo >= (int) m.size() ||
+				hi > (int) m.size())
+				return false;
+		}
+		if (mfit.get() == 0) mfit.reset(new ModelFit(mset, lo, hi));
+		return true;
+	}
+};
+
+/** Handle one request.
+ *  @param line is the request
+ *  @param lib is the library object; its wavelengths, waveguide length
+ *  and recipe are updated as specified by the request
+ *  @param fm holds the model sets; they are updated as specified by
+ *  the request
+ *  @return an error message, or the empty string on success
+ */
+string handle(const string& line, SpectralLib& lib, FitModels& fm) {
+	vector<double> wl; double x; string s;
+	if (JsonScan::getVector(line, "wavelengths", wl)) lib.setWavelengths(wl);
+	if (JsonScan::getNumber(line, "waveguideLength", x))
+		lib.setWaveguideLength(x);
+	if (JsonScan::getString(line, "recipe", s)) {
+		if (s != "classic" && s != "nuvo") return "unknown recipe";
+		lib.setRecipe(s == "classic" ? SpectralLib::CLASSIC
+									 : SpectralLib::NUVO);
+	}
+	string op;
+	if (!JsonScan::getString(line, "op", op)) return "missing op";
+
+	int n = lib.getWavelengths().size();
+	vector<double> spect, prereq[3], result;
+	if (op == "cook" || op == "absorption" || op == "absorbance") {
+		if (n == 0) return "wavelengths not set";
+		if (!JsonScan::getVector(line, "spectrum", spect) ||
+			(int) spect.size() != n)
+			return "missing spectrum or wrong length";
+	}
+	if (op == "cook") {
+		vector<double> dark;
+		if (!JsonScan::getVector(line, "dark", dark) || (int) dark.size() != n)
+			return "missing dark spectrum or wrong length";
+		lib.cook(spect, dark, result);
+		cout << "{ "; putVector("cooked", result); cout << " }\n";
+	} else if (op == "absorption" || op == "absorbance") {
+		if (!getPrereq(line, prereq) || (int) prereq[0].size() != n ||
+			(int) prereq[1].size() != n || (int) prereq[2].size() != n)
+			return "missing prereq or wrong length";
+		if (op == "absorbance") {
+			lib.absorbance(spect, prereq[0], prereq[1], prereq[2], result);
+			cout << "{ "; putVector("absorbance", result); cout << " }\n";
+			return "";
+		}
+		lib.absorption(spect, prereq[0], prereq[1], prereq[2], result);
+		double a440, slope;
+		lib.absorptionParameters(result, a440, slope);
+		cout << "{ "; putVector("absorption", result); cout << ", ";
+		putNumber("a440", a440); cout << ", ";
+		putNumber("slope", slope); cout << " }\n";
+	} else if (op == "parameters") {
+		if (!JsonScan::getVector(line, "absorption", spect))
+			return "missing absorption";
+		double a440, slope;
+		lib.absorptionParameters(spect, a440, slope);
+		cout << "{ "; putNumber("a440", a440); cout << ", ";
+		putNumber("slope", slope); cout << " }\n";
+	} else if (op == "expCurve") {
+		double a440, slope;
+		if (!JsonScan::getNumber(line, "a440", a440) ||
+			!JsonScan::getNumber(line, "slope", slope))
+			return "missing a440 or slope";
+		lib.absorpExpCurve(a440, slope, result);
+		cout << "{ "; putVector("curve", result); cout << " }\n";
+	} else if (op == "smooth") {
+		double width, sigma;
+		if (!JsonScan::getVector(line, "vector", spect) ||
+			!JsonScan::getNumber(line, "width", width) ||
+			!JsonScan::getNumber(line, "sigma", sigma))
+			return "missing vector, width or sigma";
+		FilterBank::Edges edges = FilterBank::LIBRARY;
+		if (JsonScan::getString(line, "edges", s) && s == "analysisLibrary")
+			edges = FilterBank::ANALYSISLIB;
+		FilterBank::smooth(*FilterBank::gaussian((int) width, sigma),
+						   spect, result, edges);
+		cout << "{ "; putVector("smoothed", result); cout << " }\n";
+	} else if (op == "deriv") {
+		double k, degree, width, delta = 1;
+		if (!JsonScan::getVector(line, "vector", spect) ||
+			!JsonScan::getNumber(line, "k", k) ||
+			!JsonScan::getNumber(line, "degree", degree) ||
+			!JsonScan::getNumber(line, "width", width))
+			return "missing vector, k, degree or width";
+		JsonScan::getNumber(line, "delta", delta);
+		if (!FilterBank::deriv(spect, (int) k, (int) degree, (int) width,
+							   result, delta))
+			return "invalid derivative";
+		cout << "{ "; putVector("deriv", result); cout << " }\n";
+	} else if (op == "polySmooth") {
+		double degree, width, dvx = 0;
+		if (!JsonScan::getVector(line, "vector", spect) ||
+			!JsonScan::getNumber(line, "degree", degree) ||
+			!JsonScan::getNumber(line, "width", width))
+			return "missing vector, degree or width";
+		JsonScan::getNumber(line, "dvx", dvx);
+		FilterBank::polySmooth(spect, (int) degree, (int) width, (int) dvx,
+							   result);
+		cout << "{ "; putVector("smoothed", result); cout << " }\n";
+	} else if (op == "fitModels" || op == "bestMatches") {
+		double lo = fm.lo, hi = fm.hi;
+		JsonScan::getNumber(line, "lo", lo);
+		JsonScan::getNumber(line, "hi", hi);
+		if (lo < 0 || (hi >= 0 && hi <= lo)) return "invalid lo or hi";
+		fm.setRange((int) lo, (int) hi);
+		double modelCount, approxCount, threads = 1;
+		bool posOnly = false;
+		if (!JsonScan::getNumber(line, "modelCount", modelCount) ||
+			!JsonScan::getNumber(line, "approxCount", approxCount))
+			return "missing modelCount or approxCount";
+		JsonScan::getNumber(line, "threads", threads);
+		vector<ModelFit::Match> matches;
+		if (op == "fitModels") {
+			if (!fm.update(line, "models", fm.models, fm.fit))
+				return "missing models or wrong length";
+			if (!JsonScan::getVector(line, "spect", spect) ||
+				spect.size() != fm.models[0].size())
+				return "missing spect or wrong length";
+			const char* p = JsonScan::findField(line, "posOnly");
+			if (p != 0) posOnly = (strncmp(p, "true", 4) == 0);
+			fm.fit->fit(spect, (int) modelCount, (int) approxCount,
+						posOnly, matches, (int) threads);
+		} else {
+			if (!fm.update(line, "fourthModels", fm.fourthModels,
+						   fm.fourthFit) ||
+				!fm.update(line, "backModels", fm.backModels, fm.backFit))
+				return "missing models or wrong length";
+			if (JsonScan::findField(line, "absorbModels") != 0 &&
+				!getVectors(line, "absorbModels", fm.absorbModels))
+				return "malformed absorbModels";
+			int len = fm.fourthModels[0].size();
+			if (fm.absorbModels.size() != fm.fourthModels.size() ||
+				fm.backModels[0].size() != fm.fourthModels[0].size())
+				return "missing models or wrong length";
+			for (auto& m : fm.absorbModels)
+				if ((int) m.size() != len)
+					return "missing models or wrong length";
+			vector<double> fourth;
+			if (!JsonScan::getVector(line, "absorb", spect) ||
+				!JsonScan::getVector(line, "fourth", fourth) ||
+				(int) spect.size() != len || (int) fourth.size() != len)
+				return "missing absorb or fourth, or wrong length";
+			ModelFit::bestMatches(spect, fourth, fm.absorbModels,
+								  *fm.fourthFit, *fm.backFit,
+								  (int) modelCount, (int) approxCount,
+								  matches, (int) threads);
+		}
+		cout << "{ "; putMatches(matches, op == "bestMatches");
+		cout << " }\n";
+	} else {
+		return "unknown op";
+	}
+	return "";
+}
+
+/** Measure throughput on synthetic spectra.
+ *  @param lib is the library object
+ *  @param count is the number of spectra of each kind to process
+ */
+void bench(SpectralLib& lib, int count) {
+	// wavelengths and spectra roughly like those of the spectrometer
+	int n = 2048;
+	vector<double> wl(n), dark(n), ref(n), spect(n);
+	for (int i = 0; i < n; i++) wl[i] = 190 + .45*i - 1e-5*i*i;
+	srand(1);
+	for (int i = 0; i < n; i++) {
+		double z = (wl[i] - 550) / 150;
+		dark[i] = 1000 + (rand() % 50);
+		ref[i] = dark[i] + 40000 * exp(-.5*z*z) + (rand() % 50);
+		double a = 2 * exp(-.015 * (wl[i] - 440));
+		spect[i] = dark[i] + (ref[i] - dark[i]) * exp(-.28 * a);
+	}
+	lib.setWavelengths(wl);
+
+	vector<double> result; double a440, slope, check = 0;
+	double t0 = Util::elapsedTime();
+	for (int i = 0; i < count; i++) lib.cook(spect, dark, result);
+	double t1 = Util::elapsedTime();
+	for (int i = 0; i < count; i++) {
+		lib.absorption(spect, dark, ref, dark, result);
+		lib.absorptionParameters(result, a440, slope);
+		check += a440;
+	}
+	double t2 = Util::elapsedTime();
+	for (int i = 0; i < count; i++) {
+		lib.absorbance(spect, dark, ref, dark, result);
+		check += result[100];
+	}
+	double t3 = Util::elapsedTime();
+
+	cout << fixed << setprecision(0)
+		 << "cook:       " << count/(t1-t0) << " spectra per second\n"
+		 << "absorption: " << count/(t2-t1) << " spectra per second "
+		 << "(with parameters)\n"
+		 << "absorbance: " << count/(t3-t2) << " spectra per second\n"
+		 << setprecision(4) << "a440 " << a440 << ", slope " << slope
+		 << (check != check ? " (nan)" : "") << endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	SpectralLib lib;
+	int i = 1;
+	if (i < argc && strcmp(argv[i], "-nuvo") == 0) {
+		lib.setRecipe(SpectralLib::NUVO); i++;
+	}
+	if (i < argc && strcmp(argv[i], "-bench") == 0) {
+		int count = (i+1 < argc ? atoi(argv[i+1]) : 2000);
+		bench(lib, max(count, 1));
+		return 0;
+	}
+	if (i < argc) {
+		cerr << "usage: spectral [-nuvo] [-bench [count]]" << endl;
+		return 1;
+	}
+	FitModels fm;
+	string line;
+	while (getline(cin, line)) {
+		if (line.find('{') == string::npos) continue;
+		string err = handle(line, lib, fm);
+		if (err.length() > 0)
+			cout << "{ \"error\": \"" << err << "\" }\n";
+		cout.flush();
+	}
+	return 0;
+}
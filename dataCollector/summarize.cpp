@@ -0,0 +1,544 @@
+/** @file summarize.cpp
+ *
+ *  @author Jon Turner
+ *  @date 2017
+ *
+ *  This software was developed for Mote Marine Research Laboratory.
+ */
+
+/** Summarize data from fizz raw data files.
+
+Usage: summarize [-t threads] [datapath]
+
+A native version of summarize/summarize.js, which it can replace in the
+cron job. It scans the snXX directories under datapath (default
+/usr/local/physsData) and, in each one with both raw and summary
+sub-directories, looks for raw data files that have no summary file or
+that are newer than their summary file. For each, it appends a summary
+record to the summary file for every new sample cycle. The records are
+the same, byte for byte, as those summarize.js writes.
+
+Rather than reading a whole raw file each time it changes, summarize
+maps it into memory and starts from a checkpoint saved in the checkpoint
+sub-directory on the previous run: the offset of the first byte not yet
+read, the last summarized cycle and the spectra later records may refer
+to. A checkpoint is ignored if the raw file was replaced or the summary
+file no longer ends with the cycle recorded in it, and the raw file is
+then read from the start. Files are processed by a pool of threads
+(default, one per core).
+ */
+
+#include "stdinc.h"
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "JsonScan.h"
+#include "Summarizer.h"
+
+using namespace fizz;
+
+namespace {
+
+/** Spectrum record in a raw file. */
+struct SpectrumInfo {
+	size_t	offset;			///< offset of the record in the raw file
+	int		prereq1index;	///< index of first prerequisite, or 0
+	int		prereq2index;	///< index of second prerequisite, or 0
+	string	label;			///< spectrum label
+};
+
+/** Cycle summary record read on the current run. */
+struct CycleInfo {
+	int		index;			///< record index
+	int		prevIndex;		///< index of preceding cycle summary, or 0
+	size_t	offset;			///< offset of the record in the raw file
+};
+
+/** What is known about a raw file after reading it up to some offset. */
+struct FileState {
+	ino_t	inode;			///< identifies the raw file
+	size_t	offset;			///< offset of first byte not yet read
+	int		lastIndex;		///< index in last line of summary file
+	size_t	depOffset;		///< offset of deployment record, or npos
+	int		lastCycle;		///< index of last cycle summary, or 0
+	map<int,SpectrumInfo> dir;	///< spectra that may still be used
+	map<string,int> latest;	///< index of latest spectrum with each label
+
+	FileState() : inode(0), offset(0), lastIndex(0),
+				  depOffset(string::npos), lastCycle(0) {}
+	bool	read(const string&);
+	bool	write(const string&) const;
+	void	prune();
+};
+
+/** Summary file to bring up to date. */
+struct Job {
+	string	rawFile;
+	string	sumFile;
+	string	ckptFile;		///< checkpoint file, or "" if none can be kept
+};
+
+Summarizer proto;			// has the models; copied for each file
+mutex	errMtx;				// used to keep error messages whole
+
+void error(const string& msg) {
+	unique_lock<mutex> lck(errMtx);
+	cerr << "summarize: " << msg << endl;
+}
+
+/** Read a checkpoint file.
+ *  @return true on success, false if the file is missing or invalid
+ */
+bool FileState::read(const string& path) {
+	ifstream in(path);
+	if (!in) return false;
+	unsigned long ino; long off, dep;
+	if (!(in >> ino >> off >> lastIndex >> dep >> lastCycle)) return false;
+	inode = ino; offset = off;
+	depOffset = (dep < 0 ? string::npos : (size_t) dep);
+	int n;
+	if (!(in >> n)) return false;
+	for (int i = 0; i < n; i++) {
+		int index; long soff; SpectrumInfo sinfo;
+		if (!(in >> index >> soff >> sinfo.prereq1index
+				 >> sinfo.prereq2index))
+			return false;
+		in.get(); getline(in, sinfo.label);
+		sinfo.offset = soff;
+		dir[index] = sinfo;
+	}
+	if (!(in >> n)) return false;
+	for (int i = 0; i < n; i++) {
+		int index; string label;
+		if (!(in >> index)) return false;
+		in.get(); getline(in, label);
+		latest[label] = index;
+	}
+	return !in.fail();
+}
+
+/** Write a checkpoint file.
+ *  The file is written under a temporary name and then renamed, so an
+ *  interrupted run leaves the old checkpoint in place.
+ *  @return true on success
+ */
+bool FileState::write(const string& path) const {
+	string tmp = path + ".tmp";
+	ofstream out(tmp);
+	out << inode << " " << offset << " " << lastIndex << " "
+		<< (depOffset == string::npos ? -1 : (long) depOffset) << " "
+		<< lastCycle << "\n" << dir.size() << "\n";
+	for (auto& d : dir)
+		out << d.first << " " << d.second.offset << " "
+			<< d.second.prereq1index << " " << d.second.prereq2index
+			<< " " << d.second.label << "\n";
+	out << latest.size() << "\n";
+	for (auto& l : latest) out << l.second << " " << l.first << "\n";
+	out.close();
+	if (out.fail()) return false;
+	return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+/** Discard spectra that later records cannot use.
+ *  New spectra name their prerequisites by the labels of the latest
+ *  spectra, so only those spectra and their prerequisites are needed,
+ *  along with the spectra since the last cycle summary.
+ */
+void FileState::prune() {
+	vector<int> keep;
+	for (auto& l : latest) {
+		auto sp = dir.find(l.second);
+		if (sp == dir.end()) continue;
+		keep.push_back(l.second);
+		keep.push_back(sp->second.prereq1index);
+		keep.push_back(sp->second.prereq2index);
+		auto p2 = dir.find(sp->second.prereq2index);
+		if (p2 != dir.end()) keep.push_back(p2->second.prereq1index);
+	}
+	for (auto sp = dir.begin(); sp != dir.end(); ) {
+		if (sp->first <= lastCycle &&
+			find(keep.begin(), keep.end(), sp->first) == keep.end())
+			sp = dir.erase(sp);
+		else
+			sp++;
+	}
+}
+
+/** Get the index of the last record in a summary file.
+ *  @return the value of the last _index field, or 0 if there is none
+ */
+int lastSummaryIndex(const string& path) {
+	ifstream in(path, ios::binary | ios::ate);
+	if (!in) return 0;
+	long size = in.tellg();
+	long chunk = min(size, 65536L);
+	string s(chunk, ' ');
+	in.seekg(size - chunk); in.read(&s[0], chunk);
+	string::size_type i = s.rfind("\"_index\":");
+	return (i == string::npos ? 0 : atoi(s.c_str() + i + 9));
+}
+
+/** Quote a string as JSON.stringify does. */
+string jsonQuote(const string& s) {
+	string q = "\"";
+	char buf[8];
+	for (unsigned char c : s) {
+		switch (c) {
+		case '"':  q += "\\\""; break;
+		case '\\': q += "\\\\"; break;
+		case '\b': q += "\\b"; break;
+		case '\f': q += "\\f"; break;
+		case '\n': q += "\\n"; break;
+		case '\r': q += "\\r"; break;
+		case '\t': q += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				snprintf(buf, sizeof(buf), "\\u%04x", c); q += buf;
+			} else {
+				q += c;
+			}
+		}
+	}
+	return q + "\"";
+}
+
+/** Get a field of a record in the form JSON.stringify gives it.
+ *  @param line is the record
+ *  @param name is the field name
+ *  @param value is used to return the value
+ *  @return true if the field is present
+ */
+bool jsonValue(const string& line, const string& name, string& value) {
+	const char* p = JsonScan::findField(line, name);
+	if (p == 0) return false;
+	if (*p == '"') {
+		string s;
+		if (!JsonScan::parseString(p, s)) return false;
+		value = jsonQuote(s);
+	} else if (*p == '-' || isdigit(*p)) {
+		value = Summarizer::jsNumber(strtod(p, 0));
+	} else {
+		// literal, or an array or object, which is copied as it is
+		const char* q = p; int depth = 0;
+		for (; *q != 0; q++) {
+			if (*q == '[' || *q == '{') depth++;
+			else if (*q == ']' || *q == '}') {
+				if (depth == 0) break;
+				if (--depth == 0) { q++; break; }
+			} else if (*q == ',' && depth == 0) break;
+		}
+		value = string(p, q - p);
+	}
+	return true;
+}
+
+/** Raw file mapped into memory. */
+class RawFile {
+public:
+	RawFile() : base(0), size(0) {}
+	~RawFile() { if (base != 0) munmap((void*) base, size); }
+	bool open(const string& path, ino_t& inode) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat sb;
+		if (fstat(fd, &sb) != 0) { ::close(fd); return false; }
+		inode = sb.st_ino; size = sb.st_size;
+		if (size > 0) {
+			void* p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) { ::close(fd); return false; }
+			base = (const char*) p;
+		}
+		::close(fd);
+		return true;
+	}
+	/** Get the line at an offset, without its line ending. */
+	string line(size_t offset, size_t* next = 0) const {
+		const char* p = base + offset;
+		const char* q = (const char*) memchr(p, '\n', size - offset);
+		if (next != 0) *next = (q == 0 ? size : (q - base) + 1);
+		size_t len = (q == 0 ? size - offset : q - p);
+		if (len > 0 && p[len-1] == '\r') len--;
+		return string(p, len);
+	}
+	const char* base;
+	size_t	size;
+};
+
+/** Read the records in a line of a raw file, as readDataset does.
+ *  @param line is the line
+ *  @param offset is its offset in the raw file
+ *  @param st is the state of the raw file, which is updated
+ *  @param cycles is a vector to which new cycle summaries are added
+ */
+void readRecord(const string& line, size_t offset, FileState& st,
+				vector<CycleInfo>& cycles) {
+	if (line.length() == 0 || line[0] != '{' || line.back() != '}') return;
+	string type;
+	if (!JsonScan::getString(line, "recordType", type)) return;
+	double x;
+	int index = (JsonScan::getNumber(line, "index", x) ? (int) x : 0);
+	if (type == "deployment") {
+		st.depOffset = offset;
+	} else if (type == "cycleSummary") {
+		cycles.push_back({ index, st.lastCycle, offset });
+		st.lastCycle = index;
+	} else if (type == "spectrum") {
+		SpectrumInfo& s = st.dir[index];
+		s.offset = offset;
+		s.prereq1index = (JsonScan::getNumber(line, "prereq1index", x) ?
+						  (int) x : 0);
+		s.prereq2index = (JsonScan::getNumber(line, "prereq2index", x) ?
+						  (int) x : 0);
+		JsonScan::getString(line, "label", s.label);
+		st.latest[s.label] = index;
+	} else if (type == "reset") {
+		// discard spectra since the last cycle summary
+		st.dir.erase(st.dir.upper_bound(st.lastCycle), st.dir.end());
+	}
+}
+
+/** Cache of spectra read from a raw file, by record index. */
+class SpectrumCache {
+public:
+	SpectrumCache(const RawFile& raw, const FileState& st)
+		: raw(raw), st(st) {}
+
+	/** Get the spectrum with a given index, or null if not present. */
+	const vector<double>* get(int index) {
+		auto cp = cache.find(index);
+		if (cp != cache.end()) return &cp->second;
+		auto sp = st.dir.find(index);
+		if (sp == st.dir.end()) return 0;
+		vector<double>& v = cache[index];
+		if (!JsonScan::getVector(raw.line(sp->second.offset), "spectrum", v)) {
+			cache.erase(index); return 0;
+		}
+		return &v;
+	}
+
+	/** Get the spectra for a measurement, as getPrereqs does.
+	 *  @return true if the spectrum and all its prerequisites are present
+	 */
+	bool measurement(int index, Summarizer::Measurement& m) {
+		auto sp = st.dir.find(index);
+		auto p2 = st.dir.find(sp->second.prereq2index);
+		m.spect = get(index);
+		m.dark = get(sp->second.prereq1index);
+		m.ref = get(sp->second.prereq2index);
+		m.refDark = (p2 == st.dir.end() ? 0 :
+					 get(p2->second.prereq1index));
+		return m.spect != 0 && m.dark != 0 && m.ref != 0 && m.refDark != 0;
+	}
+private:
+	const RawFile& raw;
+	const FileState& st;
+	unordered_map<int,vector<double>> cache;
+};
+
+/** Produce the summary records for new cycles, as summarize does.
+ *  @param raw is the raw file
+ *  @param st is its state, after reading all records
+ *  @param cycles is the list of cycle summaries read on this run
+ *  @param start is the first cycle index to summarize
+ *  @param sz is a summarizer, which is set up for the deployment
+ *  @param out is used to return the summary records
+ *  @return the index of the last cycle summarized, or 0 if there is none
+ */
+int summarize(const RawFile& raw, const FileState& st,
+			  const vector<CycleInfo>& cycles, int start, Summarizer& sz,
+			  string& out) {
+	if (st.depOffset == string::npos) return 0;
+	string depRec = raw.line(st.depOffset);
+	vector<double> wavelengths; double waveguideLength;
+	JsonScan::getVector(depRec, "wavelengths", wavelengths);
+	if (!JsonScan::getNumber(depRec, "waveguideLength", waveguideLength))
+		waveguideLength = 0.28;
+	sz.setDeployment(wavelengths, waveguideLength);
+
+	SpectrumCache spectra(raw, st);
+	int last = 0;
+	for (const CycleInfo& c : cycles) {
+		if (c.index < start) continue;
+
+		// find last filtered and concentrate spectra in this cycle
+		int filtered = 0; int concentrate = 0;
+		for (auto sp = st.dir.upper_bound(c.prevIndex);
+			 sp != st.dir.end() && sp->first < c.index; sp++) {
+			if (sp->second.label == "filtered") filtered = sp->first;
+			if (sp->second.label == "concentrate") concentrate = sp->first;
+		}
+		if (filtered == 0 && concentrate == 0) continue;
+
+		string csum = raw.line(c.offset);
+		string rec = "{", v;
+		if (jsonValue(csum, "serialNumber", v))
+			rec += "\"_serialNumber\":" + v + ",";
+		rec += "\"_index\":" + to_string(c.index) + ",";
+		if (jsonValue(csum, "dateTime", v))
+			rec += "\"_dateTime\":" + v + ",";
+		if (!jsonValue(csum, "gpsCoord", v) &&
+			!jsonValue(csum, "location", v) &&
+			!jsonValue(depRec, "gpsCoord", v))
+			v = "\"[N0.0,E0.0]\"";
+		rec += "\"_gpsCoord\":" + v + ",";
+		if (!jsonValue(csum, "depth", v)) v = "0";
+		rec += "\"_depth\":" + v;
+
+		Summarizer::Measurement fm, cm;
+		bool haveFiltered = filtered != 0 &&
+							spectra.measurement(filtered, fm);
+		bool haveConcentrate = concentrate != 0 &&
+							   spectra.measurement(concentrate, cm);
+		Summarizer::FieldList fields;
+		sz.summarize(haveFiltered ? &fm : 0, haveConcentrate ? &cm : 0,
+					 fields);
+		for (auto& f : fields)
+			rec += ",\"" + f.first + "\":" + f.second;
+		out += rec + "}\n";
+		last = c.index;
+	}
+	return last;
+}
+
+/** Bring one summary file up to date. */
+void process(const Job& job) {
+	RawFile raw; FileState st;
+	ino_t inode;
+	if (!raw.open(job.rawFile, inode)) {
+		error("cannot read " + job.rawFile); return;
+	}
+	int lastIndex = lastSummaryIndex(job.sumFile);
+
+	// use the checkpoint if it is still valid, else start from scratch
+	if (job.ckptFile.length() == 0 || !st.read(job.ckptFile) ||
+		st.inode != inode || st.offset > raw.size ||
+		(st.offset > 0 && raw.base[st.offset-1] != '\n') ||
+		st.lastIndex != lastIndex)
+		st = FileState();
+	st.inode = inode;
+
+	// read the complete lines added since the checkpoint
+	vector<CycleInfo> cycles;
+	size_t offset = st.offset;
+	while (offset < raw.size) {
+		const char* q = (const char*) memchr(raw.base + offset, '\n',
+											 raw.size - offset);
+		if (q == 0) break;
+		size_t next;
+		readRecord(raw.line(offset, &next), offset, st, cycles);
+		offset = next;
+	}
+	st.offset = offset;
+
+	// an unterminated last line is read, but not checkpointed
+	FileState ckpt;
+	bool tail = offset < raw.size;
+	if (tail) {
+		ckpt = st;
+		readRecord(raw.line(offset), offset, st, cycles);
+	}
+
+	Summarizer sz(proto);
+	string out;
+	int last = summarize(raw, st, cycles, lastIndex + 1, sz, out);
+	ofstream sum(job.sumFile, ios::app);
+	sum << out;
+	sum.close();
+	if (sum.fail()) { error("cannot write " + job.sumFile); return; }
+
+	if (job.ckptFile.length() == 0) return;
+	FileState& done = (tail ? ckpt : st);
+	done.lastIndex = (last != 0 ? last : lastIndex);
+	done.prune();
+	if (!done.write(job.ckptFile))
+		error("cannot write " + job.ckptFile);
+}
+
+/** Get the modification time of a file in ms, or -1 if it is missing. */
+long long modTime(const string& path) {
+	struct stat sb;
+	if (stat(path.c_str(), &sb) != 0) return -1;
+	return (long long) sb.st_mtim.tv_sec * 1000 +
+		   sb.st_mtim.tv_nsec / 1000000;
+}
+
+bool isDir(const string& path) {
+	struct stat sb;
+	return stat(path.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+/** Get the sorted names in a directory that start with a prefix. */
+vector<string> listDir(const string& path, const string& prefix) {
+	vector<string> names;
+	DIR* dp = opendir(path.c_str());
+	if (dp == 0) return names;
+	struct dirent* ep;
+	while ((ep = readdir(dp)) != 0) {
+		string name = ep->d_name;
+		if (name.compare(0, prefix.length(), prefix) == 0)
+			names.push_back(name);
+	}
+	closedir(dp);
+	sort(names.begin(), names.end());
+	return names;
+}
+
+} // ends anonymous namespace
+
+int main(int argc, char* argv[]) {
+	int threads = thread::hardware_concurrency();
+	string datapath = "/usr/local/physsData";
+	int i = 1;
+	if (i+1 < argc && strcmp(argv[i], "-t") == 0) {
+		threads = atoi(argv[i+1]); i += 2;
+	}
+	if (i < argc && argv[i][0] != '-') datapath = argv[i++];
+	if (i < argc || threads < 0) {
+		cerr << "usage: summarize [-t threads] [datapath]" << endl;
+		return 1;
+	}
+	threads = max(threads, 1);
+
+	if (proto.loadModels(datapath + "/models/unia") < 0)
+		error("cannot read models in " + datapath + "/models/unia");
+
+	// find the summary files that need to be brought up to date
+	vector<Job> jobs;
+	for (string& sn : listDir(datapath, "sn")) {
+		string rawpath = datapath + "/" + sn + "/raw";
+		string sumpath = datapath + "/" + sn + "/summary";
+		string ckptpath = datapath + "/" + sn + "/checkpoint";
+		if (!isDir(rawpath) || !isDir(sumpath)) continue;
+		if (!isDir(ckptpath) && mkdir(ckptpath.c_str(), 0755) != 0)
+			error("cannot create " + ckptpath);
+		bool ckpt = isDir(ckptpath);
+		for (string& fname : listDir(rawpath, "dep")) {
+			Job job;
+			job.rawFile = rawpath + "/" + fname;
+			job.sumFile = sumpath + "/" + fname;
+			job.ckptFile = (ckpt ? ckptpath + "/" + fname : "");
+			long long sumTime = modTime(job.sumFile);
+			if (sumTime >= 0 && sumTime > modTime(job.rawFile)) continue;
+			jobs.push_back(job);
+		}
+	}
+
+	// process them using a pool of threads
+	atomic<unsigned> next(0);
+	auto worker = [&]() {
+		unsigned j;
+		while ((j = next++) < jobs.size()) process(jobs[j]);
+	};
+	vector<thread> pool;
+	for (int t = 1; t < min(threads, (int) jobs.size()); t++)
+		pool.push_back(thread(worker));
+	worker();
+	for (thread& t : pool) t.join();
+	return 0;
+}